@@ -0,0 +1,191 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+
+#include "DecodeParse.h"
+#include "rfb.h"
+#include "../lzo/minilzo.h"
+#include <string.h>
+
+bool TightControl::Parse(rdr::U8 compCtl)
+{
+	resetStreams = compCtl & 0x0F;
+	subencoding = compCtl >> 4;
+	streamId = subencoding & 0x03;
+	explicitFilter = (subencoding & rfbTightExplicitFilter) != 0;
+	return subencoding <= rfbTightMaxSubencoding;
+}
+
+bool TightCompactLen(int &len, int n, rdr::U8 b)
+{
+	if (n == 0)
+		len = 0;
+	if (n == 2) {
+		len |= (int)b << 14;
+		return false;
+	}
+	len |= ((int)b & 0x7F) << (7 * n);
+	return (b & 0x80) != 0;
+}
+
+TightFilter::TightFilter()
+	: redShift(16), greenShift(8), blueShift(0),
+	filter(rfbTightFilterCopy), width(0), numColors(0)
+{
+}
+
+bool TightFilter::Begin(int filter_, int width_, int numColors_)
+{
+	filter = filter_;
+	width = width_;
+	numColors = numColors_;
+	switch (filter) {
+	case rfbTightFilterCopy:
+		return true;
+	case rfbTightFilterPalette:
+		return numColors >= 2 && numColors <= 256;
+	case rfbTightFilterGradient:
+		prevRow.assign((size_t)width * 3, 0);
+		return true;
+	}
+	return false;
+}
+
+rdr::U32 TightFilter::Pixel24(const rdr::U8 *p) const
+{
+	return ((rdr::U32)p[0] << redShift) | ((rdr::U32)p[1] << greenShift) | ((rdr::U32)p[2] << blueShift);
+}
+
+int TightFilter::BitsPerPixel() const
+{
+	if (filter == rfbTightFilterPalette)
+		return numColors == 2 ? 1 : 8;
+	return 24;
+}
+
+void TightFilter::Rows(const rdr::U8 *src, int numRows, rdr::U32 *dst, int dstStride)
+{
+	int rowSize = RowSize();
+	for (int y = 0; y < numRows; y++, dst += dstStride, src += rowSize) {
+		switch (filter) {
+		case rfbTightFilterCopy:
+			for (int x = 0; x < width; x++)
+				dst[x] = Pixel24(src + x * 3);
+			break;
+
+		case rfbTightFilterPalette:
+			if (numColors == 2) {
+				for (int x = 0; x < width; x++)
+					dst[x] = palette[src[x / 8] >> (7 - x % 8) & 1];
+			} else {
+				for (int x = 0; x < width; x++)
+					dst[x] = palette[src[x]];
+			}
+			break;
+
+		case rfbTightFilterGradient: {
+			// prev holds this row left of x and the row above from x on,
+			// upLeft the pixel of the row above that x-1 overwrote
+			rdr::U8 *prev = &prevRow[0];
+			rdr::U8 pix[3], upLeft[3];
+			// First pixel in a row
+			for (int c = 0; c < 3; c++) {
+				upLeft[c] = prev[c];
+				pix[c] = prev[c] + src[c];
+				prev[c] = pix[c];
+			}
+			dst[0] = Pixel24(pix);
+			// Remaining pixels of a row
+			for (int x = 1; x < width; x++) {
+				for (int c = 0; c < 3; c++) {
+					rdr::U8 up = prev[x*3+c];
+					int est = (int)up + (int)pix[c] - (int)upLeft[c];
+					if (est > 0xFF)
+						est = 0xFF;
+					else if (est < 0x00)
+						est = 0x00;
+					pix[c] = (rdr::U8)est + src[x*3+c];
+					upLeft[c] = up;
+					prev[x*3+c] = pix[c];
+				}
+				dst[x] = Pixel24(pix);
+			}
+			break;
+		}
+		}
+	}
+}
+
+static inline int Card16(const rdr::U8 *p)
+{
+	return p[0] << 8 | p[1];
+}
+
+bool NextPackedRect(const rdr::U8 *&p, const rdr::U8 *end, int bytesPerPixel, PackedRect &r)
+{
+	if (end - p < sz_rfbFramebufferUpdateRectHeader)
+		return false;
+	r.x = Card16(p);
+	r.y = Card16(p + 2);
+	r.w = Card16(p + 4);
+	r.h = Card16(p + 6);
+	rdr::U32 encoding = (rdr::U32)p[8] << 24 | (rdr::U32)p[9] << 16 | (rdr::U32)p[10] << 8 | p[11];
+	// Only raw rects are ever packed
+	if (encoding != rfbEncodingRaw)
+		return false;
+	long len = (long)r.w * r.h * bytesPerPixel;
+	if (end - p - sz_rfbFramebufferUpdateRectHeader < len)
+		return false;
+	r.pixels = p + sz_rfbFramebufferUpdateRectHeader;
+	p = r.pixels + len;
+	return true;
+}
+
+unsigned long CacheZipSize(int nRects)
+{
+	unsigned long size = (unsigned long)nRects * sz_rfbRectangle;
+	return size + size / 100 + 8;
+}
+
+bool NextCacheRect(const rdr::U8 *&p, const rdr::U8 *end, PackedRect &r)
+{
+	if (end - p < sz_rfbRectangle)
+		return false;
+	r.x = Card16(p);
+	r.y = Card16(p + 2);
+	r.w = Card16(p + 4);
+	r.h = Card16(p + 6);
+	r.pixels = NULL;
+	p += sz_rfbRectangle;
+	return true;
+}
+
+long UltraInflate(const rdr::U8 *src, int srclen, rdr::U8 *dst, long len)
+{
+	lzo_uint new_len = len;
+	if (srclen < 0 || lzo1x_decompress_safe(src, srclen, dst, &new_len, NULL) != LZO_E_OK)
+		return -1;
+	return (long)new_len;
+}
@@ -0,0 +1,116 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+
+// DecodeParse.h
+//
+// The parsing behind the Tight, Zlib, Ultra and Cache decoders, shared by
+// the viewer and the headless client. It works on bytes already read off
+// the wire: each side reads them through its own stream and draws what
+// comes out through its own framebuffer.
+
+#ifndef DECODEPARSE_H__
+#define DECODEPARSE_H__
+#pragma once
+
+#include <rdr/types.h>
+#include <vector>
+
+#define TIGHT_MIN_TO_COMPRESS 12
+
+// Tight's compression control byte
+struct TightControl
+{
+	int resetStreams;		// bit i set: reset zlib stream i first
+	int subencoding;		// rfbTightFill, rfbTightJpeg or below 8 for basic
+	int streamId;			// basic: the zlib stream, 0-3
+	bool explicitFilter;	// basic: a filter id follows
+
+	// False on a subencoding this client does not know
+	bool Parse(rdr::U8 compCtl);
+	bool Basic() const { return subencoding < 8; };
+};
+
+// Tight sends lengths in 1 to 3 bytes. Feed them in one at a time, n
+// counting from 0; returns true while another byte follows.
+bool TightCompactLen(int &len, int n, rdr::U8 b);
+
+// The filters of Tight's basic compression, for pixels sent as three bytes,
+// red first, and for palette indexes of any pixel format. The pixels come
+// out as rdr::U32 with the colours at the shifts given, BGRX in memory
+// unless those are changed.
+struct TightFilter
+{
+	TightFilter();
+
+	// False on an unknown filter or a palette of less than 2 colours.
+	// The caller fills in palette after this.
+	bool Begin(int filter, int width, int numColors);
+	rdr::U32 Pixel24(const rdr::U8 *p) const;
+	// Of the filtered data: 24, 8 or 1
+	int BitsPerPixel() const;
+	int RowSize() const { return (width * BitsPerPixel() + 7) / 8; };
+
+	// numRows rows of filtered data from src into dst, rows dstStride
+	// pixels apart. The gradient filter carries its last row over to the
+	// next call, so a rect can come in pieces.
+	void Rows(const rdr::U8 *src, int numRows, rdr::U32 *dst, int dstStride);
+
+	int redShift, greenShift, blueShift;
+	int filter;
+	int width;
+	int numColors;
+	rdr::U32 palette[256];
+	std::vector<rdr::U8> prevRow;
+};
+
+// A rect of a QueueZip or UltraZip block, or of a CacheZip list
+struct PackedRect
+{
+	int x, y, w, h;
+	const rdr::U8 *pixels;	// raw pixels, NULL for CacheZip
+};
+
+// QueueZip and UltraZip send their inflated size in the rect's y and w
+inline rdr::U32 PackedBlockSize(int y, int w) { return (rdr::U32)y + (rdr::U32)w * 65535; };
+// The largest UltraZip block accepted
+#define ULTRAZIP_MAX_BYTES 106000000
+#define ULTRAZIP_MAX_RECTS 25000
+
+// The next rect header of a QueueZip or UltraZip block and the raw pixels
+// after it, p moves past both. False at the end of the block, on a rect
+// that is not raw and on one that runs past end.
+bool NextPackedRect(const rdr::U8 *&p, const rdr::U8 *end, int bytesPerPixel, PackedRect &r);
+
+// The inflated size of a CacheZip list of nRects, with zlib's margin
+unsigned long CacheZipSize(int nRects);
+// The next rect of a CacheZip list, false past end
+bool NextCacheRect(const rdr::U8 *&p, const rdr::U8 *end, PackedRect &r);
+
+// An Ultra block, LZO compressed, into dst of len bytes. Returns the
+// inflated length, -1 if the block is broken or does not fit.
+long UltraInflate(const rdr::U8 *src, int srclen, rdr::U8 *dst, long len);
+
+#endif
@@ -0,0 +1,137 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#include "DecodeSurface.h"
+#include "rfb.h"
+#include <string.h>
+
+int DecodeSurface::DIBStride(int width, int bytesPerPixel)
+{
+	int stride = width * bytesPerPixel;
+	//8bit pitch need to be taken in account
+	if (stride % 4)
+		stride += 4 - stride % 4;
+	return stride;
+}
+
+bool DecodeSurface::Inside(int x, int y, int w, int h)
+{
+	return bits != NULL && x >= 0 && y >= 0 && w >= 0 && h >= 0 &&
+		x <= width - w && y <= height - h;
+}
+
+rdr::U8 *DecodeSurface::Rect(int x, int y, int w, int h)
+{
+	if (!Inside(x, y, w, h))
+		return NULL;
+	return bits + (size_t)y * stride + (size_t)x * bytesPerPixel;
+}
+
+void DecodeSurface::Fill(int x, int y, int w, int h, const rdr::U8 *pix)
+{
+	rdr::U8 *row = Rect(x, y, w, h);
+	if (row == NULL || w == 0 || h == 0)
+		return;
+	// Fill the first row a pixel at a time, copy it into the others
+	for (int j = 0; j < w; j++)
+		memcpy(row + j * bytesPerPixel, pix, bytesPerPixel);
+	for (int i = 1; i < h; i++)
+		memcpy(row + (size_t)i * stride, row, (size_t)w * bytesPerPixel);
+}
+
+void DecodeSurface::SetPixels(const rdr::U8 *src, int srcStride, int x, int y, int w, int h)
+{
+	rdr::U8 *row = Rect(x, y, w, h);
+	if (row == NULL)
+		return;
+	for (int i = 0; i < h; i++, row += stride, src += srcStride)
+		memcpy(row, src, (size_t)w * bytesPerPixel);
+}
+
+void DecodeSurface::CopyRect(int srcx, int srcy, int x, int y, int w, int h)
+{
+	rdr::U8 *src = Rect(srcx, srcy, w, h);
+	rdr::U8 *dst = Rect(x, y, w, h);
+	if (src == NULL || dst == NULL)
+		return;
+	// Bottom up when moving down, the rows may overlap
+	if (y > srcy) {
+		for (int i = h - 1; i >= 0; i--)
+			memmove(dst + (size_t)i * stride, src + (size_t)i * stride, (size_t)w * bytesPerPixel);
+	} else {
+		for (int i = 0; i < h; i++)
+			memmove(dst + (size_t)i * stride, src + (size_t)i * stride, (size_t)w * bytesPerPixel);
+	}
+}
+
+const rdr::U8 *DecodeSurface::HextileTile(int x, int y, int w, int h, int subencoding,
+	const rdr::U8 *p, const rdr::U8 *end, rdr::U8 *bg, rdr::U8 *fg)
+{
+	if (subencoding & rfbHextileRaw) {
+		if (end - p < w * h * bytesPerPixel)
+			return NULL;
+		SetPixels(p, w * bytesPerPixel, x, y, w, h);
+		return p + w * h * bytesPerPixel;
+	}
+
+	if (subencoding & rfbHextileBackgroundSpecified) {
+		if (end - p < bytesPerPixel)
+			return NULL;
+		memcpy(bg, p, bytesPerPixel);
+		p += bytesPerPixel;
+	}
+	Fill(x, y, w, h, bg);
+
+	if (subencoding & rfbHextileForegroundSpecified) {
+		if (end - p < bytesPerPixel)
+			return NULL;
+		memcpy(fg, p, bytesPerPixel);
+		p += bytesPerPixel;
+	}
+
+	if (!(subencoding & rfbHextileAnySubrects))
+		return p;
+
+	if (end - p < 1)
+		return NULL;
+	int nSubrects = *p++;
+	bool coloured = (subencoding & rfbHextileSubrectsColoured) != 0;
+	if (end - p < nSubrects * ((coloured ? bytesPerPixel : 0) + 2))
+		return NULL;
+	for (int i = 0; i < nSubrects; i++) {
+		if (coloured) {
+			memcpy(fg, p, bytesPerPixel);
+			p += bytesPerPixel;
+		}
+		int sx = *p >> 4;
+		int sy = *p++ & 0x0f;
+		int sw = (*p >> 4) + 1;
+		int sh = (*p++ & 0x0f) + 1;
+		// Subrects stay inside their tile
+		if (sx + sw <= w && sy + sh <= h)
+			Fill(x + sx, y + sy, sw, sh, fg);
+	}
+	return p;
+}
@@ -0,0 +1,66 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+// DecodeSurface.h
+//
+// The framebuffer writes behind the decoders, shared by the viewer, which
+// points it at its DIB, and the headless client, which points it at its
+// FrameBuffer: rows of bytesPerPixel byte pixels, stride bytes apart.
+// Nothing is written outside the surface.
+
+#ifndef DECODESURFACE_H__
+#define DECODESURFACE_H__
+#pragma once
+
+#include <rdr/types.h>
+
+struct DecodeSurface
+{
+	rdr::U8 *bits;
+	int width, height;
+	int bytesPerPixel;
+	int stride;
+
+	// A DIB's stride: rows are padded to 4 bytes
+	static int DIBStride(int width, int bytesPerPixel);
+
+	bool Inside(int x, int y, int w, int h);
+	// Top left pixel of a rect, NULL unless it is inside
+	rdr::U8 *Rect(int x, int y, int w, int h);
+
+	// Every pixel of the rect set to the bytesPerPixel bytes at pix
+	void Fill(int x, int y, int w, int h, const rdr::U8 *pix);
+	// Rows of w pixels from src, srcStride bytes apart
+	void SetPixels(const rdr::U8 *src, int srcStride, int x, int y, int w, int h);
+	void CopyRect(int srcx, int srcy, int x, int y, int w, int h);
+
+	// One hextile tile from memory, p just after its subencoding byte. bg
+	// and fg are bytesPerPixel bytes each and carry over to the next tile.
+	// Returns where the tile ends, NULL if it runs past end.
+	const rdr::U8 *HextileTile(int x, int y, int w, int h, int subencoding,
+		const rdr::U8 *p, const rdr::U8 *end, rdr::U8 *bg, rdr::U8 *fg);
+};
+
+#endif
@@ -0,0 +1,465 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// SessionRecording.cpp
+
+#include "SessionRecording.h"
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <chrono>
+#ifdef _INTERNALLIB
+#include <zstd.h>
+#else
+#include "../zstd/lib/zstd.h"
+#endif
+
+// Data chunks are cut at whichever comes first. A seek decodes at most one
+// chunk it doesn't need, a short recording is never more than this behind
+// on disk.
+#define DATA_CHUNK_BYTES (256 * 1024)
+#define DATA_CHUNK_MS 1000
+
+// RFB data is mostly compressed already, anything higher costs CPU for
+// next to nothing
+#define RECORDING_ZSTD_LEVEL 1
+
+// The most a chunk can hold: a keyframe of the cache encoding's two 32 bit
+// planes of a 8192x8192 screen, with room to spare. Larger ones are taken
+// for a broken file instead of being allocated.
+#define RECORDING_MAX_CHUNK (640 * 1024 * 1024)
+
+static long long TimeNowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int Seek64(FILE *f, long long offset, int whence)
+{
+#ifdef _WIN32
+	return _fseeki64(f, offset, whence);
+#else
+	return fseeko(f, (off_t)offset, whence);
+#endif
+}
+
+static long long Tell64(FILE *f)
+{
+#ifdef _WIN32
+	return _ftelli64(f);
+#else
+	return (long long)ftello(f);
+#endif
+}
+
+static void Put16(rdr::U8 *p, rdr::U16 v)
+{
+	p[0] = (rdr::U8)(v >> 8);
+	p[1] = (rdr::U8)v;
+}
+
+static void Put32(rdr::U8 *p, rdr::U32 v)
+{
+	p[0] = (rdr::U8)(v >> 24);
+	p[1] = (rdr::U8)(v >> 16);
+	p[2] = (rdr::U8)(v >> 8);
+	p[3] = (rdr::U8)v;
+}
+
+static void Put64(rdr::U8 *p, long long v)
+{
+	Put32(p, (rdr::U32)((unsigned long long)v >> 32));
+	Put32(p + 4, (rdr::U32)v);
+}
+
+static rdr::U16 Get16(const rdr::U8 *p)
+{
+	return (rdr::U16)((p[0] << 8) | p[1]);
+}
+
+static rdr::U32 Get32(const rdr::U8 *p)
+{
+	return ((rdr::U32)p[0] << 24) | ((rdr::U32)p[1] << 16) | ((rdr::U32)p[2] << 8) | p[3];
+}
+
+static long long Get64(const rdr::U8 *p)
+{
+	return (long long)(((unsigned long long)Get32(p) << 32) | Get32(p + 4));
+}
+
+RecordingWriter::RecordingWriter()
+	: file(NULL), offset(0), startUs(0), pendingMs(0), lastMs(0), lastKeyframeMs(0),
+	  messagesSinceKeyframe(false)
+{
+}
+
+RecordingWriter::~RecordingWriter()
+{
+	Close();
+}
+
+bool RecordingWriter::Open(const char *path, const RecordingHeader &header_)
+{
+	error.clear();
+	file = fopen(path, "wb");
+	if (file == NULL) {
+		error = strerror(errno);
+		return false;
+	}
+	header = header_;
+	if (header.startTime == 0)
+		header.startTime = (long long)time(NULL);
+	startUs = TimeNowUs();
+
+	rdr::U8 h[sz_RecordingHeader];
+	memset(h, 0, sizeof(h));
+	memcpy(h, RECORDING_MAGIC, 8);
+	Put16(h + 8, header.version);
+	Put16(h + 10, header.source);
+	Put16(h + 12, (rdr::U16)header.quality);
+	h[14] = header.cache;
+	Put32(h + 16, header.keyframeMs);
+	Put64(h + 20, header.startTime);
+	offset = 0;
+	keyframes.clear();
+	return Write(h, sizeof(h));
+}
+
+void RecordingWriter::Close()
+{
+	if (file == NULL)
+		return;
+	FlushData();
+
+	std::vector<rdr::U8> index(keyframes.size() * 12);
+	for (size_t i = 0; i < keyframes.size(); i++) {
+		Put32(&index[i * 12], keyframes[i].ms);
+		Put64(&index[i * 12 + 4], keyframes[i].offset);
+	}
+	long long indexOffset = offset;
+	WriteChunk(recordingChunkIndex, lastMs, index.empty() ? NULL : &index[0], index.size());
+
+	rdr::U8 trailer[16];
+	memcpy(trailer, RECORDING_TRAILER_MAGIC, 8);
+	Put64(trailer + 8, indexOffset);
+	if (!Write(trailer, sizeof(trailer)))
+		return;
+	// Buffered data only reaches the disk here
+	if (fclose(file) != 0 && error.empty())
+		error = strerror(errno);
+	file = NULL;
+}
+
+// Everything is written through here. A short write closes the file, the
+// recording can't be continued after a hole.
+bool RecordingWriter::Write(const void *data, size_t len)
+{
+	if (file == NULL)
+		return false;
+	if (fwrite(data, 1, len, file) != len) {
+		Fail(strerror(errno));
+		return false;
+	}
+	offset += len;
+	return true;
+}
+
+void RecordingWriter::Fail(const char *why)
+{
+	if (error.empty())
+		error = why;
+	if (file)
+		fclose(file);
+	file = NULL;
+}
+
+rdr::U32 RecordingWriter::Now()
+{
+	return (rdr::U32)((TimeNowUs() - startUs) / 1000);
+}
+
+void RecordingWriter::Message(const void *data, size_t len, rdr::U32 ms)
+{
+	if (file == NULL)
+		return;
+	if (pending.empty())
+		pendingMs = ms;
+	size_t at = pending.size();
+	pending.resize(at + 8 + len);
+	Put32(&pending[at], ms - pendingMs);
+	Put32(&pending[at + 4], (rdr::U32)len);
+	if (len)
+		memcpy(&pending[at + 8], data, len);
+	lastMs = ms;
+	messagesSinceKeyframe = true;
+
+	if (pending.size() >= DATA_CHUNK_BYTES || ms - pendingMs >= DATA_CHUNK_MS)
+		FlushData();
+}
+
+bool RecordingWriter::KeyframeDue(rdr::U32 ms)
+{
+	return file != NULL && messagesSinceKeyframe && ms - lastKeyframeMs >= header.keyframeMs;
+}
+
+void RecordingWriter::Keyframe(const void *state, size_t len, rdr::U32 ms)
+{
+	if (file == NULL)
+		return;
+	FlushData();
+	RecordingKeyframe k;
+	k.ms = ms;
+	k.offset = offset;
+	keyframes.push_back(k);
+	WriteChunk(recordingChunkKeyframe, ms, (const rdr::U8 *)state, len);
+	lastKeyframeMs = ms;
+	messagesSinceKeyframe = false;
+}
+
+void RecordingWriter::FlushData()
+{
+	if (pending.empty() || file == NULL)
+		return;
+	WriteChunk(recordingChunkData, pendingMs, &pending[0], pending.size());
+	pending.clear();
+}
+
+void RecordingWriter::WriteChunk(rdr::U8 type, rdr::U32 ms, const rdr::U8 *data, size_t len)
+{
+	if (file == NULL)
+		return;
+	size_t packedLen = 0;
+	if (len) {
+		packed.resize(ZSTD_compressBound(len));
+		packedLen = ZSTD_compress(&packed[0], packed.size(), data, len, RECORDING_ZSTD_LEVEL);
+		if (ZSTD_isError(packedLen)) {
+			Fail(ZSTD_getErrorName(packedLen));
+			return;
+		}
+	}
+
+	rdr::U8 h[sz_RecordingChunk];
+	memset(h, 0, sizeof(h));
+	h[0] = type;
+	Put32(h + 4, ms);
+	Put32(h + 8, (rdr::U32)packedLen);
+	Put32(h + 12, (rdr::U32)len);
+	if (Write(h, sizeof(h)) && packedLen)
+		Write(&packed[0], packedLen);
+}
+
+RecordingReader::RecordingReader()
+	: file(NULL), fileSize(0), duration(0), dataEnd(0), chunkMs(0), chunkPos(0)
+{
+}
+
+RecordingReader::~RecordingReader()
+{
+	Close();
+}
+
+void RecordingReader::Close()
+{
+	if (file)
+		fclose(file);
+	file = NULL;
+}
+
+bool RecordingReader::Open(const char *path)
+{
+	file = fopen(path, "rb");
+	if (file == NULL) {
+		error = strerror(errno);
+		return false;
+	}
+	rdr::U8 h[sz_RecordingHeader];
+	if (fread(h, 1, sizeof(h), file) != sizeof(h) || memcmp(h, RECORDING_MAGIC, 8) != 0) {
+		error = "not a recording";
+		Close();
+		return false;
+	}
+	header.version = Get16(h + 8);
+	if (header.version > RECORDING_VERSION) {
+		error = "recording made by a newer version";
+		Close();
+		return false;
+	}
+	header.source = Get16(h + 10);
+	header.quality = (rdr::S16)Get16(h + 12);
+	header.cache = h[14];
+	header.keyframeMs = Get32(h + 16);
+	header.startTime = Get64(h + 20);
+
+	if (Seek64(file, 0, SEEK_END) != 0 || (fileSize = Tell64(file)) < 0) {
+		error = strerror(errno);
+		Close();
+		return false;
+	}
+
+	// The index, or failing that the chunks
+	rdr::U8 trailer[16];
+	RecordingChunk c;
+	std::vector<rdr::U8> index;
+	if (Seek64(file, -16, SEEK_END) == 0 &&
+		fread(trailer, 1, sizeof(trailer), file) == sizeof(trailer) &&
+		memcmp(trailer, RECORDING_TRAILER_MAGIC, 8) == 0 &&
+		Seek64(file, Get64(trailer + 8), SEEK_SET) == 0 &&
+		ReadChunk(c, index) && c.type == recordingChunkIndex) {
+		dataEnd = Get64(trailer + 8);
+		duration = c.ms;
+		for (size_t i = 0; i + 12 <= index.size(); i += 12) {
+			RecordingKeyframe k;
+			k.ms = Get32(&index[i]);
+			k.offset = Get64(&index[i + 4]);
+			keyframes.push_back(k);
+		}
+	} else {
+		Scan();
+	}
+
+	chunk.clear();
+	chunkPos = 0;
+	return Seek64(file, sz_RecordingHeader, SEEK_SET) == 0;
+}
+
+// No index: the recording was cut short. Chunks are walked by their headers,
+// only the last data chunk is read, for the duration.
+void RecordingReader::Scan()
+{
+	keyframes.clear();
+	long long size = fileSize;
+	long long lastData = -1;
+	RecordingChunk c;
+	dataEnd = sz_RecordingHeader;
+	// Up to the first chunk the end of the file cut off
+	while (Seek64(file, dataEnd, SEEK_SET) == 0 && ReadChunkHeader(c) &&
+		dataEnd + sz_RecordingChunk + c.length <= size) {
+		if (c.type == recordingChunkKeyframe) {
+			RecordingKeyframe k;
+			k.ms = c.ms;
+			k.offset = dataEnd;
+			keyframes.push_back(k);
+		} else if (c.type == recordingChunkData) {
+			lastData = dataEnd;
+		}
+		dataEnd += sz_RecordingChunk + c.length;
+	}
+
+	duration = 0;
+	std::vector<rdr::U8> data;
+	if (lastData >= 0 && Seek64(file, lastData, SEEK_SET) == 0 && ReadChunk(c, data)) {
+		duration = c.ms;
+		for (size_t p = 0; p + 8 <= data.size(); p += 8 + Get32(&data[p + 4]))
+			duration = c.ms + Get32(&data[p]);
+	}
+}
+
+bool RecordingReader::ReadChunkHeader(RecordingChunk &c)
+{
+	rdr::U8 h[sz_RecordingChunk];
+	if (fread(h, 1, sizeof(h), file) != sizeof(h))
+		return false;
+	c.type = h[0];
+	c.ms = Get32(h + 4);
+	c.length = Get32(h + 8);
+	c.rawLength = Get32(h + 12);
+	return true;
+}
+
+// Nothing is allocated before the lengths are checked: the packed data
+// has to be in the file, and the zstd frame has to say it holds rawLength
+// bytes
+bool RecordingReader::ReadChunk(RecordingChunk &c, std::vector<rdr::U8> &data)
+{
+	if (!ReadChunkHeader(c))
+		return false;
+	if (c.length == 0) {
+		data.clear();
+		return c.rawLength == 0;
+	}
+	long long at = Tell64(file);
+	if (at < 0 || c.length > fileSize - at || c.rawLength > RECORDING_MAX_CHUNK)
+		return false;
+	packed.resize(c.length);
+	if (fread(&packed[0], 1, c.length, file) != c.length)
+		return false;
+	if (ZSTD_getFrameContentSize(&packed[0], c.length) != c.rawLength)
+		return false;
+	data.resize(c.rawLength);
+	size_t n = ZSTD_decompress(data.empty() ? NULL : &data[0], data.size(), &packed[0], c.length);
+	return !ZSTD_isError(n) && n == c.rawLength;
+}
+
+bool RecordingReader::Seek(rdr::U32 ms, std::vector<rdr::U8> &state)
+{
+	state.clear();
+	chunk.clear();
+	chunkPos = 0;
+	if (file == NULL)
+		return false;
+
+	const RecordingKeyframe *k = NULL;
+	for (size_t i = 0; i < keyframes.size() && keyframes[i].ms <= ms; i++)
+		k = &keyframes[i];
+	if (k == NULL)
+		return Seek64(file, sz_RecordingHeader, SEEK_SET) == 0;
+
+	RecordingChunk c;
+	if (Seek64(file, k->offset, SEEK_SET) != 0 || !ReadChunk(c, state) ||
+		c.type != recordingChunkKeyframe) {
+		error = "broken keyframe";
+		state.clear();
+		return false;
+	}
+	return true;
+}
+
+bool RecordingReader::Peek(rdr::U32 &ms)
+{
+	// Keyframes in between are only for seeking
+	while (chunkPos + 8 > chunk.size()) {
+		RecordingChunk c;
+		if (file == NULL || Tell64(file) >= dataEnd || !ReadChunk(c, chunk))
+			return false;
+		chunkPos = 0;
+		chunkMs = c.ms;
+		if (c.type != recordingChunkData)
+			chunk.clear();
+	}
+	ms = chunkMs + Get32(&chunk[chunkPos]);
+	return true;
+}
+
+bool RecordingReader::Next(const rdr::U8 *&data, size_t &len, rdr::U32 &ms)
+{
+	if (!Peek(ms))
+		return false;
+	len = Get32(&chunk[chunkPos + 4]);
+	if (chunkPos + 8 + len > chunk.size())
+		return false;
+	data = &chunk[chunkPos + 8];
+	chunkPos += 8 + len;
+	return true;
+}
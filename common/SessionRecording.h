@@ -0,0 +1,192 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// SessionRecording.h
+//
+// A session recording: what the server sent, as the RFB messages it
+// sent them in, compressed with zstd and cut into chunks, with keyframes
+// every so often and an index of them at the end. A player decodes from
+// the start, or from the last keyframe before the time it wants to show,
+// instead of from the start every time it seeks.
+//
+// The file, all numbers big endian as on the wire:
+//
+//   header         RecordingHeader, sz_RecordingHeader bytes
+//   chunks         a sz_RecordingChunk byte header each, then length
+//                  bytes of one zstd frame holding rawLength bytes
+//   index chunk    written by Close()
+//   trailer        RECORDING_TRAILER_MAGIC, then the index chunk's offset
+//                  as 8 bytes
+//
+// Data chunks hold messages: 4 bytes of time since the chunk's time in
+// ms, 4 bytes of length and the message. Keyframe chunks hold what the
+// player needs to decode the messages after them, whoever wrote the
+// recording decides what that is (recordingSource). The index holds 4
+// bytes of time and 8 of file offset for every keyframe. A recording that
+// was never closed has no index or trailer: the reader then finds the
+// keyframes by walking the chunk headers.
+
+#ifndef SESSIONRECORDING_H__
+#define SESSIONRECORDING_H__
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <rdr/types.h>
+
+#define RECORDING_MAGIC "UVNCREC2"
+#define RECORDING_TRAILER_MAGIC "UVNCIDX2"
+#define RECORDING_VERSION 1
+
+// Who wrote it, and so what the keyframes hold
+#define recordingSourceViewer 0		// decoder state of a viewer
+#define recordingSourceServer 1		// ServerInit, a full update follows
+
+#define recordingChunkData 'D'
+#define recordingChunkKeyframe 'K'
+#define recordingChunkIndex 'I'
+
+struct RecordingHeader
+{
+	RecordingHeader()
+		: version(RECORDING_VERSION), source(recordingSourceViewer),
+		  quality(-1), cache(0), keyframeMs(30000), startTime(0) {};
+
+	rdr::U16 version;
+	rdr::U16 source;
+	rdr::S16 quality;			// JPEG quality asked for, -1 for none
+	rdr::U8 cache;				// cache encoding enabled
+	rdr::U32 keyframeMs;		// keyframe interval
+	long long startTime;		// seconds since 1970
+};
+#define sz_RecordingHeader 32
+
+struct RecordingChunk
+{
+	rdr::U8 type;
+	rdr::U32 ms;				// since the recording started
+	rdr::U32 length;
+	rdr::U32 rawLength;
+};
+#define sz_RecordingChunk 16
+
+struct RecordingKeyframe
+{
+	rdr::U32 ms;
+	long long offset;			// of its chunk
+};
+
+class RecordingWriter
+{
+public:
+	RecordingWriter();
+	~RecordingWriter();
+
+	bool Open(const char *path, const RecordingHeader &header);
+	// Writes what is pending, the index and the trailer
+	void Close();
+	// False after Close(), and after a write failed: the file is closed
+	// then and Error() says why
+	bool IsOpen() { return file != NULL; };
+	const std::string &Error() { return error; };
+
+	// ms since Open()
+	rdr::U32 Now();
+
+	// One message as the server sent it
+	void Message(const void *data, size_t len, rdr::U32 ms);
+
+	// Once the interval has passed, if there were messages since the last
+	// one. Keyframes of an idle session would only repeat each other.
+	bool KeyframeDue(rdr::U32 ms);
+	void Keyframe(const void *state, size_t len, rdr::U32 ms);
+
+	long long Bytes() { return offset; };
+
+private:
+	void FlushData();
+	void WriteChunk(rdr::U8 type, rdr::U32 ms, const rdr::U8 *data, size_t len);
+	bool Write(const void *data, size_t len);
+	void Fail(const char *why);
+
+	FILE *file;
+	std::string error;
+	RecordingHeader header;
+	long long offset;
+	long long startUs;
+	std::vector<rdr::U8> pending;
+	rdr::U32 pendingMs;
+	rdr::U32 lastMs;
+	std::vector<rdr::U8> packed;
+	std::vector<RecordingKeyframe> keyframes;
+	rdr::U32 lastKeyframeMs;
+	bool messagesSinceKeyframe;
+};
+
+class RecordingReader
+{
+public:
+	RecordingReader();
+	~RecordingReader();
+
+	// false with error set if it isn't a recording
+	bool Open(const char *path);
+	void Close();
+	const std::string &Error() { return error; };
+
+	const RecordingHeader &Header() { return header; };
+	const std::vector<RecordingKeyframe> &Keyframes() { return keyframes; };
+	// Time of the last message
+	rdr::U32 Duration() { return duration; };
+
+	// Go back to the first message, or to the first one after the last
+	// keyframe at or before ms. state gets the keyframe, or is cleared.
+	bool Seek(rdr::U32 ms, std::vector<rdr::U8> &state);
+
+	// The next message and its time, false at the end. data stays valid
+	// until the next call.
+	bool Next(const rdr::U8 *&data, size_t &len, rdr::U32 &ms);
+	// Time of the message Next() returns next, false at the end
+	bool Peek(rdr::U32 &ms);
+
+private:
+	bool ReadChunk(RecordingChunk &chunk, std::vector<rdr::U8> &data);
+	bool ReadChunkHeader(RecordingChunk &chunk);
+	void Scan();
+
+	FILE *file;
+	long long fileSize;
+	std::string error;
+	RecordingHeader header;
+	std::vector<RecordingKeyframe> keyframes;
+	rdr::U32 duration;
+	long long dataEnd;			// where the index chunk starts
+	std::vector<rdr::U8> chunk;
+	rdr::U32 chunkMs;
+	size_t chunkPos;
+	std::vector<rdr::U8> packed;
+};
+
+#endif
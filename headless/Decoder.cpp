@@ -0,0 +1,261 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+#include "Decoder.h"
+#include <rdr/Exception.h>
+#include "../lzo/minilzo.h"
+
+void DecodeStats::Add(const DecodeStats &other)
+{
+	rects += other.rects;
+	pixels += other.pixels;
+	bytes += other.bytes;
+	us += other.us;
+}
+
+Decoder::Decoder(FrameBuffer &fb)
+	: m_fb(fb), m_is(NULL), m_rectPixels(0), m_quality(-1),
+	  m_unsavedStreams(false), zywrle_level(0), zywrle(0)
+{
+#ifdef _XZ
+	xzyw_level = 0;
+	xzyw = 0;
+#endif
+	lzo_init();
+	m_jpeg = tjInitDecompress();
+}
+
+Decoder::~Decoder()
+{
+	if (m_jpeg)
+		tjDestroy(m_jpeg);
+}
+
+void Decoder::SetQuality(int quality)
+{
+	m_quality = quality;
+}
+
+BYTE *Decoder::Buffer(size_t size)
+{
+	if (m_buf.size() < size)
+		m_buf.resize(size);
+	return m_buf.empty() ? NULL : &m_buf[0];
+}
+
+BOOL Decoder::ReadUpdate(SessionInStream *is)
+{
+	m_is = is;
+	is->skip(1);	// padding
+	int nRects = is->readU16();
+
+	for (int i = 0; i < nRects; i++) {
+		rfbFramebufferUpdateRectHeader h;
+		h.r.x = is->readU16();
+		h.r.y = is->readU16();
+		h.r.w = is->readU16();
+		h.r.h = is->readU16();
+		h.encoding = is->readU32();
+
+		// Tight - If lastrect we must quit this loop (nRects = 0xFFFF)
+		if (h.encoding == rfbEncodingLastRect)
+			break;
+
+		if (h.encoding == rfbEncodingNewFBSize) {
+			m_fb.Resize(h.r.w, h.r.h);
+			return FALSE;
+		}
+
+		if (h.encoding == rfbEncodingExtDesktopSize) {
+			int screens = is->readU8();
+			is->skip(3 + screens * sz_rfbExtDesktopScreen);
+			m_fb.Resize(h.r.w, h.r.h);
+			return FALSE;
+		}
+
+		if (h.encoding == rfbEncodingExtViewSize)
+			break;
+
+		if (h.encoding == rfbEncodingPointerPos)
+			continue;
+
+		// The client does not ask for cursor shapes, skip them if they come
+		// anyway
+		if (h.encoding == rfbEncodingXCursor || h.encoding == rfbEncodingRichCursor) {
+			if (h.r.w * h.r.h == 0)
+				continue;
+			int bytesMaskData = (h.r.w + 7) / 8 * h.r.h;
+			if (h.encoding == rfbEncodingXCursor)
+				is->skip(6 + 2 * bytesMaskData);
+			else
+				is->skip(h.r.w * h.r.h * 4 + bytesMaskData);
+			continue;
+		}
+
+		long long start = TimeUs();
+		long long waited = is->WaitUs();
+		long long bytes = is->BytesRead();
+		m_rectPixels = (long long)h.r.w * h.r.h;
+
+		i += ReadRect(h) - 1;
+
+		DecodeStats &s = m_stats[h.encoding];
+		s.rects++;
+		s.pixels += m_rectPixels;
+		s.bytes += is->BytesRead() - bytes;
+		s.us += (TimeUs() - start) - (is->WaitUs() - waited);
+	}
+	return TRUE;
+}
+
+int Decoder::ReadRect(const rfbFramebufferUpdateRectHeader &h)
+{
+	const rfbRectangle &r = h.r;
+
+	switch (h.encoding) {
+	case rfbEncodingRaw:
+	case rfbEncodingRRE:
+	case rfbEncodingCoRRE:
+	case rfbEncodingHextile:
+	case rfbEncodingZlib:
+	case rfbEncodingZstd:
+	case rfbEncodingZlibHex:
+	case rfbEncodingZstdHex:
+	case rfbEncodingZRLE:
+	case rfbEncodingZYWRLE:
+	case rfbEncodingZSTDRLE:
+	case rfbEncodingZSTDYWRLE:
+	case rfbEncodingTight:
+	case rfbEncodingTightZstd:
+		m_fb.SaveArea(r.x, r.y, r.w, r.h);
+		break;
+	}
+
+	switch (h.encoding) {
+	case rfbEncodingRaw:
+		ReadRawRect(r);
+		break;
+	case rfbEncodingCopyRect:
+		ReadCopyRect(r);
+		break;
+	case rfbEncodingRRE:
+		ReadRRERect(r, false);
+		break;
+	case rfbEncodingCoRRE:
+		ReadRRERect(r, true);
+		break;
+	case rfbEncodingHextile:
+		ReadHextileRect(r);
+		break;
+	case rfbEncodingZlib:
+	case rfbEncodingZstd:
+		ReadZlibRect(r, h.encoding == rfbEncodingZstd);
+		break;
+	case rfbEncodingZlibHex:
+	case rfbEncodingZstdHex:
+		ReadZlibHexRect(r, h.encoding == rfbEncodingZstdHex);
+		break;
+	case rfbEncodingQueueZip:
+	case rfbEncodingQueueZstd:
+		ReadQueueZip(r, h.encoding == rfbEncodingQueueZstd);
+		break;
+	case rfbEncodingUltra:
+		ReadUltraRect(r);
+		break;
+	case rfbEncodingUltraZip:
+		ReadUltraZip(r);
+		break;
+	case rfbEncodingUltra2:
+		ReadUltra2Rect(r);
+		break;
+	case rfbEncodingTight:
+	case rfbEncodingTightZstd:
+		ReadTightRect(r, h.encoding == rfbEncodingTightZstd);
+		break;
+	case rfbEncodingZRLE:
+	case rfbEncodingZSTDRLE:
+		zywrle = 0;
+		zrleDecode(r.x, r.y, r.w, r.h, h.encoding == rfbEncodingZSTDRLE);
+		break;
+	case rfbEncodingZYWRLE:
+	case rfbEncodingZSTDYWRLE:
+		zywrle = 1;
+		zrleDecode(r.x, r.y, r.w, r.h, h.encoding == rfbEncodingZSTDYWRLE);
+		break;
+#ifdef _XZ
+	case rfbEncodingXZ:
+		xzyw = 0;
+		return ReadXZRects(r);
+	case rfbEncodingXZYW:
+		xzyw = 1;
+		return ReadXZRects(r);
+#endif
+	case rfbEncodingCache:
+		ReadCacheRect(r);
+		break;
+	case rfbEncodingCacheZip:
+		ReadCacheZip(r);
+		break;
+	default:
+		// Nothing else says how long it is, the stream can't be followed
+		// past it
+		char msg[64];
+		snprintf(msg, sizeof(msg), "unsupported encoding %d", (int)h.encoding);
+		throw rdr::Exception(msg);
+	}
+	return 1;
+}
+
+const char *Decoder::EncodingName(CARD32 encoding)
+{
+	switch (encoding) {
+	case rfbEncodingRaw:		return "Raw";
+	case rfbEncodingCopyRect:	return "CopyRect";
+	case rfbEncodingRRE:		return "RRE";
+	case rfbEncodingCoRRE:		return "CoRRE";
+	case rfbEncodingHextile:	return "Hextile";
+	case rfbEncodingZlib:		return "Zlib";
+	case rfbEncodingTight:		return "Tight";
+	case rfbEncodingZlibHex:	return "ZlibHex";
+	case rfbEncodingUltra:		return "Ultra";
+	case rfbEncodingUltra2:		return "Ultra2";
+	case rfbEncodingZRLE:		return "ZRLE";
+	case rfbEncodingZYWRLE:		return "ZYWRLE";
+#ifdef _XZ
+	case rfbEncodingXZ:			return "XZ";
+	case rfbEncodingXZYW:		return "XZYW";
+#endif
+	case rfbEncodingZstd:		return "Zstd";
+	case rfbEncodingTightZstd:	return "TightZstd";
+	case rfbEncodingZstdHex:	return "ZstdHex";
+	case rfbEncodingZSTDRLE:	return "ZSTDRLE";
+	case rfbEncodingZSTDYWRLE:	return "ZSTDYWRLE";
+	case rfbEncodingCache:		return "Cache";
+	case rfbEncodingCacheZip:	return "CacheZip";
+	case rfbEncodingQueueZip:	return "QueueZip";
+	case rfbEncodingUltraZip:	return "UltraZip";
+	case rfbEncodingQueueZstd:	return "QueueZstd";
+	}
+	return "?";
+}
@@ -0,0 +1,185 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Decoder
+//
+// The framebuffer update half of ClientConnection, without a window: reads
+// FramebufferUpdate messages and decodes every rect into a FrameBuffer.
+// Raw, CopyRect, RRE, CoRRE, Hextile, ZlibHex, Zlib, Tight, ZRLE/ZYWRLE,
+// Ultra, Ultra2, XZ/XZYW, the zstd variants and the cache and queue
+// encodings are all handled. ZRLE and XZ use the same rfb/ templates as
+// the viewer and the Tight, Zlib, Ultra and Cache parsing is the viewer's
+// common/DecodeParse, the rest are ports of the viewer's Read*Rect
+// functions for the one pixel format the headless client asks for.
+//
+// Time spent in each encoding is measured per rect, minus the time the
+// stream spent waiting for the network or the disk.
+
+#ifndef DECODER_H__
+#define DECODER_H__
+#pragma once
+
+#include "stdhdrs.h"
+#include "rfb.h"
+#include "FrameBuffer.h"
+#include "../common/DecodeParse.h"
+#include "Inflater.h"
+#include "Streams.h"
+#include <rdr/ZlibInStream.h>
+#include <rdr/ZstdInStream.h>
+#ifdef _XZ
+#include <rdr/xzInStream.h>
+#endif
+#ifdef _INTERNALLIB
+#include <turbojpeg.h>
+#else
+#include "libjpeg-turbo-win/turbojpeg.h"
+#endif
+#include <map>
+#include <vector>
+
+struct DecodeStats
+{
+	DecodeStats() : rects(0), pixels(0), bytes(0), us(0) {};
+	void Add(const DecodeStats &other);
+
+	long long rects;
+	long long pixels;
+	long long bytes;		// as read from the stream, compressed
+	long long us;			// decoding only, not waiting for data
+};
+
+typedef std::map<CARD32, DecodeStats> DecodeStatsMap;
+
+class Decoder
+{
+public:
+	Decoder(FrameBuffer &fb);
+	~Decoder();
+
+	// JPEG quality 0-9 the server was asked for, -1 for none. Sets the
+	// ZYWRLE and XZYW level as the viewer does.
+	void SetQuality(int quality);
+
+	// One FramebufferUpdate, after the message type. Returns FALSE when
+	// the framebuffer was resized, the next update request must not be
+	// incremental then.
+	BOOL ReadUpdate(SessionInStream *is);
+
+	DecodeStatsMap &Stats() { return m_stats; };
+
+	// DecoderState.cpp. What a recording's keyframe needs to decode the
+	// stream from here on: the framebuffer and the windows of the zlib
+	// streams. FALSE once a zstd or xz stream was used, those hold more
+	// state than their window and can't be carried on. LoadState() throws
+	// rdr::Exception if the state is broken.
+	BOOL SaveState(std::vector<BYTE> &state);
+	void LoadState(const BYTE *state, size_t len);
+
+	static const char *EncodingName(CARD32 encoding);
+
+private:
+	// Returns the number of rects of the update it used up
+	int ReadRect(const rfbFramebufferUpdateRectHeader &h);
+
+	// DecoderRaw.cpp
+	void ReadRawRect(const rfbRectangle &r);
+	void ReadCopyRect(const rfbRectangle &r);
+	void ReadRRERect(const rfbRectangle &r, bool compact);
+
+	// DecoderHextile.cpp
+	void ReadHextileRect(const rfbRectangle &r);
+	void ReadZlibHexRect(const rfbRectangle &r, bool zstd);
+	const BYTE *ReadHextileTile(int w, int h, int subencoding, const BYTE *&tile);
+
+	// DecoderZlib.cpp
+	void ReadZlibRect(const rfbRectangle &r, bool zstd);
+	void ReadQueueZip(const rfbRectangle &r, bool zstd);
+	void ReadUltraRect(const rfbRectangle &r);
+	void ReadUltraZip(const rfbRectangle &r);
+	void ReadUltra2Rect(const rfbRectangle &r);
+	void DrawPackedRects(const BYTE *p, const BYTE *end, int nRects);
+	void DecodeJpegRect(const BYTE *src, int srclen, int x, int y, int w, int h);
+
+	// DecoderTight.cpp
+	void ReadTightRect(const rfbRectangle &r, bool zstd);
+	int ReadCompactLen();
+
+	// DecoderCache.cpp
+	void ReadCacheRect(const rfbRectangle &r);
+	void ReadCacheZip(const rfbRectangle &r);
+
+	// zrle.cpp, xz.cpp. The 32LE ones come with the ZYWRLE and XZYW
+	// filters the 24ALE ones use and are otherwise unused.
+	void zrleDecode(int x, int y, int w, int h, bool zstd);
+	template <class myInStream>
+	void zrleDecode32LE(int x, int y, int w, int h, rdr::InStream *is, myInStream *zis, rdr::U32 *buf);
+	template <class myInStream>
+	void zrleDecode24ALE(int x, int y, int w, int h, rdr::InStream *is, myInStream *zis, rdr::U32 *buf);
+#ifdef _XZ
+	int ReadXZRects(const rfbRectangle &r);
+	void xzDecode32LE(int x, int y, int w, int h, rdr::InStream *is, rdr::xzInStream *xzis, rdr::U32 *buf);
+	void xzDecode24ALE(int x, int y, int w, int h, rdr::InStream *is, rdr::xzInStream *xzis, rdr::U32 *buf);
+#endif
+
+	BYTE *Buffer(size_t size);
+	Inflater *StateStream(int id);
+
+	FrameBuffer &m_fb;
+	SessionInStream *m_is;
+	DecodeStatsMap m_stats;
+	long long m_rectPixels;		// what the current rect drew
+	int m_quality;
+
+	std::vector<BYTE> m_buf;	// compressed rect data
+	std::vector<BYTE> m_outbuf;	// and decompressed
+	Inflater m_zlib;			// Zlib and QueueZip
+	Inflater m_zlibHexRaw;
+	Inflater m_zlibHexEncoded;
+	Inflater m_tight[4];
+	rdr::ZlibInStream m_zis;	// ZRLE
+	rdr::ZstdInStream m_zstdis;
+#ifdef _XZ
+	rdr::xzInStream m_xzis;
+#endif
+	bool m_unsavedStreams;		// m_zstdis or m_xzis were used
+	tjhandle m_jpeg;
+
+	long zywrle_level;
+	int zywrleBuf[rfbZRLETileWidth * rfbZRLETileHeight];
+	long zywrle;
+#ifdef _XZ
+	long xzyw_level;
+	int xzywBuf[rfbXZTileWidth * rfbXZTileHeight];
+	long xzyw;
+#endif
+	rdr::U32 m_tileBuf[rfbZRLETileWidth * rfbZRLETileHeight];
+
+	TightFilter m_tightFilter;
+
+	Decoder(const Decoder &);
+	Decoder &operator=(const Decoder &);
+};
+
+#endif
@@ -0,0 +1,63 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Cache and CacheZip
+
+#include "Decoder.h"
+#include <rdr/Exception.h>
+#ifdef _INTERNALLIB
+#include <zlib.h>
+#else
+#include "../zlib/zlib.h"
+#endif
+
+void Decoder::ReadCacheRect(const rfbRectangle &r)
+{
+	m_is->skip(sz_rfbCacheRect);
+	m_fb.RestoreArea(r.x, r.y, r.w, r.h);
+}
+
+// A zipped list of rects to restore
+void Decoder::ReadCacheZip(const rfbRectangle &r)
+{
+	int nRects = r.x;
+	uLongf numRawBytes = CacheZipSize(nRects);
+
+	int numCompBytes = m_is->readU32();
+	BYTE *buf = Buffer(numCompBytes);
+	m_is->readBytes(buf, numCompBytes);
+
+	if (m_outbuf.size() < numRawBytes)
+		m_outbuf.resize(numRawBytes);
+	if (uncompress(&m_outbuf[0], &numRawBytes, buf, numCompBytes) != Z_OK)
+		throw rdr::Exception("CacheZip: uncompress failed");
+
+	m_rectPixels = 0;
+	const BYTE *p = &m_outbuf[0];
+	PackedRect cr;
+	for (int i = 0; i < nRects && NextCacheRect(p, &m_outbuf[0] + numRawBytes, cr); i++) {
+		m_fb.RestoreArea(cr.x, cr.y, cr.w, cr.h);
+		m_rectPixels += cr.w * cr.h;
+	}
+}
@@ -0,0 +1,117 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Hextile and ZlibHex
+
+#include "Decoder.h"
+#include <rdr/Exception.h>
+
+// The rest of a tile after its subencoding byte, read into the buffer
+// whole so the shared DecodeSurface::HextileTile can parse it, as it does
+// the inflated ZlibHex ones. Returns where the tile ends.
+const BYTE *Decoder::ReadHextileTile(int w, int h, int subencoding, const BYTE *&tile)
+{
+	if (subencoding & rfbHextileRaw) {
+		BYTE *buf = Buffer(w * h * 4);
+		m_is->readBytes(buf, w * h * 4);
+		tile = buf;
+		return buf + w * h * 4;
+	}
+	BYTE *buf = Buffer(4 + 4 + 1 + 255 * 6);
+	BYTE *p = buf;
+	if (subencoding & rfbHextileBackgroundSpecified) {
+		m_is->readBytes(p, 4);
+		p += 4;
+	}
+	if (subencoding & rfbHextileForegroundSpecified) {
+		m_is->readBytes(p, 4);
+		p += 4;
+	}
+	if (subencoding & rfbHextileAnySubrects) {
+		int nSubrects = *p++ = m_is->readU8();
+		int len = nSubrects * ((subencoding & rfbHextileSubrectsColoured) ? 6 : 2);
+		m_is->readBytes(p, len);
+		p += len;
+	}
+	tile = buf;
+	return p;
+}
+
+void Decoder::ReadHextileRect(const rfbRectangle &r)
+{
+	DecodeSurface fb = m_fb.Surface();
+	rdr::U32 bg = 0, fg = 0;
+
+	for (int y = r.y; y < r.y + r.h; y += 16) {
+		for (int x = r.x; x < r.x + r.w; x += 16) {
+			int w = (r.x + r.w - x < 16) ? r.x + r.w - x : 16;
+			int h = (r.y + r.h - y < 16) ? r.y + r.h - y : 16;
+
+			int subencoding = m_is->readU8();
+			const BYTE *tile;
+			const BYTE *end = ReadHextileTile(w, h, subencoding, tile);
+			fb.HextileTile(x, y, w, h, subencoding, tile, end, (BYTE *)&bg, (BYTE *)&fg);
+		}
+	}
+}
+
+void Decoder::ReadZlibHexRect(const rfbRectangle &r, bool zstd)
+{
+	DecodeSurface fb = m_fb.Surface();
+	rdr::U32 bg = 0, fg = 0;
+	const int tileBytes = 16 * 16 * 4 + 4 + 4 + 1 + 255 * 6;
+	if (m_outbuf.size() < tileBytes)
+		m_outbuf.resize(tileBytes);
+	BYTE *out = &m_outbuf[0];
+
+	for (int y = r.y; y < r.y + r.h; y += 16) {
+		for (int x = r.x; x < r.x + r.w; x += 16) {
+			int w = (r.x + r.w - x < 16) ? r.x + r.w - x : 16;
+			int h = (r.y + r.h - y < 16) ? r.y + r.h - y : 16;
+
+			int subencoding = m_is->readU8();
+			if (!(subencoding & rfbHextileRaw) && (subencoding & (rfbHextileZlibRaw | rfbHextileZlibHex))) {
+				int nCompData = m_is->readU16();
+				BYTE *buf = Buffer(nCompData);
+				m_is->readBytes(buf, nCompData);
+				if (subencoding & rfbHextileZlibRaw) {
+					if (m_zlibHexRaw.Inflate(buf, nCompData, out, (w * h + 2) * 4, zstd) < 0)
+						throw rdr::Exception("ZlibHex: inflate failed");
+					m_fb.SetPixels((const rdr::U32 *)out, w, x, y, w, h);
+				} else {
+					int len = m_zlibHexEncoded.Inflate(buf, nCompData, out, tileBytes, zstd);
+					if (len < 0)
+						throw rdr::Exception("ZlibHex: inflate failed");
+					if (fb.HextileTile(x, y, w, h, subencoding, out, out + len, (BYTE *)&bg, (BYTE *)&fg) == NULL)
+						throw rdr::Exception("ZlibHex: short tile");
+				}
+				continue;
+			}
+
+			const BYTE *tile;
+			const BYTE *end = ReadHextileTile(w, h, subencoding, tile);
+			fb.HextileTile(x, y, w, h, subencoding, tile, end, (BYTE *)&bg, (BYTE *)&fg);
+		}
+	}
+}
@@ -0,0 +1,76 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Raw, CopyRect, RRE and CoRRE
+
+#include "Decoder.h"
+#include <rdr/Exception.h>
+
+void Decoder::ReadRawRect(const rfbRectangle &r)
+{
+	rdr::U32 *row = m_fb.Rect(r.x, r.y, r.w, r.h);
+	if (row == NULL) {
+		m_is->skip(r.w * r.h * 4);
+		return;
+	}
+	for (int i = 0; i < r.h; i++, row += m_fb.Width())
+		m_is->readBytes(row, r.w * 4);
+}
+
+void Decoder::ReadCopyRect(const rfbRectangle &r)
+{
+	int srcX = m_is->readU16();
+	int srcY = m_is->readU16();
+	m_fb.SaveArea(r.x, r.y, r.w, r.h);
+	m_fb.CopyRect(srcX, srcY, r.x, r.y, r.w, r.h);
+}
+
+// CoRRE subrects have 8 bit coordinates
+void Decoder::ReadRRERect(const rfbRectangle &r, bool compact)
+{
+	CARD32 nSubrects = m_is->readU32();
+	rdr::U32 bg = m_is->readOpaque32();
+
+	m_fb.Fill(r.x, r.y, r.w, r.h, bg);
+
+	if (nSubrects > 20000000)
+		throw rdr::Exception("RRE: too many subrects");
+
+	for (CARD32 i = 0; i < nSubrects; i++) {
+		rdr::U32 pix = m_is->readOpaque32();
+		int x, y, w, h;
+		if (compact) {
+			x = m_is->readU8();
+			y = m_is->readU8();
+			w = m_is->readU8();
+			h = m_is->readU8();
+		} else {
+			x = m_is->readU16();
+			y = m_is->readU16();
+			w = m_is->readU16();
+			h = m_is->readU16();
+		}
+		m_fb.Fill(r.x + x, r.y + y, w, h, pix);
+	}
+}
@@ -0,0 +1,125 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Keyframes of a recording
+//
+// Byte 0 is the version, byte 1 is 1 if the cache plane follows the
+// pixels, then 2 bytes each of width and height. The pixels are as the
+// FrameBuffer holds them. Then for every zlib stream that was used, 1 byte
+// of id and 2 of length followed by its window. A stream that isn't there
+// starts fresh.
+
+#include "Decoder.h"
+#include <rdr/Exception.h>
+
+#define STATE_VERSION 1
+#define STATE_ZRLE_STREAM 7
+
+Inflater *Decoder::StateStream(int id)
+{
+	switch (id) {
+	case 0: return &m_zlib;
+	case 1: return &m_zlibHexRaw;
+	case 2: return &m_zlibHexEncoded;
+	case 3: case 4: case 5: case 6:
+		return &m_tight[id - 3];
+	}
+	return NULL;
+}
+
+BOOL Decoder::SaveState(std::vector<BYTE> &state)
+{
+	if (m_unsavedStreams)
+		return FALSE;
+
+	size_t plane = (size_t)m_fb.Width() * m_fb.Height() * 4;
+	bool cache = m_fb.Saved() != NULL;
+	state.resize(6 + plane * (cache ? 2 : 1));
+	state[0] = STATE_VERSION;
+	state[1] = cache ? 1 : 0;
+	state[2] = (BYTE)(m_fb.Width() >> 8);
+	state[3] = (BYTE)m_fb.Width();
+	state[4] = (BYTE)(m_fb.Height() >> 8);
+	state[5] = (BYTE)m_fb.Height();
+	if (plane) {
+		memcpy(&state[6], m_fb.Pixels(), plane);
+		if (cache)
+			memcpy(&state[6 + plane], m_fb.Saved(), plane);
+	}
+
+	BYTE window[rdr::ZlibInStream::windowSize];
+	for (int id = 0; id <= STATE_ZRLE_STREAM; id++) {
+		int len = id == STATE_ZRLE_STREAM ? m_zis.getWindow(window) : StateStream(id)->GetWindow(window);
+		if (len == -2)
+			return FALSE;
+		if (len < 0)
+			continue;
+		size_t at = state.size();
+		state.resize(at + 3 + len);
+		state[at] = (BYTE)id;
+		state[at + 1] = (BYTE)(len >> 8);
+		state[at + 2] = (BYTE)len;
+		memcpy(&state[at + 3], window, len);
+	}
+	return TRUE;
+}
+
+void Decoder::LoadState(const BYTE *state, size_t len)
+{
+	if (len < 6 || state[0] != STATE_VERSION)
+		throw rdr::Exception("keyframe: unknown version");
+	bool cache = state[1] != 0;
+	int w = (state[2] << 8) | state[3];
+	int h = (state[4] << 8) | state[5];
+	size_t plane = (size_t)w * h * 4;
+	const BYTE *p = state + 6;
+	const BYTE *end = state + len;
+	if ((size_t)(end - p) < plane * (cache ? 2 : 1))
+		throw rdr::Exception("keyframe: too short");
+
+	m_fb.Resize(w, h);
+	if (plane) {
+		memcpy(m_fb.Pixels(), p, plane);
+		if (cache && m_fb.Saved())
+			memcpy(m_fb.Saved(), p + plane, plane);
+	}
+	p += plane * (cache ? 2 : 1);
+
+	while (p < end) {
+		if (end - p < 3)
+			throw rdr::Exception("keyframe: too short");
+		int id = p[0];
+		int n = (p[1] << 8) | p[2];
+		p += 3;
+		if (end - p < n || n > rdr::ZlibInStream::windowSize)
+			throw rdr::Exception("keyframe: too short");
+		if (id == STATE_ZRLE_STREAM)
+			m_zis.setWindow(p, n);
+		else if (StateStream(id))
+			StateStream(id)->SetWindow(p, n);
+		else
+			throw rdr::Exception("keyframe: unknown stream");
+		p += n;
+	}
+}
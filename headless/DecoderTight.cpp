@@ -0,0 +1,107 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Tight
+//
+// The client's pixel format has depth 24 and 8 bit colours, so the server
+// always sends Tight pixels as three bytes, red first. The filters of
+// common/DecodeParse write straight into the framebuffer rows.
+
+#include "Decoder.h"
+#include <rdr/Exception.h>
+
+int Decoder::ReadCompactLen()
+{
+	int len;
+	for (int n = 0; TightCompactLen(len, n, m_is->readU8()); n++)
+		;
+	return len;
+}
+
+void Decoder::ReadTightRect(const rfbRectangle &r, bool zstd)
+{
+	TightControl ctl;
+	if (!ctl.Parse(m_is->readU8()))
+		throw rdr::Exception("Tight encoding: bad subencoding value received");
+
+	/* Flush zlib streams if we are told by the server to do so. */
+	for (int i = 0; i < 4; i++) {
+		if (ctl.resetStreams & (1 << i))
+			m_tight[i].Reset(zstd);
+	}
+
+	/* Handle solid rectangles. */
+	if (ctl.subencoding == rfbTightFill) {
+		BYTE fill[3];
+		m_is->readBytes(fill, 3);
+		m_fb.Fill(r.x, r.y, r.w, r.h, m_tightFilter.Pixel24(fill));
+		return;
+	}
+
+	if (ctl.subencoding == rfbTightJpeg) {
+		int compressedLen = ReadCompactLen();
+		BYTE *buf = Buffer(compressedLen);
+		m_is->readBytes(buf, compressedLen);
+		DecodeJpegRect(buf, compressedLen, r.x, r.y, r.w, r.h);
+		return;
+	}
+
+	/* First, we should identify a filter to use. */
+	int filter = rfbTightFilterCopy;
+	if (ctl.explicitFilter)
+		filter = m_is->readU8();
+	int numColors = 0;
+	if (filter == rfbTightFilterPalette)
+		numColors = m_is->readU8() + 1;
+	if (!m_tightFilter.Begin(filter, r.w, numColors))
+		throw rdr::Exception(filter == rfbTightFilterPalette ?
+			"Tight encoding: error receiving palette" : "Tight encoding: unknown filter code received");
+	for (int i = 0; i < numColors; i++) {
+		BYTE rgb[3];
+		m_is->readBytes(rgb, 3);
+		m_tightFilter.palette[i] = m_tightFilter.Pixel24(rgb);
+	}
+
+	/* Determine if the data should be decompressed or just copied. */
+	int dataSize = r.h * m_tightFilter.RowSize();
+	if (m_outbuf.size() < (size_t)dataSize + 1)
+		m_outbuf.resize(dataSize + 1);
+	BYTE *data = &m_outbuf[0];
+
+	if (dataSize < TIGHT_MIN_TO_COMPRESS) {
+		m_is->readBytes(data, dataSize);
+	} else {
+		int compressedLen = ReadCompactLen();
+		if (compressedLen <= 0)
+			throw rdr::Exception("Tight encoding: bad data received from server");
+		BYTE *buf = Buffer(compressedLen);
+		m_is->readBytes(buf, compressedLen);
+		if (m_tight[ctl.streamId].Inflate(buf, compressedLen, data, dataSize, zstd) != dataSize)
+			throw rdr::Exception("Tight encoding: wrong number of scan lines");
+	}
+
+	rdr::U32 *dst = m_fb.Rect(r.x, r.y, r.w, r.h);
+	if (dst != NULL)
+		m_tightFilter.Rows(data, r.h, dst, m_fb.Width());
+}
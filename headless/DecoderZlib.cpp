@@ -0,0 +1,125 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Zlib, Zstd, QueueZip, Ultra, UltraZip and Ultra2
+
+#include "Decoder.h"
+#include <rdr/Exception.h>
+
+// The compressed data after a rfbZlibHeader, into buf. Returns its length.
+static int ReadZlibData(rdr::InStream *is, std::vector<BYTE> &buf)
+{
+	int numCompBytes = is->readU32();
+	if (numCompBytes < 0)
+		throw rdr::Exception("compressed rect too long");
+	if ((int)buf.size() <= numCompBytes)
+		buf.resize(numCompBytes + 1);
+	is->readBytes(&buf[0], numCompBytes);
+	return numCompBytes;
+}
+
+static BYTE *OutBuffer(std::vector<BYTE> &buf, size_t size)
+{
+	if (buf.size() < size)
+		buf.resize(size);
+	return &buf[0];
+}
+
+void Decoder::ReadZlibRect(const rfbRectangle &r, bool zstd)
+{
+	int numCompBytes = ReadZlibData(m_is, m_buf);
+	UINT numRawBytes = r.w * r.h * 4;
+	BYTE *out = OutBuffer(m_outbuf, numRawBytes + 1);
+	if (m_zlib.Inflate(&m_buf[0], numCompBytes, out, numRawBytes, zstd) < 0)
+		throw rdr::Exception("Zlib: inflate failed");
+	m_fb.SetPixels((const rdr::U32 *)out, r.w, r.x, r.y, r.w, r.h);
+}
+
+// The rects of a QueueZip or UltraZip block
+void Decoder::DrawPackedRects(const BYTE *p, const BYTE *end, int nRects)
+{
+	m_rectPixels = 0;
+	PackedRect pr;
+	for (int i = 0; i < nRects && NextPackedRect(p, end, 4, pr); i++) {
+		m_fb.SaveArea(pr.x, pr.y, pr.w, pr.h);
+		m_fb.SetPixels((const rdr::U32 *)pr.pixels, pr.w, pr.x, pr.y, pr.w, pr.h);
+		m_rectPixels += pr.w * pr.h;
+	}
+}
+
+void Decoder::ReadQueueZip(const rfbRectangle &r, bool zstd)
+{
+	int nRects = r.x;
+	UINT numRawBytes = PackedBlockSize(r.y, r.w);
+	int numCompBytes = ReadZlibData(m_is, m_buf);
+	BYTE *out = OutBuffer(m_outbuf, numRawBytes + 500);
+	int len = m_zlib.Inflate(&m_buf[0], numCompBytes, out, numRawBytes + 500, zstd);
+	if (len < 0)
+		throw rdr::Exception("QueueZip: inflate failed");
+	DrawPackedRects(out, out + len, nRects);
+}
+
+void Decoder::ReadUltraRect(const rfbRectangle &r)
+{
+	int numCompBytes = ReadZlibData(m_is, m_buf);
+	UINT numRawBytes = r.w * r.h * 4;
+	BYTE *out = OutBuffer(m_outbuf, numRawBytes + 500);
+	if (UltraInflate(&m_buf[0], numCompBytes, out, numRawBytes + 500) < (long)numRawBytes)
+		return;
+	m_fb.SetPixels((const rdr::U32 *)out, r.w, r.x, r.y, r.w, r.h);
+}
+
+void Decoder::ReadUltraZip(const rfbRectangle &r)
+{
+	int nRects = r.x;
+	UINT numRawBytes = PackedBlockSize(r.y, r.w);
+	if (numRawBytes > ULTRAZIP_MAX_BYTES || nRects > ULTRAZIP_MAX_RECTS)
+		throw rdr::Exception("UltraZip: rect too large");
+	int numCompBytes = ReadZlibData(m_is, m_buf);
+	BYTE *out = OutBuffer(m_outbuf, numRawBytes + 500);
+	long len = UltraInflate(&m_buf[0], numCompBytes, out, numRawBytes + 500);
+	if (len < 0)
+		return;
+	DrawPackedRects(out, out + len, nRects);
+}
+
+void Decoder::ReadUltra2Rect(const rfbRectangle &r)
+{
+	int numCompBytes = ReadZlibData(m_is, m_buf);
+	DecodeJpegRect(&m_buf[0], numCompBytes, r.x, r.y, r.w, r.h);
+}
+
+// Straight into the framebuffer, whose pixels are BGRX in memory
+void Decoder::DecodeJpegRect(const BYTE *src, int srclen, int x, int y, int w, int h)
+{
+	BYTE *dst = (BYTE *)m_fb.Rect(x, y, w, h);
+	if (srclen <= 0 || dst == NULL || m_jpeg == NULL)
+		return;
+	int jpegWidth, jpegHeight, subsamp, colorspace;
+	if (tjDecompressHeader3(m_jpeg, src, (unsigned long)srclen, &jpegWidth, &jpegHeight, &subsamp, &colorspace) != 0 ||
+		jpegWidth != w || jpegHeight != h)
+		throw rdr::Exception("JPEG: wrong JPEG data received");
+	if (tjDecompress2(m_jpeg, src, (unsigned long)srclen, dst, w, m_fb.Width() * 4, h, TJPF_BGRX, 0) != 0)
+		throw rdr::Exception(tjGetErrorStr2(m_jpeg));
+}
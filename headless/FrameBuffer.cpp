@@ -0,0 +1,109 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+#include "FrameBuffer.h"
+#include "../zlib/zlib.h"
+
+void FrameBuffer::Resize(int w, int h)
+{
+	width = w;
+	height = h;
+	pixels.assign((size_t)w * h, 0);
+	if (cache)
+		saved.assign((size_t)w * h, 0);
+}
+
+rdr::U32 *FrameBuffer::Rect(int x, int y, int w, int h)
+{
+	if (x < 0 || y < 0 || w < 0 || h < 0 || x + w > width || y + h > height || pixels.empty())
+		return NULL;
+	return &pixels[(size_t)y * width + x];
+}
+
+DecodeSurface FrameBuffer::Surface()
+{
+	DecodeSurface s;
+	s.bits = pixels.empty() ? NULL : (rdr::U8 *)&pixels[0];
+	s.width = width;
+	s.height = height;
+	s.bytesPerPixel = 4;
+	s.stride = width * 4;
+	return s;
+}
+
+void FrameBuffer::Fill(int x, int y, int w, int h, rdr::U32 pix)
+{
+	Surface().Fill(x, y, w, h, (const rdr::U8 *)&pix);
+}
+
+void FrameBuffer::SetPixels(const rdr::U32 *src, int srcStride, int x, int y, int w, int h)
+{
+	Surface().SetPixels((const rdr::U8 *)src, srcStride * 4, x, y, w, h);
+}
+
+void FrameBuffer::CopyRect(int srcx, int srcy, int x, int y, int w, int h)
+{
+	Surface().CopyRect(srcx, srcy, x, y, w, h);
+}
+
+void FrameBuffer::EnableCache(bool enable)
+{
+	cache = enable;
+	if (cache)
+		saved.assign(pixels.size(), 0);
+	else
+		saved.clear();
+}
+
+void FrameBuffer::SaveArea(int x, int y, int w, int h)
+{
+	rdr::U32 *row = Rect(x, y, w, h);
+	if (!cache || row == NULL)
+		return;
+	rdr::U32 *dst = &saved[row - &pixels[0]];
+	for (int i = 0; i < h; i++, row += width, dst += width)
+		memcpy(dst, row, w * 4);
+}
+
+void FrameBuffer::RestoreArea(int x, int y, int w, int h)
+{
+	rdr::U32 *row = Rect(x, y, w, h);
+	if (!cache || row == NULL)
+		return;
+	rdr::U32 *other = &saved[row - &pixels[0]];
+	for (int i = 0; i < h; i++, row += width, other += width)
+		for (int j = 0; j < w; j++) {
+			rdr::U32 pix = row[j];
+			row[j] = other[j];
+			other[j] = pix;
+		}
+}
+
+unsigned long FrameBuffer::Checksum()
+{
+	uLong sum = adler32(0L, Z_NULL, 0);
+	if (!pixels.empty())
+		sum = adler32(sum, (const Bytef *)&pixels[0], (uInt)(pixels.size() * 4));
+	return sum;
+}
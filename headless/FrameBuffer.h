@@ -0,0 +1,83 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// FrameBuffer
+//
+// What the headless client decodes into: the viewer's DIB without the
+// window. Pixels are always 32 bit, red in bits 16-23, green in 8-15 and
+// blue in 0-7, the format the client asks the server for, so every
+// decoder can write them as they come off the wire. A second plane of the
+// same size holds the cache encoding's saved areas when it is enabled.
+
+#ifndef FRAMEBUFFER_H__
+#define FRAMEBUFFER_H__
+#pragma once
+
+#include "stdhdrs.h"
+#include <rdr/types.h>
+#include "../common/DecodeSurface.h"
+#include <vector>
+
+class FrameBuffer
+{
+public:
+	FrameBuffer() : width(0), height(0), cache(false) {};
+
+	void Resize(int w, int h);
+	int Width() { return width; };
+	int Height() { return height; };
+
+	// Top left pixel of a rect, NULL unless the rect is inside the
+	// framebuffer. Rows are Width() pixels apart.
+	rdr::U32 *Rect(int x, int y, int w, int h);
+	// The pixels for the decoder core the viewer shares
+	DecodeSurface Surface();
+
+	void Fill(int x, int y, int w, int h, rdr::U32 pix);
+	// Rows of w pixels from src, srcStride pixels apart
+	void SetPixels(const rdr::U32 *src, int srcStride, int x, int y, int w, int h);
+	void CopyRect(int srcx, int srcy, int x, int y, int w, int h);
+
+	// Cache encoding: SaveArea keeps a rect before it is drawn over,
+	// RestoreArea swaps it back in
+	void EnableCache(bool enable);
+	void SaveArea(int x, int y, int w, int h);
+	void RestoreArea(int x, int y, int w, int h);
+
+	// Both planes as they are, for recordings. Saved() is NULL unless the
+	// cache is enabled.
+	rdr::U32 *Pixels() { return pixels.empty() ? NULL : &pixels[0]; };
+	rdr::U32 *Saved() { return saved.empty() ? NULL : &saved[0]; };
+
+	// adler32 of the pixels, to check runs against each other
+	unsigned long Checksum();
+
+private:
+	int width, height;
+	std::vector<rdr::U32> pixels;
+	bool cache;
+	std::vector<rdr::U32> saved;
+};
+
+#endif
@@ -0,0 +1,142 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+#include "Inflater.h"
+#include <rdr/Exception.h>
+#ifdef _INTERNALLIB
+#include <zlib.h>
+#include <zstd.h>
+#else
+#include "../zlib/zlib.h"
+#include "../zstd/lib/zstd.h"
+#endif
+
+Inflater::Inflater() : zs(NULL), ds(NULL), zstdUsed(false), resumed(false)
+{
+}
+
+Inflater::~Inflater()
+{
+	if (zs) {
+		inflateEnd(zs);
+		delete zs;
+	}
+	if (ds)
+		ZSTD_freeDStream(ds);
+}
+
+static z_stream *NewStream(int windowBits)
+{
+	z_stream *zs = new z_stream;
+	memset(zs, 0, sizeof(*zs));
+	if (inflateInit2(zs, windowBits) != Z_OK) {
+		delete zs;
+		return NULL;
+	}
+	return zs;
+}
+
+int Inflater::Inflate(const BYTE *in, UINT inLen, BYTE *out, UINT outLen, bool zstd)
+{
+	if (zstd) {
+		if (ds == NULL) {
+			ds = ZSTD_createDStream();
+			if (ds == NULL || ZSTD_isError(ZSTD_initDStream(ds)))
+				return -1;
+		}
+		zstdUsed = true;
+		ZSTD_inBuffer input = { in, inLen, 0 };
+		ZSTD_outBuffer output = { out, outLen, 0 };
+		// Until the output is full, or the input is used up and nothing
+		// more comes out of what zstd holds back
+		while (output.pos < output.size) {
+			size_t before = output.pos;
+			size_t rc = ZSTD_decompressStream(ds, &output, &input);
+			if (ZSTD_isError(rc))
+				return -1;
+			if (input.pos == input.size && output.pos == before)
+				break;
+		}
+		return (int)output.pos;
+	}
+
+	if (zs == NULL && (zs = NewStream(MAX_WBITS)) == NULL)
+		return -1;
+	zs->next_in = (Bytef *)in;
+	zs->avail_in = inLen;
+	zs->next_out = out;
+	zs->avail_out = outLen;
+	while (zs->avail_out > 0) {
+		int rc = inflate(zs, Z_SYNC_FLUSH);
+		if (rc == Z_BUF_ERROR)
+			break;			// no progress possible, input used up
+		if (rc != Z_OK && rc != Z_STREAM_END)
+			return -1;
+		if (rc == Z_STREAM_END || zs->avail_in == 0)
+			break;
+	}
+	return (int)(outLen - zs->avail_out);
+}
+
+void Inflater::Reset(bool zstd)
+{
+	if (zstd) {
+		if (ds)
+			ZSTD_DCtx_reset(ds, ZSTD_reset_session_only);
+		zstdUsed = false;
+	} else if (resumed) {
+		// A raw stream, the new one comes with a header
+		inflateEnd(zs);
+		delete zs;
+		zs = NULL;
+		resumed = false;
+	} else if (zs) {
+		inflateReset(zs);
+	}
+}
+
+int Inflater::GetWindow(BYTE *buf)
+{
+	if (zstdUsed)
+		return -2;
+	if (zs == NULL || (zs->total_in == 0 && !resumed))
+		return -1;
+	uInt len = 0;
+	if (inflateGetDictionary(zs, buf, &len) != Z_OK)
+		return -2;
+	return (int)len;
+}
+
+// The zlib header is long gone, so the rest is inflated raw
+void Inflater::SetWindow(const BYTE *buf, int len)
+{
+	if (zs) {
+		inflateEnd(zs);
+		delete zs;
+	}
+	zs = NewStream(-MAX_WBITS);
+	if (zs == NULL || (len > 0 && inflateSetDictionary(zs, buf, len) != Z_OK))
+		throw rdr::Exception("Inflater: can't resume the stream");
+	resumed = true;
+}
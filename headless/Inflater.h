@@ -0,0 +1,70 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Inflater
+//
+// One of the server's persistent compression streams, as UltraVncZ keeps
+// them in the viewer: zlib or zstd, flushed after every rect but never
+// ended, so each rect has to go through the same Inflater as the ones
+// before it.
+
+#ifndef INFLATER_H__
+#define INFLATER_H__
+#pragma once
+
+#include "stdhdrs.h"
+
+struct z_stream_s;
+struct ZSTD_DCtx_s;
+
+class Inflater
+{
+public:
+	Inflater();
+	~Inflater();
+
+	// inLen bytes from in into at most outLen bytes at out. Returns the
+	// number of bytes produced, -1 if the stream is broken.
+	int Inflate(const BYTE *in, UINT inLen, BYTE *out, UINT outLen, bool zstd);
+
+	// The server started a new stream (Tight's reset bits)
+	void Reset(bool zstd);
+
+	// For recordings, as rdr::ZlibInStream::getWindow() and setWindow().
+	// A zstd stream that was used can't be carried on, GetWindow() then
+	// returns -2.
+	int GetWindow(BYTE *buf);
+	void SetWindow(const BYTE *buf, int len);
+
+private:
+	z_stream_s *zs;
+	ZSTD_DCtx_s *ds;
+	bool zstdUsed;
+	bool resumed;
+
+	Inflater(const Inflater &);
+	Inflater &operator=(const Inflater &);
+};
+
+#endif
@@ -0,0 +1,398 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+#include "Session.h"
+#include <rdr/Exception.h>
+#include <rdr/MemInStream.h>
+#include <errno.h>
+#include <vector>
+extern "C" {
+#include <rfb/vncauth.h>
+}
+
+Session::Session(const SessionOptions &opts)
+	: m_opts(opts), m_sock(INVALID_SOCKET), m_is(NULL),
+	  m_decoder(m_fb), m_updates(0), m_live(true), m_minor(8)
+{
+	m_fb.EnableCache(opts.cache);
+	m_decoder.SetQuality(opts.quality);
+}
+
+Session::~Session()
+{
+	m_recorder.Close();
+	delete m_is;
+	if (m_sock != INVALID_SOCKET)
+		closesocket(m_sock);
+}
+
+void Session::WriteExact(const void *buf, int len)
+{
+	const char *p = (const char *)buf;
+	while (len > 0) {
+		int n = send(m_sock, p, len, 0);
+		if (n <= 0) {
+#ifdef _WIN32
+			throw rdr::SystemException("send", WSAGetLastError());
+#else
+			if (errno == EINTR)
+				continue;
+			throw rdr::SystemException("send", errno);
+#endif
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+void Session::Connect()
+{
+	char port[16];
+	snprintf(port, sizeof(port), "%d", m_opts.port);
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(m_opts.host.c_str(), port, &hints, &res) != 0)
+		throw rdr::Exception(m_opts.host.c_str(), "unknown host");
+	for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+		m_sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (m_sock == INVALID_SOCKET)
+			continue;
+		if (connect(m_sock, ai->ai_addr, (int)ai->ai_addrlen) == 0)
+			break;
+		closesocket(m_sock);
+		m_sock = INVALID_SOCKET;
+	}
+	freeaddrinfo(res);
+	if (m_sock == INVALID_SOCKET)
+		throw rdr::Exception(m_opts.host.c_str(), "can't connect");
+	int one = 1;
+	setsockopt(m_sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+	m_is = new SocketInStream(m_sock);
+
+	// Protocol version, 3.8 at most
+	char pv[sz_rfbProtocolVersionMsg + 1];
+	m_is->readBytes(pv, sz_rfbProtocolVersionMsg);
+	pv[sz_rfbProtocolVersionMsg] = 0;
+	int major, minor;
+	if (sscanf(pv, rfbProtocolVersionFormat, &major, &minor) != 2)
+		throw rdr::Exception("not a VNC server");
+	m_minor = (major > 3 || minor >= 8) ? 8 : (minor == 7 ? 7 : 3);
+	snprintf(pv, sizeof(pv), rfbProtocolVersionFormat, 3, m_minor);
+	WriteExact(pv, sz_rfbProtocolVersionMsg);
+
+	// Security, None or VNC authentication
+	CARD32 auth = rfbInvalidAuth;
+	if (m_minor >= 7) {
+		int nTypes = m_is->readU8();
+		if (nTypes == 0) {
+			char *reason = m_is->readString();
+			rdr::Exception e(reason, "connection refused");
+			delete [] reason;
+			throw e;
+		}
+		bool none = false, vnc = false;
+		for (int i = 0; i < nTypes; i++) {
+			int type = m_is->readU8();
+			none |= type == rfbNoAuth;
+			vnc |= type == rfbVncAuth;
+		}
+		if (vnc && (!m_opts.password.empty() || !none))
+			auth = rfbVncAuth;
+		else if (none)
+			auth = rfbNoAuth;
+		else
+			throw rdr::Exception("the server wants an authentication this client does not have");
+		CARD8 type = (CARD8)auth;
+		WriteExact(&type, 1);
+	} else {
+		auth = m_is->readU32();
+		if (auth == rfbConnFailed) {
+			char *reason = m_is->readString();
+			rdr::Exception e(reason, "connection refused");
+			delete [] reason;
+			throw e;
+		}
+		if (auth != rfbNoAuth && auth != rfbVncAuth)
+			throw rdr::Exception("the server wants an authentication this client does not have");
+	}
+
+	if (auth == rfbVncAuth) {
+		unsigned char challenge[CHALLENGESIZE];
+		char passwd[MAXPWLEN + 1];
+		m_is->readBytes(challenge, CHALLENGESIZE);
+		memset(passwd, 0, sizeof(passwd));
+		strncpy(passwd, m_opts.password.c_str(), MAXPWLEN);
+		vncEncryptBytes(challenge, passwd);
+		WriteExact(challenge, CHALLENGESIZE);
+	}
+	if (auth == rfbVncAuth || m_minor >= 8)
+		ReadSecurityResult(m_minor >= 8);
+
+	// Shared, so several sessions can watch one server
+	CARD8 shared = 1;
+	WriteExact(&shared, sz_rfbClientInitMsg);
+
+	if (!m_opts.record.empty()) {
+		RecordingHeader header;
+		header.source = recordingSourceViewer;
+		header.quality = (rdr::S16)m_opts.quality;
+		header.cache = m_opts.cache ? 1 : 0;
+		header.keyframeMs = m_opts.keyframeSeconds * 1000;
+		if (!m_recorder.Open(m_opts.record.c_str(), header))
+			throw rdr::Exception(m_recorder.Error().c_str(), m_opts.record.c_str());
+		m_is->Record(&m_recorder);
+	}
+	ReadServerInit(m_is);
+	m_is->RecordMessage();
+	SendSetup();
+	RequestUpdate(false);
+}
+
+void Session::ReadSecurityResult(bool reason)
+{
+	CARD32 result = m_is->readU32();
+	if (result == rfbVncAuthOK)
+		return;
+	if (reason) {
+		char *text = m_is->readString();
+		rdr::Exception e(text, "authentication failed");
+		delete [] text;
+		throw e;
+	}
+	throw rdr::Exception(result == rfbVncAuthTooMany ? "too many tries" : "authentication failed");
+}
+
+void Session::ReadServerInit(rdr::InStream *is)
+{
+	int w = is->readU16();
+	int h = is->readU16();
+	is->skip(sz_rfbPixelFormat);
+	char *name = is->readString();
+	m_name = name;
+	delete [] name;
+	m_fb.Resize(w, h);
+}
+
+void Session::SendSetup()
+{
+	rfbSetPixelFormatMsg spf;
+	memset(&spf, 0, sizeof(spf));
+	spf.type = rfbSetPixelFormat;
+	spf.format.bitsPerPixel = 32;
+	spf.format.depth = 24;
+	spf.format.bigEndian = 0;
+	spf.format.trueColour = 1;
+	spf.format.redMax = Swap16IfLE(255);
+	spf.format.greenMax = Swap16IfLE(255);
+	spf.format.blueMax = Swap16IfLE(255);
+	spf.format.redShift = 16;
+	spf.format.greenShift = 8;
+	spf.format.blueShift = 0;
+	WriteExact(&spf, sz_rfbSetPixelFormatMsg);
+
+	std::vector<CARD32> encs;
+	encs.push_back(m_opts.encoding);
+	if (m_opts.encoding != rfbEncodingCopyRect)
+		encs.push_back(rfbEncodingCopyRect);
+	if (m_opts.compressLevel >= 0)
+		encs.push_back(rfbEncodingCompressLevel0 + m_opts.compressLevel);
+	if (m_opts.quality >= 0)
+		encs.push_back(rfbEncodingQualityLevel0 + m_opts.quality);
+	encs.push_back(rfbEncodingQueueEnable);
+	encs.push_back(rfbEncodingLastRect);
+	encs.push_back(rfbEncodingNewFBSize);
+	if (m_opts.cache)
+		encs.push_back(rfbEncodingCacheEnable);
+
+	std::vector<char> msg(sz_rfbSetEncodingsMsg + encs.size() * 4);
+	rfbSetEncodingsMsg *se = (rfbSetEncodingsMsg *)&msg[0];
+	se->type = rfbSetEncodings;
+	se->pad = 0;
+	se->nEncodings = Swap16IfLE((CARD16)encs.size());
+	for (size_t i = 0; i < encs.size(); i++) {
+		CARD32 enc = Swap32IfLE(encs[i]);
+		memcpy(&msg[sz_rfbSetEncodingsMsg + i * 4], &enc, 4);
+	}
+	WriteExact(&msg[0], (int)msg.size());
+}
+
+void Session::RequestUpdate(bool incremental)
+{
+	if (!m_live)
+		return;
+	rfbFramebufferUpdateRequestMsg fur;
+	fur.type = rfbFramebufferUpdateRequest;
+	fur.incremental = incremental ? 1 : 0;
+	fur.x = 0;
+	fur.y = 0;
+	fur.w = Swap16IfLE(m_fb.Width());
+	fur.h = Swap16IfLE(m_fb.Height());
+	WriteExact(&fur, sz_rfbFramebufferUpdateRequestMsg);
+}
+
+// One server message. Everything but the updates is read past.
+void Session::ReadMessage()
+{
+	int type = m_is->readU8();
+	switch (type) {
+	case rfbFramebufferUpdate: {
+		bool resized = !m_decoder.ReadUpdate(m_is);
+		m_updates++;
+		RequestUpdate(!resized);
+		break;
+	}
+	case rfbSetColourMapEntries: {
+		m_is->skip(3);
+		int nColours = m_is->readU16();
+		m_is->skip(nColours * 6);
+		break;
+	}
+	case rfbBell:
+	case rfbKeepAlive:
+	case rfbRequestSession:
+		break;
+	case rfbServerCutText: {
+		m_is->skip(3);
+		int length = m_is->readS32();
+		// Negative for the extended clipboard
+		m_is->skip(length < 0 ? -length : length);
+		break;
+	}
+	case rfbResizeFrameBuffer: {
+		m_is->skip(1);
+		int w = m_is->readU16();
+		int h = m_is->readU16();
+		m_fb.Resize(w, h);
+		RequestUpdate(false);
+		break;
+	}
+	case rfbServerState:
+		m_is->skip(sz_rfbServerStateMsg - 1);
+		break;
+	case rfbTextChat: {
+		m_is->skip(3);
+		CARD32 length = m_is->readU32();
+		// Open, close and finished have no text
+		if (length < rfbTextChatFinished)
+			m_is->skip(length);
+		break;
+	}
+	case rfbFileTransfer: {
+		m_is->skip(7);
+		CARD32 length = m_is->readU32();
+		m_is->skip(length);
+		break;
+	}
+	case rfbNotifyPluginStreaming:
+		m_is->skip(sz_rfbNotifyPluginStreamingMsg - 1);
+		break;
+	default: {
+		char msg[64];
+		snprintf(msg, sizeof(msg), "unknown message type %d", type);
+		throw rdr::Exception(msg);
+	}
+	}
+}
+
+void Session::Run(int seconds)
+{
+	if (seconds > 0)
+		((SocketInStream *)m_is)->SetDeadline(TimeUs() + (long long)seconds * 1000000);
+	try {
+		while (true) {
+			ReadMessage();
+			RecordMessage();
+		}
+	} catch (rdr::EndOfStream &) {
+	} catch (rdr::TimedOut &) {
+	}
+	m_recorder.Close();
+	if (!m_recorder.Error().empty())
+		throw rdr::Exception(m_recorder.Error().c_str(), m_opts.record.c_str());
+}
+
+// A keyframe after the message when one is due. Sessions that use a zstd
+// or xz stream can't have any, they only play from the start.
+void Session::RecordMessage()
+{
+	if (!m_recorder.IsOpen())
+		return;
+	m_is->RecordMessage();
+	rdr::U32 now = m_recorder.Now();
+	if (m_recorder.KeyframeDue(now)) {
+		std::vector<BYTE> state;
+		if (m_decoder.SaveState(state))
+			m_recorder.Keyframe(&state[0], state.size(), now);
+	}
+	if (!m_recorder.IsOpen())
+		throw rdr::Exception(m_recorder.Error().c_str(), m_opts.record.c_str());
+}
+
+long long Session::Replay(const char *file, long long ms)
+{
+	RecordingReader reader;
+	if (!reader.Open(file))
+		throw rdr::Exception(reader.Error().c_str(), file);
+	const RecordingHeader &header = reader.Header();
+	if (header.source != recordingSourceViewer && header.source != recordingSourceServer)
+		throw rdr::Exception("unknown recording source", file);
+
+	m_live = false;
+	m_fb.EnableCache(header.cache != 0);
+	m_decoder.SetQuality(header.quality);
+
+	std::vector<rdr::U8> state;
+	if (!reader.Seek(ms < 0 ? 0 : (rdr::U32)ms, state))
+		throw rdr::Exception(reader.Error().c_str(), file);
+	long long keyframe = -1;
+	if (!state.empty()) {
+		if (header.source == recordingSourceServer) {
+			// Its rects are stateless, the decoders start afresh
+			rdr::MemInStream init(&state[0], (int)state.size());
+			ReadServerInit(&init);
+		} else {
+			m_decoder.LoadState(&state[0], state.size());
+		}
+		for (size_t i = 0; i < reader.Keyframes().size(); i++)
+			if (reader.Keyframes()[i].ms <= ms)
+				keyframe = reader.Keyframes()[i].ms;
+	}
+
+	RecordingInStream *is = new RecordingInStream(reader);
+	m_is = is;
+	try {
+		if (state.empty())
+			ReadServerInit(m_is);
+		rdr::U32 t;
+		while (is->Time(t) && (ms < 0 || t <= ms))
+			ReadMessage();
+	} catch (rdr::EndOfStream &) {
+	}
+	// The stream refers to the reader
+	delete m_is;
+	m_is = NULL;
+	return keyframe;
+}
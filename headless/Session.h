@@ -0,0 +1,111 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Session
+//
+// One headless viewer: connects, authenticates, asks for a single
+// encoding in the client's fixed pixel format and then keeps requesting
+// and decoding updates into its FrameBuffer. Nothing is drawn and no
+// input is sent. A session can record what the server sent, from
+// ServerInit on, with keyframes of the decoder state every so often. A
+// recording, a session's or one winvnc made of its desktop, can be
+// decoded again as fast as the decoders go, or from a keyframe on to show
+// the framebuffer at some point of the session.
+
+#ifndef SESSION_H__
+#define SESSION_H__
+#pragma once
+
+#include "stdhdrs.h"
+#include "rfb.h"
+#include "FrameBuffer.h"
+#include "Decoder.h"
+#include "Streams.h"
+#include <string>
+
+struct SessionOptions
+{
+	SessionOptions()
+		: port(RFB_PORT_OFFSET), encoding(rfbEncodingZRLE),
+		  compressLevel(-1), quality(-1), cache(false), keyframeSeconds(30) {};
+
+	std::string host;
+	int port;
+	std::string password;
+	CARD32 encoding;
+	int compressLevel;			// -1 leaves it to the server
+	int quality;				// JPEG quality, -1 for none
+	bool cache;
+	std::string record;			// file to record to, none if empty
+	int keyframeSeconds;
+};
+
+class Session
+{
+public:
+	Session(const SessionOptions &opts);
+	~Session();
+
+	// Connect and get through the handshake, throws rdr::Exception
+	void Connect();
+
+	// Decode updates for seconds, or until the server closes
+	void Run(int seconds);
+
+	// Decode a recording made with SessionOptions::record or by the
+	// server, all of it or the messages up to ms. Those start at the last
+	// keyframe before ms if there is one, its time is returned then, -1
+	// otherwise.
+	long long Replay(const char *file, long long ms = -1);
+
+	FrameBuffer &Fb() { return m_fb; };
+	DecodeStatsMap &Stats() { return m_decoder.Stats(); };
+	long long Updates() { return m_updates; };
+	std::string &Name() { return m_name; };
+
+private:
+	void ReadServerInit(rdr::InStream *is);
+	void ReadMessage();
+	void SendSetup();
+	void RequestUpdate(bool incremental);
+	void WriteExact(const void *buf, int len);
+	void ReadSecurityResult(bool reason);
+	void RecordMessage();
+
+	SessionOptions m_opts;
+	SOCKET m_sock;
+	SessionInStream *m_is;
+	RecordingWriter m_recorder;
+	FrameBuffer m_fb;
+	Decoder m_decoder;
+	std::string m_name;
+	long long m_updates;
+	bool m_live;			// false while replaying
+	int m_minor;
+
+	Session(const Session &);
+	Session &operator=(const Session &);
+};
+
+#endif
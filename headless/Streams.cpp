@@ -0,0 +1,143 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+#include "Streams.h"
+#include <rdr/Exception.h>
+#include <errno.h>
+#include <chrono>
+
+enum { DEFAULT_BUF_SIZE = 65536 };
+
+long long TimeUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SessionInStream::SessionInStream(int bufSize_)
+	: bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0), waitUs(0),
+	  recorder(NULL), recordedTo(0)
+{
+	ptr = end = start = new rdr::U8[bufSize];
+}
+
+SessionInStream::~SessionInStream()
+{
+	delete [] start;
+}
+
+void SessionInStream::Record(RecordingWriter *w)
+{
+	recorder = w;
+	recorded.assign(ptr, end);
+	recordedTo = BytesRead();
+}
+
+void SessionInStream::RecordMessage()
+{
+	if (recorder == NULL)
+		return;
+	size_t n = (size_t)(BytesRead() - recordedTo);
+	recorder->Message(n ? &recorded[0] : NULL, n, recorder->Now());
+	recorded.erase(recorded.begin(), recorded.begin() + n);
+	recordedTo += n;
+}
+
+int SessionInStream::overrun(int itemSize, int nItems)
+{
+	if (itemSize > bufSize)
+		throw rdr::Exception("SessionInStream overrun: max itemSize exceeded");
+
+	if (end - ptr != 0)
+		memmove(start, ptr, end - ptr);
+	offset += ptr - start;
+	end -= ptr - start;
+	ptr = start;
+
+	while (end < start + itemSize) {
+		long long t = TimeUs();
+		int n = Fill((rdr::U8 *)end, (int)(start + bufSize - end));
+		waitUs += TimeUs() - t;
+		if (recorder)
+			recorded.insert(recorded.end(), end, end + n);
+		end += n;
+	}
+
+	if (itemSize * nItems > end - ptr)
+		nItems = (int)((end - ptr) / itemSize);
+	return nItems;
+}
+
+int SocketInStream::Fill(rdr::U8 *buf, int len)
+{
+	while (true) {
+		if (deadline) {
+			long long left = deadline - TimeUs();
+			if (left <= 0)
+				throw rdr::TimedOut();
+			fd_set rfds;
+			FD_ZERO(&rfds);
+			FD_SET(sock, &rfds);
+			struct timeval tv;
+			tv.tv_sec = (long)(left / 1000000);
+			tv.tv_usec = (long)(left % 1000000);
+			if (select((int)sock + 1, &rfds, NULL, NULL, &tv) <= 0)
+				continue;
+		}
+		int n = recv(sock, (char *)buf, len, 0);
+		if (n > 0)
+			return n;
+		if (n == 0)
+			throw rdr::EndOfStream();
+#ifdef _WIN32
+		throw rdr::SystemException("recv", WSAGetLastError());
+#else
+		if (errno != EINTR)
+			throw rdr::SystemException("recv", errno);
+#endif
+	}
+}
+
+bool RecordingInStream::Time(rdr::U32 &t)
+{
+	if (left) {
+		t = ms;
+		return true;
+	}
+	return reader.Peek(t);
+}
+
+int RecordingInStream::Fill(rdr::U8 *buf, int len)
+{
+	// Empty messages are only for timing
+	while (left == 0)
+		if (!reader.Next(data, left, ms))
+			throw rdr::EndOfStream();
+	if ((size_t)len > left)
+		len = (int)left;
+	memcpy(buf, data, len);
+	data += len;
+	left -= len;
+	return len;
+}
@@ -0,0 +1,112 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Streams
+//
+// Where the headless client reads RFB from: a socket to a live server or
+// a recording of one. Both count what they hand out and how long they
+// waited for it, so decode time can be told apart from network time. What
+// a socket hands out can go into a recording, a message at a time.
+
+#ifndef STREAMS_H__
+#define STREAMS_H__
+#pragma once
+
+#include "stdhdrs.h"
+#include <rdr/InStream.h>
+#include "../common/SessionRecording.h"
+#include <vector>
+
+// Microseconds on a clock that only goes forward
+long long TimeUs();
+
+class SessionInStream : public rdr::InStream
+{
+public:
+	virtual ~SessionInStream();
+
+	int pos() { return (int)(offset + (ptr - start)); }
+
+	// Bytes handed out so far, and the time spent waiting for them
+	long long BytesRead() { return offset + (ptr - start); }
+	long long WaitUs() { return waitUs; }
+
+	// From the current position on, keep what is read for w
+	void Record(RecordingWriter *w);
+	// What was read since the last call goes to the recording as one
+	// message
+	void RecordMessage();
+
+protected:
+	SessionInStream(int bufSize = 0);
+
+	// At most len bytes into buf, at least one, blocking
+	virtual int Fill(rdr::U8 *buf, int len) = 0;
+
+private:
+	int overrun(int itemSize, int nItems);
+
+	rdr::U8 *start;
+	int bufSize;
+	long long offset;
+	long long waitUs;
+	RecordingWriter *recorder;
+	std::vector<rdr::U8> recorded;	// read ahead, not recorded yet
+	long long recordedTo;			// stream position of recorded[0]
+};
+
+class SocketInStream : public SessionInStream
+{
+public:
+	SocketInStream(SOCKET s) : sock(s), deadline(0) {};
+
+	// Reads throw rdr::TimedOut once TimeUs() passes this
+	void SetDeadline(long long us) { deadline = us; };
+protected:
+	int Fill(rdr::U8 *buf, int len);
+private:
+	SOCKET sock;
+	long long deadline;
+};
+
+// Hands out the recorded messages one after the other. Fill() never
+// goes past the end of a message, so between messages Time() is that of
+// the next one.
+class RecordingInStream : public SessionInStream
+{
+public:
+	RecordingInStream(RecordingReader &r) : reader(r), data(NULL), left(0), ms(0) {};
+
+	// Of the message being read, else of the next one. false at the end.
+	bool Time(rdr::U32 &t);
+protected:
+	int Fill(rdr::U8 *buf, int len);
+private:
+	RecordingReader &reader;
+	const rdr::U8 *data;
+	size_t left;
+	rdr::U32 ms;
+};
+
+#endif
@@ -0,0 +1,4 @@
+/* intrin.h
+ * libjpeg-turbo-win's jconfigint.h includes the MSVC intrinsics header.
+ * The non-SIMD build needs none of it, so gcc and clang get this one.
+ */
@@ -0,0 +1,55 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// rfb.h
+// The rfb spec header for the headless client. Same as vncviewer/rfb.h,
+// but the CARD types have their wire sizes on every platform, CARD32 is
+// an unsigned long there which is 8 bytes on 64 bit Linux.
+//
+
+#ifndef RFB_H__
+#define RFB_H__
+
+#include <stdint.h>
+
+typedef uint32_t CARD32;
+typedef uint16_t CARD16;
+typedef int16_t INT16;
+typedef uint8_t CARD8;
+
+#define RFB_PORT_OFFSET 5900
+
+// include the protocol spec
+#include <rfb/rfbproto.h>
+
+// The client only runs on little endian hosts, as the viewer does
+#define Swap16IfLE(s) \
+    ((CARD16) ((((s) & 0xff) << 8) | (((s) >> 8) & 0xff)))
+#define Swap32IfLE(l) \
+    ((CARD32) ((((l) & 0xff000000) >> 24) | \
+     (((l) & 0x00ff0000) >> 8)  | \
+	 (((l) & 0x0000ff00) << 8)  | \
+	 (((l) & 0x000000ff) << 24)))
+
+#endif
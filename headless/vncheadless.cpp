@@ -0,0 +1,278 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncheadless
+//
+// Decode-only VNC client for load testing servers and benchmarking the
+// decoders. Starts N sessions against one server, each on its own
+// thread, decodes whatever they are sent into memory for a while and
+// prints how fast every encoding decoded. Or decodes a recording made
+// with -record or by winvnc's session recorder, without the network in
+// the way, all of it or up to some point of the session, which it can
+// save as a picture.
+
+#include "stdhdrs.h"
+#include "Session.h"
+#include <rdr/Exception.h>
+#include <thread>
+#include <vector>
+#include <mutex>
+
+static const struct {
+	const char *name;
+	CARD32 encoding;
+} encodings[] = {
+	{ "raw", rfbEncodingRaw },
+	{ "rre", rfbEncodingRRE },
+	{ "corre", rfbEncodingCoRRE },
+	{ "hextile", rfbEncodingHextile },
+	{ "zlib", rfbEncodingZlib },
+	{ "tight", rfbEncodingTight },
+	{ "zlibhex", rfbEncodingZlibHex },
+	{ "ultra", rfbEncodingUltra },
+	{ "ultra2", rfbEncodingUltra2 },
+	{ "zrle", rfbEncodingZRLE },
+	{ "zywrle", rfbEncodingZYWRLE },
+#ifdef _XZ
+	{ "xz", rfbEncodingXZ },
+	{ "xzyw", rfbEncodingXZYW },
+#endif
+	{ "zstd", rfbEncodingZstd },
+	{ "tightzstd", rfbEncodingTightZstd },
+	{ "zstdhex", rfbEncodingZstdHex },
+	{ "zstdrle", rfbEncodingZSTDRLE },
+	{ "zstdywrle", rfbEncodingZSTDYWRLE },
+};
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: vncheadless [options] host[:display]\n"
+		"       vncheadless -replay file [-seek seconds] [-dump file.ppm]\n"
+		"  -encoding name      one of");
+	for (size_t i = 0; i < sizeof(encodings) / sizeof(encodings[0]); i++)
+		fprintf(stderr, " %s", encodings[i].name);
+	fprintf(stderr, "\n"
+		"  -compresslevel n    0-9\n"
+		"  -quality n          JPEG quality 0-9, none by default\n"
+		"  -password pw        for VNC authentication\n"
+		"  -cache              enable the cache encoding\n"
+		"  -sessions n         parallel sessions, 1 by default\n"
+		"  -seconds n          how long to run, 10 by default, 0 for ever\n"
+		"  -record file        record the first session\n"
+		"  -keyframe n         seconds between the recording's keyframes, 30 by default\n"
+		"  -replay file        decode a recording instead of connecting\n"
+		"  -seek seconds       only up to there, from the keyframe before it\n"
+		"  -dump file.ppm      save the framebuffer after the replay\n");
+	exit(1);
+}
+
+struct SessionResult
+{
+	DecodeStatsMap stats;
+	long long updates;
+	unsigned long checksum;
+	std::string error;
+};
+
+static void PrintStats(std::vector<SessionResult> &results, double seconds)
+{
+	DecodeStatsMap total;
+	for (size_t i = 0; i < results.size(); i++)
+		for (DecodeStatsMap::iterator it = results[i].stats.begin(); it != results[i].stats.end(); it++)
+			total[it->first].Add(it->second);
+
+	printf("%-10s %10s %10s %12s %12s %10s\n", "encoding", "rects", "Mpixels", "KB", "decode ms", "Mpixel/s");
+	DecodeStats all;
+	for (DecodeStatsMap::iterator it = total.begin(); it != total.end(); it++) {
+		const DecodeStats &s = it->second;
+		all.Add(s);
+		printf("%-10s %10lld %10.2f %12.1f %12.1f %10.1f\n", Decoder::EncodingName(it->first),
+			s.rects, s.pixels / 1e6, s.bytes / 1024.0, s.us / 1000.0,
+			s.us ? s.pixels / (double)s.us : 0.0);
+	}
+	printf("%-10s %10lld %10.2f %12.1f %12.1f %10.1f\n", "total",
+		all.rects, all.pixels / 1e6, all.bytes / 1024.0, all.us / 1000.0,
+		all.us ? all.pixels / (double)all.us : 0.0);
+
+	for (size_t i = 0; i < results.size(); i++) {
+		if (!results[i].error.empty())
+			printf("session %d: %s\n", (int)i, results[i].error.c_str());
+		else
+			printf("session %d: %lld updates, %.1f/s, checksum %08lx\n", (int)i,
+				results[i].updates, seconds > 0 ? results[i].updates / seconds : 0.0,
+				results[i].checksum);
+	}
+}
+
+static bool DumpPPM(FrameBuffer &fb, const char *file)
+{
+	FILE *f = fopen(file, "wb");
+	if (f == NULL)
+		return false;
+	fprintf(f, "P6\n%d %d\n255\n", fb.Width(), fb.Height());
+	std::vector<BYTE> row(fb.Width() * 3);
+	for (int y = 0; y < fb.Height(); y++) {
+		const rdr::U32 *p = fb.Rect(0, y, fb.Width(), 1);
+		for (int x = 0; x < fb.Width(); x++) {
+			row[x * 3] = (BYTE)(p[x] >> 16);
+			row[x * 3 + 1] = (BYTE)(p[x] >> 8);
+			row[x * 3 + 2] = (BYTE)p[x];
+		}
+		fwrite(&row[0], 1, row.size(), f);
+	}
+	return fclose(f) == 0;
+}
+
+static void RunSession(SessionOptions opts, int seconds, SessionResult *result)
+{
+	Session session(opts);
+	try {
+		session.Connect();
+		session.Run(seconds);
+	} catch (rdr::Exception &e) {
+		result->error = e.str();
+	}
+	result->stats = session.Stats();
+	result->updates = session.Updates();
+	result->checksum = session.Fb().Checksum();
+}
+
+int main(int argc, char *argv[])
+{
+	SessionOptions opts;
+	int sessions = 1;
+	int seconds = 10;
+	const char *replay = NULL;
+	double seek = -1;
+	const char *dump = NULL;
+	const char *host = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		bool more = i + 1 < argc;
+		if (strcmp(arg, "-encoding") == 0 && more) {
+			const char *name = argv[++i];
+			size_t e;
+			for (e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++)
+				if (strcmp(name, encodings[e].name) == 0)
+					break;
+			if (e == sizeof(encodings) / sizeof(encodings[0]))
+				usage();
+			opts.encoding = encodings[e].encoding;
+		} else if (strcmp(arg, "-compresslevel") == 0 && more) {
+			opts.compressLevel = atoi(argv[++i]);
+		} else if (strcmp(arg, "-quality") == 0 && more) {
+			opts.quality = atoi(argv[++i]);
+		} else if (strcmp(arg, "-password") == 0 && more) {
+			opts.password = argv[++i];
+		} else if (strcmp(arg, "-cache") == 0) {
+			opts.cache = true;
+		} else if (strcmp(arg, "-sessions") == 0 && more) {
+			sessions = atoi(argv[++i]);
+		} else if (strcmp(arg, "-seconds") == 0 && more) {
+			seconds = atoi(argv[++i]);
+		} else if (strcmp(arg, "-record") == 0 && more) {
+			opts.record = argv[++i];
+		} else if (strcmp(arg, "-keyframe") == 0 && more) {
+			opts.keyframeSeconds = atoi(argv[++i]);
+		} else if (strcmp(arg, "-replay") == 0 && more) {
+			replay = argv[++i];
+		} else if (strcmp(arg, "-seek") == 0 && more) {
+			seek = atof(argv[++i]);
+		} else if (strcmp(arg, "-dump") == 0 && more) {
+			dump = argv[++i];
+		} else if (arg[0] != '-' && host == NULL) {
+			host = arg;
+		} else {
+			usage();
+		}
+	}
+
+	std::vector<SessionResult> results;
+
+	if (replay) {
+		results.resize(1);
+		Session session(opts);
+		long long start = TimeUs();
+		long long keyframe = -1;
+		try {
+			keyframe = session.Replay(replay, seek < 0 ? -1 : (long long)(seek * 1000));
+		} catch (rdr::Exception &e) {
+			results[0].error = e.str();
+		}
+		double elapsed = (TimeUs() - start) / 1e6;
+		if (seek >= 0) {
+			if (keyframe >= 0)
+				printf("%.3f s: from the keyframe at %.3f s", seek, keyframe / 1000.0);
+			else
+				printf("%.3f s: from the start", seek);
+			printf(", %.1f ms\n", elapsed * 1000);
+		}
+		if (dump && results[0].error.empty() && !DumpPPM(session.Fb(), dump))
+			results[0].error = std::string(dump) + ": can't write";
+		results[0].stats = session.Stats();
+		results[0].updates = session.Updates();
+		results[0].checksum = session.Fb().Checksum();
+		PrintStats(results, elapsed);
+		return results[0].error.empty() ? 0 : 1;
+	}
+
+	if (host == NULL || sessions < 1)
+		usage();
+
+	// host:display or host::port, as the viewer takes them
+	opts.host = host;
+	size_t colon = opts.host.find(':');
+	if (colon != std::string::npos) {
+		if (opts.host.compare(colon, 2, "::") == 0)
+			opts.port = atoi(opts.host.c_str() + colon + 2);
+		else
+			opts.port = RFB_PORT_OFFSET + atoi(opts.host.c_str() + colon + 1);
+		opts.host.resize(colon);
+	}
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+	results.resize(sessions);
+	std::vector<std::thread> threads;
+	long long start = TimeUs();
+	for (int i = 0; i < sessions; i++) {
+		SessionOptions o = opts;
+		if (i > 0)
+			o.record.clear();
+		threads.push_back(std::thread(RunSession, o, seconds, &results[i]));
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	PrintStats(results, (TimeUs() - start) / 1e6);
+	for (size_t i = 0; i < results.size(); i++)
+		if (!results[i].error.empty())
+			return 1;
+	return 0;
+}
@@ -0,0 +1,78 @@
+//
+// Copyright (C) 2002 RealVNC Ltd.  All Rights Reserved.
+//
+#ifdef _XZ
+#include <rdr/xzInStream.h>
+#include <rdr/MemInStream.h>
+#include <rdr/Exception.h>
+#include "Decoder.h"
+
+// Instantiate the decoding function for the client's pixel format, after
+// the plain 32 bit one for the XZYW filter, as in zrle.cpp
+
+#define xzDecode Decoder::xzDecode
+
+#define ENDIAN_LITTLE 0
+#define ENDIAN_BIG 1
+#define ENDIAN_NO 2
+
+#define IMAGE_RECT(x,y,w,h,data) m_fb.SetPixels(data,w,x,y,w,h)
+
+#define BPP 32
+#define XZYW_ENDIAN ENDIAN_LITTLE
+#include <rfb/xzDecode.h>
+#define CPIXEL 24A
+#include <rfb/xzDecode.h>
+#undef CPIXEL
+#undef BPP
+#undef XZYW_ENDIAN
+#undef IMAGE_RECT
+
+#undef xzDecode
+
+// The header's x and y hold the number of rects, w and h the length of
+// the xz data that carries their headers and tiles. The whole block is
+// read first so whatever the decoder leaves of it can't throw the stream
+// off. Returns the number of rects it stands for.
+int Decoder::ReadXZRects(const rfbRectangle &r)
+{
+	int nAllRects = (r.x << 16) | r.y;
+	int nDataLength = (r.w << 16) | r.h;
+
+	if (xzyw) {
+		if (m_quality < 0)
+			xzyw_level = 1;
+		else if (m_quality < 3)
+			xzyw_level = 3;
+		else if (m_quality < 6)
+			xzyw_level = 2;
+		else
+			xzyw_level = 1;
+	} else {
+		xzyw_level = 0;
+	}
+
+	m_unsavedStreams = true;
+	BYTE *buf = Buffer(nDataLength);
+	m_is->readBytes(buf, nDataLength);
+	rdr::MemInStream mis(buf, nDataLength);
+	m_xzis.setUnderlying(&mis, nDataLength);
+
+	std::vector<rfbRectangle> rects(nAllRects);
+	for (int i = 0; i < nAllRects; i++) {
+		rects[i].x = m_xzis.readU16();
+		rects[i].y = m_xzis.readU16();
+		rects[i].w = m_xzis.readU16();
+		rects[i].h = m_xzis.readU16();
+	}
+
+	m_rectPixels = 0;
+	for (int i = 0; i < nAllRects; i++) {
+		const rfbRectangle &rect = rects[i];
+		m_fb.SaveArea(rect.x, rect.y, rect.w, rect.h);
+		xzDecode24ALE(rect.x, rect.y, rect.w, rect.h, &mis, &m_xzis, m_tileBuf);
+		m_rectPixels += rect.w * rect.h;
+	}
+	return nAllRects > 0 ? nAllRects : 1;
+}
+#endif
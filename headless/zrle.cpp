@@ -0,0 +1,73 @@
+//
+// Copyright (C) 2002 RealVNC Ltd.  All Rights Reserved.
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+// USA.
+
+#include <rdr/ZlibInStream.h>
+#include <rdr/ZstdInStream.h>
+#include <rdr/Exception.h>
+#include "Decoder.h"
+
+// Instantiate the decoding function for the client's pixel format: 32 bit
+// pixels with the colours in the low three bytes, sent as three. The
+// plain 32 bit pass has to come first for the ZYWRLE synthesis filter.
+
+#define zrleDecode Decoder::zrleDecode
+
+#define ENDIAN_LITTLE 0
+#define ENDIAN_BIG 1
+#define ENDIAN_NO 2
+
+#define IMAGE_DIRECT(x,y,w,h) m_fb.Rect(x,y,w,h)
+#define IMAGE_STRIDE m_fb.Width()
+#define IMAGE_RECT(x,y,w,h,data) m_fb.SetPixels(data,w,x,y,w,h)
+
+#define BPP 32
+#define ZYWRLE_ENDIAN ENDIAN_LITTLE
+#include <rfb/zrleDecode.h>
+#define CPIXEL 24A
+#include <rfb/zrleDecode.h>
+#undef CPIXEL
+#undef BPP
+#undef ZYWRLE_ENDIAN
+#undef IMAGE_RECT
+#undef IMAGE_DIRECT
+#undef IMAGE_STRIDE
+
+#undef zrleDecode
+
+void Decoder::zrleDecode(int x, int y, int w, int h, bool use_zstd)
+{
+	if (zywrle) {
+		if (m_quality < 0)
+			zywrle_level = 1;
+		else if (m_quality < 3)
+			zywrle_level = 3;
+		else if (m_quality < 6)
+			zywrle_level = 2;
+		else
+			zywrle_level = 1;
+	} else {
+		zywrle_level = 0;
+	}
+
+	if (use_zstd) {
+		m_unsavedStreams = true;
+		zrleDecode24ALE(x, y, w, h, m_is, &m_zstdis, m_tileBuf);
+	} else {
+		zrleDecode24ALE(x, y, w, h, m_is, &m_zis, m_tileBuf);
+	}
+}
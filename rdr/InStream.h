@@ -112,6 +112,35 @@ namespace rdr {
                                  ((U8*)&r)[2] = *ptr++; ((U8*)&r)[3] = *ptr++;
                                  return r; }
 
+    // Bulk versions: n pixels into dst, with one buffer check per chunk
+    // rather than one per pixel.
+
+    inline void readOpaque8(U8* dst, int n)   { readBytes(dst, n); }
+    inline void readOpaque16(U16* dst, int n) { readBytes(dst, n * 2); }
+    inline void readOpaque32(U32* dst, int n) { readBytes(dst, n * 4); }
+    inline void readOpaque24A(U32* dst, int n) {
+      while (n > 0) {
+        int items = check(3, n);
+        for (int i = 0; i < items; i++, ptr += 3) {
+          U32 r = 0;
+          memcpy(&r, ptr, 3);
+          *dst++ = r;
+        }
+        n -= items;
+      }
+    }
+    inline void readOpaque24B(U32* dst, int n) {
+      while (n > 0) {
+        int items = check(3, n);
+        for (int i = 0; i < items; i++, ptr += 3) {
+          U32 r = 0;
+          memcpy((U8*)&r + 1, ptr, 3);
+          *dst++ = r;
+        }
+        n -= items;
+      }
+    }
+
     // pos() returns the position in the stream.
 
     virtual int pos() = 0;
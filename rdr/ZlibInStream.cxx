@@ -32,7 +32,7 @@ enum { DEFAULT_BUF_SIZE = 16384 };
 
 ZlibInStream::ZlibInStream(int bufSize_)
   : underlying(0), bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0),
-    bytesIn(0)
+    bytesIn(0), resumed(false)
 {
   zs = new z_stream;
   zs->zalloc    = Z_NULL;
@@ -78,6 +78,28 @@ void ZlibInStream::reset()
   underlying = 0;
 }
 
+int ZlibInStream::getWindow(U8* buf)
+{
+  if (zs->total_in == 0 && !resumed)
+    return -1;
+  uInt len = 0;
+  if (inflateGetDictionary(zs, buf, &len) != Z_OK)
+    throw Exception("ZlibInStream: inflateGetDictionary failed");
+  return (int)len;
+}
+
+// The zlib header is long gone, so the rest is inflated raw
+void ZlibInStream::setWindow(const U8* buf, int len)
+{
+  inflateEnd(zs);
+  zs->next_in = Z_NULL;
+  zs->avail_in = 0;
+  if (inflateInit2(zs, -MAX_WBITS) != Z_OK ||
+      (len > 0 && inflateSetDictionary(zs, buf, len) != Z_OK))
+    throw Exception("ZlibInStream: can't resume the stream");
+  resumed = true;
+}
+
 int ZlibInStream::overrun(int itemSize, int nItems)
 {
   if (itemSize > bufSize)
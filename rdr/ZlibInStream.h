@@ -43,6 +43,14 @@ namespace rdr {
     void reset();
     int pos();
 
+    // The stream between two rects, to carry on in another instance:
+    // getWindow() copies what inflate can still refer back to, at most
+    // windowSize bytes, and returns its length, -1 if nothing was
+    // inflated yet. setWindow() picks up from there.
+    enum { windowSize = 32768 };
+    int getWindow(U8* buf);
+    void setWindow(const U8* buf, int len);
+
   private:
 
     int overrun(int itemSize, int nItems);
@@ -54,6 +62,7 @@ namespace rdr {
     z_stream_s* zs;
     int bytesIn;
     U8* start;
+    bool resumed;
   };
 
 } // end of namespace rdr
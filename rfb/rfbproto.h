@@ -500,6 +500,24 @@ typedef struct {
 #define rfbEncodingpseudoSession    		0xFFFF8003
 #define rfbEncodingEnableIdleTime           0xFFFF8004
 
+/*
+ *  Server timing: a server that gets this from the viewer adds a rect of
+ *  this encoding, x, y, w and h 0, to an update when a key or a mouse
+ *  button was pressed since its last one. A CARD32 follows: ms from the
+ *  server reading the first such event to having encoded the update, so
+ *  the viewer can tell the server's share of input latency from the
+ *  network's.
+ */
+#define rfbEncodingServerTiming             0xFFFF8005
+
+/*
+ *  Frame pacing: 0xFFFF8101 .. 0xFFFF81FF -- maximum frames per second
+ *  the viewer wants to receive (1-255). The server never sends updates
+ *  faster than the lower of this and its own per-client cap.
+ */
+#define rfbEncodingMaxFPS1                  0xFFFF8101
+#define rfbEncodingMaxFPS255                0xFFFF81FF
+
 // Same encoder number as in tight 
 /*
 #define rfbEncodingXCursor         0xFFFFFF10
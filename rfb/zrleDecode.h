@@ -22,11 +22,18 @@
 // Before including this file, you must define a number of CPP macros.
 //
 // BPP should be 8, 16 or 32 depending on the bits per pixel.
-// IMAGE_RECT
+// IMAGE_RECT(x,y,w,h,data) copies a tile decoded into buf to the screen.
+// IMAGE_DIRECT(x,y,w,h) and IMAGE_STRIDE are optional: the first gives
+// the tile's top left pixel in the framebuffer, or NULL, the second the
+// framebuffer scanline in pixels. Tiles are then decoded in place and
+// IMAGE_RECT is only used for the ones that went through buf.
+// IMAGE_LOCK, also optional, is a statement that locks the framebuffer
+// around IMAGE_RECT, and TILE_DONE(x,y,w,h) is run after every tile.
 
 #include <rdr/ZlibInStream.h>
 #include <rdr/ZstdInStream.h>
 #include <rdr/InStream.h>
+#include <rfb/zrleKernels.h>
 #include <assert.h>
 
 using namespace rdr;
@@ -56,16 +63,22 @@ using namespace rdr;
 #ifdef CPIXEL
 #define PIXEL_T __RFB_CONCAT2E(rdr::U,BPP)
 #define READ_PIXEL __RFB_CONCAT2E(readOpaque,CPIXEL)
+#define LOAD_PIXEL __RFB_CONCAT2E(zrleLoad,CPIXEL)
+#define PIXEL_BYTES 3
 #define ZRLE_DECODE_BPP __RFB_CONCAT3E(zrleDecode,CPIXEL,END_FIX)
 #define BPPOUT BPP
 #elif BPP==15
 #define PIXEL_T __RFB_CONCAT2E(rdr::U,16)
 #define READ_PIXEL __RFB_CONCAT2E(readOpaque,16)
+#define LOAD_PIXEL __RFB_CONCAT2E(zrleLoad,16)
+#define PIXEL_BYTES 2
 #define ZRLE_DECODE_BPP __RFB_CONCAT3E(zrleDecode,BPP,END_FIX)
 #define BPPOUT 16
 #else
 #define PIXEL_T __RFB_CONCAT2E(rdr::U,BPP)
 #define READ_PIXEL __RFB_CONCAT2E(readOpaque,BPP)
+#define LOAD_PIXEL __RFB_CONCAT2E(zrleLoad,BPP)
+#define PIXEL_BYTES (BPP/8)
 #define ZRLE_DECODE_BPP __RFB_CONCAT3E(zrleDecode,BPP,END_FIX)
 #define BPPOUT BPP
 #endif
@@ -75,6 +88,28 @@ using namespace rdr;
 #include <rfb/zywrletemplate.c>
 #endif
 
+#ifndef ZRLE_FILL_RUN
+#define ZRLE_FILL_RUN
+// Write a run of len pixels at column col of the current tile row,
+// wrapping onto the next rows of a tile tw pixels wide
+template <class PIXEL>
+static inline void zrleFillRun(PIXEL*& row, int& col, int tw, int stride,
+                               PIXEL pix, int len)
+{
+  while (len > 0) {
+    int n = tw - col;
+    if (n > len) n = len;
+    zrleFill(row + col, pix, n);
+    col += n;
+    len -= n;
+    if (col == tw) {
+      col = 0;
+      row += stride;
+    }
+  }
+}
+#endif
+
 template <class myInStream>
 void ZRLE_DECODE_BPP (int x, int y, int w, int h, rdr::InStream* is,
 	myInStream* zis, PIXEL_T* buf)
@@ -92,6 +127,23 @@ void ZRLE_DECODE_BPP (int x, int y, int w, int h, rdr::InStream* is,
 #if BPP!=8
 top:
 #endif
+      // In place unless the tile is a zywrle one, those are synthesized
+      // in buf first
+      PIXEL_T* out = buf;
+      int scan = tw;
+#ifdef IMAGE_DIRECT
+#if BPP!=8
+      if (!(zywrle_level & 0x80))
+#endif
+      {
+        PIXEL_T* fb = IMAGE_DIRECT(tx,ty,tw,th);
+        if (fb) {
+          out = fb;
+          scan = IMAGE_STRIDE;
+        }
+      }
+#endif
+
       int mode = zis->readU8();
       BOOL rle = mode & 128;
       int palSize = mode & 127;
@@ -99,16 +151,13 @@ top:
 
       //        fprintf(stderr,"rle %d palSize %d\n",rle,palSize);
 
-      for (int i = 0; i < palSize; i++) {
-        palette[i] = zis->READ_PIXEL();
-      }
+      zis->READ_PIXEL(palette, palSize);
 
       if (palSize == 1) {
-        PIXEL_T* ptr = buf;
-        for (int i = 0; i < tw*th; i++) {
-			*ptr++ = palette[0];
-		}
-		goto draw;
+        PIXEL_T* row = out;
+        for (int i = 0; i < th; i++, row += scan)
+          zrleFill(row, palette[0], tw);
+        goto draw;
       }
 
       if (!rle) {
@@ -123,11 +172,15 @@ top:
 		  }else
 #endif
 #ifdef CPIXEL
-          for (PIXEL_T* ptr = buf; ptr < buf+tw*th; ptr++) {
-            *ptr = zis->READ_PIXEL();
-          }
+          for (int i = 0; i < th; i++)
+            zis->READ_PIXEL(out + i * scan, tw);
 #else
-          zis->readBytes(buf, tw * th * (BPPOUT / 8));
+          if (scan == tw) {
+            zis->readBytes(out, tw * th * (BPPOUT / 8));
+          } else {
+            for (int i = 0; i < th; i++)
+              zis->readBytes(out + i * scan, tw * (BPPOUT / 8));
+          }
 #endif
 
         } else {
@@ -136,34 +189,55 @@ top:
           int bppp = ((palSize > 16) ? 8 :
                       ((palSize > 4) ? 4 : ((palSize > 2) ? 2 : 1)));
 
-          PIXEL_T* ptr = buf;
+          // Each row starts on a byte boundary
+          U8 indices[rfbZRLETileWidth];
+          int rowBytes = (tw * bppp + 7) / 8;
 
           for (int i = 0; i < th; i++) {
-            PIXEL_T* eol = ptr + tw;
-            U8 byte = 0;
-            U8 nbits = 0;
-
-            while (ptr < eol) {
-              if (nbits == 0) {
-                byte = zis->readU8();
-                nbits = 8;
-              }
-              nbits -= bppp;
-              U8 index = (byte >> nbits) & ((1 << bppp) - 1) & 127;
-              *ptr++ = palette[index];
-            }
+            zis->readBytes(indices, rowBytes);
+            zrleExpand(out + i * scan, indices, tw, bppp, palette);
           }
         }
 
       } else {
 
+        PIXEL_T* row = out;
+        int col = 0;
+        int left = tw * th;
+
         if (palSize == 0) {
 
           // plain RLE
 
-          PIXEL_T* ptr = buf;
-          PIXEL_T* end = ptr + th * tw;	    
-          while (ptr < end) {
+          while (left > 0) {
+            // Whole runs straight from the stream buffer, one cut off by
+            // the end of the buffer goes through the checked reads below
+            const U8* p = zis->getptr();
+            const U8* end = zis->getend();
+            while (left > 0 && end - p > PIXEL_BYTES) {
+              const U8* run = p;
+              PIXEL_T pix = LOAD_PIXEL(p);
+              p += PIXEL_BYTES;
+              int len = 1;
+              int b = 255;
+              while (b == 255 && p < end) {
+                b = *p++;
+                len += b;
+              }
+              if (b == 255) {
+                p = run;
+                break;
+              }
+
+              assert(len <= left);
+              if (len > left) len = left;
+
+              zrleFillRun(row, col, tw, scan, pix, len);
+              left -= len;
+            }
+            zis->setptr(p);
+            if (left == 0) break;
+
             PIXEL_T pix = zis->READ_PIXEL();
             int len = 1;
             int b;
@@ -172,18 +246,44 @@ top:
               len += b;
             } while (b == 255);
 
-            assert(len <= end - ptr);
-
-            while (len-- > 0) *ptr++ = pix;
+            assert(len <= left);
+            if (len > left) len = left;
 
+            zrleFillRun(row, col, tw, scan, pix, len);
+            left -= len;
           }
         } else {
 
           // palette RLE
 
-          PIXEL_T* ptr = buf;
-          PIXEL_T* end = ptr + th * tw;
-          while (ptr < end) {
+          while (left > 0) {
+            const U8* p = zis->getptr();
+            const U8* end = zis->getend();
+            while (left > 0 && p < end) {
+              const U8* run = p;
+              int index = *p++;
+              int len = 1;
+              if (index & 128) {
+                int b = 255;
+                while (b == 255 && p < end) {
+                  b = *p++;
+                  len += b;
+                }
+                if (b == 255) {
+                  p = run;
+                  break;
+                }
+
+                assert(len <= left);
+                if (len > left) len = left;
+              }
+
+              zrleFillRun(row, col, tw, scan, palette[index & 127], len);
+              left -= len;
+            }
+            zis->setptr(p);
+            if (left == 0) break;
+
             int index = zis->readU8();
             int len = 1;
             if (index & 128) {
@@ -193,21 +293,24 @@ top:
                 len += b;
               } while (b == 255);
 
-              assert(len <= end - ptr);
+              assert(len <= left);
+              if (len > left) len = left;
             }
 
             index &= 127;
 
-            PIXEL_T pix = palette[index];
-
-            while (len-- > 0) *ptr++ = pix;
+            zrleFillRun(row, col, tw, scan, palette[index], len);
+            left -= len;
           }
         }
       }
 
       //fprintf(stderr,"copying data to screen %dx%d at %d,%d\n",tw,th,tx,ty);
 draw:
-	  omni_mutex_lock l(m_bitmapdcMutex);
+      if (out == buf) {
+#ifdef IMAGE_LOCK
+	  IMAGE_LOCK;
+#endif
 #if BPP!=8
       if( zywrle_level & 0x80 ){
 	    zywrle_level &= 0x7F;
@@ -215,7 +318,10 @@ draw:
 	  }
 #endif
       IMAGE_RECT(tx,ty,tw,th,buf);
-	   if (initialupdate_counter < 4) if (!directx_used)InvalidateRect(m_hwndcn, NULL, FALSE);
+      }
+#ifdef TILE_DONE
+      TILE_DONE(tx,ty,tw,th);
+#endif
     }
   }
 
@@ -224,5 +330,7 @@ draw:
 
 #undef ZRLE_DECODE_BPP
 #undef READ_PIXEL
+#undef LOAD_PIXEL
+#undef PIXEL_BYTES
 #undef PIXEL_T
 #undef BPPOUT
@@ -0,0 +1,194 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+//
+// zrleKernels.h - inner loops of the zrle decoder.
+//
+// Run fill and packed palette expansion for 8, 16 and 32 bit pixels, and
+// pixel loads straight from a stream buffer. SSE2 is used where every
+// x86 build has it (x64, or /arch:SSE2 and up); define ZRLE_NO_SIMD to
+// get the plain C++ versions.
+//
+
+#ifndef __RFB_ZRLEKERNELS_H__
+#define __RFB_ZRLEKERNELS_H__
+
+#include <rdr/types.h>
+#include <string.h>
+
+#if !defined(ZRLE_NO_SIMD) && (defined(_M_X64) || defined(__SSE2__) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define ZRLE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Pixels as readOpaqueN() would return them, from memory already known to
+// hold them
+
+inline rdr::U8  zrleLoad8(const rdr::U8* p)  { return *p; }
+inline rdr::U16 zrleLoad16(const rdr::U8* p) { rdr::U16 r; memcpy(&r, p, 2); return r; }
+inline rdr::U32 zrleLoad32(const rdr::U8* p) { rdr::U32 r; memcpy(&r, p, 4); return r; }
+inline rdr::U32 zrleLoad24A(const rdr::U8* p) { rdr::U32 r = 0; memcpy(&r, p, 3); return r; }
+inline rdr::U32 zrleLoad24B(const rdr::U8* p) { rdr::U32 r = 0; memcpy((rdr::U8*)&r + 1, p, 3); return r; }
+
+// n copies of pix
+
+inline void zrleFill(rdr::U8* dst, rdr::U8 pix, int n)
+{
+  memset(dst, pix, n);
+}
+
+inline void zrleFill(rdr::U16* dst, rdr::U16 pix, int n)
+{
+#ifdef ZRLE_SSE2
+  if (n >= 8) {
+    __m128i v = _mm_set1_epi16((short)pix);
+    for (; n >= 16; n -= 16, dst += 16) {
+      _mm_storeu_si128((__m128i*)dst, v);
+      _mm_storeu_si128((__m128i*)(dst + 8), v);
+    }
+    if (n >= 8) {
+      _mm_storeu_si128((__m128i*)dst, v);
+      n -= 8;
+      dst += 8;
+    }
+  }
+#endif
+  while (n-- > 0) *dst++ = pix;
+}
+
+inline void zrleFill(rdr::U32* dst, rdr::U32 pix, int n)
+{
+#ifdef ZRLE_SSE2
+  if (n >= 4) {
+    __m128i v = _mm_set1_epi32((int)pix);
+    for (; n >= 16; n -= 16, dst += 16) {
+      _mm_storeu_si128((__m128i*)dst, v);
+      _mm_storeu_si128((__m128i*)(dst + 4), v);
+      _mm_storeu_si128((__m128i*)(dst + 8), v);
+      _mm_storeu_si128((__m128i*)(dst + 12), v);
+    }
+    for (; n >= 4; n -= 4, dst += 4)
+      _mm_storeu_si128((__m128i*)dst, v);
+  }
+#endif
+  while (n-- > 0) *dst++ = pix;
+}
+
+// One row of 1 bit palette indices, most significant bit first
+
+template <class PIXEL>
+inline void zrleExpand1(PIXEL* dst, const rdr::U8* src, int n, const PIXEL* palette)
+{
+  for (; n >= 8; n -= 8, dst += 8) {
+    rdr::U8 b = *src++;
+    for (int i = 0; i < 8; i++)
+      dst[i] = palette[(b >> (7 - i)) & 1];
+  }
+  if (n > 0) {
+    rdr::U8 b = *src;
+    for (int i = 0; i < n; i++)
+      dst[i] = palette[(b >> (7 - i)) & 1];
+  }
+}
+
+#ifdef ZRLE_SSE2
+// Every output lane picks palette[1] where its bit is set, palette[0]
+// elsewhere
+inline void zrleExpand1(rdr::U16* dst, const rdr::U8* src, int n, const rdr::U16* palette)
+{
+  const __m128i bits = _mm_set_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+  __m128i p0 = _mm_set1_epi16((short)palette[0]);
+  __m128i p1 = _mm_set1_epi16((short)palette[1]);
+  for (; n >= 8; n -= 8, dst += 8) {
+    __m128i m = _mm_and_si128(_mm_set1_epi16(*src++), bits);
+    m = _mm_cmpeq_epi16(m, bits);
+    _mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_and_si128(m, p1), _mm_andnot_si128(m, p0)));
+  }
+  if (n > 0) {
+    rdr::U8 b = *src;
+    for (int i = 0; i < n; i++)
+      dst[i] = palette[(b >> (7 - i)) & 1];
+  }
+}
+
+inline void zrleExpand1(rdr::U32* dst, const rdr::U8* src, int n, const rdr::U32* palette)
+{
+  const __m128i hi = _mm_set_epi32(16, 32, 64, 128);
+  const __m128i lo = _mm_set_epi32(1, 2, 4, 8);
+  __m128i p0 = _mm_set1_epi32((int)palette[0]);
+  __m128i p1 = _mm_set1_epi32((int)palette[1]);
+  for (; n >= 8; n -= 8, dst += 8) {
+    __m128i b = _mm_set1_epi32(*src++);
+    __m128i m = _mm_cmpeq_epi32(_mm_and_si128(b, hi), hi);
+    _mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_and_si128(m, p1), _mm_andnot_si128(m, p0)));
+    m = _mm_cmpeq_epi32(_mm_and_si128(b, lo), lo);
+    _mm_storeu_si128((__m128i*)(dst + 4), _mm_or_si128(_mm_and_si128(m, p1), _mm_andnot_si128(m, p0)));
+  }
+  if (n > 0) {
+    rdr::U8 b = *src;
+    for (int i = 0; i < n; i++)
+      dst[i] = palette[(b >> (7 - i)) & 1];
+  }
+}
+#endif
+
+// One row of packed palette indices, bppp bits each, as the zrle packed
+// palette subencoding sends them. palette has 128 entries.
+
+template <class PIXEL>
+inline void zrleExpand(PIXEL* dst, const rdr::U8* src, int n, int bppp, const PIXEL* palette)
+{
+  switch (bppp) {
+  case 1:
+    zrleExpand1(dst, src, n, palette);
+    break;
+  case 2:
+    for (; n >= 4; n -= 4, dst += 4) {
+      rdr::U8 b = *src++;
+      dst[0] = palette[b >> 6];
+      dst[1] = palette[(b >> 4) & 3];
+      dst[2] = palette[(b >> 2) & 3];
+      dst[3] = palette[b & 3];
+    }
+    for (int i = 0; i < n; i++)
+      dst[i] = palette[(*src >> (6 - 2 * i)) & 3];
+    break;
+  case 4:
+    for (; n >= 2; n -= 2, dst += 2) {
+      rdr::U8 b = *src++;
+      dst[0] = palette[b >> 4];
+      dst[1] = palette[b & 15];
+    }
+    if (n > 0)
+      dst[0] = palette[*src >> 4];
+    break;
+  default:
+    for (int i = 0; i < n; i++)
+      dst[i] = palette[src[i] & 127];
+    break;
+  }
+}
+
+#endif
@@ -0,0 +1,220 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// AreaScaler.cpp
+
+#include "AreaScaler.h"
+#include <string.h>
+
+#if !defined(SCALER_NO_SIMD) && (defined(_M_X64) || defined(__SSE2__) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SCALER_SSE2
+#include <emmintrin.h>
+#endif
+
+AreaScaler::AreaScaler()
+{
+	Reset();
+}
+
+void AreaScaler::Reset()
+{
+	m_n = m_d = 0;
+	m_x.src = m_x.size = 0;
+	m_y.src = m_y.size = 0;
+}
+
+bool AreaScaler::Matches(int srcWidth, int srcHeight, int n, int d) const
+{
+	return m_n != 0 && m_x.src == srcWidth && m_y.src == srcHeight &&
+		(long long)m_n * d == (long long)n * m_d;
+}
+
+bool AreaScaler::Setup(int srcWidth, int srcHeight, int n, int d)
+{
+	Reset();
+	if (n <= 0 || d <= 0 || n >= d || srcWidth * n / d < 1 || srcHeight * n / d < 1)
+		return false;
+	// 80/100 is 4/5, fewer taps to round
+	for (int a = n, b = d; ; ) {
+		int r = a % b;
+		if (r == 0) {
+			n /= b;
+			d /= b;
+			break;
+		}
+		a = b;
+		b = r;
+	}
+	// Coordinates are worked out in 1/n of a source pixel
+	if ((long long)(srcWidth > srcHeight ? srcWidth : srcHeight) * d > 0x7fffffff)
+		return false;
+	BuildAxis(m_x, srcWidth, n, d);
+	BuildAxis(m_y, srcHeight, n, d);
+	m_n = n;
+	m_d = d;
+	m_acc.resize(srcWidth * 4);
+	m_row.resize(srcWidth * 4);
+	return true;
+}
+
+void AreaScaler::BuildAxis(Axis &axis, int src, int n, int d)
+{
+	axis.src = src;
+	axis.size = src * n / d;
+	axis.first.resize(axis.size);
+	axis.count.resize(axis.size);
+	axis.offset.resize(axis.size);
+	axis.weights.clear();
+	for (int i = 0; i < axis.size; i++) {
+		// Scaled pixel i covers [i * d, (i + 1) * d), source pixel s
+		// [s * n, (s + 1) * n)
+		int lo = i * d, hi = (i + 1) * d;
+		int s0 = lo / n, s1 = (hi + n - 1) / n;
+		if (s1 > src)
+			s1 = src;
+		axis.first[i] = s0;
+		axis.count[i] = s1 - s0;
+		axis.offset[i] = (int)axis.weights.size();
+		// Rounding where each tap ends rather than each tap's width makes
+		// them add up to exactly 256, so a flat colour stays what it was
+		int done = 0;
+		for (int s = s0; s < s1; s++) {
+			int b = (s + 1) * n < hi ? (s + 1) * n : hi;
+			int end = ((b - lo) * 256 + d / 2) / d;
+			axis.weights.push_back((rdr::U16)(end - done));
+			done = end;
+		}
+	}
+}
+
+void AreaScaler::Range(const Axis &axis, int n, int d, int from, int to, int &first, int &end)
+{
+	// Source pixel s covers scaled [s * n / d, (s + 1) * n / d)
+	first = (int)((long long)from * n / d);
+	end = (int)(((long long)to * n + d - 1) / d);
+	if (end > axis.size)
+		end = axis.size;
+}
+
+// acc += row * w, byte by byte
+static inline void Accumulate(rdr::U16 *acc, const rdr::U8 *row, int bytes, rdr::U16 w)
+{
+	int i = 0;
+#ifdef SCALER_SSE2
+	const __m128i vw = _mm_set1_epi16((short)w);
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i p = _mm_loadu_si128((const __m128i *)(row + i));
+		__m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), vw);
+		__m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), vw);
+		__m128i *a = (__m128i *)(acc + i);
+		_mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a), lo));
+		_mm_storeu_si128(a + 1, _mm_add_epi16(_mm_loadu_si128(a + 1), hi));
+	}
+#endif
+	for (; i < bytes; i++)
+		acc[i] = (rdr::U16)(acc[i] + row[i] * w);
+}
+
+// row = acc / 256, rounded
+static inline void Narrow(rdr::U8 *row, const rdr::U16 *acc, int bytes)
+{
+	int i = 0;
+#ifdef SCALER_SSE2
+	const __m128i half = _mm_set1_epi16(128);
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i *)(acc + i)), half), 8);
+		__m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i *)(acc + i + 8)), half), 8);
+		_mm_storeu_si128((__m128i *)(row + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; i < bytes; i++)
+		row[i] = (rdr::U8)((acc[i] + 128) >> 8);
+}
+
+// One scaled pixel from count pixels of row
+static inline void Blend(rdr::U8 *dst, const rdr::U8 *row, int count, const rdr::U16 *weights)
+{
+#ifdef SCALER_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum = _mm_set1_epi16(128);
+	for (int t = 0; t < count; t++) {
+		rdr::U32 pix;
+		memcpy(&pix, row + t * 4, 4);
+		__m128i p = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)pix), zero);
+		sum = _mm_add_epi16(sum, _mm_mullo_epi16(p, _mm_set1_epi16((short)weights[t])));
+	}
+	rdr::U32 out = (rdr::U32)_mm_cvtsi128_si32(_mm_packus_epi16(_mm_srli_epi16(sum, 8), zero));
+	memcpy(dst, &out, 4);
+#else
+	unsigned int sum[4] = { 128, 128, 128, 128 };
+	for (int t = 0; t < count; t++)
+		for (int c = 0; c < 4; c++)
+			sum[c] += row[t * 4 + c] * weights[t];
+	for (int c = 0; c < 4; c++)
+		dst[c] = (rdr::U8)(sum[c] >> 8);
+#endif
+}
+
+void AreaScaler::Scale(const rdr::U8 *src, int srcStride, rdr::U8 *dst, int dstStride,
+	int x, int y, int w, int h, int &dx, int &dy, int &dw, int &dh)
+{
+	dx = dy = dw = dh = 0;
+	if (m_n == 0)
+		return;
+	if (x < 0) { w += x; x = 0; }
+	if (y < 0) { h += y; y = 0; }
+	if (x + w > m_x.src) w = m_x.src - x;
+	if (y + h > m_y.src) h = m_y.src - y;
+	if (w <= 0 || h <= 0)
+		return;
+
+	int x0, x1, y0, y1;
+	Range(m_x, m_n, m_d, x, x + w, x0, x1);
+	Range(m_y, m_n, m_d, y, y + h, y0, y1);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	// The source columns those scaled columns are made of
+	const int sx = m_x.first[x0];
+	const int bytes = (m_x.first[x1 - 1] + m_x.count[x1 - 1] - sx) * 4;
+
+	for (int j = y0; j < y1; j++) {
+		const rdr::U16 *wy = &m_y.weights[m_y.offset[j]];
+		memset(&m_acc[0], 0, bytes * sizeof(rdr::U16));
+		for (int t = 0; t < m_y.count[j]; t++)
+			Accumulate(&m_acc[0], src + (size_t)(m_y.first[j] + t) * srcStride + sx * 4, bytes, wy[t]);
+		Narrow(&m_row[0], &m_acc[0], bytes);
+
+		rdr::U8 *out = dst + (size_t)j * dstStride + x0 * 4;
+		for (int i = x0; i < x1; i++, out += 4)
+			Blend(out, &m_row[(m_x.first[i] - sx) * 4], m_x.count[i], &m_x.weights[m_x.offset[i]]);
+	}
+
+	dx = x0;
+	dy = y0;
+	dw = x1 - x0;
+	dh = y1 - y0;
+}
@@ -0,0 +1,87 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// AreaScaler.h
+//
+// Downscaling by area averaging for the viewer's scaled display. Every
+// scaled pixel is the average of the framebuffer pixels under it, weighted
+// by how much of each it covers, each byte of a 32 bit pixel on its own,
+// which is what HALFTONE stretching works out for a reduction. The
+// weights are worked out once per scale; after that any rect of the
+// framebuffer can be brought over to the scaled copy, so only what an
+// update touched is scaled again and a repaint is a plain copy.
+// SSE2 is used where every x86 build has it, as in rfb/zrleKernels.h;
+// define SCALER_NO_SIMD for plain C++.
+
+#ifndef AREASCALER_H__
+#define AREASCALER_H__
+#pragma once
+
+#include <rdr/types.h>
+#include <vector>
+
+class AreaScaler
+{
+public:
+	AreaScaler();
+
+	// Scale by n/d, a reduction (n < d). false if it isn't one, the
+	// caller stretches then.
+	bool Setup(int srcWidth, int srcHeight, int n, int d);
+	bool Matches(int srcWidth, int srcHeight, int n, int d) const;
+	void Reset();
+
+	// Scaled size
+	int Width() const { return m_x.size; };
+	int Height() const { return m_y.size; };
+
+	// Scale again what the source rect x, y, w, h contributes to, from
+	// src to dst, both 32 bit pixels. dx, dy, dw, dh get the scaled rect
+	// that was written, dw or dh 0 if none.
+	void Scale(const rdr::U8 *src, int srcStride, rdr::U8 *dst, int dstStride,
+		int x, int y, int w, int h, int &dx, int &dy, int &dw, int &dh);
+
+private:
+	// Source pixels each scaled pixel along one axis is made of, and
+	// their weights out of 256
+	struct Axis
+	{
+		int src;
+		int size;
+		std::vector<int> first;
+		std::vector<int> count;
+		std::vector<int> offset;		// into weights
+		std::vector<rdr::U16> weights;
+	};
+	static void BuildAxis(Axis &axis, int src, int n, int d);
+	// Scaled pixels the source pixels [from, to) count in
+	static void Range(const Axis &axis, int n, int d, int from, int to, int &first, int &end);
+
+	Axis m_x, m_y;
+	int m_n, m_d;
+	std::vector<rdr::U16> m_acc;		// one row of vertical sums
+	std::vector<rdr::U8> m_row;			// the same, averaged
+};
+
+#endif
@@ -69,9 +69,9 @@ extern "C" {
 
 #define INITIALNETBUFSIZE 4096
 #ifdef _XZ
-#define MAX_ENCODINGS (LASTENCODING+67)
+#define MAX_ENCODINGS (LASTENCODING+68)
 #else
-#define MAX_ENCODINGS (LASTENCODING+52)
+#define MAX_ENCODINGS (LASTENCODING+53)
 #endif
 #define VWR_WND_CLASS_NAME _T("VNCviewer")
 #define VWR_WND_CLASS_NAME_VIEWER _T("VNCviewerwindow")
@@ -400,6 +400,9 @@ void ClientConnection::Init(VNCviewerApp *pApp)
 	m_nNetRectBufOffset = 0;
 	m_nReadSize = 0;
 	m_nNetRectBufSize = 0;
+	m_pStreamRestBuf = NULL;
+	m_nStreamRestLen = 0;
+	m_nStreamRestPos = 0;
 	m_pZRLENetRectBuf = NULL;
 	m_fReadFromZRLENetRectBuf = false;  //
 	m_nZRLENetRectBufOffset = 0;
@@ -527,6 +530,9 @@ void ClientConnection::Init(VNCviewerApp *pApp)
 	oldtick=0;
 
 	m_zipbuf=NULL;
+	// COLORREF order, as SETPIXELS_NOCONV takes the Tight pixels
+	m_tightFilter.redShift = 0;
+	m_tightFilter.blueShift = 16;
 	m_filezipbuf=NULL;
 	m_filechunkbuf=NULL;
 	m_zlibbuf=NULL;
@@ -561,6 +567,15 @@ void ClientConnection::Init(VNCviewerApp *pApp)
 	m_idle_time = 5000;
 	m_fullupdate_timer = 2999;
 	m_emulate3ButtonsTimer = 0;
+	m_presentRgn = CreateRectRgn(0, 0, 0, 0);
+	m_presentAll = false;
+	m_presentScheduled = false;
+	m_lastPresent = 0;
+	m_presentGeneration = 0;
+	m_shownGeneration = 0;
+	m_presentInterval = 0;
+	m_scaledBitmap = NULL;
+	m_scaledBits = NULL;
 	// adzm 2010-09
 	m_flushMouseMoveTimer = 0;
 
@@ -3834,6 +3849,7 @@ void ClientConnection::SizeWindow(bool noPosChange, bool noSizeChange)
 		m_opts->m_scaling = m_opts->m_saved_scaling;
 		m_fScalingDone = false;
 	}
+	CheckScaledShadow();
 
 	// Size the window.
 	// Let's find out how big a window would be needed to display the
@@ -4227,11 +4243,16 @@ void ClientConnection::SetFormatAndEncodings()
 
     // len = sz_rfbSetEncodingsMsg + se->nEncodings * 4;	
     encs[se->nEncodings++] = Swap32IfLE(rfbEncodingServerState);
+	encs[se->nEncodings++] = Swap32IfLE(rfbEncodingServerTiming);
     encs[se->nEncodings++] = Swap32IfLE(rfbEncodingEnableKeepAlive);
 	encs[se->nEncodings++] = Swap32IfLE(rfbEncodingEnableIdleTime);
     encs[se->nEncodings++] = Swap32IfLE(rfbEncodingFTProtocolVersion);
 	encs[se->nEncodings++] = Swap32IfLE(rfbEncodingpseudoSession);
 
+	// Ask the server to pace updates to our frame rate cap
+	if (m_opts->m_maxFPS > 0 && m_opts->m_maxFPS <= 255)
+		encs[se->nEncodings++] = Swap32IfLE(rfbEncodingMaxFPS1 + m_opts->m_maxFPS - 1);
+
 	// adzm - 2010-07 - Extended clipboard
 	encs[se->nEncodings++] = Swap32IfLE(rfbEncodingExtendedClipboard);
 	// all multithreaded versions of the plugins support streaming
@@ -4255,6 +4276,13 @@ void ClientConnection::SetFormatAndEncodings()
 void ClientConnection::Createdib()
 {
 	omni_mutex_lock l(m_bitmapdcMutex);
+	// The window may be on another monitor now
+	m_presentInterval = 0;
+	{
+		// Made again for the new DIB after the next update
+		omni_mutex_lock ls(m_scaledMutex);
+		DropScaledShadow();
+	}
 	TempDC hdc(m_hwndcn);
 	BitmapInfo bi;
 	UINT iUsage;
@@ -4413,6 +4441,8 @@ void ClientConnection::SuspendThread()
 	}
 	m_fPluginStreamingIn = false;
 	m_fPluginStreamingOut = false;
+	m_nStreamRestLen = 0;
+	m_nStreamRestPos = 0;
 }
 void
 ClientConnection::CloseWindows()
@@ -4430,6 +4460,9 @@ ClientConnection::~ClientConnection()
 	WaitForSingleObject(KillUpdateThreadEvent, 6000);
 	if (m_pNetRectBuf != NULL)
 		delete [] m_pNetRectBuf;
+	if (m_pStreamRestBuf != NULL)
+		delete [] m_pStreamRestBuf;
+	DeleteObject(m_presentRgn);
 	LowLevelHook::Release();
 
 	// Modif sf@2002 - FileTransfer
@@ -4509,6 +4542,7 @@ ClientConnection::~ClientConnection()
 
 	if (m_hmemdc != NULL) {DeleteDC(m_hmemdc);m_hmemdc = NULL;m_DIBbits=NULL;}
 	if (m_membitmap != NULL) {DeleteObject(m_membitmap);m_membitmap = NULL;}
+	if (m_scaledBitmap != NULL) {DeleteObject(m_scaledBitmap);m_scaledBitmap = NULL;m_scaledBits = NULL;}
 //	if (flash) delete flash;
 	m_pApp->DeregisterConnection(this);
 	if (m_zipbuf!=NULL)
@@ -4852,6 +4886,8 @@ ClientConnection::SendPointerEvent(int x, int y, int buttonMask)
 
 	rfbPointerEventMsg pe;
 
+	if (buttonMask & ~oldButtonMask)
+		m_latency.ClickSent(x, y);
     oldPointerX = x;
     oldPointerY = y;
     oldButtonMask = buttonMask;
@@ -4988,6 +5024,8 @@ ClientConnection::SendKeyEvent(CARD32 key, bool down)
     ke.type = rfbKeyEvent;
     ke.down = down ? 1 : 0;
     ke.key = Swap32IfLE(key);
+	if (down)
+		m_latency.KeySent();
 	//adzm 2010-09
     WriteExactQueue_timeout((char *)&ke, sz_rfbKeyEventMsg, rfbKeyEvent,5);
     //vnclog.Print(0, _T("SendKeyEvent: key = x%04x status = %s ke.key=%d\n"), key,
@@ -5109,7 +5147,7 @@ inline void ClientConnection::DoBlit()
 					}
 				}
 			}
-			else
+			else if (!BlitScaled(hdc, &ps.rcPaint))
 			{
 
 				int n = m_opts->m_scale_num;
@@ -5154,6 +5192,202 @@ inline void ClientConnection::DoBlit()
 		}
 	}
 	EndPaint(m_hwndcn, &ps);
+	m_frameRates.presented.update();
+	m_latency.Presented(m_shownGeneration);
+}
+
+// Present pacing. Invalidating what every FramebufferUpdate changed as it
+// is decoded repaints once per update, many small blits (or HALFTONE
+// stretches) per monitor frame when the server sends lots of little
+// updates. The network thread only adds the update's region here; the
+// window thread invalidates what piled up at most once per display
+// refresh. An update after a quiet spell is still drawn right away.
+void ClientConnection::Present(HRGN rgn)
+{
+	omni_mutex_lock l(m_presentMutex);
+	if (rgn == NULL)
+		m_presentAll = true;
+	else
+		CombineRgn(m_presentRgn, m_presentRgn, rgn, RGN_OR);
+	m_presentGeneration = m_latency.Generation();
+	if (!m_presentScheduled) {
+		m_presentScheduled = true;
+		PostMessage(m_hwndcn, WM_PRESENT, 0, 0);
+	}
+}
+
+// Window thread: on WM_PRESENT, and on PRESENT_TIMER when that came too
+// soon after the last present
+void ClientConnection::PresentPending(bool timer)
+{
+	omni_mutex_lock l(m_presentMutex);
+	if (m_presentInterval == 0) {
+		HDC hdc = GetDC(m_hwndcn);
+		int hz = GetDeviceCaps(hdc, VREFRESH);
+		ReleaseDC(m_hwndcn, hdc);
+		// 0 and 1 stand for the hardware's default rate
+		m_presentInterval = 1000 / (hz > 1 ? hz : 60);
+	}
+	DWORD since = GetTickCount() - m_lastPresent;
+	if (timer)
+		KillTimer(m_hwndcn, PRESENT_TIMER);
+	else if (since < m_presentInterval) {
+		SetTimer(m_hwndcn, PRESENT_TIMER, m_presentInterval - since, NULL);
+		return;
+	}
+	if (m_presentAll)
+		InvalidateRect(m_hwndcn, NULL, TRUE);
+	else
+		InvalidateRgn(m_hwndcn, m_presentRgn, FALSE);
+	SetRectRgn(m_presentRgn, 0, 0, 0, 0);
+	m_presentAll = false;
+	m_presentScheduled = false;
+	m_lastPresent = GetTickCount();
+	// The paints from here on show the updates decoded so far
+	m_shownGeneration = m_presentGeneration;
+}
+
+// Scaled display. StretchBlt with HALFTONE works out every painted pixel
+// again on every repaint, scaled as the framebuffer may be by then. A
+// reduction is instead kept in a DIB of the window's size, and only what
+// an update decoded is scaled into it, once, by AreaScaler; painting it
+// is a BitBlt. Enlarging, and DIBs that aren't 32 bit, still stretch.
+// The shadow is only ever made from the DIB on the network thread, with
+// m_bitmapdcMutex taken before m_scaledMutex; until it is there for the
+// current size and scale the window stretches.
+bool ClientConnection::ScaledShadowActive()
+{
+	return m_opts->m_scaling && !(m_opts->m_Directx && !m_opts->m_showExtend) &&
+		!directx_used && m_DIBbits != NULL && m_myFormat.bitsPerPixel == 32 &&
+		m_myFormat.redMax == 255 && m_myFormat.greenMax == 255 && m_myFormat.blueMax == 255 &&
+		m_opts->m_scale_num < m_opts->m_scale_den;
+}
+
+// m_scaledMutex held. A shadow for the framebuffer and scale as they are.
+bool ClientConnection::ScaledShadowReady()
+{
+	return m_scaledBitmap != NULL && m_scaler.Matches(m_si.framebufferWidth, m_si.framebufferHeight,
+		m_opts->m_scale_num, m_opts->m_scale_den);
+}
+
+// m_scaledMutex held
+void ClientConnection::DropScaledShadow()
+{
+	if (m_scaledBitmap != NULL) {DeleteObject(m_scaledBitmap);m_scaledBitmap = NULL;m_scaledBits = NULL;}
+	m_scaler.Reset();
+}
+
+// After the scale or the options changed. A shadow that is off missed the
+// updates since, one for another scale is no use: both are dropped, and
+// made again after the next update.
+void ClientConnection::CheckScaledShadow()
+{
+	omni_mutex_lock l(m_scaledMutex);
+	if (m_scaledBitmap != NULL && (!ScaledShadowActive() || !ScaledShadowReady()))
+		DropScaledShadow();
+}
+
+// Network thread, m_bitmapdcMutex and m_scaledMutex held. Makes the
+// shadow again, all of it, when there is none or the scale or the
+// framebuffer changed; false if it can't.
+bool ClientConnection::ScaledShadowUpdate()
+{
+	int w = m_si.framebufferWidth;
+	int h = m_si.framebufferHeight;
+	int n = m_opts->m_scale_num;
+	int d = m_opts->m_scale_den;
+	if (ScaledShadowReady())
+		return true;
+
+	DropScaledShadow();
+	if (!m_scaler.Setup(w, h, n, d))
+		return false;
+
+	BitmapInfo bi;
+	memset(&bi, 0, sizeof(bi));
+	bi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bi.bmiHeader.biBitCount = 32;
+	bi.bmiHeader.biPlanes = 1;
+	bi.bmiHeader.biWidth = m_scaler.Width();
+	bi.bmiHeader.biHeight = -m_scaler.Height();
+	bi.bmiHeader.biSizeImage = m_scaler.Width() * m_scaler.Height() * 4;
+	bi.bmiHeader.biCompression = BI_BITFIELDS;
+	bi.mask.red = (CARD32)m_myFormat.redMax << m_myFormat.redShift;
+	bi.mask.green = (CARD32)m_myFormat.greenMax << m_myFormat.greenShift;
+	bi.mask.blue = (CARD32)m_myFormat.blueMax << m_myFormat.blueShift;
+	m_scaledBitmap = CreateDIBSection(m_hmemdc, (BITMAPINFO*)&bi.bmiHeader, DIB_RGB_COLORS, &m_scaledBits, NULL, 0);
+	if (m_scaledBitmap == NULL) {
+		m_scaledBits = NULL;
+		m_scaler.Reset();
+		return false;
+	}
+
+	int dx, dy, dw, dh;
+	m_scaler.Scale((rdr::U8 *)m_DIBbits, DIBStride(), (rdr::U8 *)m_scaledBits, m_scaler.Width() * 4,
+		0, 0, w, h, dx, dy, dw, dh);
+	return true;
+}
+
+// Framebuffer rect that is complete in the DIB, from either thread. Only
+// scaled into a shadow that is already there.
+void ClientConnection::ScaleRect(const RECT *pRect)
+{
+	omni_mutex_lock lb(m_bitmapdcMutex);
+	omni_mutex_lock l(m_scaledMutex);
+	if (!ScaledShadowActive() || !ScaledShadowReady())
+		return;
+	int dx, dy, dw, dh;
+	m_scaler.Scale((rdr::U8 *)m_DIBbits, DIBStride(), (rdr::U8 *)m_scaledBits, m_scaler.Width() * 4,
+		pRect->left, pRect->top, pRect->right - pRect->left, pRect->bottom - pRect->top,
+		dx, dy, dw, dh);
+}
+
+// Network thread, once an update's rects are all decoded. Pooled rects
+// aren't when InvalidateRegion sees them, so they are scaled here. This is
+// where the shadow is made, and where one that is off is dropped.
+void ClientConnection::FlushScaled()
+{
+	{
+		omni_mutex_lock lb(m_bitmapdcMutex);
+		omni_mutex_lock l(m_scaledMutex);
+		if (!ScaledShadowActive()) {
+			DropScaledShadow();
+		} else if (!m_scaleDirty.empty()) {
+			// Made whole, that takes in the dirty rects
+			bool whole = !ScaledShadowReady();
+			if (ScaledShadowUpdate() && !whole) {
+				int dx, dy, dw, dh;
+				for (size_t i = 0; i < m_scaleDirty.size(); i++) {
+					const RECT &r = m_scaleDirty[i];
+					m_scaler.Scale((rdr::U8 *)m_DIBbits, DIBStride(), (rdr::U8 *)m_scaledBits, m_scaler.Width() * 4,
+						r.left, r.top, r.right - r.left, r.bottom - r.top, dx, dy, dw, dh);
+				}
+			}
+		}
+	}
+	m_scaleDirty.clear();
+}
+
+// Window thread, from DoBlit. false if the caller has to stretch, which it
+// does until the network thread has made the shadow.
+bool ClientConnection::BlitScaled(HDC hdc, const RECT *pRect)
+{
+	if (!ScaledShadowActive())
+		return false;
+	omni_mutex_lock l(m_scaledMutex);
+	if (!ScaledShadowReady())
+		return false;
+	HDC scaleddc = CreateCompatibleDC(hdc);
+	if (scaleddc == NULL)
+		return false;
+	{
+		ObjectSelector bb(scaleddc, m_scaledBitmap);
+		BitBlt(hdc, pRect->left, pRect->top,
+			pRect->right - pRect->left, pRect->bottom - pRect->top,
+			scaleddc, pRect->left + m_hScrollPos, pRect->top + m_vScrollPos, SRCCOPY);
+	}
+	DeleteDC(scaleddc);
+	return true;
 }
 
 void ClientConnection::ShowConnInfo()
@@ -5474,7 +5708,7 @@ void ClientConnection::Internal_SendFramebufferUpdateRequest(int x, int y, int w
     fur.y = Swap16IfLE(y);
     fur.w = Swap16IfLE(w);
     fur.h = Swap16IfLE(h);
-	fps.update();
+	m_latency.RequestSent();
     WriteExact_timeout((char *)&fur, sz_rfbFramebufferUpdateRequestMsg, rfbFramebufferUpdateRequest,5);
 }
 
@@ -5666,6 +5900,9 @@ bool ClientConnection::SendSW(int x, int y)
 // A ScreenUpdate message has been received
 inline void ClientConnection::ReadScreenUpdate()
 {
+	// Before the next request can go out
+	m_latency.UpdateStarted();
+
 	//adzm 2010-07-04
 	bool bSentUpdateRequest = false;
 	if (m_opts->m_preemptiveUpdates && !m_pendingFormatChange) {
@@ -5680,6 +5917,11 @@ inline void ClientConnection::ReadScreenUpdate()
 	bool fTimingAlreadyStopped = false;
 	fis->startTiming();
 
+	if (m_opts->m_decodeThreads > 0 && !m_decodePool.Active())
+		m_decodePool.Start(this, m_opts->m_decodeThreads);
+	// Never leave jobs running past this update, even if a read throws
+	DecodeDrain drainOnExit(m_decodePool);
+
 	rfbFramebufferUpdateMsg sut;
 	ReadExact(((char *) &sut)+m_nTO, sz_rfbFramebufferUpdateMsg-m_nTO);
     sut.nRects = Swap16IfLE(sut.nRects);
@@ -5699,6 +5941,38 @@ inline void ClientConnection::ReadScreenUpdate()
 		surh.r.h = Swap16IfLE(surh.r.h);
 		surh.encoding = Swap32IfLE(surh.encoding);
 
+		// Pooled rects still decoding: anything that reads the framebuffer,
+		// resizes it or moves the cursor waits for them, and so does a rect
+		// drawn over one of them
+		if (m_decodePool.Pending())
+		{
+			switch (surh.encoding)
+			{
+			case rfbEncodingRaw:
+			case rfbEncodingRRE:
+			case rfbEncodingCoRRE:
+			case rfbEncodingHextile:
+			case rfbEncodingUltra:
+			case rfbEncodingUltra2:
+			case rfbEncodingZlib:
+			case rfbEncodingZstd:
+			case rfbEncodingZlibHex:
+			case rfbEncodingZstdHex:
+			case rfbEncodingZRLE:
+			case rfbEncodingZYWRLE:
+			case rfbEncodingZSTDRLE:
+			case rfbEncodingZSTDYWRLE:
+			case rfbEncodingTight:
+			case rfbEncodingTightZstd:
+				if (m_decodePool.Overlaps(surh.r.x, surh.r.y, surh.r.w, surh.r.h))
+					m_decodePool.Drain();
+				break;
+			default:
+				m_decodePool.Drain();
+				break;
+			}
+		}
+
 #if 1
 		/* vnc4server in debian jessie and wheezy offers pixel format bgr101111
 			if the color depth is 32. This means it is necessary to send whole
@@ -5778,6 +6052,13 @@ inline void ClientConnection::ReadScreenUpdate()
 			continue;
 		}
 
+		if (surh.encoding == rfbEncodingServerTiming) {
+			CARD32 ms;
+			ReadExact((char *)&ms, sizeof(ms));
+			m_latency.ServerTiming(Swap32IfLE(ms));
+			continue;
+		}
+
 		if (surh.encoding != rfbEncodingExtViewSize && surh.encoding !=rfbEncodingNewFBSize && surh.encoding != rfbEncodingCacheZip && surh.encoding != rfbEncodingQueueZip && surh.encoding !=rfbEncodingUltraZip)
 			SoftCursorLockArea(surh.r.x, surh.r.y, surh.r.w, surh.r.h);
 
@@ -6043,7 +6324,8 @@ inline void ClientConnection::ReadScreenUpdate()
 					
 					xzDecode(rect.x, rect.y, rect.w, rect.h);
 
-					InvalidateScreenRect(&invalid_rect); 
+					if (!m_opts->m_Directx)
+						InvalidateRegion(&invalid_rect, &UpdateRegion);
 
 					SoftCursorUnlockScreen();
 				}
@@ -6110,6 +6392,8 @@ inline void ClientConnection::ReadScreenUpdate()
 
 			if (!m_opts->m_Directx)
 				InvalidateRegion(&rect,&UpdateRegion);
+			else
+				m_latency.RectReceived(rect);
 		}
 
 		if (m_TrafficMonitor)
@@ -6123,16 +6407,23 @@ inline void ClientConnection::ReadScreenUpdate()
 			ReleaseDC(m_TrafficMonitor,hdcX);
 		}
 
-		SoftCursorUnlockScreen();
+		// The cursor stays hidden over pooled rects until they are drawn
+		if (!m_decodePool.Pending())
+			SoftCursorUnlockScreen();
 	}
 
-	if (m_opts->m_Directx)
+	if (m_decodePool.Pending())
 	{
-		InvalidateRect(m_hwndcn, NULL, TRUE);
+		m_decodePool.Drain();
+		SoftCursorUnlockScreen();
 	}
-	else
+
+	FlushScaled();
+	m_latency.UpdateDecoded();
+	m_frameRates.decoded.update();
+	Present(m_opts->m_Directx ? NULL : UpdateRegion);
+	if (!m_opts->m_Directx)
 	{
-		InvalidateRgn(m_hwndcn, UpdateRegion, FALSE);
 		HRGN tempregion=CreateRectRgn(0,0,0,0);
 		CombineRgn(UpdateRegion,UpdateRegion,tempregion,RGN_AND);
 		DeleteObject(tempregion);
@@ -6246,6 +6537,44 @@ inline void ClientConnection::ReadScreenUpdate()
 	}
 }
 
+// Append len bytes of rect payload to a pooled job
+void ClientConnection::ReadDecodeData(DecodeJob *job, int len)
+{
+	if (len <= 0)
+		return;
+	size_t pos = job->data.size();
+	job->data.resize(pos + len);
+	try
+	{
+		ReadExact((char *)&job->data[pos], len);
+	}
+	catch (...)
+	{
+		m_decodePool.Release(job);
+		throw;
+	}
+}
+
+// Runs on a decode pool thread
+void ClientConnection::RunDecodeJob(DecodeJob *job, DecodeContext &ctx)
+{
+	switch (job->encoding)
+	{
+	case rfbEncodingRaw:
+		DecodeRawJob(job);
+		break;
+	case rfbEncodingHextile:
+		DecodeHextileJob(job);
+		break;
+	case rfbEncodingUltra2:
+		DecodeUltra2Job(job, ctx);
+		break;
+	case rfbEncodingTight:
+		DecodeTightJpegJob(job, ctx);
+		break;
+	}
+}
+
 void ClientConnection::SetDormant(int newstate)
 {
 	vnclog.Print(5, _T("%s dormant mode\n"), newstate ? _T("Entering") : _T("Leaving"));
@@ -6469,6 +6798,11 @@ void ClientConnection::ReadExact(char *inbuf, int wanted)
 				{
 					fis->readBytes(inbuf, wanted);
 				}
+				// Streaming plugin, restore in bulk
+				else if (m_fPluginStreamingIn)
+				{
+					ReadExactStreaming(inbuf, wanted);
+				}
 				else // read tansformed data from the socket (normal case)
 				{
 					// Get the DSMPlugin destination buffer where to put transformed incoming data
@@ -6513,6 +6847,56 @@ void ClientConnection::ReadExact(char *inbuf, int wanted)
 	}
 }
 
+// Plugin streaming
+// A streaming plugin restores a byte stream, chunk boundaries don't have to
+// match the server's. Small reads (headers, subrect data) would otherwise
+// cost one RestoreBuffer call each, so whatever the socket has already
+// delivered is restored in one pass and small reads are served from
+// m_pStreamRestBuf. Big reads with nothing buffered are restored straight
+// into the caller's buffer.
+#define STREAM_RESTORE_MAX 65536
+void ClientConnection::ReadExactStreaming(char *inbuf, int wanted)
+{
+	while (wanted > 0)
+	{
+		if (m_nStreamRestPos == m_nStreamRestLen)
+		{
+			m_nStreamRestPos = m_nStreamRestLen = 0;
+			char* pDest = inbuf;
+			int nChunk = wanted;
+			if (wanted < STREAM_RESTORE_MAX)
+			{
+				if (m_pStreamRestBuf == NULL)
+					m_pStreamRestBuf = new BYTE[STREAM_RESTORE_MAX];
+				// Everything already buffered, at least one byte
+				nChunk = fis->check(1, STREAM_RESTORE_MAX);
+				pDest = (char*)m_pStreamRestBuf;
+			}
+
+			int nTransDataLen = 0;
+			BYTE* pTransBuffer = RestoreBufferStep1(NULL, nChunk, &nTransDataLen);
+			if (pTransBuffer == NULL)
+				throw WarningException(sz_L65);
+			fis->readBytes(pTransBuffer, nTransDataLen);
+			int nRestDataLen = 0;
+			RestoreBufferStep2((BYTE*)pDest, nTransDataLen, &nRestDataLen);
+			if (nRestDataLen != nChunk)
+				throw WarningException(sz_L66);
+
+			if (pDest == inbuf)
+				return;
+			m_nStreamRestLen = nChunk;
+		}
+		int n = m_nStreamRestLen - m_nStreamRestPos;
+		if (n > wanted)
+			n = wanted;
+		memcpy(inbuf, m_pStreamRestBuf + m_nStreamRestPos, n);
+		m_nStreamRestPos += n;
+		inbuf += n;
+		wanted -= n;
+	}
+}
+
 //adzm 2009-06-21
 void ClientConnection::ReadExactProtocolVersion(char *inbuf, int wanted, bool& fNotEncrypted)
 {
@@ -7347,7 +7731,12 @@ void ClientConnection::UpdateStatusFields()
 	if (m_hwndStatus) {
 		SetDlgItemText(m_hwndStatus,IDC_SEND, szText);
 		SetDlgItemInt(m_hwndStatus, IDC_SPEED, avg_kbitsPerSecond, false);
-		SetDlgItemInt(m_hwndStatus, IDC_FPS, fps.get(), false);
+		char szFps[32];
+		m_frameRates.format(szFps, sizeof(szFps));
+		SetDlgItemText(m_hwndStatus, IDC_FPS, szFps);
+		char szLatency[64];
+		m_latency.Format(szLatency, sizeof(szLatency));
+		SetDlgItemText(m_hwndStatus, IDC_LATENCY, szLatency);
 	}
 
 	// Encoder
@@ -7597,6 +7986,8 @@ LRESULT CALLBACK ClientConnection::GTGBS_StatusProc(HWND hwnd, UINT iMsg, WPARAM
 			if (LOWORD(wParam) == IDCLOSE) {
 				EndDialog(hwnd, TRUE);
 			}
+			if (LOWORD(wParam) == IDC_LATENCY_SAVE)
+				_this->ExportLatency(hwnd);
 			if (LOWORD(wParam) == IDQUIT) {
 				forcedexit=true;
 				_this->Pressed_Cancel=true;
@@ -8149,6 +8540,7 @@ LRESULT CALLBACK ClientConnection::WndProc(HWND hwnd, UINT iMsg, WPARAM wParam,
 							_this->m_opts->m_scaling = true;
 							_this->m_opts->m_scale_num = 100;
 							_this->m_opts->m_scale_den = 100;
+							_this->CheckScaledShadow();
 
 							if (_this->m_nServerScale != nOldServerScale)
 							{
@@ -8178,6 +8570,7 @@ LRESULT CALLBACK ClientConnection::WndProc(HWND hwnd, UINT iMsg, WPARAM wParam,
 							_this->m_opts->m_scaling = true;
 							_this->m_opts->m_scale_num = 200;
 							_this->m_opts->m_scale_den = 100;
+							_this->CheckScaledShadow();
 
 							if (_this->m_nServerScale != nOldServerScale)
 							{
@@ -8206,6 +8599,7 @@ LRESULT CALLBACK ClientConnection::WndProc(HWND hwnd, UINT iMsg, WPARAM wParam,
 							_this->m_opts->m_scaling = false;
 							_this->m_opts->m_scale_num = 100;
 							_this->m_opts->m_scale_den = 100;
+							_this->CheckScaledShadow();
 
 							if (_this->m_nServerScale != nOldServerScale)
 							{
@@ -9007,12 +9401,20 @@ LRESULT CALLBACK ClientConnection::WndProchwnd(HWND hwnd, UINT iMsg, WPARAM wPar
 				paintbuzy=false;
 				return 0;
 
+			case WM_PRESENT:
+				_this->PresentPending(false);
+				return 0;
+
 			case WM_SENDKEEPALIVE:
 				// adzm 2010-09
 				_this->Internal_SendKeepAlive(wParam == 1);
 				return 0;
 
 			case WM_TIMER:
+				if (wParam == PRESENT_TIMER) {
+					_this->PresentPending(true);
+					return 0;
+				}
 				if (wParam !=0 && _this->m_running &&  !_this->m_pFileTransfer->m_fFileTransferRunning) {
 					if (wParam == _this->m_emulate3ButtonsTimer)
 					{
@@ -9366,6 +9768,7 @@ LRESULT CALLBACK ClientConnection::WndProchwnd(HWND hwnd, UINT iMsg, WPARAM wPar
 					_this->m_opts->m_scale_den = lParam;
 					if (_this->m_opts->m_scale_num == 1 && _this->m_opts->m_scale_den == 1)
 						_this->m_opts->m_scaling = false;
+					_this->CheckScaledShadow();
 					_this->SizeWindow();
 					InvalidateRect(hwnd, NULL, TRUE);
 					return TRUE;
@@ -9405,29 +9808,13 @@ void ClientConnection::processIdleTimer(HWND hwnd)
 
 void ClientConnection::ConvertAll(int width, int height, int xx, int yy,int bytes_per_pixel,BYTE* source,BYTE* dest,int framebufferWidth, int framebufferHeight)
 {
-	int bytesPerInputRow = width * bytes_per_pixel;
-	int bytesPerOutputRow = framebufferWidth * bytes_per_pixel;
-	//8bit pitch need to be taken in account
-	if (bytesPerOutputRow % 4)
-		bytesPerOutputRow += 4 - bytesPerOutputRow % 4;
-
-	if ( ((width + xx) * (height + yy)) > (framebufferWidth * framebufferHeight))
-			goto error;
-
-	BYTE *sourcepos,*destpos;
-	destpos = (BYTE *)dest + (bytesPerOutputRow * yy)+(xx * bytes_per_pixel);
-	sourcepos=(BYTE*)source;
-
-    int y;
-    width*=bytes_per_pixel;
-    for (y=0; y<height; y++) {
-        memcpy(destpos, sourcepos, width);
-        sourcepos = (BYTE*)sourcepos + bytesPerInputRow;
-        destpos = (BYTE*)destpos + bytesPerOutputRow;
-    }
-	return;
-error:
-	assert(true);
+	DecodeSurface s;
+	s.bits = dest;
+	s.width = framebufferWidth;
+	s.height = framebufferHeight;
+	s.bytesPerPixel = bytes_per_pixel;
+	s.stride = DecodeSurface::DIBStride(framebufferWidth, bytes_per_pixel);
+	s.SetPixels(source, width * bytes_per_pixel, xx, yy, width, height);
 }
 
 void ClientConnection:: ConvertAll_secure(int width, int height, int xx, int yy,int bytes_per_pixel,BYTE* source,BYTE* dest,int framebufferWidth, int sourceSize, int framebufferHeight)
@@ -9461,6 +9848,32 @@ error:
 	assert(true);
 }
 
+int
+ClientConnection::DIBStride()
+{
+	return DecodeSurface::DIBStride(m_si.framebufferWidth, m_myFormat.bitsPerPixel / 8);
+}
+
+DecodeSurface
+ClientConnection::DIBSurface()
+{
+	DecodeSurface s;
+	s.bits = (BYTE *)m_DIBbits;
+	s.width = m_si.framebufferWidth;
+	s.height = m_si.framebufferHeight;
+	s.bytesPerPixel = m_myFormat.bitsPerPixel / 8;
+	s.stride = DIBStride();
+	return s;
+}
+
+BYTE *
+ClientConnection::DIBRect(int x, int y, int w, int h)
+{
+	if (!m_DIBbits || w <= 0 || h <= 0 || !Check_Rectangle_borders(x, y, w, h))
+		return NULL;
+	return (BYTE *)m_DIBbits + y * DIBStride() + x * (m_myFormat.bitsPerPixel / 8);
+}
+
 void
 ClientConnection:: Copybuffer(int width, int height, int xx, int yy,int bytes_per_pixel,BYTE* source,BYTE* dest,int framebufferWidth,int framebufferHeight)
 {
@@ -9618,24 +10031,13 @@ ClientConnection:: ConvertPixel_to_bpp_from_32(int xx, int yy,int bytes_per_pixe
 void
 ClientConnection::SolidColor(int width, int height, int xx, int yy,int bytes_per_pixel,BYTE* source,BYTE* dest,int framebufferWidth)
 {
-	if (!Check_Rectangle_borders(xx, yy, width, height))
-		return;
-	int bytesPerOutputRow = framebufferWidth * bytes_per_pixel;
-	//8bit pitch need to be taken in account
-	if (bytesPerOutputRow % 4)
-		bytesPerOutputRow += 4 - bytesPerOutputRow % 4;
-	BYTE *sourcepos,*destpos;
-	destpos = (BYTE *)dest + (bytesPerOutputRow * yy)+(xx * bytes_per_pixel);
-	sourcepos=(BYTE*)source;
-
-    int y,x;
-    for (y=0; y<height; y++) {
-		for (x=0; x< width;x++)
-			{
-				memcpy(destpos+x*bytes_per_pixel, sourcepos, bytes_per_pixel);
-			}
-        destpos = (BYTE*)destpos + bytesPerOutputRow;
-    }
+	DecodeSurface s;
+	s.bits = dest;
+	s.width = framebufferWidth;
+	s.height = m_si.framebufferHeight;
+	s.bytesPerPixel = bytes_per_pixel;
+	s.stride = DecodeSurface::DIBStride(framebufferWidth, bytes_per_pixel);
+	s.Fill(xx, yy, width, height, source);
 }
 
 bool
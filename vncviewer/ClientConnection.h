@@ -36,6 +36,8 @@
 #include "KeyMapjap.h"
 #include <rdr/types.h>
 #include "../common/UltraVncZ.h"
+#include "../common/DecodeSurface.h"
+#include "../common/DecodeParse.h"
 #ifdef _INTERNALLIB
 #include <zlib.h>
 #include <zstd.h>
@@ -44,14 +46,6 @@
 #include "../zstd/lib/zstd.h"
 #endif
 
-extern "C"
-{
-#ifdef _INTERNALLIB
-#include <jpeglib.h>
-#else
-#include "libjpeg-turbo-win/jpeglib.h"
-#endif
-}
 #include "FileTransfer.h" // sf@2002
 #include "TextChat.h" // sf@2002
 //#include "bmpflasher.h"
@@ -70,6 +64,9 @@ extern "C"
 #include <algorithm>
 #include "./directx/directxviewer.h"
 #include "FpsCounter.h"
+#include "DecodePool.h"
+#include "AreaScaler.h"
+#include "LatencyMeter.h"
 
 #ifdef _Gii
 #include "vnctouch.h"
@@ -78,6 +75,9 @@ extern "C"
 class vnctouch;
 #endif
 extern const UINT FileTransferSendPacketMessage;
+// Next to the full update timer (2999), clear of the control IDs in
+// res/resource.h
+#define PRESENT_TIMER 2998
 
 #ifndef max
 #define max(a,b)            (((a) > (b)) ? (a) : (b))
@@ -138,6 +138,7 @@ typedef BOOL(WINAPI* PFN_AdjustWindowRectExForDpi) (LPRECT, DWORD, BOOL, DWORD,
 class ClientConnection  : public omni_thread
 {
 	friend DWORD WINAPI ReconnectThreadProc(LPVOID);
+	friend class DecodePool;
 public:
     HWND m_hSessionDialog;
 	int m_port;
@@ -200,7 +201,8 @@ private:
 	CRITICAL_SECTION crit;
 	UltraVncZ *ultraVncZlib;
 	UltraVncZ ultraVncZTight[4];
-	Fps fps;
+	FrameRates m_frameRates;
+	LatencyMeter m_latency;
 #ifdef _Gii
 	vnctouch *mytouch;
 #endif
@@ -208,6 +210,36 @@ private:
 	static LRESULT CALLBACK WndProcTBwin(HWND hwnd, UINT iMsg, WPARAM wParam, LPARAM lParam);
 	static LRESULT CALLBACK WndProchwnd(HWND hwnd, UINT iMsg, WPARAM wParam, LPARAM lParam);
 	void DoBlit();
+
+	// Present pacing: what the updates changed is collected here and
+	// invalidated at most once per display refresh
+	void Present(HRGN rgn);
+	void PresentPending(bool timer);
+	omni_mutex	m_presentMutex;
+	HRGN		m_presentRgn;
+	bool		m_presentAll;		// the whole window, DirectX draws that way
+	bool		m_presentScheduled;	// WM_PRESENT posted or the timer running
+	DWORD		m_lastPresent;
+	DWORD		m_presentInterval;	// ms per refresh, 0 until known
+	DWORD		m_presentGeneration;	// last decoded update in m_presentRgn
+	DWORD		m_shownGeneration;	// and once PresentPending invalidated it
+
+	// Scaled display: a reduced copy of the DIB kept up to date as updates
+	// are decoded, so painting is a BitBlt instead of a HALFTONE stretch
+	bool ScaledShadowActive();
+	bool ScaledShadowReady();
+	bool ScaledShadowUpdate();
+	void DropScaledShadow();
+	void CheckScaledShadow();
+	void ScaleRect(const RECT *pRect);
+	void FlushScaled();
+	bool BlitScaled(HDC hdc, const RECT *pRect);
+	AreaScaler	m_scaler;
+	HBITMAP		m_scaledBitmap;
+	void		*m_scaledBits;
+	omni_mutex	m_scaledMutex;
+	std::vector<RECT> m_scaleDirty;		// source rects decoded, not scaled yet
+
 	VNCviewerApp *m_pApp;
 
 	HBITMAP hbmToolbig;
@@ -326,7 +358,6 @@ private:
 	void ReadRawRect(rfbFramebufferUpdateRectHeader *pfburh);
 	void ReadUltraRect(rfbFramebufferUpdateRectHeader *pfburh);
 	void ReadUltra2Rect(rfbFramebufferUpdateRectHeader *pfburh);
-	void DecompressJpegRect(BYTE *src, int srclen, BYTE *dst, int dst_size,int w, int h,rfbPixelFormat m_remoteformat);
 	void ReadUltraZip(rfbFramebufferUpdateRectHeader *pfburh,HRGN *prgn);
 	void ReadCopyRect(rfbFramebufferUpdateRectHeader *pfburh);
     void ReadRRERect(rfbFramebufferUpdateRectHeader *pfburh);
@@ -336,6 +367,19 @@ private:
 	void HandleHextileEncoding8(int x, int y, int w, int h);
 	void HandleHextileEncoding16(int x, int y, int w, int h);
 	void HandleHextileEncoding32(int x, int y, int w, int h);
+
+	// Pooled decoding, see DecodePool.h
+	DecodePool m_decodePool;
+	DecodeContext m_decodeContext; // for rects decoded on the network thread
+	inline bool PoolDecode() { return m_decodePool.Active() && !directx_used; };
+	void ReadDecodeData(DecodeJob *job, int len);
+	void RunDecodeJob(DecodeJob *job, DecodeContext &ctx);
+	void QueueHextileRect(rfbFramebufferUpdateRectHeader *pfburh);
+	void DecodeRawJob(DecodeJob *job);
+	void DecodeHextileJob(DecodeJob *job);
+	void DecodeUltra2Job(DecodeJob *job, DecodeContext &ctx);
+	void DecodeTightJpegJob(DecodeJob *job, DecodeContext &ctx);
+	void DecodeJpegRect(DecodeContext &ctx, const BYTE *src, int srclen, int x, int y, int w, int h);
 	
 	void ReadRBSRect(rfbFramebufferUpdateRectHeader *pfburh);
 	BOOL DrawRBSRect8(int x, int y, int w, int h, CARD8 **pptr);
@@ -375,13 +419,11 @@ private:
 	int InitFilterPalette (int rw, int rh);
 	void FilterCopy8 (int numRows);
 	void FilterCopy16 (int numRows);
-	void FilterCopy24 (int numRows);
 	void FilterCopy32 (int numRows);
 	void FilterGradient8 (int numRows);
 	void FilterGradient16 (int numRows);
-	void FilterGradient24 (int numRows);
 	void FilterGradient32 (int numRows);
-	void FilterPalette (int numRows);
+	void FilterShared (int numRows);
 	void DecompressJpegRect(int x, int y, int w, int h);
 
 	// Tight ClientConnectionCursor.cpp
@@ -483,6 +525,7 @@ private:
 
 	void GetFriendlySizeString(__int64 Size, char* szText);
 	void UpdateStatusFields();	// sf@2002
+	void ExportLatency(HWND hwnd);
 
 	// This is what controls the thread
 	void * run_undetached(void* arg);
@@ -574,9 +617,10 @@ private:
 	// Tight filter stuff. Should be initialized by filter initialization code.
 	tightFilterFunc m_tightCurrentFilter;
 	bool m_tightCutZeros;
-	int m_tightRectWidth, m_tightRectColors;
-	COLORREF m_tightPalette[256];
+	int m_tightRectWidth;
 	CARD8 m_tightPrevRow[2048*3*sizeof(CARD16)];
+	// 24 bit pixels and palettes, shared with the headless client
+	TightFilter m_tightFilter;
 	//
 
 	// Bitmap for local copy of screen, and DC for writing to it.
@@ -601,6 +645,11 @@ private:
 	bool m_fUsePlugin;
 	bool m_fPluginStreamingIn; // adzm 2010-09
 	bool m_fPluginStreamingOut; // adzm 2010-09
+	// Plugin streaming: restored bytes not consumed by ReadExact yet
+	BYTE* m_pStreamRestBuf;
+	int m_nStreamRestLen;
+	int m_nStreamRestPos;
+	void ReadExactStreaming(char *inbuf, int wanted);
 
 	//adzm - 2009-06-21
 	IPlugin* m_pPluginInterface;
@@ -800,6 +849,12 @@ private:
 	void Switchbuffer(int width, int height, int xx, int yy,int bytes_per_pixel,BYTE* source,BYTE* dest,int framebufferWidth);
 	void ConvertPixel_to_bpp_from_32(int xx, int yy,int bytes_per_pixel,BYTE* source,BYTE* dest,int framebufferWidth);
 	void SolidColor(int width, int height, int xx, int yy,int bytes_per_pixel,BYTE* source,BYTE* dest,int framebufferWidth);
+	// Zero-copy decoding: where a rect starts in the DIB, NULL if it has to
+	// go through a buffer, and the DIB scanline length in bytes
+	BYTE *DIBRect(int x, int y, int w, int h);
+	int DIBStride();
+	// The DIB for the decoder core shared with the headless client
+	DecodeSurface DIBSurface();
 	HDC				m_hmemdc;
  	HBITMAP			m_membitmap;
  	VOID			*m_DIBbits;
@@ -826,8 +881,6 @@ private:
 	ViewerDirectxClass *directx_output;
 	bool directx_used;
 
-
-	jpeg_source_mgr m_jpegSrcManager;
 	bool desktopsize_requested;
 	int ShowToolbar;
 	bool ExtDesktop;
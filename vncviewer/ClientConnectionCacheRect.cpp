@@ -92,8 +92,7 @@ void ClientConnection::ReadCacheZip(rfbFramebufferUpdateRectHeader *pfburh,HRGN
 {
 	UINT nNbCacheRects = pfburh->r.x;
 
-	UINT numRawBytes = nNbCacheRects * sz_rfbRectangle;
-	numRawBytes += (numRawBytes/100) + 8;
+	unsigned long numRawBytes = CacheZipSize(nNbCacheRects);
 	UINT numCompBytes;
 
 	rfbZlibHeader hdr;
@@ -108,10 +107,10 @@ void ClientConnection::ReadCacheZip(rfbFramebufferUpdateRectHeader *pfburh,HRGN
 	ReadExact((char *)m_netbuf, numCompBytes);
 
 	// Verify buffer space for cache rects list
-	CheckZipBufferSize(numRawBytes);
+	CheckZipBufferSize((int)numRawBytes);
 
 	int nRet = uncompress((unsigned char*)m_zipbuf,// Dest  
-						  (unsigned long*)&numRawBytes,// Dest len
+						  &numRawBytes,// Dest len
 						  (unsigned char*)m_netbuf,	// Src
 						  numCompBytes	// Src len
 						 );							    
@@ -120,20 +119,17 @@ void ClientConnection::ReadCacheZip(rfbFramebufferUpdateRectHeader *pfburh,HRGN
 		return;		
 	}
 
-	// Read all the cache rects
-	rfbRectangle theRect;
-	
-	BYTE* p = m_zipbuf;
-	for (UINT i = 0 ; i < nNbCacheRects; i++)
-	{
-		memcpy((BYTE*)&theRect, p, sz_rfbRectangle);
-		p += sz_rfbRectangle;
+	// Read all the cache rects, as many as were inflated
+	PackedRect theRect;
 
+	const BYTE* p = m_zipbuf;
+	for (UINT i = 0 ; i < nNbCacheRects && NextCacheRect(p, m_zipbuf + numRawBytes, theRect); i++)
+	{
 		RECT cacherect;
-		cacherect.left = Swap16IfLE(theRect.x);
-		cacherect.right = Swap16IfLE(theRect.x) + Swap16IfLE(theRect.w);
-		cacherect.top = Swap16IfLE(theRect.y);
-		cacherect.bottom = Swap16IfLE(theRect.y) + Swap16IfLE(theRect.h);
+		cacherect.left = theRect.x;
+		cacherect.right = theRect.x + theRect.w;
+		cacherect.top = theRect.y;
+		cacherect.bottom = theRect.y + theRect.h;
 
 		SoftCursorLockArea(cacherect.left, cacherect.top, cacherect.right - cacherect.left, cacherect.bottom - cacherect.top);
 		RestoreArea(cacherect);
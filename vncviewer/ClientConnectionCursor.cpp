@@ -424,12 +424,18 @@ void ClientConnection::InvalidateScreenRect(const RECT *pRect) {
 		rect.right  = pRect->right  - m_hScrollPos;
 		rect.bottom = pRect->bottom - m_vScrollPos;
 	}
+	ScaleRect(pRect);
 	InvalidateRect(m_hwndcn, &rect, FALSE);
 }
 
 void ClientConnection::InvalidateRegion(const RECT *pRect,HRGN *prgn) {
 	RECT rect;
 
+	// Scaled once the update is decoded, see FlushScaled()
+	if (ScaledShadowActive())
+		m_scaleDirty.push_back(*pRect);
+	m_latency.RectReceived(*pRect);
+
 	// If we're scaling, we transform the coordinates of the rectangle
 	// received into the corresponding window coords, and invalidate
 	// *that* region.
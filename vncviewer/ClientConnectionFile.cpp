@@ -126,6 +126,32 @@ void ClientConnection::SaveConnection()
 	//m_opts->Register();
 }
 
+//
+// ExportLatency
+// Save the input latency histograms, from the status window
+//
+
+void ClientConnection::ExportLatency(HWND hwnd)
+{
+	static char filter[] = "CSV files (*.csv)\0*.csv\0" \
+						   "All files (*.*)\0*.*\0";
+	char fname[_MAX_PATH];
+	char tname[_MAX_FNAME + _MAX_EXT];
+	ofnInit();
+	strcpy_s(fname, "latency.csv");
+	ofn.lpstrFilter = filter;
+	ofn.lpstrDefExt = "csv";
+	ofn.hwndOwner = hwnd;
+	ofn.lpstrFile = fname;
+	ofn.lpstrFileTitle = tname;
+	ofn.Flags = OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT;
+	if (!GetSaveFileName(&ofn))
+		return;
+	vnclog.Print(1, "Saving latency to %s\n", fname);
+	if (!m_latency.Export(fname))
+		MessageBox(hwnd, fname, "Can't write the latency file", MB_ICONERROR | MB_OK | MB_SETFOREGROUND | MB_TOPMOST);
+}
+
 
 void ClientConnection::Save_Latest_Connection()
 {
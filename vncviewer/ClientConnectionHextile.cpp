@@ -28,6 +28,10 @@
 
 void ClientConnection::ReadHextileRect(rfbFramebufferUpdateRectHeader *pfburh)
 {
+	if (PoolDecode() && (m_myFormat.bitsPerPixel == 8 || m_myFormat.bitsPerPixel == 16 || m_myFormat.bitsPerPixel == 32)) {
+		QueueHextileRect(pfburh);
+		return;
+	}
 	switch (m_myFormat.bitsPerPixel) {
 	case 8:
 		HandleHextileEncoding8(pfburh->r.x, pfburh->r.y, pfburh->r.w, pfburh->r.h);
@@ -136,4 +140,68 @@ DEFINE_HEXTILE(8)
 DEFINE_HEXTILE(16)
 DEFINE_HEXTILE(32)
 
+// Hextile has no length up front, so walk the tile headers and copy each
+// tile as it comes. The decode pool parses the copy again.
+void ClientConnection::QueueHextileRect(rfbFramebufferUpdateRectHeader *pfburh)
+{
+	int rx = pfburh->r.x, ry = pfburh->r.y, rw = pfburh->r.w, rh = pfburh->r.h;
+	int bytesPerPixel = m_myFormat.bitsPerPixel / 8;
+	DecodeJob *job = m_decodePool.GetJob(rfbEncodingHextile, rx, ry, rw, rh);
+
+	for (int y = ry; y < ry+rh; y += 16) {
+		for (int x = rx; x < rx+rw; x += 16) {
+			int w = (rx+rw - x < 16) ? rx+rw - x : 16;
+			int h = (ry+rh - y < 16) ? ry+rh - y : 16;
+
+			ReadDecodeData(job, 1);
+			CARD8 subencoding = job->data.back();
+			if (subencoding & rfbHextileRaw) {
+				ReadDecodeData(job, w * h * bytesPerPixel);
+				continue;
+			}
+			int len = 0;
+			if (subencoding & rfbHextileBackgroundSpecified)
+				len += bytesPerPixel;
+			if (subencoding & rfbHextileForegroundSpecified)
+				len += bytesPerPixel;
+			if (subencoding & rfbHextileAnySubrects)
+				len += 1;
+			ReadDecodeData(job, len);
+			if (subencoding & rfbHextileAnySubrects) {
+				int nSubrects = job->data.back();
+				if (subencoding & rfbHextileSubrectsColoured)
+					ReadDecodeData(job, nSubrects * (2 + bytesPerPixel));
+				else
+					ReadDecodeData(job, nSubrects * 2);
+			}
+		}
+	}
+	m_decodePool.Submit(job);
+}
 
+void ClientConnection::DecodeHextileJob(DecodeJob *job)
+{
+	int rx = job->x, ry = job->y, rw = job->w, rh = job->h;
+	if (job->data.empty())
+		return;
+	const BYTE *ptr = &job->data[0];
+	const BYTE *end = ptr + job->data.size();
+	CARD32 bg = 0, fg = 0;
+
+	for (int y = ry; y < ry+rh; y += 16) {
+		omni_mutex_lock l(m_bitmapdcMutex);
+		DecodeSurface fb = DIBSurface();
+		for (int x = rx; x < rx+rw; x += 16) {
+			int w = (rx+rw - x < 16) ? rx+rw - x : 16;
+			int h = (ry+rh - y < 16) ? ry+rh - y : 16;
+
+			// The tile lengths were checked when the job was framed
+			if (ptr >= end)
+				return;
+			int subencoding = *ptr++;
+			ptr = fb.HextileTile(x, y, w, h, subencoding, ptr, end, (BYTE *)&bg, (BYTE *)&fg);
+			if (ptr == NULL)
+				return;
+		}
+	}
+}
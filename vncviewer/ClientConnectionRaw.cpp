@@ -34,6 +34,27 @@ void ClientConnection::ReadRawRect(rfbFramebufferUpdateRectHeader *pfburh) {
 	// Security Check
 	if (numbytes > 106000000)
 		goto error;
+	if (PoolDecode())
+	{
+		DecodeJob *job = m_decodePool.GetJob(rfbEncodingRaw, pfburh->r.x, pfburh->r.y, pfburh->r.w, pfburh->r.h);
+		ReadDecodeData(job, numbytes);
+		m_decodePool.Submit(job);
+		return;
+	}
+	// The server sends our own pixel format, so the rows can go straight
+	// from the socket into the DIB without passing through m_netbuf
+	BYTE *dst = DIBRect(pfburh->r.x, pfburh->r.y, pfburh->r.w, pfburh->r.h);
+	if (dst)
+	{
+		int rowBytes = pfburh->r.w * m_minPixelBytes;
+		int stride = DIBStride();
+		if (rowBytes == stride)
+			ReadExact((char *)dst, numbytes);
+		else
+			for (int row = 0; row < pfburh->r.h; row++, dst += stride)
+				ReadExact((char *)dst, rowBytes);
+		return;
+	}
 	// Read in the whole thing
     CheckBufferSize(numbytes);
 	ReadExact(m_netbuf, numbytes);
@@ -47,3 +68,11 @@ void ClientConnection::ReadRawRect(rfbFramebufferUpdateRectHeader *pfburh) {
 		assert(true);
 }
 
+void ClientConnection::DecodeRawJob(DecodeJob *job)
+{
+	if (job->data.empty() || !m_DIBbits)
+		return;
+	omni_mutex_lock l(m_bitmapdcMutex);
+	ConvertAll_secure(job->w, job->h, job->x, job->y, m_myFormat.bitsPerPixel/8, &job->data[0], (BYTE *)m_DIBbits, m_si.framebufferWidth, (int)job->data.size(), m_si.framebufferHeight);
+}
+
@@ -26,7 +26,6 @@
 #include "vncviewer.h"
 #include "ClientConnection.h"
 
-#define TIGHT_MIN_TO_COMPRESS 12
 #define TIGHT_BUFFER_SIZE (2048 * 200)
 
 void ClientConnection::ReadTightRect(rfbFramebufferUpdateRectHeader *pfburh, bool zstd)
@@ -41,19 +40,20 @@ void ClientConnection::ReadTightRect(rfbFramebufferUpdateRectHeader *pfburh, boo
 
   CARD8 comp_ctl;
   ReadExact((char *)&comp_ctl, 1);
+  TightControl ctl;
+  bool known = ctl.Parse(comp_ctl);
 
   /* Flush zlib streams if we are told by the server to do so. */
   for (int i = 0; i < 4; i++) {
-    if (comp_ctl & 1){
+    if (ctl.resetStreams & (1 << i)){
 		UltraVncZ *uz = &ultraVncZTight[i];
 		uz->endInflateStream(zstd);
 		}
-    comp_ctl >>= 1;
   }
 
   /* Handle solid rectangles. */
   BYTE colorpointer[4];
-  if (comp_ctl == rfbTightFill) {
+  if (ctl.subencoding == rfbTightFill) {
     if (m_myFormat.depth == 24 && m_myFormat.redMax == 0xFF &&
         m_myFormat.greenMax == 0xFF && m_myFormat.blueMax == 0xFF) {
       CARD8 fillColourBuf[3];
@@ -74,14 +74,14 @@ void ClientConnection::ReadTightRect(rfbFramebufferUpdateRectHeader *pfburh, boo
     return;
   }
 
-  if (comp_ctl == rfbTightJpeg) {
+  if (ctl.subencoding == rfbTightJpeg) {
     DecompressJpegRect(pfburh->r.x, pfburh->r.y, pfburh->r.w, pfburh->r.h);
 	return;
   }
 
 
   /* Quit on unsupported subencoding value. */
-  if (comp_ctl >= rfbTightMaxSubencoding) {
+  if (!known) {
     vnclog.Print(0, _T("Tight encoding: bad subencoding value received.\n"));
     return;
   }
@@ -93,7 +93,7 @@ void ClientConnection::ReadTightRect(rfbFramebufferUpdateRectHeader *pfburh, boo
 
   /* First, we should identify a filter to use. */
   int bitsPixel;
-  if ((comp_ctl & rfbTightExplicitFilter) != 0) {
+  if (ctl.explicitFilter) {
     CARD8 filter_id;
     ReadExact((char *)&filter_id, 1);
 
@@ -144,8 +144,7 @@ void ClientConnection::ReadTightRect(rfbFramebufferUpdateRectHeader *pfburh, boo
   }
 
   /* Now let's initialize compression stream if needed. */
-  int stream_id = comp_ctl & 0x03;
-  UltraVncZ *uz = &ultraVncZTight[stream_id];
+  UltraVncZ *uz = &ultraVncZTight[ctl.streamId];
 
   /* Read, decode and draw actual pixel data in a loop. */
   int beforeBufferSize =
@@ -208,16 +207,11 @@ void ClientConnection::ReadTightRect(rfbFramebufferUpdateRectHeader *pfburh, boo
 
 int ClientConnection::ReadCompactLen() {
   CARD8 len_byte;
-  ReadExact((char *)&len_byte, 1);
-  int compressedLen = (int)len_byte & 0x7F;
-  if (len_byte & 0x80) {
+  int compressedLen;
+  int n = 0;
+  do {
     ReadExact((char *)&len_byte, 1);
-    compressedLen |= ((int)len_byte & 0x7F) << 7;
-    if (len_byte & 0x80) {
-      ReadExact((char *)&len_byte, 1);
-      compressedLen |= ((int)len_byte & 0xFF) << 14;
-    }
-  }
+  } while (TightCompactLen(compressedLen, n++, len_byte));
   return compressedLen;
 }
 
@@ -229,9 +223,10 @@ int ClientConnection::ReadCompactLen() {
 // The following variables are defined in the class declaration:
 //   tightFilterFunc m_tightCurrentFilter;
 //   Bool m_tightCutZeros;
-//   int m_tightRectWidth, m_tightRectColors;
-//   COLORREF m_tightPalette[256];
+//   int m_tightRectWidth;
 //   CARD8 m_tightPrevRow[2048*3*sizeof(CARD16)];
+//   TightFilter m_tightFilter;
+// The 24 bit and palette filters are common/DecodeParse's TightFilter.
 
 int ClientConnection::InitFilterCopy (int rw, int rh)
 {
@@ -247,7 +242,8 @@ int ClientConnection::InitFilterCopy (int rw, int rh)
   if (m_myFormat.depth == 24 && m_myFormat.redMax == 0xFF &&
       m_myFormat.greenMax == 0xFF && m_myFormat.blueMax == 0xFF) {
     m_tightCutZeros = TRUE;
-    m_tightCurrentFilter = &ClientConnection::FilterCopy24;
+    m_tightFilter.Begin(rfbTightFilterCopy, rw, 0);
+    m_tightCurrentFilter = &ClientConnection::FilterShared;
     return 24;
   }
 
@@ -268,8 +264,8 @@ int ClientConnection::InitFilterGradient (int rw, int rh)
   m_tightCurrentFilter = funcArray[m_myFormat.bitsPerPixel/16];
 
   if (m_tightCutZeros) {
-    m_tightCurrentFilter = &ClientConnection::FilterGradient24;
-    memset(m_tightPrevRow, 0, rw * 3);
+    m_tightFilter.Begin(rfbTightFilterGradient, rw, 0);
+    m_tightCurrentFilter = &ClientConnection::FilterShared;
   } else
     memset(m_tightPrevRow, 0, rw * 3 * sizeof(CARD16));
 
@@ -278,48 +274,48 @@ int ClientConnection::InitFilterGradient (int rw, int rh)
 
 int ClientConnection::InitFilterPalette (int rw, int rh)
 {
-  m_tightCurrentFilter = &ClientConnection::FilterPalette;
+  m_tightCurrentFilter = &ClientConnection::FilterShared;
   m_tightRectWidth = rw;
 
   CARD8 numColors;
   ReadExact((char *)&numColors, 1);
 
-  m_tightRectColors = (int)numColors;
-  if (++m_tightRectColors < 2)
+  int nColors = (int)numColors + 1;
+  if (!m_tightFilter.Begin(rfbTightFilterPalette, rw, nColors))
     return 0;
 
   if (m_myFormat.depth == 24 && m_myFormat.redMax == 0xFF &&
       m_myFormat.greenMax == 0xFF && m_myFormat.blueMax == 0xFF) {
 
-    CheckBufferSize(m_tightRectColors * 3);
-    ReadExact(m_netbuf, m_tightRectColors * 3);
+    CheckBufferSize(nColors * 3);
+    ReadExact(m_netbuf, nColors * 3);
 
-    for (int i = 0; i < m_tightRectColors; i++)
-      m_tightPalette[i] = COLOR_FROM_PIXEL24_ADDRESS(&m_netbuf[i*3]);
+    for (int i = 0; i < nColors; i++)
+      m_tightFilter.palette[i] = COLOR_FROM_PIXEL24_ADDRESS(&m_netbuf[i*3]);
 
   } else {
-    CheckBufferSize(m_tightRectColors * (m_myFormat.bitsPerPixel / 8));
-    ReadExact(m_netbuf, m_tightRectColors * (m_myFormat.bitsPerPixel / 8));
+    CheckBufferSize(nColors * (m_myFormat.bitsPerPixel / 8));
+    ReadExact(m_netbuf, nColors * (m_myFormat.bitsPerPixel / 8));
 
     SETUP_COLOR_SHORTCUTS;
 
     int i;
     switch (m_myFormat.bitsPerPixel) {
     case 8:
-      for (i = 0; i < m_tightRectColors; i++)
-        m_tightPalette[i] = COLOR_FROM_PIXEL8_ADDRESS(&m_netbuf[i]);
+      for (i = 0; i < nColors; i++)
+        m_tightFilter.palette[i] = COLOR_FROM_PIXEL8_ADDRESS(&m_netbuf[i]);
       break;
     case 16:
-      for (i = 0; i < m_tightRectColors; i++)
-        m_tightPalette[i] = COLOR_FROM_PIXEL16_ADDRESS(&m_netbuf[i*2]);
+      for (i = 0; i < nColors; i++)
+        m_tightFilter.palette[i] = COLOR_FROM_PIXEL16_ADDRESS(&m_netbuf[i*2]);
       break;
     default:
-      for (i = 0; i < m_tightRectColors; i++)
-        m_tightPalette[i] = COLOR_FROM_PIXEL32_ADDRESS(&m_netbuf[i*4]);
+      for (i = 0; i < nColors; i++)
+        m_tightFilter.palette[i] = COLOR_FROM_PIXEL32_ADDRESS(&m_netbuf[i*4]);
     }
   }
 
-  return (m_tightRectColors == 2) ? 1 : 8;
+  return m_tightFilter.BitsPerPixel();
 }
 
 //
@@ -346,7 +342,6 @@ void ClientConnection::FilterCopy##bpp (int numRows)                          \
 
 DEFINE_TIGHT_FILTER_COPY(8)
 DEFINE_TIGHT_FILTER_COPY(16)
-DEFINE_TIGHT_FILTER_COPY(24)
 DEFINE_TIGHT_FILTER_COPY(32)
 
 #define DEFINE_TIGHT_FILTER_GRADIENT(bpp)                                     \
@@ -408,212 +403,107 @@ DEFINE_TIGHT_FILTER_GRADIENT(8)
 DEFINE_TIGHT_FILTER_GRADIENT(16)
 DEFINE_TIGHT_FILTER_GRADIENT(32)
 
-void ClientConnection::FilterGradient24 (int numRows)
-{
-  CARD8 thisRow[2048*3];
-  CARD8 pix[3];
-  int est[3];
-
-  COLORREF *dst = (COLORREF *)m_zlibbuf;
-
-  for (int y = 0; y < numRows; y++) {
-
-    // First pixel in a row
-    for (int c = 0; c < 3; c++) {
-      pix[c] = m_tightPrevRow[c] + m_netbuf[y*m_tightRectWidth*3+c];
-      thisRow[c] = pix[c];
-    }
-    dst[y*m_tightRectWidth] = COLOR_FROM_PIXEL24_ADDRESS(pix);
-
-    // Remaining pixels of a row
-    for (int x = 1; x < m_tightRectWidth; x++) {
-      for (int c = 0; c < 3; c++) {
-        est[c] = (int)m_tightPrevRow[x*3+c] + (int)pix[c] -
-                 (int)m_tightPrevRow[(x-1)*3+c];
-        if (est[c] > 0xFF) {
-          est[c] = 0xFF;
-        } else if (est[c] < 0x00) {
-          est[c] = 0x00;
-        }
-        pix[c] = (CARD8)est[c] + m_netbuf[(y*m_tightRectWidth+x)*3+c];
-        thisRow[x*3+c] = pix[c];
-      }
-      dst[y*m_tightRectWidth+x] = COLOR_FROM_PIXEL24_ADDRESS(pix);
-    }
-
-    memcpy(m_tightPrevRow, thisRow, m_tightRectWidth * 3);
-  }
-}
-
-void ClientConnection::FilterPalette (int numRows)
+// 24 bit copy and gradient and the palette filter
+void ClientConnection::FilterShared (int numRows)
 {
-  int x, y, b, w;
-  CARD8 *src = (CARD8 *)m_netbuf;
-  COLORREF *dst = (COLORREF *)m_zlibbuf;
-
-  if (m_tightRectColors == 2) {
-    w = (m_tightRectWidth + 7) / 8;
-    for (y = 0; y < numRows; y++) {
-      for (x = 0; x < m_tightRectWidth / 8; x++) {
-        for (b = 7; b >= 0; b--)
-          dst[y*m_tightRectWidth+x*8+7-b] = m_tightPalette[src[y*w+x] >> b & 1];
-      }
-      for (b = 7; b >= 8 - m_tightRectWidth % 8; b--) {
-        dst[y*m_tightRectWidth+x*8+7-b] = m_tightPalette[src[y*w+x] >> b & 1];
-      }
-    }
-  } else {
-    for (y = 0; y < numRows; y++)
-      for (x = 0; x < m_tightRectWidth; x++)
-        dst[y*m_tightRectWidth+x] = m_tightPalette[(int)src[y*m_tightRectWidth+x]];
-  }
+  m_tightFilter.Rows((BYTE *)m_netbuf, numRows, (rdr::U32 *)m_zlibbuf, m_tightRectWidth);
 }
 
 //
 // JPEG decompression code.
 //
 
-static bool jpegError;
-//
-// A "Source manager" for the JPEG library.
-//
-
-static struct jpeg_source_mgr jpegSrcManager;
-static JOCTET *jpegBufferPtr;
-static size_t jpegBufferLen;
-
-static void JpegInitSource(j_decompress_ptr cinfo);
-static boolean JpegFillInputBuffer(j_decompress_ptr cinfo);
-static void JpegSkipInputData(j_decompress_ptr cinfo, long num_bytes);
-static void JpegTermSource(j_decompress_ptr cinfo);
-
-static void
-JpegInitSource(j_decompress_ptr cinfo)
-{
-	jpegError = false;
-}
-
-static boolean
-JpegFillInputBuffer(j_decompress_ptr cinfo)
-{
-	jpegError = true;
-	jpegSrcManager.bytes_in_buffer = jpegBufferLen;
-	jpegSrcManager.next_input_byte = (JOCTET *)jpegBufferPtr;
-
-	return TRUE;
-}
-
-static void
-JpegSkipInputData(j_decompress_ptr cinfo, long num_bytes)
-{
-	if (num_bytes < 0 || (size_t)num_bytes > jpegSrcManager.bytes_in_buffer) {
-		jpegError = true;
-		jpegSrcManager.bytes_in_buffer = jpegBufferLen;
-		jpegSrcManager.next_input_byte = (JOCTET *)jpegBufferPtr;
-	}
-	else {
-		jpegSrcManager.next_input_byte += (size_t)num_bytes;
-		jpegSrcManager.bytes_in_buffer -= (size_t)num_bytes;
-	}
-}
-
-static void
-JpegTermSource(j_decompress_ptr cinfo)
-{
-	/* No work necessary here. */
-}
-
-/*static void
-JpegSetSrcManager(j_decompress_ptr cinfo, char *compressedData, int compressedLen)
-{
-jpegBufferPtr = (JOCTET *)compressedData;
-jpegBufferLen = (size_t)compressedLen;
-
-jpegSrcManager.init_source = JpegInitSource;
-jpegSrcManager.fill_input_buffer = JpegFillInputBuffer;
-jpegSrcManager.skip_input_data = JpegSkipInputData;
-jpegSrcManager.resync_to_restart = jpeg_resync_to_restart;
-jpegSrcManager.term_source = JpegTermSource;
-jpegSrcManager.next_input_byte = jpegBufferPtr;
-jpegSrcManager.bytes_in_buffer = jpegBufferLen;
-
-cinfo->src = &jpegSrcManager;
-}*/
-
-
-/*static void JpegSetSrcManager(j_decompress_ptr cinfo, char *compressedData,
-							  int compressedLen);*/
-
 void ClientConnection::DecompressJpegRect(int x, int y, int w, int h)
 {
-  struct jpeg_decompress_struct cinfo;
-  struct jpeg_error_mgr jerr;
-
   int compressedLen = (int)ReadCompactLen();
   if (compressedLen <= 0) {
     vnclog.Print(0, _T("Incorrect data received from the server.\n"));
     return;
   }
 
+  if (PoolDecode()) {
+    DecodeJob *job = m_decodePool.GetJob(rfbEncodingTight, x, y, w, h);
+    ReadDecodeData(job, compressedLen);
+    m_decodePool.Submit(job);
+    return;
+  }
+
   CheckBufferSize(compressedLen);
   ReadExact(m_netbuf, compressedLen);
+  DecodeJpegRect(m_decodeContext, (BYTE *)m_netbuf, compressedLen, x, y, w, h);
+}
 
-  cinfo.err = jpeg_std_error(&jerr);
-  jpeg_create_decompress(&cinfo);
-
-  //JpegSetSrcManager(&cinfo, m_netbuf, compressedLen);
-
-  jpegBufferPtr = (JOCTET *)m_netbuf;
-  jpegBufferLen = (size_t)compressedLen;
+void ClientConnection::DecodeTightJpegJob(DecodeJob *job, DecodeContext &ctx)
+{
+  if (job->data.empty())
+    return;
+  DecodeJpegRect(ctx, &job->data[0], (int)job->data.size(), job->x, job->y, job->w, job->h);
+}
 
-  m_jpegSrcManager.init_source = JpegInitSource;
-  m_jpegSrcManager.fill_input_buffer = JpegFillInputBuffer;
-  m_jpegSrcManager.skip_input_data = JpegSkipInputData;
-  m_jpegSrcManager.resync_to_restart = jpeg_resync_to_restart;
-  m_jpegSrcManager.term_source = JpegTermSource;
-  m_jpegSrcManager.next_input_byte = jpegBufferPtr;
-  m_jpegSrcManager.bytes_in_buffer = jpegBufferLen;
+// TurboJPEG pixel format that matches a 32 bit framebuffer, -1 if none does
+static int JpegPixelFormat(const rfbPixelFormat &pf)
+{
+  if (pf.bitsPerPixel != 32 || pf.redMax != 0xFF || pf.greenMax != 0xFF || pf.blueMax != 0xFF)
+    return -1;
+
+  int redShift = pf.redShift, greenShift = pf.greenShift, blueShift = pf.blueShift;
+  if (pf.bigEndian) {
+    redShift = 24 - redShift;
+    greenShift = 24 - greenShift;
+    blueShift = 24 - blueShift;
+  }
 
-  cinfo.src = &m_jpegSrcManager;
+  if (redShift == 0 && greenShift == 8 && blueShift == 16)
+    return TJPF_RGBX;
+  if (redShift == 16 && greenShift == 8 && blueShift == 0)
+    return TJPF_BGRX;
+  if (redShift == 24 && greenShift == 16 && blueShift == 8)
+    return TJPF_XBGR;
+  if (redShift == 8 && greenShift == 16 && blueShift == 24)
+    return TJPF_XRGB;
+  return -1;
+}
 
-  jpeg_read_header(&cinfo, TRUE);
-  cinfo.out_color_space = JCS_RGB;
+// Decode one JPEG rect (Tight or Ultra2) with the calling thread's own
+// TurboJPEG handle, so the network thread and every decode pool thread
+// can do this at the same time.
+void ClientConnection::DecodeJpegRect(DecodeContext &ctx, const BYTE *src, int srclen, int x, int y, int w, int h)
+{
+  if (srclen <= 0 || w <= 0 || h <= 0 || !Check_Rectangle_borders(x, y, w, h))
+    return;
 
-  jpeg_start_decompress(&cinfo);
-  if ((int)cinfo.output_width != w || (int)cinfo.output_height != h ||
-      cinfo.output_components != 3) {
-    vnclog.Print(0, _T("Tight Encoding: Wrong JPEG data received.\n"));
-    jpeg_destroy_decompress(&cinfo);
+  tjhandle jpeg = ctx.JpegHandle();
+  if (jpeg == NULL) {
+    vnclog.Print(0, _T("JPEG: decompressor init failed\n"));
     return;
   }
 
-  omni_mutex_lock l(m_bitmapdcMutex);
-
-  // Two scanlines: for 24bit and COLORREF samples
-  // adzm 2010-08 - Increase zlib buffer size (from TightVNC)
-  const int maxRowWidth = 8192;
-  CheckZlibBufferSize(2*maxRowWidth*4);
-
-  JSAMPROW rowPointer[1];
-  rowPointer[0] = (JSAMPROW)m_zlibbuf;
-
-  COLORREF *pixelPtr;
-  for (int dy = 0; cinfo.output_scanline < cinfo.output_height; dy++) {
-    jpeg_read_scanlines(&cinfo, rowPointer, 1);
-    if (jpegError) {
-      break;
-    }
-    pixelPtr = (COLORREF *)&m_zlibbuf[maxRowWidth*4];
-    for (int dx = 0; dx < w; dx++) {
-      *pixelPtr++ = COLOR_FROM_PIXEL24_ADDRESS(&m_zlibbuf[dx*3]);
-    }
-    SETPIXELS_NOCONV(&m_zlibbuf[maxRowWidth*4], x, y + dy, w, 1);
+  int jpegWidth, jpegHeight, subsamp, colorspace;
+  if (tjDecompressHeader3(jpeg, src, (unsigned long)srclen, &jpegWidth, &jpegHeight, &subsamp, &colorspace) != 0 ||
+      jpegWidth != w || jpegHeight != h) {
+    vnclog.Print(0, _T("JPEG: Wrong JPEG data received.\n"));
+    return;
   }
 
-  if (!jpegError)
-    jpeg_finish_decompress(&cinfo);
+  int pixelFormat = JpegPixelFormat(m_myFormat);
+  if (pixelFormat >= 0) {
+    // Straight into the DIB, without m_bitmapdcMutex. Pooled rects in one
+    // update never overlap, the soft cursor is kept off them, and the DIB
+    // is only reallocated by the network thread after the pool is drained.
+    BYTE *dst = DIBRect(x, y, w, h);
+    if (dst == NULL)
+      return;
+    if (tjDecompress2(jpeg, src, (unsigned long)srclen, dst, w, DIBStride(), h, pixelFormat, 0) != 0)
+      vnclog.Print(0, _T("JPEG: %s\n"), tjGetErrorStr2(jpeg));
+    return;
+  }
 
-  jpeg_destroy_decompress(&cinfo);
+  // Other formats go through COLORREF pixels (RGBX byte order)
+  ctx.scratch.resize(w * h * 4);
+  if (tjDecompress2(jpeg, src, (unsigned long)srclen, &ctx.scratch[0], w, w * 4, h, TJPF_RGBX, 0) != 0) {
+    vnclog.Print(0, _T("JPEG: %s\n"), tjGetErrorStr2(jpeg));
+    return;
+  }
+  omni_mutex_lock l(m_bitmapdcMutex);
+  SETPIXELS_NOCONV(&ctx.scratch[0], x, y, w, h);
 }
-
-
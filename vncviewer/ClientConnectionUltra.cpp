@@ -28,7 +28,6 @@
 #include "stdhdrs.h"
 #include "vncviewer.h"
 #include "ClientConnection.h"
-#include "lzo/minilzo.h"
 
 void ClientConnection::ReadUltraRect(rfbFramebufferUpdateRectHeader *pfburh) {
 
@@ -36,7 +35,7 @@ void ClientConnection::ReadUltraRect(rfbFramebufferUpdateRectHeader *pfburh) {
     // this assumes at least one byte per pixel. Naughty.
 	UINT numRawBytes = numpixels * m_minPixelBytes;
 	UINT numCompBytes;
-	lzo_uint new_len;
+	long new_len;
 
 	rfbZlibHeader hdr;
 
@@ -50,9 +49,9 @@ void ClientConnection::ReadUltraRect(rfbFramebufferUpdateRectHeader *pfburh) {
     CheckBufferSize(numCompBytes);
 	ReadExact(m_netbuf, numCompBytes);
 	CheckZlibBufferSize(numRawBytes+ 500);
-	new_len = numRawBytes + 500;
-	//m_zlibbuf is bad after !LZO_E_OK
-	if (lzo1x_decompress_safe((BYTE*)m_netbuf,numCompBytes,(BYTE*)m_zlibbuf,&new_len,NULL) != LZO_E_OK)
+	//m_zlibbuf is bad after an error
+	new_len = UltraInflate((BYTE*)m_netbuf, numCompBytes, (BYTE*)m_zlibbuf, numRawBytes + 500);
+	if (new_len < 0)
 		return;
 	SoftCursorLockArea(pfburh->r.x, pfburh->r.y,pfburh->r.w,pfburh->r.h);
 	if (!Check_Rectangle_borders(pfburh->r.x, pfburh->r.y,pfburh->r.w,pfburh->r.h)) return;
@@ -63,13 +62,13 @@ void ClientConnection::ReadUltraRect(rfbFramebufferUpdateRectHeader *pfburh) {
 void ClientConnection::ReadUltraZip(rfbFramebufferUpdateRectHeader *pfburh,HRGN *prgn)
 {
 	UINT nNbCacheRects = pfburh->r.x;
-	UINT numRawBytes = pfburh->r.y+pfburh->r.w*65535;
+	UINT numRawBytes = PackedBlockSize(pfburh->r.y, pfburh->r.w);
 	// Security Check
-	if (numRawBytes > 106000000 || nNbCacheRects > 25000)
+	if (numRawBytes > ULTRAZIP_MAX_BYTES || nNbCacheRects > ULTRAZIP_MAX_RECTS)
 	{assert(true);return;}
 
 	UINT numCompBytes;
-	lzo_uint new_len;
+	long new_len;
 	rfbZlibHeader hdr;
 	// Read in the rfbZlibHeader
 	omni_mutex_lock l(m_bitmapdcMutex);
@@ -84,43 +83,26 @@ void ClientConnection::ReadUltraZip(rfbFramebufferUpdateRectHeader *pfburh,HRGN
 
 	// Verify buffer space for cache rects list
 	CheckZlibBufferSize(numRawBytes+500);
-	new_len = numRawBytes+500;
-	//m_zlibbuf is bad after !LZO_E_OK
-	if (lzo1x_decompress_safe((BYTE*)m_netbuf,numCompBytes,(BYTE*)m_zlibbuf,&new_len,NULL) != LZO_E_OK)
+	//m_zlibbuf is bad after an error
+	new_len = UltraInflate((BYTE*)m_netbuf, numCompBytes, (BYTE*)m_zlibbuf, numRawBytes + 500);
+	if (new_len < 0)
 		return;
-	BYTE* pzipbuf = m_zlibbuf;
-	UINT m_zlibbuf_size = 0;
-	for (UINT i = 0 ; i < nNbCacheRects; i++)
+	const BYTE* pzipbuf = m_zlibbuf;
+	PackedRect pr;
+	// Security Check: NextPackedRect keeps every header and its pixels inside the block
+	for (UINT i = 0 ; i < nNbCacheRects && NextPackedRect(pzipbuf, m_zlibbuf + new_len, m_myFormat.bitsPerPixel / 8, pr); i++)
 	{
-		rfbFramebufferUpdateRectHeader surh;
-		m_zlibbuf_size += sz_rfbFramebufferUpdateRectHeader;
-		// Security Check
-		if (m_zlibbuf_size > new_len)
-			{assert(true);return;}
-		memcpy((char *) &surh,pzipbuf, sz_rfbFramebufferUpdateRectHeader);
-		surh.r.x = Swap16IfLE(surh.r.x);
-		surh.r.y = Swap16IfLE(surh.r.y);
-		surh.r.w = Swap16IfLE(surh.r.w);
-		surh.r.h = Swap16IfLE(surh.r.h);
-		surh.encoding = Swap32IfLE(surh.encoding);
-		pzipbuf += sz_rfbFramebufferUpdateRectHeader;
-
 		RECT rect;
-		rect.left = surh.r.x;
-		rect.right = surh.r.x + surh.r.w;
-		rect.top = surh.r.y;
-		rect.bottom = surh.r.y + surh.r.h;
+		rect.left = pr.x;
+		rect.right = pr.x + pr.w;
+		rect.top = pr.y;
+		rect.bottom = pr.y + pr.h;
 		//border check
-		if (!Check_Rectangle_borders(rect.left,rect.top,surh.r.w,surh.r.h)) return;
+		if (!Check_Rectangle_borders(rect.left,rect.top,pr.w,pr.h)) return;
 
 		SoftCursorLockArea(rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top);
-		
-		 if ( surh.encoding==rfbEncodingRaw)
-			{
-				UINT numpixels = surh.r.w * surh.r.h;							  
-				if (m_DIBbits) ConvertAll(surh.r.w,surh.r.h,surh.r.x, surh.r.y,m_myFormat.bitsPerPixel/8,(BYTE *)pzipbuf,(BYTE *)m_DIBbits,m_si.framebufferWidth,m_si.framebufferHeight);
-				pzipbuf +=numpixels*m_myFormat.bitsPerPixel/8;
-				if (!m_opts->m_Directx)InvalidateRegion(&rect,prgn);
-			}
+
+		if (m_DIBbits) ConvertAll(pr.w,pr.h,pr.x, pr.y,m_myFormat.bitsPerPixel/8,(BYTE *)pr.pixels,(BYTE *)m_DIBbits,m_si.framebufferWidth,m_si.framebufferHeight);
+		if (!m_opts->m_Directx)InvalidateRegion(&rect,prgn);
 	}
 }
\ No newline at end of file
@@ -115,7 +115,7 @@ void ClientConnection::CheckZlibBufferSize(int bufsize)
 void ClientConnection::ReadQueueZip(rfbFramebufferUpdateRectHeader *pfburh,HRGN *prgn, bool zstd)
 {
 	UINT nNbCacheRects = pfburh->r.x;
-	UINT numRawBytes = pfburh->r.y+pfburh->r.w*65535;
+	UINT numRawBytes = PackedBlockSize(pfburh->r.y, pfburh->r.w);
 	UINT numCompBytes;
 	rfbZlibHeader hdr;
 	// Read in the rfbZlibHeader
@@ -129,50 +129,42 @@ void ClientConnection::ReadQueueZip(rfbFramebufferUpdateRectHeader *pfburh,HRGN
 	// Verify buffer space for cache rects list
 	CheckZipBufferSize(numRawBytes+500);
 
-	if (ultraVncZlib->decompress(numCompBytes, numRawBytes, (unsigned char *)m_netbuf, m_zlibbuf, zstd) != Z_OK)
+	UINT avail_out = numRawBytes + 500;
+	if (ultraVncZlib->decompress(numCompBytes, avail_out, (unsigned char *)m_netbuf, m_zipbuf, zstd) != Z_OK)
 		return;
 
-	BYTE* pzipbuf = m_zipbuf;
-	for (UINT ii = 0 ; ii < nNbCacheRects; ii++)
+	const BYTE *pzipbuf = m_zipbuf;
+	const BYTE *zipend = m_zipbuf + numRawBytes + 500 - avail_out;
+	PackedRect pr;
+	for (UINT ii = 0 ; ii < nNbCacheRects && NextPackedRect(pzipbuf, zipend, m_myFormat.bitsPerPixel / 8, pr); ii++)
 	{
-		rfbFramebufferUpdateRectHeader surh;
-		memcpy((char *) &surh,pzipbuf, sz_rfbFramebufferUpdateRectHeader);
-		surh.r.x = Swap16IfLE(surh.r.x);
-		surh.r.y = Swap16IfLE(surh.r.y);
-		surh.r.w = Swap16IfLE(surh.r.w);
-		surh.r.h = Swap16IfLE(surh.r.h);
-		surh.encoding = Swap32IfLE(surh.encoding);
-		pzipbuf += sz_rfbFramebufferUpdateRectHeader;
-
 		RECT rect;
-		rect.left = surh.r.x;
-		rect.right = surh.r.x + surh.r.w;
-		rect.top = surh.r.y;
-		rect.bottom = surh.r.y + surh.r.h;
+		rect.left = pr.x;
+		rect.right = pr.x + pr.w;
+		rect.top = pr.y;
+		rect.bottom = pr.y + pr.h;
 
 		SoftCursorLockArea(rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top);
 		SaveArea(rect);
-		if ( surh.encoding==rfbEncodingRaw) {
-			UINT numpixels = surh.r.w * surh.r.h;
-			omni_mutex_lock l(m_bitmapdcMutex);						  
+		{
+			omni_mutex_lock l(m_bitmapdcMutex);
 
 			// This big switch is untidy but fast
 			switch (m_myFormat.bitsPerPixel) {
 				case 8:
-					SETPIXELS(pzipbuf, 8, surh.r.x, surh.r.y, surh.r.w, surh.r.h)
+					SETPIXELS(pr.pixels, 8, pr.x, pr.y, pr.w, pr.h)
 						break;
 				case 16:
-					SETPIXELS(pzipbuf, 16, surh.r.x, surh.r.y, surh.r.w, surh.r.h)
+					SETPIXELS(pr.pixels, 16, pr.x, pr.y, pr.w, pr.h)
 						break;
 				case 24:
 				case 32:
-					SETPIXELS(pzipbuf, 32, surh.r.x, surh.r.y, surh.r.w, surh.r.h)            
+					SETPIXELS(pr.pixels, 32, pr.x, pr.y, pr.w, pr.h)
 						break;
 				default:
 					vnclog.Print(0, _T("Invalid number of bits per pixel: %d\n"), m_myFormat.bitsPerPixel);
 			}
-			pzipbuf +=numpixels*m_myFormat.bitsPerPixel/8;
-			if (!m_opts->m_Directx)InvalidateRegion(&rect,prgn);
 		}
+		if (!m_opts->m_Directx)InvalidateRegion(&rect,prgn);
 	}
 }
\ No newline at end of file
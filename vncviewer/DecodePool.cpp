@@ -0,0 +1,243 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+#include "stdhdrs.h"
+#include "vncviewer.h"
+#include "ClientConnection.h"
+#include "DecodePool.h"
+
+// Buffers larger than this are not kept around for the next rect
+#define DECODE_KEEP_BUFFER (8 * 1024 * 1024)
+#define DECODE_STATS_MS 10000
+
+class DecodeWorker : public omni_thread
+{
+public:
+	DecodeWorker(DecodePool *pool) : m_pool(pool) {};
+	void Start() { start_undetached(); };
+protected:
+	virtual void *run_undetached(void *arg) {
+		m_pool->WorkerLoop();
+		return NULL;
+	};
+	DecodePool *m_pool;
+};
+
+static LONGLONG Ticks()
+{
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return t.QuadPart;
+}
+
+DecodePool::DecodePool()
+	: m_workSignal(&m_lock), m_doneSignal(&m_lock)
+{
+	m_cc = NULL;
+	m_nworkers = 0;
+	m_running = false;
+	m_outstanding = 0;
+	LARGE_INTEGER f;
+	QueryPerformanceFrequency(&f);
+	m_freq = f.QuadPart > 0 ? f.QuadPart : 1;
+	m_decodeTicks = 0;
+	m_waitTicks = 0;
+	m_rects = 0;
+	m_bytes = 0;
+	m_drains = 0;
+	m_lastLog = GetTickCount();
+}
+
+DecodePool::~DecodePool()
+{
+	Stop();
+	for (size_t i = 0; i < m_free.size(); i++)
+		delete m_free[i];
+	m_free.clear();
+}
+
+void DecodePool::Start(ClientConnection *cc, int nthreads)
+{
+	if (m_nworkers > 0 || nthreads <= 0)
+		return;
+	m_cc = cc;
+	m_running = true;
+	for (int i = 0; i < nthreads; i++) {
+		DecodeWorker *worker = new DecodeWorker(this);
+		m_workers.push_back(worker);
+		worker->Start();
+	}
+	m_nworkers = nthreads;
+	vnclog.Print(2, _T("Decode pool started, %d threads\n"), nthreads);
+}
+
+void DecodePool::Stop()
+{
+	if (m_nworkers == 0)
+		return;
+	Drain();
+	{
+		omni_mutex_lock l(m_lock);
+		m_running = false;
+		m_workSignal.broadcast();
+	}
+	// join() deletes the thread objects
+	for (size_t i = 0; i < m_workers.size(); i++)
+		m_workers[i]->join(NULL);
+	m_workers.clear();
+	m_nworkers = 0;
+}
+
+DecodeJob *DecodePool::GetJob(int encoding, int x, int y, int w, int h)
+{
+	DecodeJob *job = NULL;
+	{
+		omni_mutex_lock l(m_lock);
+		if (!m_free.empty()) {
+			job = m_free.back();
+			m_free.pop_back();
+		}
+	}
+	if (job == NULL)
+		job = new DecodeJob;
+	job->encoding = encoding;
+	job->x = x;
+	job->y = y;
+	job->w = w;
+	job->h = h;
+	job->data.clear();
+	return job;
+}
+
+void DecodePool::Release(DecodeJob *job)
+{
+	omni_mutex_lock l(m_lock);
+	m_free.push_back(job);
+}
+
+void DecodePool::Submit(DecodeJob *job)
+{
+	RECT r;
+	r.left = job->x;
+	r.top = job->y;
+	r.right = job->x + job->w;
+	r.bottom = job->y + job->h;
+	m_areas.push_back(r);
+	m_rects++;
+	m_bytes += (DWORD)job->data.size();
+
+	omni_mutex_lock l(m_lock);
+	// Enough queued to keep every worker busy, let the reader wait
+	if (m_outstanding >= 2 * m_nworkers + 2) {
+		LONGLONG start = Ticks();
+		while (m_outstanding >= 2 * m_nworkers + 2)
+			m_doneSignal.wait();
+		m_waitTicks += Ticks() - start;
+	}
+	m_queue.push_back(job);
+	m_outstanding++;
+	m_workSignal.signal();
+}
+
+bool DecodePool::Overlaps(int x, int y, int w, int h)
+{
+	for (size_t i = 0; i < m_areas.size(); i++) {
+		const RECT &r = m_areas[i];
+		if (x < r.right && r.left < x + w && y < r.bottom && r.top < y + h)
+			return true;
+	}
+	return false;
+}
+
+void DecodePool::Drain()
+{
+	if (m_areas.empty())
+		return;
+	{
+		omni_mutex_lock l(m_lock);
+		if (m_outstanding > 0) {
+			LONGLONG start = Ticks();
+			while (m_outstanding > 0)
+				m_doneSignal.wait();
+			m_waitTicks += Ticks() - start;
+		}
+	}
+	m_areas.clear();
+	m_drains++;
+
+	if (GetTickCount() - m_lastLog >= DECODE_STATS_MS)
+		LogStats();
+}
+
+void DecodePool::WorkerLoop()
+{
+	DecodeContext ctx;
+	omni_mutex_lock l(m_lock);
+	while (m_running) {
+		if (m_queue.empty()) {
+			m_workSignal.wait();
+			continue;
+		}
+		DecodeJob *job = m_queue.front();
+		m_queue.pop_front();
+
+		m_lock.unlock();
+		LONGLONG start = Ticks();
+		m_cc->RunDecodeJob(job, ctx);
+		LONGLONG ticks = Ticks() - start;
+		if (job->data.capacity() > DECODE_KEEP_BUFFER)
+			std::vector<BYTE>().swap(job->data);
+		if (ctx.scratch.capacity() > DECODE_KEEP_BUFFER)
+			std::vector<BYTE>().swap(ctx.scratch);
+		m_lock.lock();
+
+		m_decodeTicks += ticks;
+		if (m_free.size() < (size_t)(4 * m_nworkers + 4))
+			m_free.push_back(job);
+		else
+			delete job;
+		m_outstanding--;
+		m_doneSignal.broadcast();
+	}
+}
+
+void DecodePool::LogStats()
+{
+	DWORD now = GetTickCount();
+	LONGLONG decodeTicks;
+	{
+		omni_mutex_lock l(m_lock);
+		decodeTicks = m_decodeTicks;
+		m_decodeTicks = 0;
+	}
+	vnclog.Print(2, _T("Decode pool: %lu rects, %lu KB in %lu updates over %lu ms, decode %lu ms on %d threads, network thread waited %lu ms\n"),
+		m_rects, m_bytes / 1024, m_drains, now - m_lastLog,
+		(DWORD)(decodeTicks * 1000 / m_freq), m_nworkers,
+		(DWORD)(m_waitTicks * 1000 / m_freq));
+	m_rects = 0;
+	m_bytes = 0;
+	m_drains = 0;
+	m_waitTicks = 0;
+	m_lastLog = now;
+}
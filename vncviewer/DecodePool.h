@@ -0,0 +1,140 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// DecodePool
+//
+// Worker threads that decode framebuffer update rectangles off the
+// network thread. The network thread stays the reader: it frames each
+// independent rect (one whose length is known up front and which only
+// writes its own area) into a DecodeJob and submits it. Everything else,
+// CopyRect, caches and the stateful zlib/zstd streams, is still decoded in
+// order on the network thread, after the pending jobs it could collide
+// with have been drained.
+
+#ifndef DECODEPOOL_H__
+#define DECODEPOOL_H__
+#pragma once
+
+#include "stdhdrs.h"
+#include "omnithread/omnithread.h"
+#include <deque>
+#include <vector>
+#ifdef _INTERNALLIB
+#include <turbojpeg.h>
+#else
+#include "libjpeg-turbo-win/turbojpeg.h"
+#endif
+
+class ClientConnection;
+class DecodeWorker;
+
+struct DecodeJob
+{
+	int encoding;
+	int x, y, w, h;
+	std::vector<BYTE> data;		// rect payload as it came off the wire
+};
+
+// Decoder state owned by one thread, each worker has its own and so has
+// the network thread, so decoders never share anything
+struct DecodeContext
+{
+	DecodeContext() : jpeg(NULL) {};
+	~DecodeContext() { if (jpeg) tjDestroy(jpeg); };
+	tjhandle JpegHandle() { if (!jpeg) jpeg = tjInitDecompress(); return jpeg; };
+
+	tjhandle jpeg;
+	std::vector<BYTE> scratch;	// decoder output on its way to the DIB
+private:
+	DecodeContext(const DecodeContext &);
+	DecodeContext &operator=(const DecodeContext &);
+};
+
+class DecodePool
+{
+public:
+	DecodePool();
+	~DecodePool();
+
+	// nthreads workers decoding for cc, 0 leaves decoding inline
+	void Start(ClientConnection *cc, int nthreads);
+	void Stop();
+	bool Active() { return m_nworkers > 0; };
+
+	// Network thread only from here on
+	// A free job for the rect, handed back with Submit or Release
+	DecodeJob *GetJob(int encoding, int x, int y, int w, int h);
+	// Queue the job, blocks while too many are already queued
+	void Submit(DecodeJob *job);
+	// Give back a job that was not submitted
+	void Release(DecodeJob *job);
+	// Jobs submitted since the last Drain
+	bool Pending() { return !m_areas.empty(); };
+	// Does the area touch one of them
+	bool Overlaps(int x, int y, int w, int h);
+	// Wait until every submitted job has been written to the DIB
+	void Drain();
+
+protected:
+	friend class DecodeWorker;
+	void WorkerLoop();
+	void LogStats();
+
+	ClientConnection	*m_cc;
+	std::vector<DecodeWorker *> m_workers;
+	int					m_nworkers;
+	volatile bool		m_running;
+
+	omni_mutex			m_lock;
+	omni_condition		m_workSignal;	// a job was queued, or stopping
+	omni_condition		m_doneSignal;	// a job finished
+	std::deque<DecodeJob *> m_queue;
+	std::vector<DecodeJob *> m_free;
+	int					m_outstanding;	// queued or running
+
+	std::vector<RECT>	m_areas;
+
+	// Stats, logged every 10 s
+	LONGLONG			m_freq;
+	LONGLONG			m_decodeTicks;	// worker time spent decoding
+	LONGLONG			m_waitTicks;	// network thread time blocked on the pool
+	DWORD				m_rects;
+	DWORD				m_bytes;
+	DWORD				m_drains;
+	DWORD				m_lastLog;
+};
+
+// Drains the pool when it goes out of scope, also when a read throws
+// halfway through an update
+class DecodeDrain
+{
+public:
+	DecodeDrain(DecodePool &pool) : m_pool(pool) {};
+	~DecodeDrain() { m_pool.Drain(); };
+private:
+	DecodePool &m_pool;
+	DecodeDrain &operator=(const DecodeDrain &);
+};
+
+#endif // DECODEPOOL_H__
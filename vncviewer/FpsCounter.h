@@ -1,4 +1,5 @@
 #include <Windows.h>
+#include <stdio.h>
 
 class Interval
 {
@@ -58,4 +59,20 @@ public:
     {
         return m_fps;
     }
-};
\ No newline at end of file
+};
+
+// Updates decoded versus frames put on the screen. Presents are paced to
+// the display refresh, so with a busy server the second stays at or under
+// the refresh rate while the first can be much higher.
+class FrameRates
+{
+public:
+    Fps decoded;
+    Fps presented;
+
+    // "decoded / presented", for the status window
+    void format(char *buf, size_t len) const
+    {
+        _snprintf_s(buf, len, _TRUNCATE, "%u / %u", decoded.get(), presented.get());
+    }
+};
@@ -0,0 +1,248 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+#include "stdhdrs.h"
+#include "LatencyMeter.h"
+
+// How near a click an update has to draw to answer it, in pixels
+#define CLICK_AREA 48
+
+static const char *seriesNames[LATENCY_SERIES] = {
+	"key decoded", "key shown", "click decoded", "click shown", "request", "server"
+};
+
+void LatencyHistogram::Reset()
+{
+	memset(m_buckets, 0, sizeof(m_buckets));
+	m_count = 0;
+}
+
+void LatencyHistogram::Add(DWORD ms)
+{
+	m_buckets[ms < LATENCY_MAX_MS ? ms : LATENCY_MAX_MS]++;
+	m_count++;
+}
+
+DWORD LatencyHistogram::Percentile(int p) const
+{
+	if (m_count == 0)
+		return 0;
+	// The sample at rank ceil(count * p / 100)
+	DWORD rank = (DWORD)(((ULONGLONG)m_count * p + 99) / 100);
+	if (rank == 0)
+		rank = 1;
+	DWORD seen = 0;
+	for (int ms = 0; ms <= LATENCY_MAX_MS; ms++) {
+		seen += m_buckets[ms];
+		if (seen >= rank)
+			return ms;
+	}
+	return LATENCY_MAX_MS;
+}
+
+LatencyMeter::LatencyMeter()
+{
+	LARGE_INTEGER f;
+	QueryPerformanceFrequency(&f);
+	m_freq = f.QuadPart > 0 ? f.QuadPart : 1;
+	m_generation = 0;
+	Reset();
+}
+
+void LatencyMeter::Reset()
+{
+	omni_mutex_lock l(m_lock);
+	memset(&m_key, 0, sizeof(m_key));
+	memset(&m_click, 0, sizeof(m_click));
+	m_requestSent = 0;
+	for (int i = 0; i < LATENCY_SERIES; i++)
+		m_hist[i].Reset();
+}
+
+LONGLONG LatencyMeter::Now()
+{
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return t.QuadPart;
+}
+
+DWORD LatencyMeter::Ms(LONGLONG from, LONGLONG to)
+{
+	return to > from ? (DWORD)((to - from) * 1000 / m_freq) : 0;
+}
+
+// m_lock held. An answer that never came isn't a latency, just forget it.
+void LatencyMeter::Expire(Sample &s, LONGLONG now)
+{
+	if (s.waiting && Ms(s.sent, now) > LATENCY_MAX_MS)
+		s.waiting = false;
+}
+
+// m_lock held. area NULL for anywhere.
+void LatencyMeter::Start(Sample &s, const RECT *area)
+{
+	LONGLONG now = Now();
+	Expire(s, now);
+	if (s.waiting)
+		return;
+	s.waiting = true;
+	s.touched = false;
+	s.decoded = false;
+	s.sent = now;
+	if (area)
+		s.area = *area;
+	else
+		SetRect(&s.area, 0, 0, 0x7fff, 0x7fff);
+}
+
+void LatencyMeter::KeySent()
+{
+	omni_mutex_lock l(m_lock);
+	Start(m_key, NULL);
+}
+
+void LatencyMeter::ClickSent(int x, int y)
+{
+	omni_mutex_lock l(m_lock);
+	RECT area;
+	SetRect(&area, x - CLICK_AREA, y - CLICK_AREA, x + CLICK_AREA, y + CLICK_AREA);
+	Start(m_click, &area);
+}
+
+void LatencyMeter::RequestSent()
+{
+	omni_mutex_lock l(m_lock);
+	if (m_requestSent == 0)
+		m_requestSent = Now();
+}
+
+void LatencyMeter::UpdateStarted()
+{
+	omni_mutex_lock l(m_lock);
+	if (m_requestSent != 0) {
+		m_hist[latencyRequest].Add(Ms(m_requestSent, Now()));
+		m_requestSent = 0;
+	}
+}
+
+void LatencyMeter::RectReceived(const RECT &r)
+{
+	omni_mutex_lock l(m_lock);
+	RECT i;
+	if (m_key.waiting && !m_key.decoded && IntersectRect(&i, &m_key.area, &r))
+		m_key.touched = true;
+	if (m_click.waiting && !m_click.decoded && IntersectRect(&i, &m_click.area, &r))
+		m_click.touched = true;
+}
+
+void LatencyMeter::ServerTiming(DWORD ms)
+{
+	omni_mutex_lock l(m_lock);
+	m_hist[latencyServer].Add(ms);
+}
+
+void LatencyMeter::UpdateDecoded()
+{
+	omni_mutex_lock l(m_lock);
+	LONGLONG now = Now();
+	m_generation++;
+	Sample *samples[2] = { &m_key, &m_click };
+	LatencySeries series[2] = { latencyKeyDecoded, latencyClickDecoded };
+	for (int i = 0; i < 2; i++) {
+		Sample &s = *samples[i];
+		Expire(s, now);
+		if (s.waiting && s.touched && !s.decoded) {
+			s.decoded = true;
+			s.generation = m_generation;
+			s.decodedAt = now;
+			m_hist[series[i]].Add(Ms(s.sent, now));
+		}
+	}
+}
+
+DWORD LatencyMeter::Generation()
+{
+	omni_mutex_lock l(m_lock);
+	return m_generation;
+}
+
+void LatencyMeter::Presented(DWORD generation)
+{
+	omni_mutex_lock l(m_lock);
+	LONGLONG now = Now();
+	Sample *samples[2] = { &m_key, &m_click };
+	LatencySeries series[2] = { latencyKeyShown, latencyClickShown };
+	for (int i = 0; i < 2; i++) {
+		Sample &s = *samples[i];
+		if (s.waiting && s.decoded && (LONG)(generation - s.generation) >= 0) {
+			m_hist[series[i]].Add(Ms(s.sent, now));
+			s.waiting = false;
+		}
+	}
+}
+
+void LatencyMeter::Format(char *buf, size_t len)
+{
+	omni_mutex_lock l(m_lock);
+	const LatencyHistogram &key = m_hist[latencyKeyShown];
+	const LatencyHistogram &click = m_hist[latencyClickShown];
+	if (key.Count() == 0 && click.Count() == 0) {
+		_snprintf_s(buf, len, _TRUNCATE, "-");
+		return;
+	}
+	_snprintf_s(buf, len, _TRUNCATE, "%u/%u/%u, %u/%u/%u ms",
+		key.Percentile(50), key.Percentile(95), key.Percentile(99),
+		click.Percentile(50), click.Percentile(95), click.Percentile(99));
+}
+
+bool LatencyMeter::Export(const char *filename)
+{
+	omni_mutex_lock l(m_lock);
+	FILE *f;
+	if (fopen_s(&f, filename, "w") != 0 || f == NULL)
+		return false;
+
+	fprintf(f, "series,count,p50,p95,p99\n");
+	for (int i = 0; i < LATENCY_SERIES; i++)
+		fprintf(f, "%s,%u,%u,%u,%u\n", seriesNames[i], m_hist[i].Count(),
+			m_hist[i].Percentile(50), m_hist[i].Percentile(95), m_hist[i].Percentile(99));
+
+	// Only the ms anything took, the last row is LATENCY_MAX_MS and over
+	fprintf(f, "\nms");
+	for (int i = 0; i < LATENCY_SERIES; i++)
+		fprintf(f, ",%s", seriesNames[i]);
+	fprintf(f, "\n");
+	for (int ms = 0; ms <= LATENCY_MAX_MS; ms++) {
+		DWORD any = 0;
+		for (int i = 0; i < LATENCY_SERIES; i++)
+			any += m_hist[i].Bucket(ms);
+		if (any == 0)
+			continue;
+		fprintf(f, "%d", ms);
+		for (int i = 0; i < LATENCY_SERIES; i++)
+			fprintf(f, ",%u", m_hist[i].Bucket(ms));
+		fprintf(f, "\n");
+	}
+	return fclose(f) == 0;
+}
@@ -0,0 +1,131 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// LatencyMeter
+//
+// Input to screen latency. The viewer notes when it sends a key press, a
+// mouse button press and a FramebufferUpdateRequest. A press is answered
+// by the first update that draws near where it happened (anywhere, for a
+// key), which is when it counts as decoded; the first paint after that
+// update's region was handed to the window is when it was shown. Updates
+// are numbered as they are decoded so a paint of something else in
+// between, the soft cursor say, doesn't count. A request is answered by
+// the next update to arrive. A press nothing answers within
+// LATENCY_MAX_MS is dropped. Servers that know rfbEncodingServerTiming
+// also say how long they held on to the input before sending the update,
+// the rest is network and viewer. Only the first press is timed while
+// one is waiting for its answer.
+
+#ifndef LATENCYMETER_H__
+#define LATENCYMETER_H__
+#pragma once
+
+#include "stdhdrs.h"
+#include "omnithread/omnithread.h"
+
+#define LATENCY_MAX_MS 2000
+
+enum LatencySeries
+{
+	latencyKeyDecoded,
+	latencyKeyShown,
+	latencyClickDecoded,
+	latencyClickShown,
+	latencyRequest,			// FramebufferUpdateRequest to update
+	latencyServer,			// what the server reported
+	LATENCY_SERIES
+};
+
+// Counts in 1 ms buckets, the last one for LATENCY_MAX_MS and over
+class LatencyHistogram
+{
+public:
+	LatencyHistogram() { Reset(); };
+	void Reset();
+	void Add(DWORD ms);
+	DWORD Count() const { return m_count; };
+	DWORD Bucket(int ms) const { return m_buckets[ms]; };
+	// Smallest ms that p percent of the samples are at or under
+	DWORD Percentile(int p) const;
+
+private:
+	DWORD m_buckets[LATENCY_MAX_MS + 1];
+	DWORD m_count;
+};
+
+class LatencyMeter
+{
+public:
+	LatencyMeter();
+	void Reset();
+
+	// Window thread, as the event goes out. x, y in framebuffer coordinates.
+	void KeySent();
+	void ClickSent(int x, int y);
+	void RequestSent();
+
+	// Network thread: a FramebufferUpdate starts, one of its rects, what
+	// the server reported, all of it decoded
+	void UpdateStarted();
+	void RectReceived(const RECT &r);
+	void ServerTiming(DWORD ms);
+	void UpdateDecoded();
+	// Number of the last update UpdateDecoded() saw
+	DWORD Generation();
+
+	// Window thread, after a paint. generation is the last update whose
+	// region had been invalidated for it.
+	void Presented(DWORD generation);
+
+	// p50/p95/p99 of key and click to shown, "12/30/55, 20/41/90 ms"
+	void Format(char *buf, size_t len);
+	// CSV, percentiles and then the histograms
+	bool Export(const char *filename);
+
+private:
+	struct Sample
+	{
+		bool waiting;
+		bool touched;		// by a rect of the update being read
+		bool decoded;
+		DWORD generation;	// of the update that decoded it
+		LONGLONG sent;
+		LONGLONG decodedAt;
+		RECT area;
+	};
+	void Start(Sample &s, const RECT *area);
+	void Expire(Sample &s, LONGLONG now);
+	DWORD Ms(LONGLONG from, LONGLONG to);
+	static LONGLONG Now();
+
+	omni_mutex m_lock;
+	LONGLONG m_freq;
+	Sample m_key;
+	Sample m_click;
+	LONGLONG m_requestSent;		// 0 if none is outstanding
+	DWORD m_generation;
+	LatencyHistogram m_hist[LATENCY_SERIES];
+};
+
+#endif
@@ -251,6 +251,8 @@ VNCOptions::VNCOptions()
 	m_keepAliveInterval = KEEPALIVE_INTERVAL;
 	m_IdleInterval = 0;
 	m_throttleMouse = 0; // adzm 2010-10
+	m_maxFPS = 0;
+	m_decodeThreads = 0;
 	setDefaultOptionsFileName(m_optionfile);
 	LoadOptions(getDefaultOptionsFileName());
 }
@@ -429,6 +431,8 @@ VNCOptions& VNCOptions::operator=(VNCOptions& s)
 	m_IdleInterval = s.m_IdleInterval;
 
 	m_throttleMouse = s.m_throttleMouse; // adzm 2010-10
+	m_maxFPS = s.m_maxFPS;
+	m_decodeThreads = s.m_decodeThreads;
 
 #ifdef _Gii
 	m_giiEnable = s.m_giiEnable;
@@ -1014,6 +1018,32 @@ void VNCOptions::SetFromCommandLine(LPTSTR szCmdLine) {
 				continue;
 			}
 		}
+		else if (SwitchMatch(args[j], _T("maxfps")))
+		{
+			if (++j == i) {
+				ArgError(sz_D22);
+				continue;
+			}
+			if (_stscanf_s(args[j], _T("%d"), &m_maxFPS) != 1) {
+				ArgError(sz_D23);
+				continue;
+			}
+			if (m_maxFPS < 0) m_maxFPS = 0;
+			if (m_maxFPS > 255) m_maxFPS = 255;
+		}
+		else if (SwitchMatch(args[j], _T("decodethreads")))
+		{
+			if (++j == i) {
+				ArgError(sz_D22);
+				continue;
+			}
+			if (_stscanf_s(args[j], _T("%d"), &m_decodeThreads) != 1) {
+				ArgError(sz_D23);
+				continue;
+			}
+			if (m_decodeThreads < 0) m_decodeThreads = 0;
+			if (m_decodeThreads > 16) m_decodeThreads = 16;
+		}
 		else
 		{
 			TCHAR phost[256];
@@ -1182,6 +1212,8 @@ void VNCOptions::SaveOptions(char* fname)
 	saveInt("KeepAliveInterval", m_keepAliveInterval, fname);
 
 	saveInt("ThrottleMouse", m_throttleMouse, fname); // adzm 2010-10
+	saveInt("MaxFPS", m_maxFPS, fname);
+	saveInt("DecodeThreads", m_decodeThreads, fname);
 
 	//adzm 2009-06-21
 	saveInt("AutoAcceptIncoming", m_fAutoAcceptIncoming, fname);
@@ -1287,6 +1319,12 @@ void VNCOptions::LoadOptions(char* fname)
 		m_keepAliveInterval = (m_FTTimeout - KEEPALIVE_HEADROOM);
 
 	m_throttleMouse = readInt("ThrottleMouse", m_throttleMouse, fname); // adzm 2010-10
+	m_maxFPS = readInt("MaxFPS", m_maxFPS, fname);
+	if (m_maxFPS < 0) m_maxFPS = 0;
+	if (m_maxFPS > 255) m_maxFPS = 255;
+	m_decodeThreads = readInt("DecodeThreads", m_decodeThreads, fname);
+	if (m_decodeThreads < 0) m_decodeThreads = 0;
+	if (m_decodeThreads > 16) m_decodeThreads = 16;
 
 #ifdef _Gii
 	m_giiEnable = readInt("GiiEnable", (int)m_giiEnable, fname) ? true : false;
@@ -1326,6 +1364,7 @@ void VNCOptions::ShowUsage(LPTSTR info) {
 			"      [/encodings xz zrle ...]  (in order of priority)\r\n"
 			"      [/autoacceptincoming] [/autoacceptnodsm] [/disablesponsor][/InfoMsg \"Messages need quotes\"]\r\n" //adzm 2009-06-21, adzm 2009-07-19
 			"      [/requireencryption] [/enablecache] [/throttlemouse n] [/socketkeepalivetimeout n]\r\n" //adzm 2010-05-12
+			"      [/maxfps n] [/decodethreads n]\r\n"
 			"For full details see documentation."),
 		tmpinf);
 	MessageBox(NULL, msg, sz_A2, MB_OK | MB_ICONINFORMATION | MB_TOPMOST);
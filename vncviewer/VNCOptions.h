@@ -87,6 +87,8 @@ public:
 	bool	m_DisableClipboard;
 	int     m_localCursor;
 	int     m_throttleMouse; // adzm 2010-10
+	int     m_maxFPS; // update rate cap requested from the server, 0 = none
+	int     m_decodeThreads; // rect decode threads, 0 = decode on the network thread
 	bool	m_scaling;
 	bool    m_fAutoScaling;
 	bool    m_fAutoScalingEven;
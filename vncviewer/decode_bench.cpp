@@ -0,0 +1,442 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Decode microbenchmark, not part of vncviewer.
+// Runs the real rfb/zrleDecode.h and the Raw copy both ways, through a
+// tile/rect buffer and straight into a 1920x1080 32 bit framebuffer:
+//   cl /O2 /EHsc /I.. decode_bench.cpp
+//   g++ -O2 -I.. decode_bench.cpp
+// Add /DZRLE_NO_SIMD (-DZRLE_NO_SIMD) for the plain C++ zrle kernels.
+// "decode_bench verify" decodes every content with every pixel variant
+// the viewer instantiates (8, 16, 15, 32, 24A and 24B) and checks that
+// both ways give the same framebuffer. "decode_bench digest" prints a
+// digest of each of those framebuffers; "decode_bench verify file" also
+// compares against digests printed by another build, to check that the
+// SIMD kernels decode exactly like the plain ones:
+//   g++ -O2 -DZRLE_NO_SIMD -I.. decode_bench.cpp -o decode_ref
+//   ./decode_ref digest > ref.txt
+//   g++ -O2 -I.. decode_bench.cpp -o decode_bench
+//   ./decode_bench verify ref.txt
+// "decode_bench file..." decodes recorded frames instead of generated
+// ones: each file holds the inflated ZRLE data of one 1920x1080 rect,
+// as the zlib stream hands it to the decoder.
+
+#include <rdr/InStream.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <chrono>
+
+typedef int BOOL;
+#define rfbZRLETileWidth 64
+#define rfbZRLETileHeight 64
+
+const int SCREEN_W = 1920;
+const int SCREEN_H = 1080;
+
+static unsigned int seed = 12345;
+static int rnd(int n) {
+	seed = seed * 1103515245 + 12345;
+	return (int)((seed >> 8) % (unsigned int)n);
+}
+
+// The encoded rect, playing both the socket and the zlib stream. It hands
+// out the data a buffer at a time, as ZlibInStream does.
+const int STREAM_BUFFER = 16384;
+
+class BufInStream : public rdr::InStream {
+public:
+	BufInStream(const std::vector<rdr::U8> &data) {
+		ptr = end = start = data.empty() ? NULL : &data[0];
+		last = start + data.size();
+	}
+	void setUnderlying(rdr::InStream *, int) {}
+	void reset() {}
+	int pos() { return (int)(ptr - start); }
+private:
+	int overrun(int itemSize, int nItems) {
+		if (last - ptr < itemSize) {
+			fprintf(stderr, "stream overrun\n");
+			exit(1);
+		}
+		end = last - ptr > STREAM_BUFFER ? ptr + STREAM_BUFFER : last;
+		if (itemSize * nItems > end - ptr)
+			nItems = (int)((end - ptr) / itemSize);
+		return nItems;
+	}
+	const rdr::U8 *start;
+	const rdr::U8 *last;
+};
+
+// The zrleDecode instances of zrle.cpp
+enum Variant { V8, V16, V15, V32, V24A, V24B, VARIANTS };
+
+static const struct {
+	const char *name;
+	int wireBytes;	// per pixel in the ZRLE stream
+	int fbBytes;	// per pixel in the framebuffer
+} variants[VARIANTS] = {
+	{ "8", 1, 1 }, { "16", 2, 2 }, { "15", 2, 2 }, { "32", 4, 4 }, { "24A", 3, 4 }, { "24B", 3, 4 }
+};
+
+class Decoder {
+public:
+	Decoder(Variant v = V32) : variant(v), fb(SCREEN_H * SCREEN_W * 4), netbuf(SCREEN_H * SCREEN_W * 4) {
+		direct = false;
+		zywrle_level = 0;
+	}
+
+	template <class myInStream>
+	void zrleDecode8NE(int x, int y, int w, int h, rdr::InStream *is, myInStream *zis, rdr::U8 *buf);
+	template <class myInStream>
+	void zrleDecode16LE(int x, int y, int w, int h, rdr::InStream *is, myInStream *zis, rdr::U16 *buf);
+	template <class myInStream>
+	void zrleDecode15LE(int x, int y, int w, int h, rdr::InStream *is, myInStream *zis, rdr::U16 *buf);
+	template <class myInStream>
+	void zrleDecode32LE(int x, int y, int w, int h, rdr::InStream *is, myInStream *zis, rdr::U32 *buf);
+	template <class myInStream>
+	void zrleDecode24ALE(int x, int y, int w, int h, rdr::InStream *is, myInStream *zis, rdr::U32 *buf);
+	template <class myInStream>
+	void zrleDecode24BLE(int x, int y, int w, int h, rdr::InStream *is, myInStream *zis, rdr::U32 *buf);
+
+	// The viewer side, as in ClientConnection
+	int PixelBytes() { return variants[variant].fbBytes; }
+	int DIBStride() { return SCREEN_W * PixelBytes(); }
+	rdr::U8 *DIBRect(int x, int y, int /*w*/, int /*h*/) {
+		return direct ? &fb[y * DIBStride() + x * PixelBytes()] : NULL;
+	}
+	void SetPixels(const void *src, int x, int y, int w, int h) {
+		const rdr::U8 *s = (const rdr::U8 *)src;
+		rdr::U8 *d = &fb[y * DIBStride() + x * PixelBytes()];
+		for (int row = 0; row < h; row++, s += w * PixelBytes(), d += DIBStride())
+			memcpy(d, s, w * PixelBytes());
+	}
+
+	void Zrle(const std::vector<rdr::U8> &data) {
+		BufInStream is(data);
+		BufInStream zis(data);
+		is.readU32();
+		zis.skip(4);
+		switch (variant) {
+		case V8:
+			zrleDecode8NE(0, 0, SCREEN_W, SCREEN_H, &is, &zis, (rdr::U8 *)&netbuf[0]);
+			break;
+		case V16:
+			zrleDecode16LE(0, 0, SCREEN_W, SCREEN_H, &is, &zis, (rdr::U16 *)&netbuf[0]);
+			break;
+		case V15:
+			zrleDecode15LE(0, 0, SCREEN_W, SCREEN_H, &is, &zis, (rdr::U16 *)&netbuf[0]);
+			break;
+		case V24A:
+			zrleDecode24ALE(0, 0, SCREEN_W, SCREEN_H, &is, &zis, (rdr::U32 *)&netbuf[0]);
+			break;
+		case V24B:
+			zrleDecode24BLE(0, 0, SCREEN_W, SCREEN_H, &is, &zis, (rdr::U32 *)&netbuf[0]);
+			break;
+		default:
+			zrleDecode32LE(0, 0, SCREEN_W, SCREEN_H, &is, &zis, (rdr::U32 *)&netbuf[0]);
+			break;
+		}
+	}
+
+	// FNV-1a of the framebuffer
+	unsigned long long Digest() {
+		unsigned long long h = 14695981039346656037ULL;
+		for (size_t i = 0; i < (size_t)SCREEN_W * SCREEN_H * PixelBytes(); i++)
+			h = (h ^ fb[i]) * 1099511628211ULL;
+		return h;
+	}
+	void Raw(const std::vector<rdr::U8> &data) {
+		BufInStream is(data);
+		rdr::U8 *dst = DIBRect(0, 0, SCREEN_W, SCREEN_H);
+		if (dst) {
+			for (int row = 0; row < SCREEN_H; row++, dst += DIBStride())
+				is.readBytes(dst, SCREEN_W * 4);
+			return;
+		}
+		is.readBytes(&netbuf[0], SCREEN_W * SCREEN_H * 4);
+		SetPixels(&netbuf[0], 0, 0, SCREEN_W, SCREEN_H);
+	}
+
+	Variant variant;
+	bool direct;
+	std::vector<rdr::U8> fb;
+	std::vector<rdr::U8> netbuf;
+
+	long zywrle_level;
+	int zywrleBuf[rfbZRLETileWidth * rfbZRLETileHeight];
+};
+
+#define ENDIAN_LITTLE 0
+#define ENDIAN_BIG 1
+#define ENDIAN_NO 2
+#define zrleDecode Decoder::zrleDecode
+#define IMAGE_DIRECT(x,y,w,h) ((PIXEL_T*)DIBRect(x,y,w,h))
+#define IMAGE_STRIDE (DIBStride() / (BPPOUT / 8))
+#define IMAGE_RECT(x,y,w,h,data) SetPixels(data,x,y,w,h)
+#define BPP 8
+#define ZYWRLE_ENDIAN ENDIAN_NO
+#include <rfb/zrleDecode.h>
+#undef BPP
+#undef ZYWRLE_ENDIAN
+#define BPP 16
+#define ZYWRLE_ENDIAN ENDIAN_LITTLE
+#include <rfb/zrleDecode.h>
+#undef BPP
+#define BPP 15
+#include <rfb/zrleDecode.h>
+#undef BPP
+#define BPP 32
+#include <rfb/zrleDecode.h>
+#define CPIXEL 24A
+#include <rfb/zrleDecode.h>
+#undef CPIXEL
+#define CPIXEL 24B
+#include <rfb/zrleDecode.h>
+#undef CPIXEL
+#undef BPP
+#undef ZYWRLE_ENDIAN
+#undef zrleDecode
+
+// Content, one ZRLE subencoding for every tile
+enum Content { SOLID, RAW, PACKED, PLAIN_RLE, PALETTE_RLE, MIXED };
+
+// Bytes per pixel in the stream being generated
+static int wireBytes = 4;
+
+static void pixel(std::vector<rdr::U8> &d) {
+	for (int i = 0; i < wireBytes; i++)
+		d.push_back((rdr::U8)rnd(256));
+}
+
+static void runLength(std::vector<rdr::U8> &d, int len) {
+	for (len -= 1; len >= 255; len -= 255)
+		d.push_back(255);
+	d.push_back((rdr::U8)len);
+}
+
+static std::vector<rdr::U8> zrleFrame(Content content) {
+	std::vector<rdr::U8> d(4, 0);	// length, unused here
+	for (int ty = 0; ty < SCREEN_H; ty += rfbZRLETileHeight) {
+		int th = SCREEN_H - ty < rfbZRLETileHeight ? SCREEN_H - ty : rfbZRLETileHeight;
+		for (int tx = 0; tx < SCREEN_W; tx += rfbZRLETileWidth) {
+			int tw = SCREEN_W - tx < rfbZRLETileWidth ? SCREEN_W - tx : rfbZRLETileWidth;
+			int mode = content == MIXED ? rnd(MIXED) : content;
+			if (mode == SOLID) {
+				d.push_back(1);
+				pixel(d);
+			} else if (mode == RAW) {
+				d.push_back(0);
+				for (int i = 0; i < tw * th; i++)
+					pixel(d);
+			} else if (mode == PACKED) {
+				int palSize = 2 + rnd(15);
+				int bppp = palSize > 4 ? 4 : palSize > 2 ? 2 : 1;
+				d.push_back((rdr::U8)palSize);
+				for (int i = 0; i < palSize; i++)
+					pixel(d);
+				for (int row = 0; row < th; row++) {
+					int byte = 0, nbits = 0;
+					for (int col = 0; col < tw; col++) {
+						byte = (byte << bppp) | rnd(palSize);
+						nbits += bppp;
+						if (nbits == 8) {
+							d.push_back((rdr::U8)byte);
+							byte = nbits = 0;
+						}
+					}
+					if (nbits)
+						d.push_back((rdr::U8)(byte << (8 - nbits)));
+				}
+			} else if (mode == PLAIN_RLE) {
+				d.push_back(128);
+				for (int left = tw * th; left > 0; ) {
+					int len = 1 + rnd(left < 200 ? left : 200);
+					pixel(d);
+					runLength(d, len);
+					left -= len;
+				}
+			} else {
+				int palSize = 2 + rnd(126);
+				d.push_back((rdr::U8)(128 | palSize));
+				for (int i = 0; i < palSize; i++)
+					pixel(d);
+				for (int left = tw * th; left > 0; ) {
+					int len = 1 + rnd(left < 40 ? left : 40);
+					if (len == 1) {
+						d.push_back((rdr::U8)rnd(palSize));
+					} else {
+						d.push_back((rdr::U8)(128 | rnd(palSize)));
+						runLength(d, len);
+					}
+					left -= len;
+				}
+			}
+		}
+	}
+	return d;
+}
+
+static std::vector<rdr::U8> rawFrame() {
+	std::vector<rdr::U8> d;
+	d.reserve(SCREEN_W * SCREEN_H * 4);
+	for (int i = 0; i < SCREEN_W * SCREEN_H; i++)
+		pixel(d);
+	return d;
+}
+
+static const char *contentName[] = { "solid", "raw", "packed", "plainrle", "palrle", "mixed" };
+
+// Best frame time, the others mostly measure the rest of the machine
+static double run(Decoder &dec, bool zrle, const std::vector<rdr::U8> &frame, int iterations) {
+	double best = 0;
+	for (int i = 0; i < iterations; i++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (zrle)
+			dec.Zrle(frame);
+		else
+			dec.Raw(frame);
+		std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+		double ms = std::chrono::duration<double, std::milli>(stop - start).count();
+		if (i == 0 || ms < best)
+			best = ms;
+	}
+	return best;
+}
+
+static void bench(const char *name, bool zrle, const std::vector<rdr::U8> &frame, int iterations) {
+	Decoder dec;
+	dec.direct = false;
+	run(dec, zrle, frame, 1);
+	double staged = run(dec, zrle, frame, iterations);
+	dec.direct = true;
+	run(dec, zrle, frame, 1);
+	double direct = run(dec, zrle, frame, iterations);
+	printf("%-5s %-9s %8.2f ms/frame staged %8.2f ms/frame direct %6.1f%% saved\n",
+		zrle ? "zrle" : "raw", name, staged, direct, 100.0 * (staged - direct) / staged);
+}
+
+// Decodes every content with every variant, the same streams in every
+// build. Returns the number of cases where staged and direct differ.
+static int decodeAll(unsigned long long digests[VARIANTS][MIXED + 1]) {
+	int failures = 0;
+	for (int v = 0; v < VARIANTS; v++) {
+		seed = 12345;
+		wireBytes = variants[v].wireBytes;
+		for (int c = SOLID; c <= MIXED; c++) {
+			std::vector<rdr::U8> frame = zrleFrame((Content)c);
+			Decoder staged((Variant)v), direct((Variant)v);
+			direct.direct = true;
+			memset(&staged.fb[0], 0x5a, staged.fb.size());
+			memset(&direct.fb[0], 0x5a, direct.fb.size());
+			staged.Zrle(frame);
+			direct.Zrle(frame);
+			if (staged.fb != direct.fb) {
+				printf("zrle %s %s: staged and direct framebuffers differ\n", variants[v].name, contentName[c]);
+				failures++;
+			}
+			digests[v][c] = direct.Digest();
+		}
+	}
+	wireBytes = 4;
+	return failures;
+}
+
+static int digest() {
+	unsigned long long digests[VARIANTS][MIXED + 1];
+	int failures = decodeAll(digests);
+	for (int v = 0; v < VARIANTS; v++)
+		for (int c = SOLID; c <= MIXED; c++)
+			printf("%s %s %016llx\n", variants[v].name, contentName[c], digests[v][c]);
+	return failures ? 1 : 0;
+}
+
+static int verify(const char *reference) {
+	unsigned long long digests[VARIANTS][MIXED + 1];
+	int failures = decodeAll(digests);
+	int cases = VARIANTS * (MIXED + 1);
+	printf("%d of %d cases differ between staged and direct\n", failures, cases);
+	if (reference == NULL)
+		return failures ? 1 : 0;
+
+	FILE *f = fopen(reference, "r");
+	if (f == NULL) {
+		perror(reference);
+		return 1;
+	}
+	int compared = 0, mismatches = 0;
+	char name[16], content[16];
+	unsigned long long ref;
+	while (fscanf(f, "%15s %15s %llx", name, content, &ref) == 3) {
+		for (int v = 0; v < VARIANTS; v++) {
+			for (int c = SOLID; c <= MIXED; c++) {
+				if (strcmp(name, variants[v].name) != 0 || strcmp(content, contentName[c]) != 0)
+					continue;
+				compared++;
+				if (digests[v][c] != ref) {
+					printf("zrle %s %s: differs from %s\n", name, content, reference);
+					mismatches++;
+				}
+			}
+		}
+	}
+	fclose(f);
+	printf("%d of %d cases differ from %s\n", mismatches, compared, reference);
+	if (compared != cases)
+		printf("%s covers %d of %d cases\n", reference, compared, cases);
+	return (failures || mismatches || compared != cases) ? 1 : 0;
+}
+
+static std::vector<rdr::U8> recordedFrame(const char *name) {
+	std::vector<rdr::U8> d(4, 0);
+	FILE *f = fopen(name, "rb");
+	if (f == NULL) {
+		perror(name);
+		exit(1);
+	}
+	rdr::U8 block[65536];
+	size_t n;
+	while ((n = fread(block, 1, sizeof(block), f)) > 0)
+		d.insert(d.end(), block, block + n);
+	fclose(f);
+	return d;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && strcmp(argv[1], "verify") == 0)
+		return verify(argc > 2 ? argv[2] : NULL);
+	if (argc > 1 && strcmp(argv[1], "digest") == 0)
+		return digest();
+	if (argc > 1) {
+		for (int i = 1; i < argc; i++)
+			bench(argv[i], true, recordedFrame(argv[i]), 20);
+		return 0;
+	}
+	bench("frame", false, rawFrame(), 50);
+	for (int c = SOLID; c <= MIXED; c++)
+		bench(contentName[c], true, zrleFrame((Content)c), 20);
+	return 0;
+}
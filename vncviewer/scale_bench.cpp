@@ -0,0 +1,202 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Scaler microbenchmark, not part of vncviewer.
+// Scales a 3840x2160 32 bit framebuffer with AreaScaler, all of it and
+// as damaged 64x64 tiles, and on Windows with StretchBlt in HALFTONE
+// mode as DoBlit did, in source Mpixel/s:
+//   cl /O2 /EHsc /I.. scale_bench.cpp AreaScaler.cpp gdi32.lib
+//   g++ -O2 -I.. scale_bench.cpp AreaScaler.cpp
+// Add /DSCALER_NO_SIMD (-DSCALER_NO_SIMD) for the plain C++ kernels.
+// "scale_bench verify" checks the scaler against an exact area average
+// and that scaling tile by tile gives the same as scaling the lot.
+
+#include "AreaScaler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+const int SCREEN_W = 3840;
+const int SCREEN_H = 2160;
+const int TILE = 64;
+
+static const struct { int n, d; } scales[] = { { 1, 2 }, { 2, 3 }, { 3, 4 }, { 4, 5 }, { 1, 4 }, { 1, 10 } };
+
+static unsigned int seed = 12345;
+static int rnd(int n) {
+	seed = seed * 1103515245 + 12345;
+	return (int)((seed >> 8) % (unsigned int)n);
+}
+
+// Something like a desktop: flat areas, gradients and noisy patches
+static void Fill(std::vector<rdr::U8> &fb)
+{
+	for (int y = 0; y < SCREEN_H; y++)
+		for (int x = 0; x < SCREEN_W; x++) {
+			rdr::U8 *p = &fb[((size_t)y * SCREEN_W + x) * 4];
+			if ((x / 256 + y / 256) % 3 == 0) {
+				p[0] = (rdr::U8)rnd(256); p[1] = (rdr::U8)rnd(256); p[2] = (rdr::U8)rnd(256);
+			} else {
+				p[0] = (rdr::U8)x; p[1] = (rdr::U8)y; p[2] = (rdr::U8)(x + y);
+			}
+			p[3] = 0;
+		}
+}
+
+static double Now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int Verify()
+{
+	std::vector<rdr::U8> fb((size_t)SCREEN_W * SCREEN_H * 4);
+	Fill(fb);
+	int failures = 0;
+	for (size_t s = 0; s < sizeof(scales) / sizeof(scales[0]); s++) {
+		int n = scales[s].n, d = scales[s].d;
+		AreaScaler scaler;
+		scaler.Setup(SCREEN_W, SCREEN_H, n, d);
+		int w = scaler.Width(), h = scaler.Height();
+		std::vector<rdr::U8> all((size_t)w * h * 4), tiled((size_t)w * h * 4);
+		int dx, dy, dw, dh;
+		scaler.Scale(&fb[0], SCREEN_W * 4, &all[0], w * 4, 0, 0, SCREEN_W, SCREEN_H, dx, dy, dw, dh);
+		for (int y = 0; y < SCREEN_H; y += TILE)
+			for (int x = 0; x < SCREEN_W; x += TILE)
+				scaler.Scale(&fb[0], SCREEN_W * 4, &tiled[0], w * 4, x, y, TILE, TILE, dx, dy, dw, dh);
+		if (all != tiled) {
+			printf("%d/%d: tiles differ from the whole frame\n", n, d);
+			failures++;
+		}
+		// Exact average over the area of every scaled pixel
+		int worst = 0;
+		for (int j = 0; j < h; j += 7)
+			for (int i = 0; i < w; i += 5)
+				for (int c = 0; c < 3; c++) {
+					double sum = 0;
+					for (int y = j * d / n; y <= ((j + 1) * d - 1) / n; y++)
+						for (int x = i * d / n; x <= ((i + 1) * d - 1) / n; x++) {
+							double ox = (x + 1.0) * n < (i + 1.0) * d ? (x + 1.0) * n : (i + 1.0) * d;
+							ox -= x * (double)n > i * (double)d ? x * (double)n : i * (double)d;
+							double oy = (y + 1.0) * n < (j + 1.0) * d ? (y + 1.0) * n : (j + 1.0) * d;
+							oy -= y * (double)n > j * (double)d ? y * (double)n : j * (double)d;
+							sum += fb[((size_t)y * SCREEN_W + x) * 4 + c] * ox * oy;
+						}
+					int want = (int)(sum / ((double)d * d) + 0.5);
+					int diff = abs(want - all[((size_t)j * w + i) * 4 + c]);
+					if (diff > worst)
+						worst = diff;
+				}
+		printf("%d/%d: %dx%d, at most %d off the exact average\n", n, d, w, h, worst);
+		if (worst > 2)
+			failures++;
+	}
+	printf(failures ? "FAILED\n" : "ok\n");
+	return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "verify") == 0)
+		return Verify();
+
+	std::vector<rdr::U8> fb((size_t)SCREEN_W * SCREEN_H * 4);
+	Fill(fb);
+	const double mpix = (double)SCREEN_W * SCREEN_H / 1e6;
+#ifdef SCALER_NO_SIMD
+	printf("AreaScaler, plain C++\n");
+#else
+	printf("AreaScaler\n");
+#endif
+	printf("%-6s %12s %12s %12s\n", "scale", "full frame", "64x64 tiles", "HALFTONE");
+
+	for (size_t s = 0; s < sizeof(scales) / sizeof(scales[0]); s++) {
+		int n = scales[s].n, d = scales[s].d;
+		AreaScaler scaler;
+		scaler.Setup(SCREEN_W, SCREEN_H, n, d);
+		int w = scaler.Width(), h = scaler.Height();
+		std::vector<rdr::U8> out((size_t)w * h * 4);
+		int dx, dy, dw, dh;
+
+		const int frames = 10;
+		double t = Now();
+		for (int f = 0; f < frames; f++)
+			scaler.Scale(&fb[0], SCREEN_W * 4, &out[0], w * 4, 0, 0, SCREEN_W, SCREEN_H, dx, dy, dw, dh);
+		double full = mpix * frames / (Now() - t);
+
+		// An update's worth of scattered damage, a tenth of the screen
+		const int tiles = SCREEN_W / TILE * SCREEN_H / TILE / 10;
+		t = Now();
+		for (int f = 0; f < frames * 10; f++)
+			for (int k = 0; k < tiles; k++)
+				scaler.Scale(&fb[0], SCREEN_W * 4, &out[0], w * 4,
+					rnd(SCREEN_W / TILE) * TILE, rnd(SCREEN_H / TILE) * TILE, TILE, TILE, dx, dy, dw, dh);
+		double tiled = (double)tiles * TILE * TILE / 1e6 * frames * 10 / (Now() - t);
+
+		double halftone = 0;
+#ifdef _WIN32
+		BITMAPINFO bi;
+		memset(&bi, 0, sizeof(bi));
+		bi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+		bi.bmiHeader.biPlanes = 1;
+		bi.bmiHeader.biBitCount = 32;
+		bi.bmiHeader.biCompression = BI_RGB;
+		HDC screen = GetDC(NULL);
+		HDC srcdc = CreateCompatibleDC(screen), dstdc = CreateCompatibleDC(screen);
+		void *bits;
+		bi.bmiHeader.biWidth = SCREEN_W;
+		bi.bmiHeader.biHeight = -SCREEN_H;
+		HBITMAP srcbm = CreateDIBSection(srcdc, &bi, DIB_RGB_COLORS, &bits, NULL, 0);
+		memcpy(bits, &fb[0], fb.size());
+		bi.bmiHeader.biWidth = w;
+		bi.bmiHeader.biHeight = -h;
+		HBITMAP dstbm = CreateDIBSection(dstdc, &bi, DIB_RGB_COLORS, &bits, NULL, 0);
+		HGDIOBJ oldsrc = SelectObject(srcdc, srcbm), olddst = SelectObject(dstdc, dstbm);
+		SetStretchBltMode(dstdc, HALFTONE);
+		SetBrushOrgEx(dstdc, 0, 0, NULL);
+		t = Now();
+		for (int f = 0; f < frames; f++)
+			StretchBlt(dstdc, 0, 0, w, h, srcdc, 0, 0, SCREEN_W, SCREEN_H, SRCCOPY);
+		GdiFlush();
+		halftone = mpix * frames / (Now() - t);
+		SelectObject(srcdc, oldsrc);
+		SelectObject(dstdc, olddst);
+		DeleteObject(srcbm);
+		DeleteObject(dstbm);
+		DeleteDC(srcdc);
+		DeleteDC(dstdc);
+		ReleaseDC(NULL, screen);
+#endif
+		char scale[16];
+		snprintf(scale, sizeof(scale), "%d/%d", n, d);
+		printf("%-6s %12.1f %12.1f %12.1f\n", scale, full, tiled, halftone);
+	}
+	printf("Mpixel/s of the source\n");
+	return 0;
+}
@@ -50,6 +50,8 @@
 #define WM_SENDKEEPALIVE WM_NOTIFYPLUGINSTREAMING+1
 #define WM_SOCKEVENT6 WM_SENDKEEPALIVE+1
 #define WM_SOCKEVENT4 WM_SENDKEEPALIVE+2
+// Decoded regions are waiting to be presented, see ClientConnection::Present
+#define WM_PRESENT WM_SENDKEEPALIVE+3
 
 // The Application
 extern VNCviewerApp *pApp;
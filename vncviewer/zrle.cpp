@@ -16,6 +16,14 @@
 #define ENDIAN_LITTLE 0
 #define ENDIAN_BIG 1
 #define ENDIAN_NO 2
+
+// Tiles are decoded straight into the DIB, the server sends our format
+#define IMAGE_DIRECT(x,y,w,h) ((PIXEL_T*)DIBRect(x,y,w,h))
+#define IMAGE_STRIDE (DIBStride() / (BPPOUT / 8))
+#define IMAGE_LOCK omni_mutex_lock l(m_bitmapdcMutex)
+#define TILE_DONE(x,y,w,h) \
+    if (initialupdate_counter < 4) if (!directx_used)InvalidateRect(m_hwndcn, NULL, FALSE)
+
 #define BPP 8
 #define ZYWRLE_ENDIAN ENDIAN_NO
 #define IMAGE_RECT(x,y,w,h,data)                \
@@ -57,6 +65,10 @@
 #undef BPP
 #undef ZYWRLE_ENDIAN
 #undef IMAGE_RECT
+#undef IMAGE_DIRECT
+#undef IMAGE_STRIDE
+#undef IMAGE_LOCK
+#undef TILE_DONE
 
 #undef zrleDecode
 
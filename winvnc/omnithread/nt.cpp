@@ -53,6 +53,377 @@ omni_mutex::~omni_mutex(void)
 }
 
 
+///////////////////////////////////////////////////////////////////////////
+//
+// Lock contention profiler
+//
+///////////////////////////////////////////////////////////////////////////
+
+//
+// Recording never takes a lock: each thread owns its table and dump()
+// reads the others' tables as they are. Counts may be off by the few
+// acquisitions in flight, which is fine for a profiler. A thread frees its
+// own table when it exits, or once the profiler is disabled and it holds
+// no profiled lock; while enabled the counts are folded into prof_retired
+// first, their history is part of the picture.
+// The periodic dump runs on a thread of its own, never under a lock that
+// is being profiled.
+// Histogram bucket b counts durations below 2^b microseconds.
+//
+
+#define PROF_SITES 1024
+#define PROF_BUCKETS 24
+#define PROF_FRAMES 32
+#define PROF_DUMP_LINES 40
+
+struct omni_prof_site {
+    unsigned __int64 count;
+    unsigned __int64 contended;
+    unsigned __int64 wait_total;	// QPC ticks
+    unsigned __int64 hold_total;
+    unsigned __int64 wait_max;
+    unsigned __int64 hold_max;
+    unsigned long wait_hist[PROF_BUCKETS];
+    unsigned long hold_hist[PROF_BUCKETS];
+};
+
+// A lock currently held by the thread
+struct omni_prof_frame {
+    omni_mutex* mutex;
+    int site;
+    __int64 start;
+    __int64 paused;	// time spent in a condition wait on this mutex
+};
+
+struct omni_prof_thread {
+    omni_prof_thread* next;
+    DWORD thread_id;
+    omni_prof_site* sites[PROF_SITES];
+    omni_prof_frame frames[PROF_FRAMES];
+    int depth;
+};
+
+volatile long omni_lock_profiler::enabled = 0;
+static __declspec(thread) omni_prof_thread* prof_self = NULL;
+static omni_prof_thread* prof_threads = NULL;
+static omni_prof_site* prof_retired = NULL;	// PROF_SITES, exited threads
+static CRITICAL_SECTION prof_crit;
+static volatile long prof_crit_init = 0;
+static DWORD prof_fls = FLS_OUT_OF_INDEXES;
+static __int64 prof_freq = 0;
+static __int64 prof_since = 0;
+static void (*prof_sink)(const char* line) = NULL;
+static HANDLE prof_dumper = NULL;
+static HANDLE prof_dumper_stop = NULL;
+
+__int64
+omni_lock_profiler::now(void)
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+static inline int
+prof_bucket(__int64 ticks)
+{
+    unsigned __int64 us = (unsigned __int64)ticks * 1000000 / prof_freq;
+    int b = 0;
+    while (b < PROF_BUCKETS - 1 && ((unsigned __int64)1 << b) <= us)
+	b++;
+    return b;
+}
+
+static omni_prof_site*
+prof_site(omni_prof_thread* t, int site)
+{
+    if (site < 0 || site >= PROF_SITES)
+	site = 0;
+    if (t->sites[site] == NULL)
+	t->sites[site] = (omni_prof_site*)calloc(1, sizeof(omni_prof_site));
+    return t->sites[site];
+}
+
+static void
+prof_add(omni_prof_site* total, const omni_prof_site* s)
+{
+    total->count += s->count;
+    total->contended += s->contended;
+    total->wait_total += s->wait_total;
+    total->hold_total += s->hold_total;
+    if (s->wait_max > total->wait_max) total->wait_max = s->wait_max;
+    if (s->hold_max > total->hold_max) total->hold_max = s->hold_max;
+    for (int b = 0; b < PROF_BUCKETS; b++) {
+	total->wait_hist[b] += s->wait_hist[b];
+	total->hold_hist[b] += s->hold_hist[b];
+    }
+}
+
+// Unlinks and frees a thread's table, on that thread
+static void
+prof_retire(omni_prof_thread* t)
+{
+    EnterCriticalSection(&prof_crit);
+    for (omni_prof_thread** p = &prof_threads; *p != NULL; p = &(*p)->next) {
+	if (*p == t) {
+	    *p = t->next;
+	    break;
+	}
+    }
+    if (omni_lock_profiler::enabled && prof_retired == NULL)
+	prof_retired = (omni_prof_site*)calloc(PROF_SITES, sizeof(omni_prof_site));
+    for (int i = 0; i < PROF_SITES; i++) {
+	if (t->sites[i] == NULL)
+	    continue;
+	if (omni_lock_profiler::enabled && prof_retired != NULL)
+	    prof_add(&prof_retired[i], t->sites[i]);
+	free(t->sites[i]);
+    }
+    LeaveCriticalSection(&prof_crit);
+    free(t);
+}
+
+// Called by Windows as a thread that recorded anything exits
+static void WINAPI
+prof_thread_exit(void* data)
+{
+    if (data != NULL)
+	prof_retire((omni_prof_thread*)data);
+}
+
+static omni_prof_thread*
+prof_thread(void)
+{
+    if (prof_self == NULL) {
+	omni_prof_thread* t = (omni_prof_thread*)calloc(1, sizeof(omni_prof_thread));
+	if (t == NULL)
+	    return NULL;
+	t->thread_id = GetCurrentThreadId();
+	EnterCriticalSection(&prof_crit);
+	t->next = prof_threads;
+	prof_threads = t;
+	LeaveCriticalSection(&prof_crit);
+	if (prof_fls != FLS_OUT_OF_INDEXES)
+	    FlsSetValue(prof_fls, t);
+	prof_self = t;
+    }
+    return prof_self;
+}
+
+static unsigned __stdcall
+prof_dump_loop(void* arg)
+{
+    DWORD interval = (DWORD)(ULONG_PTR)arg;
+    while (WaitForSingleObject(prof_dumper_stop, interval) == WAIT_TIMEOUT)
+	omni_lock_profiler::dump();
+    return 0;
+}
+
+static void
+prof_stop_dumper(void)
+{
+    if (prof_dumper == NULL)
+	return;
+    SetEvent(prof_dumper_stop);
+    WaitForSingleObject(prof_dumper, INFINITE);
+    CloseHandle(prof_dumper);
+    CloseHandle(prof_dumper_stop);
+    prof_dumper = NULL;
+    prof_dumper_stop = NULL;
+}
+
+void
+omni_lock_profiler::enable(unsigned long interval_ms, void (*sink)(const char* line))
+{
+    if (InterlockedExchange(&prof_crit_init, 1) == 0) {
+	InitializeCriticalSection(&prof_crit);
+	prof_fls = FlsAlloc(prof_thread_exit);
+    }
+    prof_stop_dumper();
+    EnterCriticalSection(&prof_crit);
+    if (prof_freq == 0) {
+	LARGE_INTEGER f;
+	QueryPerformanceFrequency(&f);
+	prof_freq = f.QuadPart;
+	prof_since = now();
+    }
+    prof_sink = sink;
+    LeaveCriticalSection(&prof_crit);
+    enabled = 1;
+
+    if (interval_ms != 0) {
+	prof_dumper_stop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	prof_dumper = (HANDLE)_beginthreadex(NULL, 0, prof_dump_loop, (void*)(ULONG_PTR)interval_ms, 0, NULL);
+	if (prof_dumper == NULL) {
+	    CloseHandle(prof_dumper_stop);
+	    prof_dumper_stop = NULL;
+	}
+    }
+}
+
+void
+omni_lock_profiler::disable(void)
+{
+    // Locks taken while enabled still release through the profiler, the
+    // threads holding them free their tables once they let go
+    enabled = 0;
+    if (InterlockedCompareExchange(&prof_crit_init, 1, 1) == 0)
+	return;
+    prof_stop_dumper();
+    EnterCriticalSection(&prof_crit);
+    free(prof_retired);
+    prof_retired = NULL;
+    LeaveCriticalSection(&prof_crit);
+}
+
+bool
+omni_lock_profiler::acquire(omni_mutex& m, int site)
+{
+    omni_prof_thread* t = prof_thread();
+    if (t == NULL) {
+	m.lock();
+	return false;
+    }
+
+    __int64 wait = 0;
+    bool contended = !TryEnterCriticalSection(&m.crit);
+    if (contended) {
+	__int64 t0 = now();
+	EnterCriticalSection(&m.crit);
+	wait = now() - t0;
+    }
+
+    omni_prof_site* s = prof_site(t, site);
+    if (s != NULL) {
+	s->count++;
+	if (contended) {
+	    s->contended++;
+	    s->wait_total += wait;
+	    if ((unsigned __int64)wait > s->wait_max)
+		s->wait_max = wait;
+	}
+	s->wait_hist[prof_bucket(wait)]++;
+    }
+
+    if (t->depth >= PROF_FRAMES)
+	return false;
+    omni_prof_frame& f = t->frames[t->depth++];
+    f.mutex = &m;
+    f.site = site;
+    f.start = now();
+    f.paused = 0;
+    return true;
+}
+
+void
+omni_lock_profiler::release(omni_mutex& m)
+{
+    omni_prof_thread* t = prof_self;
+    // Scoped locks unwind in order, the search is for the odd exception
+    int i = t->depth - 1;
+    while (i > 0 && t->frames[i].mutex != &m)
+	i--;
+    omni_prof_frame f = t->frames[i];
+    for (; i < t->depth - 1; i++)
+	t->frames[i] = t->frames[i + 1];
+    t->depth--;
+
+    __int64 hold = now() - f.start - f.paused;
+    m.unlock();
+
+    omni_prof_site* s = prof_site(t, f.site);
+    if (s != NULL) {
+	s->hold_total += hold;
+	if ((unsigned __int64)hold > s->hold_max)
+	    s->hold_max = hold;
+	s->hold_hist[prof_bucket(hold)]++;
+    }
+
+    if (!enabled && t->depth == 0) {
+	prof_self = NULL;
+	if (prof_fls != FLS_OUT_OF_INDEXES)
+	    FlsSetValue(prof_fls, NULL);
+	prof_retire(t);
+    }
+}
+
+void
+omni_lock_profiler::condition_wait(omni_mutex* m, __int64 since)
+{
+    omni_prof_thread* t = prof_self;
+    if (t == NULL)
+	return;
+    __int64 waited = now() - since;
+    for (int i = 0; i < t->depth; i++)
+	if (t->frames[i].mutex == m)
+	    t->frames[i].paused += waited;
+}
+
+static unsigned __int64
+prof_percentile(const unsigned long* hist, unsigned __int64 count, int pct)
+{
+    unsigned __int64 target = (count * pct + 99) / 100;
+    unsigned __int64 seen = 0;
+    for (int b = 0; b < PROF_BUCKETS; b++) {
+	seen += hist[b];
+	if (seen >= target && seen > 0)
+	    return (unsigned __int64)1 << b;
+    }
+    return (unsigned __int64)1 << (PROF_BUCKETS - 1);
+}
+
+void
+omni_lock_profiler::dump(void)
+{
+    if (prof_sink == NULL || prof_freq == 0)
+	return;
+
+    omni_prof_site* total = (omni_prof_site*)calloc(PROF_SITES, sizeof(omni_prof_site));
+    if (total == NULL)
+	return;
+    int threads = 0;
+    EnterCriticalSection(&prof_crit);
+    for (omni_prof_thread* t = prof_threads; t != NULL; t = t->next) {
+	threads++;
+	for (int i = 0; i < PROF_SITES; i++)
+	    if (t->sites[i] != NULL)
+		prof_add(&total[i], t->sites[i]);
+    }
+    if (prof_retired != NULL)
+	for (int i = 0; i < PROF_SITES; i++)
+	    prof_add(&total[i], &prof_retired[i]);
+    LeaveCriticalSection(&prof_crit);
+
+    char line[256];
+    _snprintf_s(line, sizeof(line), _TRUNCATE,
+	"lock profile: %d threads, %I64u ms, sites by total wait (us; p99 as histogram bound)\n",
+	threads, (unsigned __int64)(now() - prof_since) * 1000 / prof_freq);
+    prof_sink(line);
+
+    // Selection sort of the busiest sites, the table is small
+    for (int n = 0; n < PROF_DUMP_LINES; n++) {
+	int best = -1;
+	for (int i = 0; i < PROF_SITES; i++)
+	    if (total[i].count > 0 && (best < 0 || total[i].wait_total > total[best].wait_total))
+		best = i;
+	if (best < 0)
+	    break;
+	omni_prof_site& s = total[best];
+	_snprintf_s(line, sizeof(line), _TRUNCATE,
+	    "  site %4d: n=%I64u contended=%I64u wait total=%I64u max=%I64u p99<%I64u"
+	    " hold avg=%I64u max=%I64u p99<%I64u\n",
+	    best, s.count, s.contended,
+	    s.wait_total * 1000000 / prof_freq, s.wait_max * 1000000 / prof_freq,
+	    prof_percentile(s.wait_hist, s.count, 99),
+	    s.hold_total * 1000000 / prof_freq / s.count, s.hold_max * 1000000 / prof_freq,
+	    prof_percentile(s.hold_hist, s.count, 99));
+	prof_sink(line);
+	s.count = 0;
+    }
+    free(total);
+}
+
+
 
 ///////////////////////////////////////////////////////////////////////////
 //
@@ -181,12 +552,17 @@ omni_condition::wait(DWORD dwTimeout)
 
     LeaveCriticalSection(&crit);
 
+    __int64 since = omni_lock_profiler::enabled ? omni_lock_profiler::now() : 0;
+
     mutex->unlock();
 
     DWORD result = WaitForSingleObject(me->cond_semaphore, dwTimeout);
 
     mutex->lock();
 
+    if (since != 0)
+	omni_lock_profiler::condition_wait(mutex, since);
+
     if (result != WAIT_OBJECT_0 && result != WAIT_TIMEOUT)
 	throw omni_thread_fatal(GetLastError());
 
@@ -212,6 +588,8 @@ omni_condition::timedwait(unsigned long abs_sec, unsigned long abs_nsec)
 
     LeaveCriticalSection(&crit);
 
+    __int64 since = omni_lock_profiler::enabled ? omni_lock_profiler::now() : 0;
+
     mutex->unlock();
 
     unsigned long now_sec, now_nsec;
@@ -247,6 +625,8 @@ omni_condition::timedwait(unsigned long abs_sec, unsigned long abs_nsec)
 	    LeaveCriticalSection(&crit);
 
 	    mutex->lock();
+	    if (since != 0)
+		omni_lock_profiler::condition_wait(mutex, since);
 	    return 0;
 	}
 
@@ -265,6 +645,8 @@ omni_condition::timedwait(unsigned long abs_sec, unsigned long abs_nsec)
 	throw omni_thread_fatal(GetLastError());
 
     mutex->lock();
+    if (since != 0)
+	omni_lock_profiler::condition_wait(mutex, since);
     return 1;
 }
 
@@ -222,6 +222,7 @@ public:
 	// since we are attempting to be as POSIX-like as possible.
 
     friend class omni_condition;
+    friend class omni_lock_profiler;
 
 private:
     // dummy copy constructor and operator= to prevent copying
@@ -232,6 +233,34 @@ OMNI_THREAD_EXPOSE:
     OMNI_MUTEX_IMPLEMENTATION
 };
 
+//
+// Lock contention profiler
+//
+// While enabled, every omni_mutex_lock records how long it waited for the
+// mutex and how long it held it, keyed by its site ID, into per-thread
+// tables. Time spent in omni_condition::wait on the same mutex doesn't
+// count as held. dump() merges the tables and prints the busiest sites;
+// with a non-zero interval enable() starts a thread that dumps periodically.
+// disable() stops that thread and drops the numbers, dump first for a
+// final report.
+// Disabled, the cost is one test of 'enabled' per lock.
+//
+
+class _OMNITHREAD_NTDLL_ omni_lock_profiler {
+public:
+    static void enable(unsigned long interval_ms, void (*sink)(const char* line));
+    static void disable(void);
+    static void dump(void);
+
+    static volatile long enabled;
+
+    // Used by omni_mutex_lock and omni_condition
+    static bool acquire(omni_mutex& m, int site);
+    static void release(omni_mutex& m);
+    static void condition_wait(omni_mutex* m, __int64 since);
+    static __int64 now(void);
+};
+
 //
 // As an alternative to:
 // {
@@ -253,11 +282,16 @@ OMNI_THREAD_EXPOSE:
 #include <stdio.h>
 class _OMNITHREAD_NTDLL_ omni_mutex_lock {
     omni_mutex& mutex;
+	bool profiled;
 public:
 	int nummer;
     omni_mutex_lock(omni_mutex& m,int i) : mutex(m) {
 		nummer=i;
-		mutex.lock();
+		profiled = false;
+		if (omni_lock_profiler::enabled)
+			profiled = omni_lock_profiler::acquire(mutex, nummer);
+		else
+			mutex.lock();
 /*#ifdef _DEBUG
 			char			szText[256];
 			sprintf(szText,"lock %i %d\n",nummer,GetTickCount());
@@ -265,7 +299,10 @@ public:
 #endif*/
 	}
     ~omni_mutex_lock(void) {
-		mutex.unlock(); 
+		if (profiled)
+			omni_lock_profiler::release(mutex);
+		else
+			mutex.unlock();
 		/*#ifdef _DEBUG
 			char			szText[256];
 			sprintf(szText,"unlock %i %d\n",nummer,GetTickCount());
@@ -19,13 +19,15 @@
 // which you received this file, check http://www.realvnc.com/ or contact
 // the authors on info@realvnc.com for information on obtaining it.
 
+// Region backend. The default is the portable band implementation; the
+// GDI HRGN one is kept for comparison (see rfbRegion_bench.cpp)
 //#define USE_X11_REGIONS
+//#define USE_WIN32_REGIONS
 
-#ifdef USE_X11_REGIONS
+#if defined(USE_X11_REGIONS)
 #include "rfbRegion_X11.h"
-#else
-
+#elif defined(USE_WIN32_REGIONS)
 #include "rfbRegion_win32.h"
-
-
-#endif // X11
+#else
+#include "rfbRegion_band.h"
+#endif
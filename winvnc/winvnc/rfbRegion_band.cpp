@@ -0,0 +1,403 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Portable band-structured Region, see rfbRegion_band.h
+
+#include "rfbRegion.h"
+
+#if !defined(USE_X11_REGIONS) && !defined(USE_WIN32_REGIONS)
+
+#include <string.h>
+#include <limits.h>
+
+using namespace rfb;
+
+RegionBoxes::RegionBoxes(const RegionBoxes& b) : m_boxes(m_inline), m_count(0), m_capacity(BAND_INLINE_BOXES) {
+	*this = b;
+}
+
+RegionBoxes &RegionBoxes::operator=(const RegionBoxes& b) {
+	if (this == &b)
+		return *this;
+	reserve(b.m_count);
+	memcpy(m_boxes, b.m_boxes, b.m_count * sizeof(RegionBox));
+	m_count = b.m_count;
+	return *this;
+}
+
+void RegionBoxes::grow(int n) {
+	if (n < BAND_INLINE_BOXES * 2)
+		n = BAND_INLINE_BOXES * 2;
+	RegionBox *boxes = new RegionBox[n];
+	memcpy(boxes, m_boxes, m_count * sizeof(RegionBox));
+	if (m_boxes != m_inline)
+		delete [] m_boxes;
+	m_boxes = boxes;
+	m_capacity = n;
+}
+
+void RegionBoxes::take(RegionBoxes& b) {
+	if (b.m_boxes == b.m_inline) {
+		// Fits our inline array too
+		if (m_boxes != m_inline)
+			delete [] m_boxes;
+		m_boxes = m_inline;
+		m_capacity = BAND_INLINE_BOXES;
+		memcpy(m_inline, b.m_inline, b.m_count * sizeof(RegionBox));
+	} else {
+		if (m_boxes != m_inline)
+			delete [] m_boxes;
+		m_boxes = b.m_boxes;
+		m_capacity = b.m_capacity;
+		b.m_boxes = b.m_inline;
+		b.m_capacity = BAND_INLINE_BOXES;
+	}
+	m_count = b.m_count;
+	b.m_count = 0;
+}
+
+
+Region::Region() {
+}
+
+Region::Region(int x1, int y1, int x2, int y2) {
+	if (x1 < x2 && y1 < y2)
+		m_boxes.push(x1, y1, x2, y2);
+}
+
+Region::Region(const Rect& r) {
+	if (!r.is_empty())
+		m_boxes.push(r.tl.x, r.tl.y, r.br.x, r.br.y);
+}
+
+Region::Region(const Region& r) : m_boxes(r.m_boxes) {
+}
+
+Region::~Region() {
+}
+
+rfb::Region& Region::operator=(const Region& r) {
+	m_boxes = r.m_boxes;
+	return *this;
+}
+
+bool Region::IsPtInRegion(int x, int y) {
+	for (int i = 0; i < m_boxes.size(); i++) {
+		const RegionBox &b = m_boxes[i];
+		if (y < b.y1)
+			return false;
+		if (y < b.y2 && x >= b.x1 && x < b.x2)
+			return true;
+	}
+	return false;
+}
+
+void Region::clear() {
+	m_boxes.clear();
+}
+
+void Region::reset(const Rect& r) {
+	m_boxes.clear();
+	if (!r.is_empty())
+		m_boxes.push(r.tl.x, r.tl.y, r.br.x, r.br.y);
+}
+
+void Region::translate(const Point& delta) {
+	for (int i = 0; i < m_boxes.size(); i++) {
+		RegionBox &b = m_boxes[i];
+		b.x1 += delta.x; b.x2 += delta.x;
+		b.y1 += delta.y; b.y2 += delta.y;
+	}
+}
+
+void Region::setOrderedRects(const std::vector<Rect>& rects) {
+	clear();
+	for (std::vector<Rect>::const_iterator i = rects.begin(); i != rects.end(); i++)
+		assign_union(Region(*i));
+}
+
+// One band's boxes, [first, end)
+struct BandCursor {
+	const RegionBoxes &boxes;
+	int first, end;
+
+	BandCursor(const RegionBoxes &b) : boxes(b), first(0), end(0) { findEnd(); }
+	bool done() const { return first >= boxes.size(); }
+	int y1() const { return boxes[first].y1; }
+	int y2() const { return boxes[first].y2; }
+	void next() { first = end; findEnd(); }
+	void findEnd() {
+		end = first;
+		while (end < boxes.size() && boxes[end].y1 == boxes[first].y1)
+			end++;
+	}
+};
+
+// Append a span to the band being built, merging with a touching one
+static inline void emitSpan(RegionBoxes &out, int bandStart, int x1, int x2, int y1, int y2) {
+	int n = out.size();
+	if (n > bandStart && out[n - 1].x2 >= x1) {
+		if (x2 > out[n - 1].x2)
+			out[n - 1].x2 = x2;
+		return;
+	}
+	out.push(x1, y1, x2, y2);
+}
+
+// Combine the spans of one band of each operand over the rows [y1, y2).
+// A NULL operand is a band with no spans.
+static void combineSpans(RegionBoxes &out, int bandStart, int y1, int y2,
+						 const RegionBoxes *a, int ai, int aend,
+						 const RegionBoxes *b, int bi, int bend, int op) {
+	if (a == NULL) ai = aend = 0;
+	if (b == NULL) bi = bend = 0;
+
+	switch (op) {
+	case 0: // union
+		while (ai < aend || bi < bend) {
+			const RegionBox *s;
+			if (bi >= bend || (ai < aend && (*a)[ai].x1 <= (*b)[bi].x1))
+				s = &(*a)[ai++];
+			else
+				s = &(*b)[bi++];
+			emitSpan(out, bandStart, s->x1, s->x2, y1, y2);
+		}
+		break;
+	case 1: // intersect
+		while (ai < aend && bi < bend) {
+			int x1 = std::max((*a)[ai].x1, (*b)[bi].x1);
+			int x2 = std::min((*a)[ai].x2, (*b)[bi].x2);
+			if (x1 < x2)
+				out.push(x1, y1, x2, y2);
+			if ((*a)[ai].x2 < (*b)[bi].x2)
+				ai++;
+			else
+				bi++;
+		}
+		break;
+	case 2: // subtract
+		for (; ai < aend; ai++) {
+			int x1 = (*a)[ai].x1;
+			int x2 = (*a)[ai].x2;
+			while (bi < bend && (*b)[bi].x2 <= x1)
+				bi++;
+			for (int k = bi; k < bend && (*b)[k].x1 < x2; k++) {
+				if ((*b)[k].x1 > x1)
+					out.push(x1, y1, (*b)[k].x1, y2);
+				if ((*b)[k].x2 > x1)
+					x1 = (*b)[k].x2;
+				if (x1 >= x2)
+					break;
+			}
+			if (x1 < x2)
+				out.push(x1, y1, x2, y2);
+		}
+		break;
+	}
+}
+
+// Merge the band just built into the one above it when they touch and
+// carry the same spans
+static void coalesce(RegionBoxes &out, int &prevStart, int bandStart) {
+	int n = out.size();
+	if (n == bandStart)
+		return;
+	if (prevStart >= 0 && out[prevStart].y2 == out[bandStart].y1 &&
+		bandStart - prevStart == n - bandStart) {
+		bool same = true;
+		for (int i = 0; i < n - bandStart && same; i++)
+			same = out[prevStart + i].x1 == out[bandStart + i].x1 &&
+				   out[prevStart + i].x2 == out[bandStart + i].x2;
+		if (same) {
+			int y2 = out[bandStart].y2;
+			for (int i = prevStart; i < bandStart; i++)
+				out[i].y2 = y2;
+			out.truncate(bandStart);
+			return;
+		}
+	}
+	prevStart = bandStart;
+}
+
+void Region::combine(const Region& r, Op op) {
+	BandCursor a(m_boxes), b(r.m_boxes);
+	RegionBoxes out;
+	out.reserve(m_boxes.size() + r.m_boxes.size());
+	int prevStart = -1;
+	int y = INT_MIN;
+
+	for (;;) {
+		while (!a.done() && a.y2() <= y) a.next();
+		while (!b.done() && b.y2() <= y) b.next();
+		if (a.done() && (b.done() || op != OP_UNION))
+			break;
+		if (b.done() && op == OP_INTERSECT)
+			break;
+
+		// Rows [top, bottom) where neither operand changes bands
+		int top = INT_MAX;
+		if (!a.done()) top = std::min(top, std::max(y, a.y1()));
+		if (!b.done()) top = std::min(top, std::max(y, b.y1()));
+		bool inA = !a.done() && a.y1() <= top;
+		bool inB = !b.done() && b.y1() <= top;
+		int bottom = INT_MAX;
+		if (!a.done()) bottom = std::min(bottom, inA ? a.y2() : a.y1());
+		if (!b.done()) bottom = std::min(bottom, inB ? b.y2() : b.y1());
+
+		int bandStart = out.size();
+		combineSpans(out, bandStart, top, bottom,
+					 inA ? &m_boxes : NULL, a.first, a.end,
+					 inB ? &r.m_boxes : NULL, b.first, b.end, op);
+		coalesce(out, prevStart, bandStart);
+		y = bottom;
+	}
+	m_boxes.take(out);
+}
+
+void Region::assign_intersect(const Region& r) {
+	if (is_empty() || r.is_empty()) {
+		clear();
+		return;
+	}
+	combine(r, OP_INTERSECT);
+}
+
+void Region::assign_union(const Region& r) {
+	if (r.is_empty())
+		return;
+	if (is_empty()) {
+		m_boxes = r.m_boxes;
+		return;
+	}
+	// Damage usually arrives top to bottom: r below us is just appended
+	int n = m_boxes.size();
+	if (r.m_boxes[0].y1 >= m_boxes[n - 1].y2) {
+		int prevStart = n - 1;
+		while (prevStart > 0 && m_boxes[prevStart - 1].y1 == m_boxes[n - 1].y1)
+			prevStart--;
+		BandCursor b(r.m_boxes);
+		for (; !b.done(); b.next()) {
+			int bandStart = m_boxes.size();
+			for (int i = b.first; i < b.end; i++)
+				m_boxes.push(r.m_boxes[i].x1, r.m_boxes[i].y1, r.m_boxes[i].x2, r.m_boxes[i].y2);
+			coalesce(m_boxes, prevStart, bandStart);
+		}
+		return;
+	}
+	combine(r, OP_UNION);
+}
+
+void Region::assign_subtract(const Region& r) {
+	if (is_empty() || r.is_empty())
+		return;
+	combine(r, OP_SUBTRACT);
+}
+
+
+rfb::Region Region::intersect(const Region& r) const {
+	Region t = *this;
+	t.assign_intersect(r);
+	return t;
+}
+
+rfb::Region Region::union_(const Region& r) const {
+	Region t = *this;
+	t.assign_union(r);
+	return t;
+}
+
+rfb::Region Region::subtract(const Region& r) const {
+	Region t = *this;
+	t.assign_subtract(r);
+	return t;
+}
+
+
+bool Region::equals(const Region& b) const {
+	if (m_boxes.size() != b.m_boxes.size())
+		return false;
+	for (int i = 0; i < m_boxes.size(); i++) {
+		const RegionBox &p = m_boxes[i], &q = b.m_boxes[i];
+		if (p.x1 != q.x1 || p.y1 != q.y1 || p.x2 != q.x2 || p.y2 != q.y2)
+			return false;
+	}
+	return true;
+}
+
+bool Region::is_empty() const {
+	return m_boxes.size() == 0;
+}
+
+bool Region::get_rects(std::vector<Rect>& rects,
+					   bool left2right,
+					   bool topdown) const {
+	int nRects = m_boxes.size();
+	int xInc = left2right ? 1 : -1;
+	int yInc = topdown ? 1 : -1;
+	int i = topdown ? 0 : nRects-1;
+
+	rects.clear();
+	rects.reserve(nRects);
+	while (nRects > 0) {
+		int firstInNextBand = i;
+		int nRectsInBand = 0;
+
+		while (nRects > 0 && m_boxes[firstInNextBand].y1 == m_boxes[i].y1) {
+			firstInNextBand += yInc;
+			nRects--;
+			nRectsInBand++;
+		}
+
+		if (xInc != yInc)
+			i = firstInNextBand - yInc;
+
+		while (nRectsInBand > 0) {
+			const RegionBox &b = m_boxes[i];
+			rects.push_back(Rect(b.x1, b.y1, b.x2, b.y2));
+			i += xInc;
+			nRectsInBand--;
+		}
+
+		i = firstInNextBand;
+	}
+	return !rects.empty();
+}
+
+rfb::Rect Region::get_bounding_rect() const {
+	int n = m_boxes.size();
+	if (n == 0)
+		return Rect(0, 0, 0, 0);
+	int x1 = m_boxes[0].x1, x2 = m_boxes[0].x2;
+	for (int i = 1; i < n; i++) {
+		x1 = std::min(x1, m_boxes[i].x1);
+		x2 = std::max(x2, m_boxes[i].x2);
+	}
+	return Rect(x1, m_boxes[0].y1, x2, m_boxes[n - 1].y2);
+}
+
+int Region::Numrects() {
+	return m_boxes.size();
+}
+
+#endif
@@ -0,0 +1,138 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// rfb::Region2D class, portable band implementation
+
+// A region is an array of boxes in y-x banded order, as in X11 and GDI:
+// boxes in one band share y1/y2, bands are sorted top to bottom and do
+// not overlap, boxes in a band are sorted left to right and never touch.
+// Vertically adjacent bands with the same spans are always merged, which
+// makes the representation canonical, so equals() is a compare.
+// Union, intersect and subtract are one sweep over both band lists.
+// Up to BAND_INLINE_BOXES boxes live inside the object; the damage of a
+// typical frame never touches the heap.
+
+#ifndef __RFB_REGION_BAND_INCLUDED__
+#define __RFB_REGION_BAND_INCLUDED__
+
+#include "rfbRect.h"
+#include <vector>
+
+namespace rfb {
+
+	// rfb::Region2D
+	//
+	// See the rfbRegion.h header for documentation.
+
+	struct RegionBox {
+		int x1, y1, x2, y2;
+	};
+
+	// Box array with inline storage for the first few boxes
+	class RegionBoxes {
+	public:
+		enum { BAND_INLINE_BOXES = 8 };
+
+		RegionBoxes() : m_boxes(m_inline), m_count(0), m_capacity(BAND_INLINE_BOXES) {}
+		RegionBoxes(const RegionBoxes& b);
+		RegionBoxes &operator=(const RegionBoxes& b);
+		~RegionBoxes() { if (m_boxes != m_inline) delete [] m_boxes; }
+
+		void clear() { m_count = 0; }
+		void reserve(int n) { if (n > m_capacity) grow(n); }
+		void push(int x1, int y1, int x2, int y2) {
+			if (m_count == m_capacity)
+				grow(m_count * 2);
+			RegionBox &b = m_boxes[m_count++];
+			b.x1 = x1; b.y1 = y1; b.x2 = x2; b.y2 = y2;
+		}
+		void truncate(int n) { m_count = n; }
+		// Takes the other array's contents, leaving it empty
+		void take(RegionBoxes& b);
+
+		int size() const { return m_count; }
+		RegionBox &operator[](int i) { return m_boxes[i]; }
+		const RegionBox &operator[](int i) const { return m_boxes[i]; }
+
+	protected:
+		void grow(int n);
+
+		RegionBox *m_boxes;
+		int m_count;
+		int m_capacity;
+		RegionBox m_inline[BAND_INLINE_BOXES];
+	};
+
+	class Region {
+	public:
+		// Create an empty region
+		Region();
+		// Create a rectangular region
+		Region(int x1, int y1, int x2, int y2);
+		Region(const Rect& r);
+
+		Region(const Region& r);
+		Region &operator=(const Region& src);
+		bool IsPtInRegion(int x, int y);
+
+		~Region();
+
+		// the following methods alter the region in place:
+
+		void clear();
+		void reset(const Rect& r);
+		void translate(const rfb::Point& delta);
+		void setOrderedRects(const std::vector<Rect>& rects);
+
+		void name(const char *) {}
+
+		void assign_intersect(const Region& r);
+		void assign_union(const Region& r);
+		void assign_subtract(const Region& r);
+
+		// the following three operations return a new region:
+
+		Region intersect(const Region& r) const;
+		Region union_(const Region& r) const;
+		Region subtract(const Region& r) const;
+
+		bool equals(const Region& b) const;
+		bool is_empty() const;
+
+		bool get_rects(std::vector<Rect>& rects, bool left2right=true,
+					   bool topdown=true) const;
+		Rect get_bounding_rect() const;
+		int Numrects();
+
+	protected:
+		enum Op { OP_UNION, OP_INTERSECT, OP_SUBTRACT };
+		void combine(const Region& r, Op op);
+
+		RegionBoxes m_boxes;
+	};
+	typedef Region Region2D;
+
+};
+
+#endif /* __RFB_REGION_BAND_INCLUDED__ */
@@ -0,0 +1,217 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// Region backend microbenchmark, not part of winvnc.
+// Build it once per backend and compare the tables:
+//   cl /O2 /EHsc rfbRegion_bench.cpp rfbRegion_band.cpp
+//   cl /O2 /EHsc /DUSE_WIN32_REGIONS rfbRegion_bench.cpp rfbRegion_win32.cpp gdi32.lib
+//   cl /O2 /EHsc /DUSE_X11_REGIONS rfbRegion_bench.cpp rfbRegion_X11.cxx (needs Xregion)
+//   g++ -O2 rfbRegion_bench.cpp rfbRegion_band.cpp
+// "rfbRegion_bench verify" also checks the backend against a pixel mask.
+
+#include "rfbRegion.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#if defined(USE_X11_REGIONS)
+static const char *backend = "X11";
+#elif defined(USE_WIN32_REGIONS)
+static const char *backend = "HRGN";
+#else
+static const char *backend = "band";
+#endif
+
+#if defined(USE_WIN32_REGIONS) || defined(USE_X11_REGIONS)
+// The real log lives in winvnc
+#include "stdhdrs.h"
+VNCLog vnclog;
+#endif
+
+const int SCREEN_W = 1920;
+const int SCREEN_H = 1080;
+
+static unsigned int seed = 12345;
+static int rnd(int n) {
+	seed = seed * 1103515245 + 12345;
+	return (int)((seed >> 8) % (unsigned int)n);
+}
+
+static rfb::Rect randomRect(int maxw, int maxh) {
+	int w = 1 + rnd(maxw), h = 1 + rnd(maxh);
+	int x = rnd(SCREEN_W - w), y = rnd(SCREEN_H - h);
+	return rfb::Rect(x, y, x + w, y + h);
+}
+
+// Damage patterns, each one "frame" as seen by the update tracker:
+// accumulate the changed region, take away what was copied, clip to the
+// screen and walk the rects.
+
+// Typing: a few glyph cells and the caret along one line
+static size_t typing() {
+	rfb::Region2D changed, screen(0, 0, SCREEN_W, SCREEN_H);
+	int y = 200 + rnd(600), x = 100 + rnd(1000);
+	for (int i = 0; i < 12; i++)
+		changed.assign_union(rfb::Region2D(x + i * 9, y, x + i * 9 + 9, y + 16));
+	changed.assign_union(rfb::Region2D(x + 108, y, x + 110, y + 16));
+	changed.assign_intersect(screen);
+	std::vector<rfb::Rect> rects;
+	changed.get_rects(rects);
+	return rects.size();
+}
+
+// Scrolling: a copyrect of most of a window and the exposed strip
+static size_t scrolling() {
+	rfb::Region2D changed, copied, screen(0, 0, SCREEN_W, SCREEN_H);
+	rfb::Rect win(300, 100, 1500, 1000);
+	int dy = 16 + rnd(48);
+	copied.reset(rfb::Rect(win.tl.x, win.tl.y, win.br.x, win.br.y - dy));
+	changed.assign_union(rfb::Region2D(win.tl.x, win.br.y - dy, win.br.x, win.br.y));
+	changed.assign_union(rfb::Region2D(win.br.x - 16, win.tl.y, win.br.x, win.br.y));	// scrollbar
+	changed.assign_subtract(copied);
+	changed.assign_union(copied.intersect(rfb::Region2D(win.br.x - 16, 0, SCREEN_W, SCREEN_H)));
+	changed.assign_intersect(screen);
+	std::vector<rfb::Rect> rects;
+	changed.get_rects(rects);
+	return rects.size();
+}
+
+// Polling: scattered 32x32 tiles from CheckRect, merged and walked
+static size_t polling() {
+	rfb::Region2D changed, screen(0, 0, SCREEN_W, SCREEN_H);
+	for (int i = 0; i < 200; i++) {
+		int tx = rnd(SCREEN_W / 32) * 32, ty = rnd(SCREEN_H / 32) * 32;
+		changed.assign_union(rfb::Region2D(tx, ty, tx + 32, ty + 32));
+	}
+	changed.assign_intersect(screen);
+	std::vector<rfb::Rect> rects;
+	changed.get_rects(rects);
+	return rects.size();
+}
+
+// Video: one large rect with overlapping UI chrome and the cursor
+static size_t video() {
+	rfb::Region2D changed, sent, screen(0, 0, SCREEN_W, SCREEN_H);
+	changed.assign_union(rfb::Region2D(320, 180, 1600, 900));
+	for (int i = 0; i < 6; i++)
+		changed.assign_union(rfb::Region2D(randomRect(200, 40)));
+	sent.assign_union(rfb::Region2D(320, 180, 1600, 540));
+	changed.assign_subtract(sent);
+	changed.assign_intersect(screen);
+	std::vector<rfb::Rect> rects;
+	changed.get_rects(rects);
+	return rects.size();
+}
+
+// Window drag: many overlapping window-sized rects
+static size_t dragging() {
+	rfb::Region2D changed, screen(0, 0, SCREEN_W, SCREEN_H);
+	int x = 200 + rnd(400), y = 100 + rnd(200);
+	for (int i = 0; i < 20; i++)
+		changed.assign_union(rfb::Region2D(x + i * 7, y + i * 5, x + i * 7 + 800, y + i * 5 + 600));
+	changed.assign_intersect(screen);
+	std::vector<rfb::Rect> rects;
+	changed.get_rects(rects);
+	return rects.size();
+}
+
+static void bench(const char *name, size_t (*pattern)(), int iterations) {
+	size_t rects = 0;
+	seed = 12345;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		rects += pattern();
+	std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+	double us = std::chrono::duration<double, std::micro>(stop - start).count();
+	printf("%-6s %-10s %8d frames %10.2f us/frame %8.1f rects/frame\n",
+		backend, name, iterations, us / iterations, (double)rects / iterations);
+}
+
+// Random operations on small regions, checked pixel by pixel
+const int MASK_W = 64;
+const int MASK_H = 64;
+typedef unsigned char Mask[MASK_H][MASK_W];
+
+static void toMask(const rfb::Region2D &r, Mask m) {
+	memset(m, 0, sizeof(Mask));
+	std::vector<rfb::Rect> rects;
+	r.get_rects(rects);
+	for (size_t i = 0; i < rects.size(); i++)
+		for (int y = rects[i].tl.y; y < rects[i].br.y; y++)
+			for (int x = rects[i].tl.x; x < rects[i].br.x; x++)
+				m[y][x]++;
+}
+
+static int verify(int iterations) {
+	int failures = 0;
+	for (int i = 0; i < iterations; i++) {
+		rfb::Region2D a, b;
+		Mask ma, mb, mr, expect;
+		memset(expect, 0, sizeof(Mask));
+		for (int n = rnd(6); n >= 0; n--) {
+			int x = rnd(MASK_W - 1), y = rnd(MASK_H - 1);
+			a.assign_union(rfb::Region2D(x, y, x + 1 + rnd(MASK_W - x - 1), y + 1 + rnd(MASK_H - y - 1)));
+		}
+		for (int n = rnd(6); n >= 0; n--) {
+			int x = rnd(MASK_W - 1), y = rnd(MASK_H - 1);
+			b.assign_union(rfb::Region2D(x, y, x + 1 + rnd(MASK_W - x - 1), y + 1 + rnd(MASK_H - y - 1)));
+		}
+		int op = rnd(3);
+		rfb::Region2D r = op == 0 ? a.union_(b) : op == 1 ? a.intersect(b) : a.subtract(b);
+		toMask(a, ma);
+		toMask(b, mb);
+		toMask(r, mr);
+		bool ok = true;
+		for (int y = 0; y < MASK_H; y++)
+			for (int x = 0; x < MASK_W; x++) {
+				bool in = op == 0 ? (ma[y][x] || mb[y][x]) : op == 1 ? (ma[y][x] && mb[y][x]) : (ma[y][x] && !mb[y][x]);
+				// Rects of a region never overlap
+				if (mr[y][x] != (in ? 1 : 0) || ma[y][x] > 1 || mb[y][x] > 1)
+					ok = false;
+			}
+		// Canonical form: the same pixels always give the same rects
+		rfb::Region2D rebuilt;
+		std::vector<rfb::Rect> rects;
+		r.get_rects(rects, (i & 1) != 0, (i & 2) != 0);
+		for (size_t k = 0; k < rects.size(); k++)
+			rebuilt.assign_union(rfb::Region2D(rects[k]));
+		if (!rebuilt.equals(r) || r.is_empty() != rects.empty())
+			ok = false;
+		if (!ok)
+			failures++;
+	}
+	printf("%s: %d of %d random operations wrong\n", backend, failures, iterations);
+	return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && strcmp(argv[1], "verify") == 0)
+		return verify(100000);
+	bench("typing", typing, 200000);
+	bench("scrolling", scrolling, 200000);
+	bench("polling", polling, 5000);
+	bench("video", video, 100000);
+	bench("dragging", dragging, 20000);
+	return 0;
+}
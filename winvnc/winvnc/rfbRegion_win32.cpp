@@ -22,7 +22,9 @@
 // Cross-platform Region class based on the X11 region implementation
 
 #include "stdhdrs.h"
-#include "rfbRegion_win32.h"
+#include "rfbRegion.h"
+
+#if defined(USE_WIN32_REGIONS)
 
 using namespace rfb;
 
@@ -278,3 +280,4 @@ int Region::Numrects()
 	return nRects;
 }
 
+#endif // USE_WIN32_REGIONS
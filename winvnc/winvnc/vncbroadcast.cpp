@@ -0,0 +1,122 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncBroadcast - shared frames and encoded rects for broadcast mode
+
+#include "vncbroadcast.h"
+
+// Upper bound for the encoded rects of one frame
+const size_t BROADCAST_CACHE_BYTES = 64 * 1024 * 1024;
+const DWORD BROADCAST_STATS_MS = 10000;
+
+bool
+vncBroadcastKey::operator<(const vncBroadcastKey &other) const
+{
+	// Field by field, rfbPixelFormat has padding
+	if (frame != other.frame) return frame < other.frame;
+	if (encoding != other.encoding) return encoding < other.encoding;
+	if (scale != other.scale) return scale < other.scale;
+	if (offsetx != other.offsetx) return offsetx < other.offsetx;
+	if (offsety != other.offsety) return offsety < other.offsety;
+	if (rect.tl.x != other.rect.tl.x) return rect.tl.x < other.rect.tl.x;
+	if (rect.tl.y != other.rect.tl.y) return rect.tl.y < other.rect.tl.y;
+	if (rect.br.x != other.rect.br.x) return rect.br.x < other.rect.br.x;
+	if (rect.br.y != other.rect.br.y) return rect.br.y < other.rect.br.y;
+	const rfbPixelFormat &a = format, &b = other.format;
+	if (a.bitsPerPixel != b.bitsPerPixel) return a.bitsPerPixel < b.bitsPerPixel;
+	if (a.depth != b.depth) return a.depth < b.depth;
+	if (a.bigEndian != b.bigEndian) return a.bigEndian < b.bigEndian;
+	if (a.trueColour != b.trueColour) return a.trueColour < b.trueColour;
+	if (a.redMax != b.redMax) return a.redMax < b.redMax;
+	if (a.greenMax != b.greenMax) return a.greenMax < b.greenMax;
+	if (a.blueMax != b.blueMax) return a.blueMax < b.blueMax;
+	if (a.redShift != b.redShift) return a.redShift < b.redShift;
+	if (a.greenShift != b.greenShift) return a.greenShift < b.greenShift;
+	return a.blueShift < b.blueShift;
+}
+
+vncBroadcast::vncBroadcast()
+{
+	m_frame = 0;
+	m_frameEpoch = 0;
+	m_frameStart = 0;
+	m_encodedBytes = 0;
+	m_statsStart = GetTickCount();
+	m_hits = 0;
+	m_misses = 0;
+}
+
+LONG
+vncBroadcast::Sync(DWORD cadence, vncDamageLog &log, LONG &epoch)
+{
+	omni_mutex_lock l(m_lock, 363);
+	DWORD now = GetTickCount();
+	DWORD elapsed = now - m_frameStart;
+	if (m_frame == 0 || elapsed >= cadence) {
+		m_frame++;
+		m_frameEpoch = log.Head();
+		// Keep the cadence, but don't make up for idle time with a burst
+		m_frameStart = elapsed < 2 * cadence ? m_frameStart + cadence : now;
+		m_encoded.clear();
+		m_encodedBytes = 0;
+
+		if (now - m_statsStart >= BROADCAST_STATS_MS) {
+			if (m_hits + m_misses > 0)
+				vnclog.Print(LL_INTINFO, VNCLOG("broadcast: frame %ld, %ld rects encoded, %ld shared\n"),
+					m_frame, m_misses, m_hits);
+			m_statsStart = now;
+			m_hits = 0;
+			m_misses = 0;
+		}
+	}
+	epoch = m_frameEpoch;
+	return m_frame;
+}
+
+BOOL
+vncBroadcast::Lookup(const vncBroadcastKey &key, vncEncodedRect &data)
+{
+	omni_mutex_lock l(m_lock, 363);
+	std::map<vncBroadcastKey, vncEncodedRect>::const_iterator i = m_encoded.find(key);
+	if (i == m_encoded.end()) {
+		m_misses++;
+		return FALSE;
+	}
+	data = i->second;
+	m_hits++;
+	return TRUE;
+}
+
+void
+vncBroadcast::Store(const vncBroadcastKey &key, const BYTE *data, UINT size)
+{
+	omni_mutex_lock l(m_lock, 363);
+	// Only the current frame is worth keeping
+	if (key.frame != m_frame || size == 0 || m_encodedBytes + size > BROADCAST_CACHE_BYTES)
+		return;
+	if (m_encoded.find(key) != m_encoded.end())
+		return;
+	m_encoded[key] = std::make_shared<std::vector<BYTE> >(data, data + size);
+	m_encodedBytes += size;
+}
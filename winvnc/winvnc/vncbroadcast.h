@@ -0,0 +1,98 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncBroadcast
+
+// Broadcast mode for many view-only viewers. Frames are closed on a fixed
+// cadence: a frame is the damage log up to the epoch that was current when
+// it closed. Viewers only fold whole frames, and a viewer that is still
+// busy with an older frame folds everything up to the newest one when it
+// gets back, so it skips the frames in between instead of queueing them.
+// Rects of a frame encoded with a stateless encoding (Raw, RRE, CoRRE,
+// Hextile) are kept until the next frame closes, so each distinct format
+// is encoded once and the other viewers send the same bytes. The zlib based
+// encoders keep per-connection stream state and always encode per viewer.
+
+#if !defined(_WINVNC_VNCBROADCAST)
+#define _WINVNC_VNCBROADCAST
+#pragma once
+
+#include "stdhdrs.h"
+#include <omnithread.h>
+#include <map>
+#include <memory>
+#include <vector>
+#include "rfb.h"
+#include "rfbRect.h"
+#include "vncdamagelog.h"
+
+// Everything the encoded bytes of a rect depend on
+struct vncBroadcastKey
+{
+	LONG			frame;
+	CARD32			encoding;
+	rfbPixelFormat	format;
+	int				scale;
+	int				offsetx;
+	int				offsety;
+	rfb::Rect		rect;
+
+	vncBroadcastKey() : frame(0), encoding(0), format(), scale(1), offsetx(0), offsety(0) {};
+	bool operator<(const vncBroadcastKey &other) const;
+};
+
+// Shared by the cache and the viewers sending it, so a lookup copies
+// nothing and a frame closing under a sender doesn't free the bytes
+typedef std::shared_ptr<const std::vector<BYTE> > vncEncodedRect;
+
+class vncBroadcast
+{
+public:
+	vncBroadcast();
+
+	// Close a frame if the cadence says so. Returns the newest frame and
+	// the damage log epoch it ends at.
+	LONG Sync(DWORD cadence, vncDamageLog &log, LONG &epoch);
+
+	// Encoded bytes another viewer stored for this rect of the frame
+	BOOL Lookup(const vncBroadcastKey &key, vncEncodedRect &data);
+	void Store(const vncBroadcastKey &key, const BYTE *data, UINT size);
+
+protected:
+	omni_mutex		m_lock;
+	LONG			m_frame;
+	LONG			m_frameEpoch;
+	DWORD			m_frameStart;
+
+	// Encoded rects of the current frame only
+	std::map<vncBroadcastKey, vncEncodedRect> m_encoded;
+	size_t			m_encodedBytes;
+
+	// Shared/encoded rects, logged every few seconds
+	DWORD			m_statsStart;
+	LONG			m_hits;
+	LONG			m_misses;
+};
+
+#endif // _WINVNC_VNCBROADCAST
@@ -335,10 +335,28 @@ vncClientUpdateThread::Init(vncClient *client)
 	omni_mutex_lock l(m_client->GetUpdateLock(),80);
 	m_signal = new omni_condition(&m_client->GetUpdateLock());
 	m_sync_sig = new omni_condition(&m_client->GetUpdateLock());
+	m_hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
 	m_active = TRUE;
 	m_enable = m_client->m_disable_protocol == 0;
+	// Handshake is done, from here on a writer thread may own the socket
+	if (m_client->m_server->AsyncSendKB() > 0)
+		m_client->m_socket->EnableAsyncSend((VCard)m_client->m_server->AsyncSendKB() * 1024);
+	m_client->m_telemetry.Init(m_client->m_id, m_client->m_socket);
+	m_update.enable_copyrect(true);
+	first_run = true;
+	m_pooled = m_client->m_server->UpdatePool() != FALSE;
+	m_jobState = JOB_IDLE;
+	m_jobDue = 0;
+	m_jobHold = false;
+	m_pending = false;
+	m_pendingSince = 0;
+	m_idleSince = GetTickCount();
 	if (m_signal && m_sync_sig) {
-		start_undetached();
+		// Pooled: no thread of its own, Trigger() submits a job instead
+		if (m_pooled)
+			m_client->m_server->UpdateScheduler().Start();
+		else
+			start_undetached();
 		return TRUE;
 	}
 	return FALSE;
@@ -348,6 +366,7 @@ vncClientUpdateThread::~vncClientUpdateThread()
 {
 	if (m_signal) delete m_signal;
 	if (m_sync_sig) delete m_sync_sig;
+	if (m_hWake) CloseHandle(m_hWake);
 	vnclog.Print(LL_INTINFO, VNCLOG("update thread gone\n"));
 	m_client->m_updatethread=NULL;
 }
@@ -358,10 +377,35 @@ vncClientUpdateThread::Trigger()
 	// ALWAYS lock client UpdateLock before calling this!
 	// Only trigger an update if protocol is enabled
 	if (m_client->m_disable_protocol == 0) {
-		m_signal->signal();
+		if (m_pooled)
+			m_client->m_server->UpdateScheduler().Submit(this);
+		else
+			Wake();
 	}
 }
 
+void
+vncClientUpdateThread::Wake()
+{
+	m_signal->signal();
+	if (m_hWake)
+		SetEvent(m_hWake);
+}
+
+BOOL
+vncClientUpdateThread::WaitWake(DWORD ms)
+{
+	// Called with the UpdateLock held once, like a condition wait
+	omni_mutex &lock = m_client->GetUpdateLock();
+	__int64 since = omni_lock_profiler::enabled ? omni_lock_profiler::now() : 0;
+	lock.unlock();
+	BOOL woken = WaitForSingleObject(m_hWake, ms) == WAIT_OBJECT_0;
+	lock.lock();
+	if (since != 0)
+		omni_lock_profiler::condition_wait(&lock, since);
+	return woken;
+}
+
 void
 vncClientUpdateThread::Kill()
 {
@@ -369,7 +413,20 @@ vncClientUpdateThread::Kill()
 
 	omni_mutex_lock l(m_client->GetUpdateLock(),81);
 	m_active=FALSE;
-	m_signal->signal();
+	Wake();
+}
+
+void
+vncClientUpdateThread::Stop()
+{
+	Kill();
+	if (m_pooled) {
+		// Never started, so there is nothing to join
+		m_client->m_server->UpdateScheduler().Cancel(this);
+		delete this;
+	}
+	else
+		join(NULL);
 }
 
 
@@ -407,7 +464,14 @@ vncClientUpdateThread::EnableUpdates(BOOL enable)
 	}
 
 	m_enable = enable;
-	m_signal->signal();
+	if (m_pooled) {
+		// Nothing would answer the wait below
+		if (!m_client->m_server->UpdateScheduler().IsRunning())
+			return;
+		m_client->m_server->UpdateScheduler().Submit(this, true);
+	}
+	else
+		Wake();
 	//unsigned long now_sec, now_nsec;
     //get_time_now(&now_sec, &now_nsec);
 
@@ -425,15 +489,353 @@ vncClientUpdateThread::EnableUpdates(BOOL enable)
 
 extern bool g_DesktopThread_running;
 
+// Frame pacing
+// Called with the update lock held once there is something to send.
+// Waits until the client's frame interval has passed since the last update
+// and the coalescing window is over. The wait releases the update lock, so
+// the desktop thread keeps merging damage into the client's update tracker
+// and the next update carries all of it in one go.
+// With asynchronous sends the same applies while the socket writer is
+// behind: frames are held back instead of piling up in its ring.
+void
+vncClientUpdateThread::PaceFrame()
+{
+	// The coalescing window starts now
+	m_pendingSince = GetTickCount();
+	DWORD wait;
+	while ((wait = PaceDelay()) > 0 && m_active && m_enable && m_client->cl_connected)
+		m_signal->wait(wait);
+}
+
+DWORD
+vncClientUpdateThread::PaceDelay()
+{
+	if (m_client->m_socket->IsSendBacklogged())
+		return 10;
+
+	m_client->m_socket->SetRateLimit((VCard)std::max(m_client->m_server->ClientRateKB(), 0L) * 1024);
+	VSocket::SetServerRateLimit((VCard)std::max(m_client->m_server->ServerRateKB(), 0L) * 1024);
+	DWORD shape = m_client->m_socket->GetShapingDelay();
+	if (shape > 0) {
+		m_client->m_telemetry.Shaped(shape);
+		return shape;
+	}
+
+	// The coalescing window runs from when the damage was first seen
+	DWORD interval = m_client->FrameInterval();
+	DWORD coalesce = (DWORD)std::max(m_client->m_server->CoalesceMs(), 0L);
+	DWORD now = GetTickCount();
+	DWORD wait = 0;
+	DWORD pending = now - m_pendingSince;
+	if (pending < coalesce)
+		wait = coalesce - pending;
+	DWORD elapsed = now - m_client->m_lastFrameTime;
+	if (elapsed < interval)
+		wait = std::max(wait, interval - elapsed);
+	return wait;
+}
+
+BOOL
+vncClientUpdateThread::UpdatePending(bool initial)
+{
+	if (!m_client->m_update_tracker.get_changed_region().intersect(m_client->m_incr_rgn).is_empty() ||
+		!m_client->m_update_tracker.get_copied_region().intersect(m_client->m_incr_rgn).is_empty() ||
+		!m_client->m_update_tracker.get_cached_region().intersect(m_client->m_incr_rgn).is_empty())
+		return TRUE;
+	// adzm - 2010-07 - Extended clipboard
+	if (m_client->m_clipboard.m_bNeedToProvide || m_client->m_clipboard.m_bNeedToNotify)
+		return TRUE;
+	// nyama/marscha - PointerPos
+	if (m_client->m_cursor_pos_changed)
+		return TRUE;
+	if (initial)
+		return FALSE;
+	return m_client->m_encodemgr.IsCursorUpdatePending() || m_client->m_NewSWUpdateWaiting;
+}
+
+void
+vncClientUpdateThread::SendPending()
+{
+	m_clipregion = m_client->m_incr_rgn;
+	m_client->m_incr_rgn.clear();
+
+	// sf@2002
+	// New scale requested, we do it before sending the next Update
+	if (m_client->fNewScale)
+	{
+		// Send the new framebuffer size to the client
+		rfb::Rect ViewerSize = m_client->m_encodemgr.m_buffer->GetViewerSize();
+		
+		// Copyright (C) 2001 - Harakan software
+		if (m_client->m_fPalmVNCScaling)
+		{
+			rfb::Rect ScreenSize = m_client->m_encodemgr.m_buffer->GetSize();
+			rfbPalmVNCReSizeFrameBufferMsg rsfb = {0};
+
+			rsfb.type = rfbPalmVNCReSizeFrameBuffer;
+			rsfb.desktop_w = Swap16IfLE(ScreenSize.br.x);
+			rsfb.desktop_h = Swap16IfLE(ScreenSize.br.y);
+			rsfb.buffer_w = Swap16IfLE(ViewerSize.br.x);
+			rsfb.buffer_h = Swap16IfLE(ViewerSize.br.y);
+			omni_mutex_lock l(m_client->GetUpdateLock(), 82);
+			m_client->m_socket->SendExact((char*)&rsfb,
+											sz_rfbPalmVNCReSizeFrameBufferMsg,
+											rfbPalmVNCReSizeFrameBuffer);
+		}
+		else // eSVNC-UltraVNC Scaling
+		{
+			rfbResizeFrameBufferMsg rsmsg;
+			memset(&rsmsg, 0, sizeof(rfbResizeFrameBufferMsg));
+			rsmsg.type = rfbResizeFrameBuffer;
+			rsmsg.framebufferWidth  = Swap16IfLE(ViewerSize.br.x);
+			rsmsg.framebufferHeigth = Swap16IfLE(ViewerSize.br.y);
+			omni_mutex_lock l(m_client->GetUpdateLock(), 82);
+			m_client->m_socket->SendExact((char*)&rsmsg,
+											sz_rfbResizeFrameBufferMsg,
+											rfbResizeFrameBuffer);
+			m_client->m_ScaledScreen = m_client->m_encodemgr.m_buffer->GetViewerSize();
+			m_client->m_nScale = m_client->m_encodemgr.m_buffer->GetScale();
+		}
+
+		m_client->m_encodemgr.m_buffer->ClearCache();
+		m_client->fNewScale = false;
+		m_client->m_fPalmVNCScaling = false;
+
+		// return 0;
+	}
+
+	// Has the palette changed?
+	BOOL send_palette = m_client->m_palettechanged;
+	m_client->m_palettechanged = FALSE;
+
+	// Get the update details from the update tracker
+	m_client->m_update_tracker.flush_update(m_update, m_clipregion);
+
+	m_client->m_cursor_update_pending = m_client->m_encodemgr.WasCursorUpdatePending();
+
+	if (!m_client->m_cursor_update_sent && !m_client->m_cursor_update_pending) {
+		if (m_client->m_mousemoved) {
+			// Re-render its old location
+			m_client->m_oldmousepos = m_client->m_oldmousepos.intersect(m_client->m_ScaledScreen); // sf@2002
+			if (!m_client->m_oldmousepos.is_empty())
+				m_update.add_changed(m_client->m_oldmousepos);
+
+			// And render its new one
+			m_client->m_encodemgr.m_buffer->GetMousePos(m_client->m_oldmousepos);
+			m_client->m_oldmousepos = m_client->m_oldmousepos.intersect(m_client->m_ScaledScreen);
+			if (!m_client->m_oldmousepos.is_empty())
+				m_update.add_changed(m_client->m_oldmousepos);	
+			m_client->m_mousemoved = FALSE;
+		}
+	}
+
+
+	// SEND THE CLIPBOARD
+	// If there is clipboard text to be sent then send it
+	// Also allow in loopbackmode
+	// Loopback mode with winvncviewer will cause a loping
+	// But ssh is back working		
+	if (!m_client->m_fFileSessionOpen) {
+		bool bShouldFlush = false;
+		omni_mutex_lock l(m_client->GetUpdateLock(), 82);
+		// adzm - 2010-07 - Extended clipboard
+		// send any clipboard data that should be sent automatically
+		if (m_client->m_clipboard.m_bNeedToProvide) {
+			m_client->m_clipboard.m_bNeedToProvide = false;
+			if (m_client->m_clipboard.settings.m_bSupportsEx) {
+			
+				int actualLen = m_client->m_clipboard.extendedClipboardDataMessage.GetDataLength();
+
+				rfbServerCutTextMsg message;
+				memset(&message, 0, sizeof(rfbServerCutTextMsg));
+				message.type = rfbServerCutText;
+
+				message.length = Swap32IfLE(-actualLen);
+
+				bShouldFlush = true;
+
+				//adzm 2010-09 - minimize packets. SendExact flushes the queue.
+				if (!m_client->SendRFBMsgQueue(rfbServerCutText,
+					(BYTE *) &message, sizeof(message))) {
+					m_client->m_socket->Close();
+				}
+				if (!m_client->m_socket->SendExactQueue((char*)(m_client->m_clipboard.extendedClipboardDataMessage.GetData()), m_client->m_clipboard.extendedClipboardDataMessage.GetDataLength()))
+					m_client->m_socket->Close();
+			} 
+			else {
+				rfbServerCutTextMsg message;
+				memset(&message, 0, sizeof(rfbServerCutTextMsg));
+				const char* cliptext = m_client->m_clipboard.m_strLastCutText.c_str();
+				char* unixtext = new char[m_client->m_clipboard.m_strLastCutText.length() + 1];
+			
+				// Replace CR-LF with LF - never send CR-LF on the wire,
+				// since Unix won't like it
+				int unixpos=0;
+                        size_t cliplen=strlen(cliptext);
+				for (unsigned int x=0; x<cliplen; x++) {
+					if (cliptext[x] != '\x0d') {
+						unixtext[unixpos] = cliptext[x];
+						unixpos++;
+					}
+				}
+				unixtext[unixpos] = 0;
+
+				message.length = Swap32IfLE(strlen(unixtext));
+
+				bShouldFlush = true;
+
+				//adzm 2010-09 - minimize packets. SendExact flushes the queue.
+				if (!m_client->SendRFBMsgQueue(rfbServerCutText,
+					(BYTE *) &message, sizeof(message))) {
+					m_client->m_socket->Close();
+				}
+				if (!m_client->m_socket->SendExactQueue(unixtext, (const VCard)strlen(unixtext)))
+					m_client->m_socket->Close();
+				delete[] unixtext;
+			}
+			m_client->m_clipboard.extendedClipboardDataMessage.Reset();
+		}
+	
+		// adzm - 2010-07 - Extended clipboard
+		// notify of any other formats
+		if (m_client->m_clipboard.m_bNeedToNotify) {
+			m_client->m_clipboard.m_bNeedToNotify = false;
+			if (m_client->m_clipboard.settings.m_bSupportsEx) {
+			
+				int actualLen = m_client->m_clipboard.extendedClipboardDataNotifyMessage.GetDataLength();
+
+				rfbServerCutTextMsg message;
+				memset(&message, 0, sizeof(rfbServerCutTextMsg));
+				message.type = rfbServerCutText;
+
+				message.length = Swap32IfLE(-actualLen);
+
+				//adzm 2010-09 - minimize packets. SendExact flushes the queue.Queue
+
+				bShouldFlush = true;
+
+				if (!m_client->SendRFBMsgQueue(rfbServerCutText,
+					(BYTE *) &message, sizeof(message))) {
+					m_client->m_socket->Close();
+				}
+				if (!m_client->m_socket->SendExact((char*)(m_client->m_clipboard.extendedClipboardDataNotifyMessage.GetData()), m_client->m_clipboard.extendedClipboardDataNotifyMessage.GetDataLength()))
+					m_client->m_socket->Close();
+			}
+			m_client->m_clipboard.extendedClipboardDataNotifyMessage.Reset();
+		}
+
+	if (bShouldFlush) 
+		m_client->m_socket->ClearQueue();
+	}
+	
+	// SEND AN UPDATE
+	// We do this without holding locks, to avoid network problems
+	// stalling the server.
+
+	// Update the client palette if necessary
+
+	if (send_palette) 
+		m_client->SendPalette();
+
+	//add extra check to avoid buffer/encoder sync problems
+	if ((m_client->m_encodemgr.m_scrinfo.framebufferHeight == m_client->m_encodemgr.m_buffer->m_scrinfo.framebufferHeight) &&
+			(m_client->m_encodemgr.m_scrinfo.framebufferWidth == m_client->m_encodemgr.m_buffer->m_scrinfo.framebufferWidth) &&
+			(m_client->m_encodemgr.m_scrinfo.format.bitsPerPixel == m_client->m_encodemgr.m_buffer->m_scrinfo.format.bitsPerPixel &&
+			m_client->initialCapture_done)) {
+		if (m_client->m_server->CpuGovernor().PowerMode())
+			m_client->sendingUpdate = true;
+		m_client->m_encodemgr.SetCompressCap(m_client->m_server->CpuGovernor().CompressCap());
+		DWORD sendStart = GetTickCount();
+		m_client->m_telemetry.UpdateStart();
+		vncStageTimer timer(STAGE_UPDATE, m_client->m_id);
+		if (m_client->SendUpdate(m_update)) {
+			m_client->m_lastUpdateSendTime = GetTickCount() - sendStart;
+			if (m_client->m_socket->IsAsyncSend()) {
+				m_client->m_lastUpdateStart = sendStart;
+				m_client->m_socket->SetSendMark();
+			}
+			m_client->m_telemetry.UpdateDone(m_client->m_updateRawBytes, m_client->m_updateCachedBytes,
+				m_client->m_encodemgr.m_encoding);
+			m_client->FrameSent();
+			m_clipregion.clear();
+#ifdef _DEBUG
+			static DWORD sNotifyLastCopy1 = GetTickCount();
+			DWORD now = GetTickCount();;
+			OutputDevMessage("==================== SendUpdate %4d =======================", now - sNotifyLastCopy1);
+			sNotifyLastCopy1 = now;
+#endif
+		}
+		m_client->sendingUpdate = false;
+	}
+	if (m_client->m_server->TelemetrySec() > 0)
+		m_client->m_telemetry.Poll((DWORD)m_client->m_server->TelemetrySec() * 1000, m_client->GetAchievedFPS(),
+			m_client->m_server->CpuGovernor().Level());
+}
+
+// Forced update when nothing was sent for this long
+const DWORD UPDATE_IDLE_MS = 4000;
+
+DWORD
+vncClientUpdateThread::RunPooled()
+{
+	if (!g_DesktopThread_running || !m_client->cl_connected)
+		return 0;
+
+	m_client->m_incr_rgn.assign_union(m_clipregion);
+	DWORD wait = RunPooledLocked();
+	m_client->m_telemetry.Flush();
+	return wait;
+}
+
+DWORD
+vncClientUpdateThread::RunPooledLocked()
+{
+	omni_mutex_lock l(m_client->GetUpdateLock(), 82);
+	if (!m_active)
+		return 0;
+	m_client->FoldDamage();
+
+	DWORD now = GetTickCount();
+	if (!m_enable || !UpdatePending(first_run)) {
+		// Tell other threads where we have got to
+		m_sync_sig->broadcast();
+		if (m_enable && !first_run)
+			m_client->EncodeAhead();
+		m_pending = false;
+		first_run = false;
+		DWORD idle = now - m_idleSince;
+		if (idle >= UPDATE_IDLE_MS) {
+			//do forcefull update after 4 seconds
+			m_idleSince = now;
+			m_client->TriggerUpdate();
+			m_client->TriggerUpdateThread();
+			return 0;
+		}
+		return UPDATE_IDLE_MS - idle;
+	}
+
+	m_idleSince = now;
+	if (!m_pending) {
+		m_pending = true;
+		m_pendingSince = now;
+	}
+	DWORD delay = PaceDelay();
+	if (delay > 0) {
+		m_jobHold = true;
+		// EnableUpdates doesn't wait for the frame to go out
+		m_sync_sig->broadcast();
+		return delay;
+	}
+	m_pending = false;
+	first_run = false;
+	SendPending();
+	m_sync_sig->broadcast();
+	return 0;
+}
+
 void*
 vncClientUpdateThread::run_undetached(void *arg)
 {
-	rfb::SimpleUpdateTracker update;
-	rfb::Region2D clipregion;
-	// adzm - 2010-07 - Extended clipboard
-	//char *clipboard_text = 0;
-	update.enable_copyrect(true);
-	BOOL send_palette = FALSE;
 	const int UPDATE_INTERVAL=40;
 	first_run = true;
 
@@ -444,259 +846,65 @@ vncClientUpdateThread::run_undetached(void *arg)
 	while (g_DesktopThread_running && m_client->cl_connected)
 	{				
 		{
-			m_client->m_incr_rgn.assign_union(clipregion);
+			m_client->m_incr_rgn.assign_union(m_clipregion);
 			omni_mutex_lock l(m_client->GetUpdateLock(),82);
+			m_client->FoldDamage();
 			// We block as long as updates are disabled, or the client
 			// isn't interested in them, unless this thread is killed.
 
 			if (first_run)  {
-				while (m_active && (!m_enable || (
-								m_client->m_update_tracker.get_changed_region().intersect(m_client->m_incr_rgn).is_empty() &&
-								m_client->m_update_tracker.get_copied_region().intersect(m_client->m_incr_rgn).is_empty() &&
-								m_client->m_update_tracker.get_cached_region().intersect(m_client->m_incr_rgn).is_empty() &&
-								// adzm - 2010-07 - Extended clipboard
-								!(m_client->m_clipboard.m_bNeedToProvide || m_client->m_clipboard.m_bNeedToNotify) &&
-								!m_client->m_cursor_pos_changed // nyama/marscha - PointerPos
-								))) {
+				while (m_active && (!m_enable || !UpdatePending(true))) {
 					// Issue the synchronisation signal, to tell other threads
 					// where we have got to
 					m_sync_sig->broadcast();
 					// Wait to be kicked into action
-					m_signal->wait();
+					if (m_client->m_server->UseDamageLog()) {
+						WaitWake(INFINITE);
+						m_client->FoldDamage();
+					}
+					else
+						m_signal->wait();
 					first_run = false;
 				}
 			} 
 			else {
-				while (m_active && ( !m_enable || (
-							m_client->m_update_tracker.get_changed_region().intersect(m_client->m_incr_rgn).is_empty() &&
-							m_client->m_update_tracker.get_copied_region().intersect(m_client->m_incr_rgn).is_empty() &&
-							m_client->m_update_tracker.get_cached_region().intersect(m_client->m_incr_rgn).is_empty() &&
-							!m_client->m_encodemgr.IsCursorUpdatePending() &&
-							// adzm - 2010-07 - Extended clipboard
-							!(m_client->m_clipboard.m_bNeedToProvide || m_client->m_clipboard.m_bNeedToNotify) &&
-							!m_client->m_NewSWUpdateWaiting &&
-							!m_client->m_cursor_pos_changed // nyama/marscha - PointerPos
-							))) {
+				while (m_active && (!m_enable || !UpdatePending(false))) {
 					// Issue the synchronisation signal, to tell other threads
 					// where we have got to
 					m_sync_sig->broadcast();
+					// Use the wait to encode what the viewer will ask for next
+					if (m_enable)
+						m_client->EncodeAhead();
 					do{
 						if (!m_client->cl_connected) return 0;
-						if(m_signal->wait(UPDATE_INTERVAL*100)==false) {
+						BOOL woken;
+						if (m_client->m_server->UseDamageLog())
+							woken = WaitWake(UPDATE_INTERVAL*100);
+						else
+							woken = m_signal->wait(UPDATE_INTERVAL*100);
+						if(woken==false) {
 							//do forcefull update after 4 seconds
 							m_client->TriggerUpdate();
 							m_client->TriggerUpdateThread();						
 						}
-						else 
+						else {
+							m_client->FoldDamage();
 							break;
+						}
 					}while(g_DesktopThread_running);
 				}
 			}
 			// If the thread is being killed then quit
 			if (!m_active) 
 				break;
-			clipregion = m_client->m_incr_rgn;
-			m_client->m_incr_rgn.clear();
-
-			// sf@2002
-			// New scale requested, we do it before sending the next Update
-			if (m_client->fNewScale)
-			{
-				// Send the new framebuffer size to the client
-				rfb::Rect ViewerSize = m_client->m_encodemgr.m_buffer->GetViewerSize();
-				
-				// Copyright (C) 2001 - Harakan software
-				if (m_client->m_fPalmVNCScaling)
-				{
-					rfb::Rect ScreenSize = m_client->m_encodemgr.m_buffer->GetSize();
-					rfbPalmVNCReSizeFrameBufferMsg rsfb = {0};
-
-					rsfb.type = rfbPalmVNCReSizeFrameBuffer;
-					rsfb.desktop_w = Swap16IfLE(ScreenSize.br.x);
-					rsfb.desktop_h = Swap16IfLE(ScreenSize.br.y);
-					rsfb.buffer_w = Swap16IfLE(ViewerSize.br.x);
-					rsfb.buffer_h = Swap16IfLE(ViewerSize.br.y);
-					omni_mutex_lock l(m_client->GetUpdateLock(), 82);
-					m_client->m_socket->SendExact((char*)&rsfb,
-													sz_rfbPalmVNCReSizeFrameBufferMsg,
-													rfbPalmVNCReSizeFrameBuffer);
-				}
-				else // eSVNC-UltraVNC Scaling
-				{
-					rfbResizeFrameBufferMsg rsmsg;
-					memset(&rsmsg, 0, sizeof(rfbResizeFrameBufferMsg));
-					rsmsg.type = rfbResizeFrameBuffer;
-					rsmsg.framebufferWidth  = Swap16IfLE(ViewerSize.br.x);
-					rsmsg.framebufferHeigth = Swap16IfLE(ViewerSize.br.y);
-					omni_mutex_lock l(m_client->GetUpdateLock(), 82);
-					m_client->m_socket->SendExact((char*)&rsmsg,
-													sz_rfbResizeFrameBufferMsg,
-													rfbResizeFrameBuffer);
-					m_client->m_ScaledScreen = m_client->m_encodemgr.m_buffer->GetViewerSize();
-					m_client->m_nScale = m_client->m_encodemgr.m_buffer->GetScale();
-				}
-
-				m_client->m_encodemgr.m_buffer->ClearCache();
-				m_client->fNewScale = false;
-				m_client->m_fPalmVNCScaling = false;
-
-				// return 0;
-			}
-
-			// Has the palette changed?
-			send_palette = m_client->m_palettechanged;
-			m_client->m_palettechanged = FALSE;
-		
-			// Get the update details from the update tracker
-			m_client->m_update_tracker.flush_update(update, clipregion);
-
-			m_client->m_cursor_update_pending = m_client->m_encodemgr.WasCursorUpdatePending();
-
-			if (!m_client->m_cursor_update_sent && !m_client->m_cursor_update_pending) {
-				if (m_client->m_mousemoved) {
-					// Re-render its old location
-					m_client->m_oldmousepos = m_client->m_oldmousepos.intersect(m_client->m_ScaledScreen); // sf@2002
-					if (!m_client->m_oldmousepos.is_empty())
-						update.add_changed(m_client->m_oldmousepos);
-
-					// And render its new one
-					m_client->m_encodemgr.m_buffer->GetMousePos(m_client->m_oldmousepos);
-					m_client->m_oldmousepos = m_client->m_oldmousepos.intersect(m_client->m_ScaledScreen);
-					if (!m_client->m_oldmousepos.is_empty())
-						update.add_changed(m_client->m_oldmousepos);	
-					m_client->m_mousemoved = FALSE;
-				}
-			}
-		
-
-			// SEND THE CLIPBOARD
-			// If there is clipboard text to be sent then send it
-			// Also allow in loopbackmode
-			// Loopback mode with winvncviewer will cause a loping
-			// But ssh is back working		
-			if (!m_client->m_fFileSessionOpen) {
-				bool bShouldFlush = false;
-				omni_mutex_lock l(m_client->GetUpdateLock(), 82);
-				// adzm - 2010-07 - Extended clipboard
-				// send any clipboard data that should be sent automatically
-				if (m_client->m_clipboard.m_bNeedToProvide) {
-					m_client->m_clipboard.m_bNeedToProvide = false;
-					if (m_client->m_clipboard.settings.m_bSupportsEx) {
-					
-						int actualLen = m_client->m_clipboard.extendedClipboardDataMessage.GetDataLength();
-
-						rfbServerCutTextMsg message;
-						memset(&message, 0, sizeof(rfbServerCutTextMsg));
-						message.type = rfbServerCutText;
-
-						message.length = Swap32IfLE(-actualLen);
-
-						bShouldFlush = true;
-
-						//adzm 2010-09 - minimize packets. SendExact flushes the queue.
-						if (!m_client->SendRFBMsgQueue(rfbServerCutText,
-							(BYTE *) &message, sizeof(message))) {
-							m_client->m_socket->Close();
-						}
-						if (!m_client->m_socket->SendExactQueue((char*)(m_client->m_clipboard.extendedClipboardDataMessage.GetData()), m_client->m_clipboard.extendedClipboardDataMessage.GetDataLength()))
-							m_client->m_socket->Close();
-					} 
-					else {
-						rfbServerCutTextMsg message;
-						memset(&message, 0, sizeof(rfbServerCutTextMsg));
-						const char* cliptext = m_client->m_clipboard.m_strLastCutText.c_str();
-						char* unixtext = new char[m_client->m_clipboard.m_strLastCutText.length() + 1];
-					
-						// Replace CR-LF with LF - never send CR-LF on the wire,
-						// since Unix won't like it
-						int unixpos=0;
-                        size_t cliplen=strlen(cliptext);
-						for (unsigned int x=0; x<cliplen; x++) {
-							if (cliptext[x] != '\x0d') {
-								unixtext[unixpos] = cliptext[x];
-								unixpos++;
-							}
-						}
-						unixtext[unixpos] = 0;
-
-						message.length = Swap32IfLE(strlen(unixtext));
-
-						bShouldFlush = true;
-
-						//adzm 2010-09 - minimize packets. SendExact flushes the queue.
-						if (!m_client->SendRFBMsgQueue(rfbServerCutText,
-							(BYTE *) &message, sizeof(message))) {
-							m_client->m_socket->Close();
-						}
-						if (!m_client->m_socket->SendExactQueue(unixtext, (const VCard)strlen(unixtext)))
-							m_client->m_socket->Close();
-						delete[] unixtext;
-					}
-					m_client->m_clipboard.extendedClipboardDataMessage.Reset();
-				}
-			
-				// adzm - 2010-07 - Extended clipboard
-				// notify of any other formats
-				if (m_client->m_clipboard.m_bNeedToNotify) {
-					m_client->m_clipboard.m_bNeedToNotify = false;
-					if (m_client->m_clipboard.settings.m_bSupportsEx) {
-					
-						int actualLen = m_client->m_clipboard.extendedClipboardDataNotifyMessage.GetDataLength();
-
-						rfbServerCutTextMsg message;
-						memset(&message, 0, sizeof(rfbServerCutTextMsg));
-						message.type = rfbServerCutText;
-
-						message.length = Swap32IfLE(-actualLen);
-
-						//adzm 2010-09 - minimize packets. SendExact flushes the queue.Queue
-
-						bShouldFlush = true;
-
-						if (!m_client->SendRFBMsgQueue(rfbServerCutText,
-							(BYTE *) &message, sizeof(message))) {
-							m_client->m_socket->Close();
-						}
-						if (!m_client->m_socket->SendExact((char*)(m_client->m_clipboard.extendedClipboardDataNotifyMessage.GetData()), m_client->m_clipboard.extendedClipboardDataNotifyMessage.GetDataLength()))
-							m_client->m_socket->Close();
-					}
-					m_client->m_clipboard.extendedClipboardDataNotifyMessage.Reset();
-				}
-
-			if (bShouldFlush) 
-				m_client->m_socket->ClearQueue();
-			}
-			
-			// SEND AN UPDATE
-			// We do this without holding locks, to avoid network problems
-			// stalling the server.
-
-			// Update the client palette if necessary
-
-			if (send_palette) 
-				m_client->SendPalette();
-
-			//add extra check to avoid buffer/encoder sync problems
-			if ((m_client->m_encodemgr.m_scrinfo.framebufferHeight == m_client->m_encodemgr.m_buffer->m_scrinfo.framebufferHeight) &&
-					(m_client->m_encodemgr.m_scrinfo.framebufferWidth == m_client->m_encodemgr.m_buffer->m_scrinfo.framebufferWidth) &&
-					(m_client->m_encodemgr.m_scrinfo.format.bitsPerPixel == m_client->m_encodemgr.m_buffer->m_scrinfo.format.bitsPerPixel &&
-					m_client->initialCapture_done)) {
-				if (m_client->m_server->MaxCpu() == 100)
-					m_client->sendingUpdate = true;
-				if (m_client->SendUpdate(update)) {
-					clipregion.clear();
-#ifdef _DEBUG
-					static DWORD sNotifyLastCopy1 = GetTickCount();
-					DWORD now = GetTickCount();;
-					OutputDevMessage("==================== SendUpdate %4d =======================", now - sNotifyLastCopy1);
-					sNotifyLastCopy1 = now;
-#endif
-				}
-				m_client->sendingUpdate = false;
-			}
+			PaceFrame();
+			if (!m_active) 
+				break;
+			SendPending();
 			//else
 				//clipregion.clear();
 			}//end omni_mutex_lock l(m_client->GetUpdateLock(),82);
+		m_client->m_telemetry.Flush();
 		yield();
 
 		
@@ -2371,6 +2579,8 @@ vncClientThread::run(void *arg)
 	// m_client->m_update_tracker.add_changed(m_client->m_fullscreen);
 	{ // RealVNC 336
 		omni_mutex_lock l(m_client->GetUpdateLock(),91);
+		// Damage logged before this goes in first, as it would have without the log
+		m_client->FoldDamage();
 		m_client->m_update_tracker.add_changed(m_client->m_ScaledScreen);
 	}
 
@@ -2579,6 +2789,8 @@ vncClientThread::run(void *arg)
 			m_client->m_encodemgr.EnableXCursor(FALSE);
 			m_client->m_encodemgr.EnableRichCursor(FALSE);
 			m_client->m_use_PointerPos = FALSE;
+			m_client->m_use_ServerTiming = FALSE;
+			m_client->m_viewerMaxFPS = 0;
 			m_server->EnableXRichCursor(FALSE);
 			m_client->m_cursor_update_pending = FALSE;
 			m_client->m_cursor_update_sent = FALSE;
@@ -2688,6 +2900,16 @@ vncClientThread::run(void *arg)
 						continue;
 					}
 
+					// Is this a MaxFPS encoding?
+					if ((Swap32IfLE(encoding) >= rfbEncodingMaxFPS1) &&
+						(Swap32IfLE(encoding) <= rfbEncodingMaxFPS255))
+					{
+						// Viewer wants updates paced to this frame rate
+						m_client->m_viewerMaxFPS = (int)(Swap32IfLE(encoding) - rfbEncodingMaxFPS1) + 1;
+						vnclog.Print(LL_INTINFO, VNCLOG("max frame rate requested: %d\n"), m_client->m_viewerMaxFPS);
+						continue;
+					}
+
 					// Is this a LastRect encoding request?
 					if (Swap32IfLE(encoding) == rfbEncodingLastRect) {
 						m_client->m_encodemgr.EnableLastRect(TRUE); // We forbid Last Rect for now 
@@ -2719,6 +2941,11 @@ vncClientThread::run(void *arg)
 						vnclog.Print(LL_INTINFO, VNCLOG("PointerPos protocol extension enabled\n"));
 						continue;
 					}
+					if (Swap32IfLE(encoding) == rfbEncodingServerTiming) {
+						m_client->m_use_ServerTiming = TRUE;
+						vnclog.Print(LL_INTINFO, VNCLOG("ServerTiming protocol extension enabled\n"));
+						continue;
+					}
 					// 21 March 2008 jdp - client wants server state updates
 					if (Swap32IfLE(encoding) == rfbEncodingServerState) {
 						m_client->m_wants_ServerStateUpdates = true;
@@ -3263,6 +3490,8 @@ vncClientThread::run(void *arg)
 						// Get the keymapper to do the work
 						// m_client->m_keymap.DoXkeysym(msg.ke.key, msg.ke.down);
 						vncKeymap::keyEvent(msg.ke.key, (0 != msg.ke.down), m_client->m_jap, m_client->m_unicode);
+						if (msg.ke.down)
+							m_client->InputArrived();
 
 						m_client->m_remoteevent = TRUE;
 					}
@@ -3436,6 +3665,9 @@ vncClientThread::run(void *arg)
 									}
 							}
 					}
+					if (msg.pe.buttonMask & ~m_client->m_ptrevent.buttonMask)
+						m_client->InputArrived();
+
 					// Save the old position
 					m_client->m_ptrevent = msg.pe;
 
@@ -4520,8 +4752,7 @@ vncClientThread::run(void *arg)
 
 	// Finally, it's safe to kill the update thread here
 	if (m_client->m_updatethread) {
-		m_client->m_updatethread->Kill();
-		m_client->m_updatethread->join(NULL);
+		m_client->m_updatethread->Stop();
 	}
 	// Remove the client from the server
 	// This may result in the desktop and buffer being destroyed
@@ -4571,6 +4802,7 @@ vncClient::vncClient() : m_clipboard(ClipboardSettings::defaultServerCaps), Send
 	// Initialise the two update stores
 	m_updatethread = NULL;
 	m_update_tracker.init(this);
+	m_damageEpoch = 0;
 
 	m_remoteevent = FALSE;
 
@@ -4632,6 +4864,34 @@ vncClient::vncClient() : m_clipboard(ClipboardSettings::defaultServerCaps), Send
 	m_cursor_pos_changed = FALSE;
 	m_cursor_pos.x = 0;
 	m_cursor_pos.y = 0;
+	m_use_ServerTiming = FALSE;
+	m_inputArrived = 0;
+
+	// Pointer-centric prioritisation
+	m_lastUpdateSendTime = 0;
+	m_lastUpdateStart = 0;
+	m_lastUpdatePixels = 0;
+	m_deferredUpdates = 0;
+
+	// Frame pacing
+	m_viewerMaxFPS = 0;
+	m_lastFrameTime = 0;
+	m_fpsWindowStart = GetTickCount();
+	m_fpsFrames = 0;
+	m_achievedFPS = 0;
+	m_fpsLogCounter = 0;
+	m_updateRawBytes = 0;
+	m_updateCachedBytes = 0;
+
+	// Broadcast mode
+	m_broadcastFrame = 0;
+	m_broadcastSent = 0;
+	m_framesSkipped = 0;
+
+	// Encode-ahead
+	m_stagedBytes = 0;
+	m_stageHits = 0;
+	m_stageMisses = 0;
 
 	//cachestats
 	totalraw=0;
@@ -4757,8 +5017,7 @@ vncClient::~vncClient()
 		free(m_szHost);
 	}
 	if (m_updatethread) {
-		m_updatethread->Kill();
-		m_updatethread->join(NULL);
+		m_updatethread->Stop();
 	}
 
 	int counter = 0;
@@ -4792,6 +5051,8 @@ vncClient::Init(vncServer *server,
 {
 	// Save the server id;
 	m_server = server;
+	// Damage from before we connected is covered by the first full update
+	m_damageEpoch = m_server->GetDamageLog().Head();
 
 	// Save the socket
 	m_socket = socket;
@@ -4945,6 +5206,39 @@ vncClient::TriggerUpdateThread()
 		m_updatethread->Trigger();
 }
 
+BOOL
+vncClient::FoldDamage()
+{
+	LONG upto = 0;
+	m_broadcastFrame = 0;
+	if (m_server->BroadcastMs() > 0) {
+		// Only whole frames, a viewer that fell behind gets all of them merged
+		m_broadcastFrame = m_server->Broadcast().Sync((DWORD)m_server->BroadcastMs(), m_server->GetDamageLog(), upto);
+	}
+	if (m_staged.empty())
+		return m_server->GetDamageLog().Fold(m_damageEpoch, m_update_tracker, upto);
+
+	rfb::Region2D touched;
+	BOOL folded = m_server->GetDamageLog().Fold(m_damageEpoch, m_update_tracker, upto, &touched);
+	StageInvalidate(touched);
+	return folded;
+}
+
+// Lock-free counterpart of TriggerUpdateThread for the damage log, called
+// for every append. A pooled job is resubmitted; a thread of its own waits
+// on m_hWake while the log is in use, which keeps a wakeup that races with
+// its pending check.
+void
+vncClient::KickUpdateThread()
+{
+	if (!m_updatethread) {
+		omni_mutex_lock l(GetUpdateLock(), 357);
+		TriggerUpdateThread();
+		return;
+	}
+	m_updatethread->Trigger();
+}
+
 void
 vncClient::UpdateMouse()
 {
@@ -5165,6 +5459,163 @@ vncClient::SendRFBMsgQueue(CARD8 type, BYTE *buffer, int buflen)
 	return TRUE;
 }
 
+// Frame pacing
+// The interval is the strictest of the server's per-client cap, its minimum
+// inter-frame interval, the rate the viewer asked for and the CPU governor's
+// pacing floor.
+DWORD
+vncClient::FrameInterval()
+{
+	DWORD interval = (DWORD)std::max(m_server->MinFrameInterval(), 0L);
+	if (m_server->ClientMaxFPS() > 0)
+		interval = std::max(interval, (DWORD)(1000 / m_server->ClientMaxFPS()));
+	if (m_viewerMaxFPS > 0)
+		interval = std::max(interval, (DWORD)(1000 / m_viewerMaxFPS));
+	interval = std::max(interval, m_server->CpuGovernor().FrameIntervalFloor());
+	// Broadcast mode: at most one update per frame
+	interval = std::max(interval, (DWORD)std::max(m_server->BroadcastMs(), 0L));
+	return interval;
+}
+
+void
+vncClient::FrameSent()
+{
+	DWORD now = GetTickCount();
+	m_lastFrameTime = now;
+	m_fpsFrames++;
+	if (m_broadcastFrame != 0) {
+		if (m_broadcastSent != 0 && m_broadcastFrame - m_broadcastSent > 1)
+			m_framesSkipped += m_broadcastFrame - m_broadcastSent - 1;
+		m_broadcastSent = m_broadcastFrame;
+	}
+	DWORD window = now - m_fpsWindowStart;
+	if (window < 1000)
+		return;
+	m_achievedFPS = (int)(m_fpsFrames * 1000 / window);
+	m_fpsFrames = 0;
+	m_fpsWindowStart = now;
+	if (++m_fpsLogCounter >= 10) {
+		m_fpsLogCounter = 0;
+		vnclog.Print(LL_INTINFO, VNCLOG("client %d: %d fps, frame interval %u ms\n"), m_id, m_achievedFPS, FrameInterval());
+		if (m_broadcastSent != 0)
+			vnclog.Print(LL_INTINFO, VNCLOG("client %d: broadcast frame %ld, %ld frames skipped\n"), m_id, m_broadcastSent, m_framesSkipped);
+		if (m_stageHits + m_stageMisses > 0) {
+			vnclog.Print(LL_INTINFO, VNCLOG("client %d: encode-ahead %ld rects sent staged, %ld encoded on request\n"), m_id, m_stageHits, m_stageMisses);
+			m_stageHits = 0;
+			m_stageMisses = 0;
+		}
+	}
+}
+
+// Pointer-centric damage prioritisation
+// Changed rects are ordered so the area the user is looking at goes out
+// first: the rect under the pointer, then rects touching the foreground
+// window, then everything else by distance from the pointer.
+// When the previous update needed more than PRIORITY_TARGET_MS on the wire,
+// only as many pixels as the link moved in that time are sent now; the far
+// rects are handed back to the update tracker and follow in later updates.
+// After PRIORITY_MAX_DEFER deferring updates in a row everything is sent,
+// so distant damage can't starve behind a busy area under the pointer.
+const DWORD PRIORITY_TARGET_MS = 100;
+const int PRIORITY_MAX_DEFER = 8;
+const DWORD PRIORITY_MIN_PIXELS = 128 * 128;
+
+// Queue to wire for the last update. One still in the writer's ring counts
+// as the time so far, which only grows
+DWORD
+vncClient::LastUpdateSendTime()
+{
+	if (!m_socket->IsAsyncSend() || m_lastUpdateStart == 0)
+		return m_lastUpdateSendTime;
+	DWORD done = m_socket->GetSendMarkTick();
+	return (done ? done : GetTickCount()) - m_lastUpdateStart;
+}
+
+void
+vncClient::PrioritiseChanged(rfb::RectVector &changed)
+{
+	if (changed.empty())
+		return;
+
+	// The pointer as the server tracks it: the desktop's cursor rect, or
+	// the position last sent with PointerPos. Everything is compared in
+	// buffer space, the space of the changed rects: PointerPos is on the
+	// wire, past monitor_Offset, and the window rect is on the screen. GetCursorPos fails or is
+	// stale while this thread isn't on the input desktop (UAC, secure
+	// desktop); without a position the order is left alone.
+	POINT cursorPos;
+	rfb::Rect mouse = m_encodemgr.m_buffer->m_desktop->MouseRect();
+	if (!mouse.is_empty()) {
+		cursorPos.x = mouse.tl.x;
+		cursorPos.y = mouse.tl.y;
+	} else if (m_use_PointerPos) {
+		cursorPos.x = m_cursor_pos.x + monitor_Offsetx;
+		cursorPos.y = m_cursor_pos.y + monitor_Offsety;
+	} else {
+		DWORD pixels = 0;
+		for (rfb::RectVector::const_iterator i = changed.begin(); i != changed.end(); i++)
+			pixels += (*i).area();
+		m_lastUpdatePixels = pixels;
+		m_deferredUpdates = 0;
+		return;
+	}
+
+	rfb::Rect focus;
+	RECT windowRect;
+	HWND hwndForeground = GetForegroundWindow();
+	if (hwndForeground && GetWindowRect(hwndForeground, &windowRect))
+		focus = rfb::Rect(windowRect).translate(rfb::Point(-m_ScreenOffsetx, -m_ScreenOffsety));
+
+	// Sort key: tier in the top bits, distance to the pointer below
+	std::vector< std::pair<DWORD, rfb::Rect> > ordered;
+	ordered.reserve(changed.size());
+	for (rfb::RectVector::const_iterator i = changed.begin(); i != changed.end(); i++) {
+		int dx = std::max(std::max((*i).tl.x - (int)cursorPos.x, (int)cursorPos.x - ((*i).br.x - 1)), 0);
+		int dy = std::max(std::max((*i).tl.y - (int)cursorPos.y, (int)cursorPos.y - ((*i).br.y - 1)), 0);
+		DWORD distance = std::min((DWORD)(dx + dy), (DWORD)0x0FFFFFFF);
+		DWORD tier = 2;
+		if (distance == 0)
+			tier = 0;
+		else if (!focus.intersect(*i).is_empty())
+			tier = 1;
+		ordered.push_back(std::make_pair((tier << 28) | distance, *i));
+	}
+	std::stable_sort(ordered.begin(), ordered.end(),
+		[](const std::pair<DWORD, rfb::Rect> &a, const std::pair<DWORD, rfb::Rect> &b) { return a.first < b.first; });
+
+	DWORD budget = 0xFFFFFFFF;
+	DWORD sendTime = LastUpdateSendTime();
+	if (sendTime > PRIORITY_TARGET_MS && m_deferredUpdates < PRIORITY_MAX_DEFER) {
+		budget = (DWORD)((unsigned __int64)m_lastUpdatePixels * PRIORITY_TARGET_MS / sendTime);
+		budget = std::max(budget, PRIORITY_MIN_PIXELS);
+	}
+
+	changed.clear();
+	rfb::Region2D deferred;
+	DWORD pixels = 0;
+	for (size_t n = 0; n < ordered.size(); n++) {
+		if (n > 0 && pixels >= budget)
+			deferred.assign_union(rfb::Region2D(ordered[n].second));
+		else {
+			changed.push_back(ordered[n].second);
+			pixels += ordered[n].second.area();
+		}
+	}
+	m_lastUpdatePixels = pixels;
+
+	if (deferred.is_empty()) {
+		m_deferredUpdates = 0;
+		return;
+	}
+	// The viewer requests the full screen again after this update arrives,
+	// so the deferred area goes out with the next one
+	m_deferredUpdates++;
+	FoldDamage();
+	m_update_tracker.add_changed(deferred);
+	vnclog.Print(LL_INTINFO, VNCLOG("deferred %d of %d changed rects, %u pixels sent\n"),
+		(int)(ordered.size() - changed.size()), (int)ordered.size(), pixels);
+}
+
 BOOL
 vncClient::SendUpdate(rfb::SimpleUpdateTracker &update)
 {		
@@ -5253,6 +5704,13 @@ vncClient::SendUpdate(rfb::SimpleUpdateTracker &update)
 		return TRUE;
 	}
 
+	// Rects encoded ahead of the request go out as they are
+	UseStaged(update_info.changed);
+
+	// Send what the user is looking at first, defer the rest when the link is slow
+	if (m_server->PointerPriority())
+		PrioritiseChanged(update_info.changed);
+
 	// Find out how many rectangles in total will be updated
 	// This includes copyrects and changed rectangles split
 	// up by codings such as CoRRE.
@@ -5325,8 +5783,25 @@ vncClient::SendUpdate(rfb::SimpleUpdateTracker &update)
 		if (updates == 0) return FALSE;
 	}
 
+	// A key or button press this update may be the answer to. Left for
+	// the next update if there is nothing to send.
+	DWORD inputArrived = m_use_ServerTiming ? (DWORD)InterlockedExchange(&m_inputArrived, 0) : 0;
+	if (inputArrived != 0 && updates != 0xFFFF)
+		updates++;
+
 //	Sendtimer.start();
 
+	// Raw size of the pixel data about to be encoded, for the telemetry ratio.
+	// Cached rects cost only a reference on the wire, they're counted apart.
+	m_updateRawBytes = 0;
+	for (i = update_info.changed.begin(); i != update_info.changed.end(); i++)
+		m_updateRawBytes += (*i).area();
+	m_updateRawBytes *= m_encodemgr.GetClientFormat().bitsPerPixel / 8;
+	m_updateCachedBytes = 0;
+	for (i = update_info.cached.begin(); i != update_info.cached.end(); i++)
+		m_updateCachedBytes += (*i).area();
+	m_updateCachedBytes *= m_encodemgr.GetClientFormat().bitsPerPixel / 8;
+
 	omni_mutex_lock l(GetUpdateLock(),100);
 	// Otherwise, send <number of rectangles> header
 	rfbFramebufferUpdateMsg header;
@@ -5376,6 +5851,10 @@ vncClient::SendUpdate(rfb::SimpleUpdateTracker &update)
 	
 	if (!SendRectangles(update_info.changed))
 		return FALSE;
+	// Last, so the encoding counts
+	if (inputArrived != 0)
+		if (!SendServerTiming(inputArrived))
+			return FALSE;
 	// Tight specific - Send LastRect marker if needed.
 	if (updates == 0xFFFF)
 	{
@@ -5563,6 +6042,12 @@ vncClient::SendRectangle(const rfb::Rect &rect)
 	}
 	else // Normal case - No DSM - Symetry is not important
 	{
+		BOOL staged;
+		if (!m_staged.empty() && SendStagedRect(rect, staged))
+			return staged;
+		if (m_broadcastFrame != 0 && m_encodemgr.IsStatelessEncoding())
+			return SendBroadcastRect(ScaledRect);
+
 		UINT bytes = m_encodemgr.EncodeRect(ScaledRect, m_socket);
 
 		// if (bytes == 0) return false; // From realvnc337. No! Causes viewer disconnections/
@@ -5574,6 +6059,181 @@ vncClient::SendRectangle(const rfb::Rect &rect)
 	return true;
 }
 
+// Broadcast mode: send the bytes another viewer with the same format
+// encoded for this rect of the frame, or encode and share them
+BOOL
+vncClient::SendBroadcastRect(const rfb::Rect &rect)
+{
+	vncBroadcastKey key;
+	GetEncodeKey(key);
+	key.frame = m_broadcastFrame;
+	key.rect = rect;
+
+	vncEncodedRect encoded;
+	if (m_server->Broadcast().Lookup(key, encoded))
+		return m_socket->SendExactQueue((char *)&(*encoded)[0], (VCard)encoded->size());
+
+	UINT bytes = m_encodemgr.EncodeRect(rect, m_socket);
+	m_server->Broadcast().Store(key, m_encodemgr.GetClientBuffer(), bytes);
+	return m_socket->SendExactQueue((char *)(m_encodemgr.GetClientBuffer()), bytes);
+}
+
+// What the encoded bytes of a rect depend on, apart from the rect itself
+void
+vncClient::GetEncodeKey(vncBroadcastKey &key)
+{
+	key.frame = 0;
+	key.encoding = m_encodemgr.m_encoding;
+	key.format = m_encodemgr.GetClientFormat();
+	key.scale = m_nScale;
+	key.offsetx = monitor_Offsetx;
+	key.offsety = monitor_Offsety;
+	key.rect = rfb::Rect();
+}
+
+// Encode-ahead
+// While the update thread waits for the viewer's next request, pending
+// damage is encoded into m_staged. When the request comes in, SendUpdate
+// sends the staged bytes of every rect that hasn't changed since and only
+// encodes the rest. Stateless encodings only: a zlib stream can't take back
+// output that never gets sent.
+const size_t STAGE_MAX_BYTES = 16 * 1024 * 1024;
+
+void
+vncClient::EncodeAhead()
+{
+	if (!m_server->EncodeAhead() || !m_encodemgr.IsStatelessEncoding() || !initialCapture_done ||
+		m_NewSWUpdateWaiting || fNewScale || m_broadcastFrame != 0)
+		return;
+	// Palette changes aren't tracked, and DSM plugins frame every rect themselves
+	if (!m_encodemgr.GetClientFormat().trueColour ||
+		(m_socket->IsUsePluginEnabled() && m_server->GetDSMPluginPointer()->IsEnabled()))
+		return;
+	if ((m_encodemgr.m_scrinfo.framebufferHeight != m_encodemgr.m_buffer->m_scrinfo.framebufferHeight) ||
+		(m_encodemgr.m_scrinfo.framebufferWidth != m_encodemgr.m_buffer->m_scrinfo.framebufferWidth) ||
+		(m_encodemgr.m_scrinfo.format.bitsPerPixel != m_encodemgr.m_buffer->m_scrinfo.format.bitsPerPixel))
+		return;
+
+	vncBroadcastKey key;
+	GetEncodeKey(key);
+	if (key < m_stageKey || m_stageKey < key) {
+		m_staged.clear();
+		m_stagedRgn.clear();
+		m_stagedBytes = 0;
+		m_stageKey = key;
+	}
+
+	rfb::Region2D todo = m_update_tracker.get_changed_region().intersect(rfb::Region2D(m_ScaledScreen));
+	todo.assign_subtract(m_stagedRgn);
+	if (todo.is_empty())
+		return;
+
+	rfb::RectVector rects;
+	todo.get_rects(rects, 1, 1);
+	for (rfb::RectVector::const_iterator i = rects.begin(); i != rects.end() && m_stagedBytes < STAGE_MAX_BYTES; i++) {
+		// Same scaling as SendRectangle
+		rfb::Rect scaled((*i).tl.x / m_nScale, (*i).tl.y / m_nScale, (*i).br.x / m_nScale, (*i).br.y / m_nScale);
+		UINT bytes = m_encodemgr.EncodeRect(scaled, m_socket);
+		if (bytes == 0)
+			continue;
+		StagedRect staged;
+		staged.rect = *i;
+		staged.data.assign(m_encodemgr.GetClientBuffer(), m_encodemgr.GetClientBuffer() + bytes);
+		staged.used = false;
+		m_staged.push_back(staged);
+		m_stagedRgn.assign_union(rfb::Region2D(*i));
+		m_stagedBytes += bytes;
+	}
+}
+
+void
+vncClient::StageInvalidate(const rfb::Region2D &rgn)
+{
+	if (m_staged.empty() || rgn.intersect(m_stagedRgn).is_empty())
+		return;
+	m_stagedRgn.clear();
+	for (size_t i = 0; i < m_staged.size(); ) {
+		if (!rgn.intersect(rfb::Region2D(m_staged[i].rect)).is_empty()) {
+			m_stagedBytes -= m_staged[i].data.size();
+			m_staged.erase(m_staged.begin() + i);
+			continue;
+		}
+		m_stagedRgn.assign_union(rfb::Region2D(m_staged[i].rect));
+		i++;
+	}
+}
+
+// Replace the changed rects by the staged rects they fully contain, plus
+// rects for whatever is left
+void
+vncClient::UseStaged(rfb::RectVector &changed)
+{
+	if (m_staged.empty() || changed.empty())
+		return;
+	vncBroadcastKey key;
+	GetEncodeKey(key);
+	if (key < m_stageKey || m_stageKey < key) {
+		m_staged.clear();
+		m_stagedRgn.clear();
+		m_stagedBytes = 0;
+		return;
+	}
+
+	rfb::Region2D sent;
+	rfb::RectVector::const_iterator i;
+	for (i = changed.begin(); i != changed.end(); i++)
+		sent.assign_union(rfb::Region2D(*i));
+
+	rfb::Region2D rest = sent;
+	rfb::RectVector result;
+	for (size_t s = 0; s < m_staged.size(); s++) {
+		rfb::Region2D r(m_staged[s].rect);
+		m_staged[s].used = r.subtract(rest).is_empty();
+		if (m_staged[s].used) {
+			result.push_back(m_staged[s].rect);
+			rest.assign_subtract(r);
+		}
+	}
+	if (result.empty()) {
+		m_stageMisses += (LONG)changed.size();
+		return;
+	}
+
+	rfb::RectVector encode;
+	rest.get_rects(encode, 1, 1);
+	m_stageHits += (LONG)result.size();
+	m_stageMisses += (LONG)encode.size();
+	result.insert(result.end(), encode.begin(), encode.end());
+	changed.swap(result);
+
+	// Staged rects partly in this update are sent fresh, drop them
+	m_stagedRgn.clear();
+	for (size_t s = 0; s < m_staged.size(); ) {
+		if (!m_staged[s].used && !sent.intersect(rfb::Region2D(m_staged[s].rect)).is_empty()) {
+			m_stagedBytes -= m_staged[s].data.size();
+			m_staged.erase(m_staged.begin() + s);
+			continue;
+		}
+		m_stagedRgn.assign_union(rfb::Region2D(m_staged[s].rect));
+		s++;
+	}
+}
+
+BOOL
+vncClient::SendStagedRect(const rfb::Rect &rect, BOOL &result)
+{
+	for (size_t s = 0; s < m_staged.size(); s++) {
+		if (!m_staged[s].used || !m_staged[s].rect.equals(rect))
+			continue;
+		result = m_socket->SendExactQueue((char *)&m_staged[s].data[0], (VCard)m_staged[s].data.size());
+		m_stagedBytes -= m_staged[s].data.size();
+		m_stagedRgn.assign_subtract(rfb::Region2D(rect));
+		m_staged.erase(m_staged.begin() + s);
+		return TRUE;
+	}
+	return FALSE;
+}
+
 // Send a single CopyRect message
 BOOL
 vncClient::SendCopyRect(const rfb::Rect &dest, const rfb::Point &source)
@@ -5765,6 +6425,48 @@ vncClient::SendCursorPosUpdate()
 	return TRUE;
 }
 
+// ms on a clock with better than GetTickCount()'s resolution, never 0
+static DWORD
+TimingMs()
+{
+	static LONGLONG freq = 0;
+	LARGE_INTEGER t;
+	if (freq == 0) {
+		QueryPerformanceFrequency(&t);
+		freq = t.QuadPart > 0 ? t.QuadPart : 1;
+	}
+	QueryPerformanceCounter(&t);
+	DWORD ms = (DWORD)(t.QuadPart * 1000 / freq);
+	return ms != 0 ? ms : 1;
+}
+
+// Client thread: a key or mouse button was pressed. Only the first one
+// since the last update is timed, the viewer does the same.
+void
+vncClient::InputArrived()
+{
+	if (m_use_ServerTiming)
+		InterlockedCompareExchange(&m_inputArrived, (LONG)TimingMs(), 0);
+}
+
+BOOL
+vncClient::SendServerTiming(DWORD arrived)
+{
+	rfbFramebufferUpdateRectHeader hdr;
+	hdr.r.x = 0;
+	hdr.r.y = 0;
+	hdr.r.w = 0;
+	hdr.r.h = 0;
+	hdr.encoding = Swap32IfLE(rfbEncodingServerTiming);
+	CARD32 ms = Swap32IfLE(TimingMs() - arrived);
+
+	if (!m_socket->SendExactQueue((char *)&hdr, sizeof(hdr)))
+		return FALSE;
+	if (!m_socket->SendExactQueue((char *)&ms, sizeof(ms)))
+		return FALSE;
+	return TRUE;
+}
+
 // Tight specific - Send LastRect marker indicating that there are no more rectangles to send
 BOOL
 vncClient::SendLastRect()
@@ -70,6 +70,8 @@ typedef std::list<vncClientId> vncClientList;
 #include "common/Clipboard.h"
 
 #include "MouseSimulator.h"
+#include "vnctelemetry.h"
+#include "vncbroadcast.h"
 
 // The vncClient class itself
 typedef UINT (WINAPI *pSendinput)(UINT,LPINPUT,INT);
@@ -128,17 +130,58 @@ public:
 	// The main thread function
 	virtual void* run_undetached(void* arg);
 
+	// Kill the thread and wait for it to go away
+	void Stop();
+
 protected:
+	friend class vncUpdateScheduler;
+
 	virtual ~vncClientUpdateThread();
 
+	// Hold the next update back until the frame interval has passed
+	void PaceFrame();
+	// Time left to hold it back, 0 when it can go; PaceFrame waits this out
+	DWORD PaceDelay();
+
+	// Something the client asked for is waiting to be sent
+	BOOL UpdatePending(bool initial);
+	// Flush the tracker and send the update, with the UpdateLock held
+	void SendPending();
+
+	// One pass of the loop on a scheduler worker; returns how long
+	// to park the job for, 0 when it only needs running on a trigger
+	DWORD RunPooled();
+	// The part of RunPooled that runs with the UpdateLock held
+	DWORD RunPooledLocked();
+
+	// Wake the thread: m_signal and m_hWake both
+	void Wake();
+	// Damage log mode: wait for a Wake outside the update lock
+	BOOL WaitWake(DWORD ms);
+
 	// Fields
 protected:
 	vncClient* m_client;
 	omni_condition* m_signal;
 	omni_condition* m_sync_sig;
+	// Auto-reset, so a wakeup from the damage log that lands between the
+	// pending check and the wait isn't lost like a condition signal
+	HANDLE m_hWake;
 	BOOL m_active;
 	BOOL m_enable;
 	bool first_run;
+
+	rfb::SimpleUpdateTracker m_update;
+	rfb::Region2D m_clipregion;
+
+	// Pooled mode, see vncUpdateScheduler
+	bool m_pooled;
+	volatile LONG m_jobState;
+	DWORD m_jobDue;
+	bool m_jobHold;			// parked for pacing, not idle
+	bool m_pending;
+	DWORD m_pendingSince;
+	DWORD m_idleSince;
 };
 
 class vncClient
@@ -276,6 +319,12 @@ public:
 	void Clear_Update_Tracker();
 	void TriggerUpdate();
 	void UpdateCursorShape();
+	// Frame pacing
+	DWORD FrameInterval();
+	void FrameSent();
+	int GetAchievedFPS() { return m_achievedFPS; };
+	// Telemetry, the latest transport/encoder sample
+	vncTelemetry::Sample GetTelemetry() { return m_telemetry.GetLast(); };
 	void setTiming(DWORD value) {
 		m_timing = value;
 	}
@@ -368,11 +417,16 @@ public:
 	char infoMsg[255] = { 0 };
 protected:
 	BOOL SendUpdate(rfb::SimpleUpdateTracker &update);
+	void PrioritiseChanged(rfb::RectVector &changed);
 	BOOL SendRFBMsg(CARD8 type, BYTE *buffer, int buflen);
 	//adzm 2010-09 - minimize packets. SendExact flushes the queue.
 	BOOL SendRFBMsgQueue(CARD8 type, BYTE *buffer, int buflen);
 	BOOL SendRectangles(const rfb::RectVector &rects);
 	BOOL SendRectangle(const rfb::Rect &rect);
+	BOOL SendBroadcastRect(const rfb::Rect &rect);
+	void UseStaged(rfb::RectVector &changed);
+	BOOL SendStagedRect(const rfb::Rect &rect, BOOL &result);
+	void GetEncodeKey(vncBroadcastKey &key);
 	BOOL SendCopyRect(const rfb::Rect &dest, const rfb::Point &source);
 	BOOL SendPalette();
 	// CACHE
@@ -385,6 +439,9 @@ protected:
 	// nyama/marscha - PointerPos
 	BOOL SendCursorPosUpdate();
 	BOOL SendLastRect(); // Tight
+	// Server timing, see rfbEncodingServerTiming
+	void InputArrived();
+	BOOL SendServerTiming(DWORD arrived);
 
 	void TriggerUpdateThread();
 
@@ -412,6 +469,7 @@ protected:
 			{
 				// RealVNC 336 change - omni_mutex_lock l(m_client->GetUpdateLock());
 				SimpleUpdateTracker::add_changed(region);
+				m_client->StageInvalidate(region);
 				m_client->TriggerUpdateThread();
 			}
 		}
@@ -419,6 +477,7 @@ protected:
 			{
 				// RealVNC 336 change - omni_mutex_lock l(m_client->GetUpdateLock());
 				SimpleUpdateTracker::add_cached(region);
+				m_client->StageInvalidate(region);
 				m_client->TriggerUpdateThread();
 			}
 		}
@@ -427,6 +486,7 @@ protected:
 			{
 				// RealVNC 336 change - omni_mutex_lock l(m_client->GetUpdateLock());
 				SimpleUpdateTracker::add_copied(dest, delta);
+				m_client->StageInvalidate(dest);
 				m_client->TriggerUpdateThread();
 			}
 		}
@@ -468,6 +528,14 @@ protected:
 public:
 
 	rfb::UpdateTracker &GetUpdateTracker() {return m_update_tracker;};
+	// Shared damage log: replay new entries into our tracker (update lock held),
+	// and wake the update thread without taking the update lock
+	BOOL FoldDamage();
+	void KickUpdateThread();
+	// Encode-ahead: encode pending damage while waiting for the viewer's
+	// request (update lock held), and drop what changed again since
+	void EncodeAhead();
+	void StageInvalidate(const rfb::Region2D &rgn);
 	int				monitor_Offsetx;
 	int				monitor_Offsety;
 	int				m_ScreenOffsetx;
@@ -540,6 +608,8 @@ protected:
 
 	// Client update transmission thread
 	vncClientUpdateThread *m_updatethread;
+	// Last vncDamageLog epoch folded into m_update_tracker
+	LONG			m_damageEpoch;
 
 	// Requested update region & requested flag
 	rfb::Region2D	m_incr_rgn;
@@ -574,6 +644,53 @@ protected:
 	BOOL			m_use_PointerPos;
 	POINT			m_cursor_pos;
 
+	// Server timing: ms of the first key or button press since the last
+	// update, 0 if none
+	BOOL			m_use_ServerTiming;
+	volatile LONG	m_inputArrived;
+
+	// Pointer-centric prioritisation. With the writer thread on, SendUpdate
+	// only queues: the time runs from m_lastUpdateStart to the socket's
+	// send mark
+	DWORD			m_lastUpdateSendTime;
+	DWORD			m_lastUpdateStart;
+	DWORD			LastUpdateSendTime();
+	DWORD			m_lastUpdatePixels;
+	int				m_deferredUpdates;
+
+	// Frame pacing, viewer cap from the MaxFPS pseudo-encoding
+	int				m_viewerMaxFPS;
+	DWORD			m_lastFrameTime;
+	DWORD			m_fpsWindowStart;
+	int				m_fpsFrames;
+	int				m_achievedFPS;
+	int				m_fpsLogCounter;
+
+	// Broadcast mode: frame folded last, frame of the last update sent
+	LONG			m_broadcastFrame;
+	LONG			m_broadcastSent;
+	LONG			m_framesSkipped;
+
+	// Encode-ahead staging: rects encoded before the request came in,
+	// all with the encoding and format in m_stageKey
+	struct StagedRect
+	{
+		rfb::Rect			rect;
+		std::vector<BYTE>	data;
+		bool				used;
+	};
+	std::vector<StagedRect> m_staged;
+	rfb::Region2D	m_stagedRgn;
+	vncBroadcastKey	m_stageKey;
+	size_t			m_stagedBytes;
+	LONG			m_stageHits;
+	LONG			m_stageMisses;
+
+	// Telemetry
+	vncTelemetry	m_telemetry;
+	UINT			m_updateRawBytes;
+	UINT			m_updateCachedBytes;
+
 	// Modif sf@2002 - FileTransfer 
 	BOOL m_fFileTransferRunning;
 	CZipUnZip32		*m_pZipUnZip;
@@ -0,0 +1,171 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncCpuGovernor - closed-loop MaxCpu control
+
+#include "vnccpugovernor.h"
+
+// The ladder, see the header
+const LONG POLL_LEVELS = 10;		// 1..10
+const LONG ACCURACY_LEVELS = 3;		// 11..13
+const LONG COMPRESS_LEVELS = 3;		// 14..16
+const LONG PACING_LEVELS = 4;		// 17..20
+const LONG MAX_LEVEL = POLL_LEVELS + ACCURACY_LEVELS + COMPRESS_LEVELS + PACING_LEVELS;
+
+const DWORD POLL_INTERVAL_MIN = 33;
+const DWORD POLL_INTERVAL_MAX = 500;
+const DWORD POLL_INTERVAL_POWER = 25;
+static const int compressCaps[COMPRESS_LEVELS] = { 5, 3, 1 };
+static const DWORD pacingFloors[PACING_LEVELS] = { 50, 100, 200, 400 };
+
+// Usage must fall this many points below target before a knob is released,
+// so the loop settles instead of toggling the last knob every sample
+const LONG RELEASE_MARGIN = 10;
+
+vncCpuGovernor::vncCpuGovernor()
+{
+	m_target = 100;
+	m_level = 0;
+	m_usage = 0;
+}
+
+void
+vncCpuGovernor::SetTarget(LONG maxcpu)
+{
+	if (maxcpu <= 0 || maxcpu > 100)
+		maxcpu = 100;
+	m_target = maxcpu;
+	if (PowerMode())
+		m_level = 0;
+}
+
+void
+vncCpuGovernor::Sample(short usage)
+{
+	if (PowerMode())
+		return;
+
+	// Exponential average over ~4 samples, in 1/16 percent
+	LONG smoothed = (m_usage * 3 + (LONG)usage * 16) / 4;
+	m_usage = smoothed;
+	LONG current = smoothed / 16;
+	LONG target = m_target;
+
+	// Proportional step: far over target climbs several rungs at once,
+	// release is always one rung at a time
+	LONG level = m_level;
+	if (current > target)
+		level += 1 + (current - target) / 20;
+	else if (current < target - RELEASE_MARGIN)
+		level -= 1;
+	if (level < 0)
+		level = 0;
+	if (level > MAX_LEVEL)
+		level = MAX_LEVEL;
+	if (level == m_level)
+		return;
+
+	Knob before = LevelKnob(m_level);
+	m_level = level;
+	if (LevelKnob(level) != before)
+		vnclog.Print(LL_INTINFO, VNCLOG("cpu governor: usage %d%% target %d%%, level %d, knob %s\n"),
+			current, target, level, KnobName(level));
+}
+
+vncCpuGovernor::Knob
+vncCpuGovernor::LevelKnob(int level)
+{
+	if (level <= 0)
+		return KNOB_NONE;
+	if (level <= POLL_LEVELS)
+		return KNOB_POLL;
+	if (level <= POLL_LEVELS + ACCURACY_LEVELS)
+		return KNOB_ACCURACY;
+	if (level <= POLL_LEVELS + ACCURACY_LEVELS + COMPRESS_LEVELS)
+		return KNOB_COMPRESS;
+	return KNOB_PACING;
+}
+
+vncCpuGovernor::Knob
+vncCpuGovernor::ActiveKnob()
+{
+	return LevelKnob(m_level);
+}
+
+const char *
+vncCpuGovernor::KnobName(int level)
+{
+	static const char *names[] = { "none", "poll", "accuracy", "compress", "pacing" };
+	return names[LevelKnob(level)];
+}
+
+DWORD
+vncCpuGovernor::PollInterval()
+{
+	if (PowerMode())
+		return POLL_INTERVAL_POWER;
+	LONG level = m_level;
+	if (level > POLL_LEVELS)
+		level = POLL_LEVELS;
+	return POLL_INTERVAL_MIN + (POLL_INTERVAL_MAX - POLL_INTERVAL_MIN) * level / POLL_LEVELS;
+}
+
+// The divider must stay a divisor of 32
+int
+vncCpuGovernor::Accuracy(int base)
+{
+	LONG steps = m_level - POLL_LEVELS;
+	if (steps <= 0)
+		return base;
+	if (steps > ACCURACY_LEVELS)
+		steps = ACCURACY_LEVELS;
+	int accuracy = base << steps;
+	return accuracy > 32 ? 32 : accuracy;
+}
+
+int
+vncCpuGovernor::CompressCap()
+{
+	LONG steps = m_level - POLL_LEVELS - ACCURACY_LEVELS;
+	if (steps <= 0)
+		return 9;
+	if (steps > COMPRESS_LEVELS)
+		steps = COMPRESS_LEVELS;
+	return compressCaps[steps - 1];
+}
+
+DWORD
+vncCpuGovernor::FrameIntervalFloor()
+{
+	LONG steps = m_level - POLL_LEVELS - ACCURACY_LEVELS - COMPRESS_LEVELS;
+	if (steps <= 0)
+		return 0;
+	return pacingFloors[steps - 1];
+}
+
+bool
+vncCpuGovernor::Headroom()
+{
+	return PowerMode() || (m_level == 0 && m_usage / 16 < m_target / 2);
+}
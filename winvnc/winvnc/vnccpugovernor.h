@@ -0,0 +1,77 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncCpuGovernor
+
+// Keeps the server near the MaxCpu target. The desktop thread feeds it
+// CProcessorUsage samples; a smoothed usage drives a throttle level up
+// while above target and back down once usage is clearly below it.
+// The level walks a ladder of knobs, cheapest to give up first:
+//   poll		desktop poll interval, 33 -> 500 ms
+//   accuracy	coarser change detection (vncBuffer::SetAccuracy)
+//   compress	cap on the zlib/tight/zrle compress level
+//   pacing		floor on every client's frame interval
+// Readers are lock-free; the level is the only shared state.
+// MaxCpu == 100 is power mode: no throttling at all.
+
+#if !defined(_WINVNC_VNCCPUGOVERNOR)
+#define _WINVNC_VNCCPUGOVERNOR
+#pragma once
+
+#include "stdhdrs.h"
+
+class vncCpuGovernor
+{
+public:
+	enum Knob { KNOB_NONE, KNOB_POLL, KNOB_ACCURACY, KNOB_COMPRESS, KNOB_PACING };
+
+	vncCpuGovernor();
+
+	void SetTarget(LONG maxcpu);
+	bool PowerMode() { return m_target >= 100; };
+
+	// Feed one usage sample (percent), called by the desktop thread
+	void Sample(short usage);
+
+	// Knob settings for the current level
+	DWORD PollInterval();
+	int Accuracy(int base);
+	int CompressCap();
+	DWORD FrameIntervalFloor();
+	// Spare CPU for optional work such as copyrect detection
+	bool Headroom();
+
+	int Level() { return m_level; };
+	Knob ActiveKnob();
+	static const char *KnobName(int level);
+
+protected:
+	static Knob LevelKnob(int level);
+
+	volatile LONG	m_target;
+	volatile LONG	m_level;
+	volatile LONG	m_usage;	// smoothed, percent * 16
+};
+
+#endif // _WINVNC_VNCCPUGOVERNOR
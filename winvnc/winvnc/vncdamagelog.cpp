@@ -0,0 +1,173 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncDamageLog - epoch-indexed damage shared by all clients
+
+#include "vncdamagelog.h"
+
+vncDamageLog::vncDamageLog()
+{
+	m_entries = new vncDamageEntry[DAMAGE_LOG_ENTRIES];
+	for (LONG i = 0; i < DAMAGE_LOG_ENTRIES; i++)
+		m_entries[i].epoch = 0;
+	m_head = 0;
+	for (ULONG i = 0; i < DAMAGE_BOUNDS_WINDOWS; i++) {
+		m_windows[i].used = FALSE;
+		m_windows[i].bounds.clear();
+	}
+	m_older.clear();
+}
+
+vncDamageLog::~vncDamageLog()
+{
+	delete [] m_entries;
+}
+
+void
+vncDamageLog::Append(vncDamageKind kind, const rfb::Region2D &rgn, const rfb::Point &delta)
+{
+	rfb::RectVector rects;
+	if (!rgn.get_rects(rects))
+		return;
+
+	// Split copies would replay as a chain of copies, send those as changed
+	if (kind == DAMAGE_COPIED && rects.size() > (size_t)DAMAGE_ENTRY_RECTS)
+		kind = DAMAGE_CHANGED;
+
+	for (size_t first = 0; first < rects.size(); first += DAMAGE_ENTRY_RECTS) {
+		LONG epoch = NextEpoch(m_head);
+		vncDamageEntry &e = Entry(epoch);
+		InterlockedExchange(&e.epoch, 0);
+		e.kind = kind;
+		e.delta = delta;
+		e.nrects = 0;
+		rfb::Rect bounds;
+		bounds.clear();
+		for (size_t i = first; i < rects.size() && e.nrects < DAMAGE_ENTRY_RECTS; i++) {
+			e.rects[e.nrects++] = rects[i];
+			bounds = bounds.union_boundary(rects[i]);
+		}
+		AddBounds(epoch, bounds);
+		// Publish the entry, then the head
+		InterlockedExchange(&e.epoch, epoch);
+		InterlockedExchange(&m_head, epoch);
+	}
+}
+
+// Desktop thread, before the entry is published
+void
+vncDamageLog::AddBounds(LONG epoch, const rfb::Rect &bounds)
+{
+	omni_mutex_lock l(m_boundsLock, 356);
+	ULONG window = Window(epoch);
+	BoundsWindow &w = m_windows[window & (DAMAGE_BOUNDS_WINDOWS - 1)];
+	if (!w.used || w.window != window) {
+		if (w.used)
+			m_older = m_older.union_boundary(w.bounds);
+		w.window = window;
+		w.used = TRUE;
+		w.bounds.clear();
+	}
+	w.bounds = w.bounds.union_boundary(bounds);
+}
+
+// Bounding box of the entries after epoch up to head. Only a reader that
+// is more than DAMAGE_BOUNDS_WINDOWS windows behind gets the older ones too.
+rfb::Rect
+vncDamageLog::MissedBounds(LONG epoch, LONG head)
+{
+	omni_mutex_lock l(m_boundsLock, 356);
+	ULONG first = Window(NextEpoch(epoch));
+	ULONG last = Window(head);
+	rfb::Rect bounds;
+	bounds.clear();
+	if (last - first >= DAMAGE_BOUNDS_WINDOWS)
+		bounds = m_older;
+	for (ULONG i = 0; i < DAMAGE_BOUNDS_WINDOWS; i++) {
+		const BoundsWindow &w = m_windows[i];
+		if (w.used && w.window - first <= last - first)
+			bounds = bounds.union_boundary(w.bounds);
+	}
+	return bounds;
+}
+
+BOOL
+vncDamageLog::Read(LONG epoch, vncDamageEntry &copy)
+{
+	vncDamageEntry &e = Entry(epoch);
+	if (e.epoch != epoch)
+		return FALSE;
+	copy.kind = e.kind;
+	copy.delta = e.delta;
+	copy.nrects = e.nrects;
+	if (copy.nrects < 0 || copy.nrects > DAMAGE_ENTRY_RECTS)
+		return FALSE;
+	for (int i = 0; i < copy.nrects; i++)
+		copy.rects[i] = e.rects[i];
+	MemoryBarrier();
+	// Still the same entry, so the copy is not torn
+	return e.epoch == epoch;
+}
+
+BOOL
+vncDamageLog::Fold(LONG &epoch, rfb::SimpleUpdateTracker &tracker, LONG upto, rfb::Region2D *touched)
+{
+	LONG head = upto != 0 ? upto : m_head;
+	// A reader that started after upto is already past it
+	if (epoch == head || (LONG)((ULONG)head - (ULONG)epoch) < 0)
+		return FALSE;
+
+	vncDamageEntry entry;
+	while (epoch != head) {
+		LONG next = NextEpoch(epoch);
+		if ((ULONG)head - (ULONG)next >= (ULONG)DAMAGE_LOG_ENTRIES || !Read(next, entry)) {
+			// Overwritten before we got to it
+			rfb::Rect bounds = MissedBounds(epoch, head);
+			vnclog.Print(LL_INTWARN, VNCLOG("damage log overrun, epoch %ld head %ld\n"), epoch, head);
+			tracker.SimpleUpdateTracker::add_changed(rfb::Region2D(bounds));
+			if (touched)
+				touched->assign_union(rfb::Region2D(bounds));
+			epoch = head;
+			return TRUE;
+		}
+
+		rfb::Region2D rgn;
+		rgn.setOrderedRects(rfb::RectVector(entry.rects, entry.rects + entry.nrects));
+		switch (entry.kind) {
+		case DAMAGE_CHANGED:
+			tracker.SimpleUpdateTracker::add_changed(rgn);
+			break;
+		case DAMAGE_CACHED:
+			tracker.SimpleUpdateTracker::add_cached(rgn);
+			break;
+		case DAMAGE_COPIED:
+			tracker.SimpleUpdateTracker::add_copied(rgn, entry.delta);
+			break;
+		}
+		if (touched)
+			touched->assign_union(rgn);
+		epoch = next;
+	}
+	return TRUE;
+}
@@ -0,0 +1,115 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncDamageLog
+
+// Shared damage log for all clients. The desktop thread appends each
+// changed/cached/copied region once, without taking any client lock; every
+// client update thread remembers the last epoch it folded and replays the
+// newer entries into its own tracker under its own update lock.
+// Entries are fixed size and live in a ring, so a reader never chases a
+// pointer the writer may free: it copies an entry and checks the entry's
+// epoch again afterwards, seqlock style. A reader that fell a whole ring
+// behind gets the bounding box of the damage it missed as changed instead:
+// the log keeps one per window of DAMAGE_LOG_ENTRIES epochs, for the last
+// DAMAGE_BOUNDS_WINDOWS windows.
+
+#if !defined(_WINVNC_VNCDAMAGELOG)
+#define _WINVNC_VNCDAMAGELOG
+#pragma once
+
+#include "stdhdrs.h"
+#include <omnithread.h>
+#include "rfbRegion.h"
+#include "rfbUpdateTracker.h"
+
+enum vncDamageKind
+{
+	DAMAGE_CHANGED,
+	DAMAGE_CACHED,
+	DAMAGE_COPIED
+};
+
+// Power of two
+const LONG DAMAGE_LOG_ENTRIES = 256;
+// Larger regions take several entries
+const int DAMAGE_ENTRY_RECTS = 32;
+// Power of two
+const ULONG DAMAGE_BOUNDS_WINDOWS = 64;
+
+struct vncDamageEntry
+{
+	volatile LONG	epoch;		// 0 while the writer is filling the entry
+	int				kind;
+	rfb::Point		delta;		// DAMAGE_COPIED only
+	int				nrects;
+	rfb::Rect		rects[DAMAGE_ENTRY_RECTS];
+};
+
+class vncDamageLog
+{
+public:
+	vncDamageLog();
+	~vncDamageLog();
+
+	// Desktop thread only
+	void Append(vncDamageKind kind, const rfb::Region2D &rgn, const rfb::Point &delta = rfb::Point());
+
+	// Epoch of the newest entry; a new reader starts here
+	LONG Head() { return m_head; };
+
+	// Replay the entries after epoch into tracker and advance epoch, up to
+	// upto if it's set (broadcast frames), else up to the head. Entries go
+	// in one by one in epoch order, the order they were appended, so copies
+	// and changes combine as they would have going straight to the tracker;
+	// a client folds before adding damage of its own for the same reason.
+	// The caller holds the lock that protects tracker. If touched is set,
+	// every region replayed is added to it.
+	BOOL Fold(LONG &epoch, rfb::SimpleUpdateTracker &tracker, LONG upto = 0, rfb::Region2D *touched = NULL);
+
+protected:
+	static LONG NextEpoch(LONG epoch) { return epoch + 1 == 0 ? 1 : epoch + 1; };
+	vncDamageEntry &Entry(LONG epoch) { return m_entries[(ULONG)epoch & (DAMAGE_LOG_ENTRIES - 1)]; };
+	BOOL Read(LONG epoch, vncDamageEntry &copy);
+	static ULONG Window(LONG epoch) { return (ULONG)epoch / DAMAGE_LOG_ENTRIES; };
+	void AddBounds(LONG epoch, const rfb::Rect &bounds);
+	rfb::Rect MissedBounds(LONG epoch, LONG head);
+
+	vncDamageEntry	*m_entries;
+	volatile LONG	m_head;
+
+	// For readers that fell behind: the bounding box of each window's
+	// damage, and of the windows that have dropped out of m_windows
+	struct BoundsWindow
+	{
+		ULONG		window;
+		BOOL		used;
+		rfb::Rect	bounds;
+	};
+	omni_mutex		m_boundsLock;
+	BoundsWindow	m_windows[DAMAGE_BOUNDS_WINDOWS];
+	rfb::Rect		m_older;
+};
+
+#endif // _WINVNC_VNCDAMAGELOG
@@ -452,9 +452,6 @@ vncDesktop::vncDesktop()
 {
 	m_server = NULL;
 	m_thread = NULL;
-#ifdef AVILOG
-	AviGen = NULL;
-#endif
 	m_Black_window_active = false;
 	m_hwnd = NULL;
 	//m_timerid = 0;
@@ -807,25 +804,11 @@ vncDesktop::Startup()
 	// Initialise the buffer object
 	if (!m_buffer.SetDesktop(this))
 		return ERROR_DESKTOP_OUT_OF_MEMORY;
-#ifdef AVILOG
-	if (vnclog.GetVideo()) {
-		SYSTEMTIME lt;
-		GetLocalTime(&lt);
-		char str[MAX_PATH + 32]; // 29 January 2008 jdp 
-		_snprintf_s(str, sizeof str, "%02d_%02d_%02d_%02d_%02d", lt.wMonth, lt.wDay, lt.wHour, lt.wMinute, lt.wSecond);
-		strcat_s(str, "_vnc.avi");
-		AviGen = new CAVIGenerator(str, "c:\\temp", &m_bminfo.bmi.bmiHeader, 5);
-		HRESULT hr;
-		hr = AviGen->InitEngine();
-		if (FAILED(hr))
-		{
-			AviGen->ReleaseEngine();
-			delete AviGen;
-			AviGen = NULL;
-		}
-
-	}
-#endif
+	// Log video: record the session, damaged rects only. One recording
+	// across desktop restarts, it follows resizes itself; the server stops
+	// it when it shuts down.
+	if (vnclog.GetVideo())
+		m_server->Recorder().Start(vnclog.GetPath(), m_server->RecordMs(), m_server->RecordKeyframeSec() * 1000);
 	// Everything is ok, so return success
 	return 0;
 }
@@ -834,14 +817,6 @@ vncDesktop::Startup()
 BOOL
 vncDesktop::Shutdown()
 {
-#ifdef AVILOG
-	if (AviGen)
-	{
-		AviGen->ReleaseEngine();
-		delete AviGen;
-		AviGen = NULL;
-	}
-#endif	
 	ShutdownInitWindowthread();
 
 	RECT rect{};
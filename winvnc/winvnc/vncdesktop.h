@@ -52,9 +52,6 @@ class vncServer;
 #include <list>
 #include <set>
 #include "TextChat.h"
-#ifdef AVILOG
-#include "avilog/avilog/AVIGenerator.h"
-#endif
 #include "common/Clipboard.h"
 #include "IPC.h"
 #include <map>
@@ -442,9 +439,6 @@ protected:
 	bool requested_all_monitor;
 
 	bool m_bIsInputDisabledByClient; // 28 March 2008 jdp
-	#ifdef AVILOG
-	CAVIGenerator *AviGen;
-	#endif
 
 private:
 	HDESK m_input_desktop;
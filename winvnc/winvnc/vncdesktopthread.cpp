@@ -25,6 +25,7 @@
 #include "vncdesktopthread.h"
 #include "vncOSVersion.h"
 #include "uvncUiAccess.h"
+#include "vncstagetrace.h"
 extern bool G_USE_PIXEL;
 
 bool g_DesktopThread_running;
@@ -613,7 +614,7 @@ void vncDesktopThread::do_polling(HANDLE& threadHandle, rfb::Region2D& rgncache,
 	
 
 	DWORD lTime = GetTimeFunction();
-	m_desktop->m_buffer.SetAccuracy(m_desktop->m_server->TurboMode() ? 8 : 4); 
+	m_desktop->m_buffer.SetAccuracy(m_desktop->m_server->CpuGovernor().Accuracy(m_desktop->m_server->TurboMode() ? 8 : 4));
 	if (cursormoved)  {
 		m_desktop->idle_counter=0;
 		m_lLastMouseMoveTime = lTime;
@@ -899,20 +900,14 @@ vncDesktopThread::run_undetached(void *arg)
 						sLastCopy3 = now;
 #endif
 								// MaxCpu() == 100  PowerMode
-								if (m_server->MaxCpu() != 100) {
+								// otherwise the governor picks the poll interval and the other knobs
+								if (!m_server->CpuGovernor().PowerMode()) {
 									if ((fullpollcounter==10 || fullpollcounter==0 || fullpollcounter==5)) {
 										cpuUsage = usage.GetUsage();
-										if (cpuUsage > m_server->MaxCpu()) 
-											MIN_UPDATE_INTERVAL+=10;
-										else MIN_UPDATE_INTERVAL-=10;
-										if (MIN_UPDATE_INTERVAL<MIN_UPDATE_INTERVAL_MIN) 
-											MIN_UPDATE_INTERVAL=MIN_UPDATE_INTERVAL_MIN;
-										if (MIN_UPDATE_INTERVAL>MIN_UPDATE_INTERVAL_MAX) 
-											MIN_UPDATE_INTERVAL=MIN_UPDATE_INTERVAL_MAX;
+										m_server->CpuGovernor().Sample(cpuUsage);
 									}
 								}
-								else
-									MIN_UPDATE_INTERVAL = 25;
+								MIN_UPDATE_INTERVAL = m_server->CpuGovernor().PollInterval();
 
 								// MAX 30fps
 								newtick = GetTimeFunction(); 
@@ -994,9 +989,9 @@ vncDesktopThread::run_undetached(void *arg)
 									//****************************************************************************
 									else  {
 										if (cursormoved)
-											m_desktop->m_buffer.SetAccuracy(m_desktop->m_server->TurboMode() ? 2 : 1);
+											m_desktop->m_buffer.SetAccuracy(m_server->CpuGovernor().Accuracy(m_desktop->m_server->TurboMode() ? 2 : 1));
 										else
-											m_desktop->m_buffer.SetAccuracy(m_desktop->m_server->TurboMode() ? 4 : 2); 
+											m_desktop->m_buffer.SetAccuracy(m_server->CpuGovernor().Accuracy(m_desktop->m_server->TurboMode() ? 4 : 2));
 									}
 									
 									
@@ -1034,11 +1029,12 @@ vncDesktopThread::run_undetached(void *arg)
 									{
 										// Prevent any clients from accessing the Buffer
 										omni_mutex_lock ll(m_desktop->m_update_lock,276);
+										vncStageTrace::NextFrame();
 										
 										// CHECK FOR COPYRECTS
 										// This actually just checks where the Foreground window is
 										// Back added, no need to stop polling during move
-										if ((cpuUsage < m_server->MaxCpu()/2) && !m_desktop->m_hookdriver && !s_moved)
+										if (m_server->CpuGovernor().Headroom() && !m_desktop->m_hookdriver && !s_moved)
 											s_moved=m_desktop->CalcCopyRects(updates);
 										
 										// GRAB THE DISPLAY
@@ -1054,10 +1050,13 @@ vncDesktopThread::run_undetached(void *arg)
 										if (PreConnect && m_desktop->m_server->IsEncoderSet())
 											m_desktop->m_buffer.WriteMessageOnScreenPreConnect();
 										else if (!PreConnect && m_desktop->VideoBuffer() && m_desktop->m_hookdriver ) {
+											vncStageTimer timer(STAGE_CAPTURE);
 											m_desktop->m_buffer.GrabRegion(rgncache, true, capture);
 										}
-										else if (!PreConnect)
+										else if (!PreConnect) {
+											vncStageTimer timer(STAGE_CAPTURE);
 											m_desktop->m_buffer.GrabRegion(rgncache,false,capture);
+										}
 
 										capture=true;
 											
@@ -1146,7 +1145,7 @@ vncDesktopThread::run_undetached(void *arg)
 										//Remove the copyrect region from the other updates																
 										checkrgn = rgncache.subtract(clipped_updates.get_copied_region());	
 										//make sure the copyrect is checked next update
-										if (!clipped_updates.get_copied_region().is_empty() && (cpuUsage < m_server->MaxCpu()/2)) {
+										if (!clipped_updates.get_copied_region().is_empty() && m_server->CpuGovernor().Headroom()) {
 
 											rfb::UpdateInfo update_info;
 											rfb::RectVector::const_iterator i;
@@ -1188,7 +1187,10 @@ vncDesktopThread::run_undetached(void *arg)
 												}
 											}
 
-											m_desktop->m_buffer.CheckRegion(changedrgn,cachedrgn, checkrgn, fullframe);
+											{
+												vncStageTimer timer(STAGE_CHECK);
+												m_desktop->m_buffer.CheckRegion(changedrgn,cachedrgn, checkrgn, fullframe);
+											}
 
 											if(m_desktop->m_screenCapture)
 												m_desktop->m_screenCapture->Unlock();
@@ -1204,6 +1206,7 @@ vncDesktopThread::run_undetached(void *arg)
 										updates.add_cached(cachedrgn);
 												
 										clipped_updates.get_update(m_server->GetUpdateTracker());
+										m_server->Recorder().Capture(m_desktop->m_buffer);
 									}  // end mutex lock
 
 									// Clear the update tracker and region cache an solid
@@ -1216,10 +1219,6 @@ vncDesktopThread::run_undetached(void *arg)
 											monitor_sleep_timer=new_timer;
 										}
 									}
-
-					#ifdef AVILOG
-									if (m_desktop->AviGen) m_desktop->AviGen->AddFrame((BYTE*)m_desktop->m_DIBbits);
-					#endif
 								}
 							}
 						}
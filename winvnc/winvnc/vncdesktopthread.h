@@ -77,8 +77,6 @@ public:
 		}
 		cpuUsage=0;
 		MIN_UPDATE_INTERVAL=33;
-		MIN_UPDATE_INTERVAL_MAX=500;
-		MIN_UPDATE_INTERVAL_MIN=33;
 		// replaced by macpu ini setting
 		//MAX_CPU_USAGE=20;
 		monitor_sleep_timer=0;
@@ -128,8 +126,6 @@ protected:
 	CProcessorUsage usage;
 	short cpuUsage;
 	DWORD MIN_UPDATE_INTERVAL;
-	DWORD MIN_UPDATE_INTERVAL_MAX;
-	DWORD MIN_UPDATE_INTERVAL_MIN;
 	//DWORD MAX_CPU_USAGE;
 	bool capture;
 	bool initialupdate;
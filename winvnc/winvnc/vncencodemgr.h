@@ -40,6 +40,7 @@ class vncEncodeMgr;
 // Includes
 
 #include "vncencoder.h"
+#include "vncstagetrace.h"
 #include "vncencoderre.h"
 #include "vncencodecorre.h"
 #include "vncencodehext.h"
@@ -112,6 +113,8 @@ public:
 
 	// Tight - CONFIGURING ENCODER
 	inline void SetCompressLevel(int level);
+	// Upper bound on the requested level, lowered by the CPU governor
+	inline void SetCompressCap(int cap);
 	inline void SetQualityLevel(int level);
 	inline void SetFineQualityLevel(int level);
 	inline void SetSubsampling(subsamp_type subsamp);
@@ -158,6 +161,8 @@ public:
 #ifdef _XZ
 	inline bool IsBulkRectEncoding() {return (m_encoding == rfbEncodingXZ || m_encoding == rfbEncodingXZYW);};
 #endif
+	// Output depends on the rect and the client format only, no stream state
+	inline bool IsStatelessEncoding() {return (m_encoding == rfbEncodingRaw || m_encoding == rfbEncodingRRE || m_encoding == rfbEncodingCoRRE || m_encoding == rfbEncodingHextile);};
 	inline bool IsUltraEncoding() {return (m_encoding == rfbEncodingUltra || m_encoding == rfbEncodingUltra2);};
 	inline bool IsUltra2Encoding() {return (m_encoding == rfbEncodingUltra2);};
 	inline bool IsEncoderSet() { return ((m_encoder != NULL) && (m_encoding != rfbEncodingRaw)); };
@@ -192,6 +197,7 @@ protected:
 
 	// Tight 
 	int				m_compresslevel;
+	int				m_compresscap;
 	int				m_qualitylevel;
 	int				m_finequalitylevel;
 	subsamp_type	m_subsampling;
@@ -255,6 +261,7 @@ inline vncEncodeMgr::vncEncodeMgr()
 
 	// Tight 
 	m_compresslevel = 6;
+	m_compresscap = 9;
 	m_qualitylevel = -1;
 	m_finequalitylevel = -1;
 	m_subsampling = SUBSAMP_2X;
@@ -726,7 +733,7 @@ vncEncodeMgr::SetEncoding(CARD32 encoding,BOOL reinitialize)
 	if (m_encoder != NULL) {
 		m_encoder->EnableXCursor(m_use_xcursor);
 		m_encoder->EnableRichCursor(m_use_richcursor);
-		m_encoder->SetCompressLevel(m_compresslevel);
+		m_encoder->SetCompressLevel(m_compresslevel < m_compresscap ? m_compresslevel : m_compresscap);
 		m_encoder->SetQualityLevel(m_qualitylevel);
 		m_encoder->SetFineQualityLevel(m_finequalitylevel);
 		m_encoder->SetSubsampling(m_subsampling);
@@ -809,6 +816,7 @@ vncEncodeMgr::EncodeRect(const rfb::Rect &rect,VSocket *outconn)
 		return 0;
 	if(rect.br.y>m_scrinfo.framebufferHeight) 
 		return 0;
+	vncStageTimer timer(STAGE_ENCODE, m_encoding);
 	// Call the encoder to encode the rectangle into the client buffer...
 	/*if (!m_clientbackbuffif){*/
 	if (!m_buffer->m_backbuff){
@@ -848,6 +856,7 @@ vncEncodeMgr::EncodeRect(const rfb::Rect &rect,VSocket *outconn)
 inline UINT
 vncEncodeMgr::EncodeBulkRects(const rfb::RectVector &allRects, int nScale, VSocket *outconn)
 {
+	vncStageTimer timer(STAGE_ENCODE, m_encoding);
 	if (!m_buffer->m_backbuff){
 		vnclog.Print(LL_INTERR, "no client back-buffer available in EncodeRect\n");
 		return 0;
@@ -948,7 +957,17 @@ vncEncodeMgr::SetCompressLevel(int level)
 {
 	m_compresslevel = (level >= 0 && level <= 9) ? level : 6;
 	if (m_encoder != NULL)
-		m_encoder->SetCompressLevel(m_compresslevel);
+		m_encoder->SetCompressLevel(m_compresslevel < m_compresscap ? m_compresslevel : m_compresscap);
+}
+
+inline void
+vncEncodeMgr::SetCompressCap(int cap)
+{
+	if (cap == m_compresscap)
+		return;
+	m_compresscap = cap;
+	if (m_encoder != NULL)
+		m_encoder->SetCompressLevel(m_compresslevel < m_compresscap ? m_compresslevel : m_compresscap);
 }
 
 inline void
@@ -29,6 +29,7 @@
 #include "stdhdrs.h"
 #include "vncencoder.h"
 #include "vncbuffer.h"
+#include "vncstagetrace.h"
 #ifdef _INTERNALLIB
 #include <zlib.h>
 #include <zstd.h>
@@ -130,6 +131,9 @@ vncEncoder::Translate(BYTE *source, BYTE *dest, const rfb::Rect &rect)
 	// Calculate where in the source rectangle to read from
 	BYTE *sourcepos = (BYTE *)(source + (m_bytesPerRow * rect.tl.y)+(rect.tl.x * (m_localformat.bitsPerPixel / 8)));
 
+	// Tiles and single pixels would flood the trace, they're part of their encode
+	__int64 traceStart = (vncStageTrace::enabled && rect.area() >= 4096) ? vncStageTrace::Now() : 0;
+
 	// Call the translation function
 	(*m_transfunc) (m_transtable,
 					&m_localformat,
@@ -140,6 +144,8 @@ vncEncoder::Translate(BYTE *source, BYTE *dest, const rfb::Rect &rect)
 					rect.br.x-rect.tl.x,
 					rect.br.y-rect.tl.y
 					);
+	if (traceStart != 0)
+		vncStageTrace::Record(STAGE_TRANSLATE, traceStart, rect.area());
 }
 
 // Encode a rectangle
@@ -513,10 +513,8 @@ vncProperties::DialogProc(HWND hwnd,
 		   else
 			   CheckDlgButton(hwnd, IDC_LOG, BST_UNCHECKED);
 
-#ifndef AVILOG
+		   // Log video records with vncRecorder, there is no codec to configure
 		   ShowWindow (GetDlgItem(hwnd, IDC_CLEAR), SW_HIDE);
-		   ShowWindow (GetDlgItem(hwnd, IDC_VIDEO), SW_HIDE);
-#endif
 		   if (vnclog.GetVideo())
 		   {
 			   SetDlgItemText(hwnd, IDC_EDIT_PATH, vnclog.GetPath());
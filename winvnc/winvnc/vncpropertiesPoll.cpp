@@ -800,6 +800,22 @@ LABELUSERSETTINGS:
 	m_pref_PollOnEventOnly=FALSE;
 	m_pref_MaxCpu=100;
 	m_pref_MaxFPS = 25;
+	m_pref_PointerPriority = FALSE;
+	m_pref_ClientMaxFPS = 0;
+	m_pref_MinFrameInterval = 0;
+	m_pref_CoalesceMs = 0;
+	m_pref_AsyncSendKB = 0;
+	m_pref_TelemetrySec = 0;
+	m_pref_ClientRateKB = 0;
+	m_pref_ServerRateKB = 0;
+	m_pref_LockProfileSec = 0;
+	m_pref_TraceSec = 0;
+	m_pref_DamageLog = FALSE;
+	m_pref_UpdatePool = FALSE;
+	m_pref_BroadcastMs = 0;
+	m_pref_EncodeAhead = FALSE;
+	m_pref_RecordMs = 200;
+	m_pref_RecordKeyframeSec = 30;
 	m_pref_Driver=CheckVideoDriver(0);
 	m_pref_Hook=TRUE;
 	m_pref_Virtual=FALSE;
@@ -871,6 +887,22 @@ vncPropertiesPoll::LoadUserPrefsPoll(HKEY appkey)
 	m_pref_MaxCpu=LoadInt(appkey, "MaxCpu2", m_pref_MaxCpu);
 	if (m_pref_MaxCpu==0) m_pref_MaxCpu=100;
 	m_pref_MaxFPS = LoadInt(appkey, "MaxFPS", m_pref_MaxFPS);
+	m_pref_PointerPriority = LoadInt(appkey, "PointerPriority", m_pref_PointerPriority);
+	m_pref_ClientMaxFPS = LoadInt(appkey, "ClientMaxFPS", m_pref_ClientMaxFPS);
+	m_pref_MinFrameInterval = LoadInt(appkey, "MinFrameInterval", m_pref_MinFrameInterval);
+	m_pref_CoalesceMs = LoadInt(appkey, "CoalesceMs", m_pref_CoalesceMs);
+	m_pref_AsyncSendKB = LoadInt(appkey, "AsyncSendKB", m_pref_AsyncSendKB);
+	m_pref_TelemetrySec = LoadInt(appkey, "TelemetrySec", m_pref_TelemetrySec);
+	m_pref_ClientRateKB = LoadInt(appkey, "ClientRateKB", m_pref_ClientRateKB);
+	m_pref_ServerRateKB = LoadInt(appkey, "ServerRateKB", m_pref_ServerRateKB);
+	m_pref_LockProfileSec = LoadInt(appkey, "LockProfileSec", m_pref_LockProfileSec);
+	m_pref_TraceSec = LoadInt(appkey, "TraceSec", m_pref_TraceSec);
+	m_pref_DamageLog = LoadInt(appkey, "DamageLog", m_pref_DamageLog);
+	m_pref_UpdatePool = LoadInt(appkey, "UpdatePool", m_pref_UpdatePool);
+	m_pref_BroadcastMs = LoadInt(appkey, "BroadcastMs", m_pref_BroadcastMs);
+	m_pref_EncodeAhead = LoadInt(appkey, "EncodeAhead", m_pref_EncodeAhead);
+	m_pref_RecordMs = LoadInt(appkey, "RecordMs", m_pref_RecordMs);
+	m_pref_RecordKeyframeSec = LoadInt(appkey, "RecordKeyframeSec", m_pref_RecordKeyframeSec);
 	m_pref_Driver=LoadInt(appkey, "EnableDriver", m_pref_Driver);
 	if (m_pref_Driver)m_pref_Driver=CheckVideoDriver(0);
 	m_pref_Hook=LoadInt(appkey, "EnableHook", m_pref_Hook);
@@ -897,6 +929,22 @@ vncPropertiesPoll::ApplyUserPrefs()
 	m_server->PollOnEventOnly(m_pref_PollOnEventOnly);
 	m_server->MaxCpu(m_pref_MaxCpu);	
 	m_server->MaxFPS(m_pref_MaxFPS);
+	m_server->PointerPriority(m_pref_PointerPriority);
+	m_server->ClientMaxFPS(m_pref_ClientMaxFPS);
+	m_server->MinFrameInterval(m_pref_MinFrameInterval);
+	m_server->CoalesceMs(m_pref_CoalesceMs);
+	m_server->AsyncSendKB(m_pref_AsyncSendKB);
+	m_server->TelemetrySec(m_pref_TelemetrySec);
+	m_server->ClientRateKB(m_pref_ClientRateKB);
+	m_server->ServerRateKB(m_pref_ServerRateKB);
+	m_server->LockProfileSec(m_pref_LockProfileSec);
+	m_server->TraceSec(m_pref_TraceSec);
+	m_server->DamageLog(m_pref_DamageLog);
+	m_server->UpdatePool(m_pref_UpdatePool);
+	m_server->BroadcastMs(m_pref_BroadcastMs);
+	m_server->EncodeAhead(m_pref_EncodeAhead);
+	m_server->RecordMs(m_pref_RecordMs);
+	m_server->RecordKeyframeSec(m_pref_RecordKeyframeSec);
 	if (CheckVideoDriver(0) && m_pref_Driver) m_server->Driver(m_pref_Driver);
 	else m_server->Driver(false);
 	m_server->Hook(m_pref_Hook);
@@ -987,6 +1035,22 @@ vncPropertiesPoll::SaveUserPrefsPoll(HKEY appkey)
 	SaveInt(appkey, "OnlyPollOnEvent", m_server->PollOnEventOnly());
 	SaveInt(appkey, "MaxCpu2", m_server->MaxCpu());
 	SaveInt(appkey, "MaxFPS", m_server->MaxFPS());
+	SaveInt(appkey, "PointerPriority", m_server->PointerPriority());
+	SaveInt(appkey, "ClientMaxFPS", m_server->ClientMaxFPS());
+	SaveInt(appkey, "MinFrameInterval", m_server->MinFrameInterval());
+	SaveInt(appkey, "CoalesceMs", m_server->CoalesceMs());
+	SaveInt(appkey, "AsyncSendKB", m_server->AsyncSendKB());
+	SaveInt(appkey, "TelemetrySec", m_server->TelemetrySec());
+	SaveInt(appkey, "ClientRateKB", m_server->ClientRateKB());
+	SaveInt(appkey, "ServerRateKB", m_server->ServerRateKB());
+	SaveInt(appkey, "LockProfileSec", m_server->LockProfileSec());
+	SaveInt(appkey, "TraceSec", m_server->TraceSec());
+	SaveInt(appkey, "DamageLog", m_server->DamageLog());
+	SaveInt(appkey, "UpdatePool", m_server->UpdatePool());
+	SaveInt(appkey, "BroadcastMs", m_server->BroadcastMs());
+	SaveInt(appkey, "EncodeAhead", m_server->EncodeAhead());
+	SaveInt(appkey, "RecordMs", m_server->RecordMs());
+	SaveInt(appkey, "RecordKeyframeSec", m_server->RecordKeyframeSec());
 	SaveInt(appkey, "EnableDriver", m_server->Driver());
 	SaveInt(appkey, "EnableHook", m_server->Hook());
 	SaveInt(appkey, "EnableVirtual", m_server->Virtual());
@@ -1016,6 +1080,22 @@ void vncPropertiesPoll::LoadFromIniFile()
 	m_pref_PollOnEventOnly=FALSE;
 	m_pref_MaxCpu=100;
 	m_pref_MaxFPS = 25;
+	m_pref_PointerPriority = FALSE;
+	m_pref_ClientMaxFPS = 0;
+	m_pref_MinFrameInterval = 0;
+	m_pref_CoalesceMs = 0;
+	m_pref_AsyncSendKB = 0;
+	m_pref_TelemetrySec = 0;
+	m_pref_ClientRateKB = 0;
+	m_pref_ServerRateKB = 0;
+	m_pref_LockProfileSec = 0;
+	m_pref_TraceSec = 0;
+	m_pref_DamageLog = FALSE;
+	m_pref_UpdatePool = FALSE;
+	m_pref_BroadcastMs = 0;
+	m_pref_EncodeAhead = FALSE;
+	m_pref_RecordMs = 200;
+	m_pref_RecordKeyframeSec = 30;
 	m_pref_Driver=CheckVideoDriver(0);
 	m_pref_Hook=TRUE;
 	m_pref_Virtual=FALSE;
@@ -1040,6 +1120,22 @@ void vncPropertiesPoll::LoadUserPrefsPollFromIniFile()
 	m_pref_MaxCpu=myIniFile.ReadInt("poll", "MaxCpu2", m_pref_MaxCpu);
 	if (m_pref_MaxCpu==0) m_pref_MaxCpu=100;
 	m_pref_MaxFPS = myIniFile.ReadInt("poll", "MaxFPS", m_pref_MaxFPS);
+	m_pref_PointerPriority = myIniFile.ReadInt("poll", "PointerPriority", m_pref_PointerPriority);
+	m_pref_ClientMaxFPS = myIniFile.ReadInt("poll", "ClientMaxFPS", m_pref_ClientMaxFPS);
+	m_pref_MinFrameInterval = myIniFile.ReadInt("poll", "MinFrameInterval", m_pref_MinFrameInterval);
+	m_pref_CoalesceMs = myIniFile.ReadInt("poll", "CoalesceMs", m_pref_CoalesceMs);
+	m_pref_AsyncSendKB = myIniFile.ReadInt("poll", "AsyncSendKB", m_pref_AsyncSendKB);
+	m_pref_TelemetrySec = myIniFile.ReadInt("poll", "TelemetrySec", m_pref_TelemetrySec);
+	m_pref_ClientRateKB = myIniFile.ReadInt("poll", "ClientRateKB", m_pref_ClientRateKB);
+	m_pref_ServerRateKB = myIniFile.ReadInt("poll", "ServerRateKB", m_pref_ServerRateKB);
+	m_pref_LockProfileSec = myIniFile.ReadInt("poll", "LockProfileSec", m_pref_LockProfileSec);
+	m_pref_TraceSec = myIniFile.ReadInt("poll", "TraceSec", m_pref_TraceSec);
+	m_pref_DamageLog = myIniFile.ReadInt("poll", "DamageLog", m_pref_DamageLog);
+	m_pref_UpdatePool = myIniFile.ReadInt("poll", "UpdatePool", m_pref_UpdatePool);
+	m_pref_BroadcastMs = myIniFile.ReadInt("poll", "BroadcastMs", m_pref_BroadcastMs);
+	m_pref_EncodeAhead = myIniFile.ReadInt("poll", "EncodeAhead", m_pref_EncodeAhead);
+	m_pref_RecordMs = myIniFile.ReadInt("poll", "RecordMs", m_pref_RecordMs);
+	m_pref_RecordKeyframeSec = myIniFile.ReadInt("poll", "RecordKeyframeSec", m_pref_RecordKeyframeSec);
 	m_pref_Driver=myIniFile.ReadInt("poll", "EnableDriver", m_pref_Driver);
 	if (m_pref_Driver)m_pref_Driver=CheckVideoDriver(0);
 	m_pref_Hook=myIniFile.ReadInt("poll", "EnableHook", m_pref_Hook);
@@ -1088,6 +1184,22 @@ void vncPropertiesPoll::SaveUserPrefsPollToIniFile()
 	myIniFile.WriteInt("poll", "OnlyPollOnEvent", m_server->PollOnEventOnly());
 	myIniFile.WriteInt("poll", "MaxCpu2", m_server->MaxCpu());
 	myIniFile.WriteInt("poll", "MaxFPS", m_server->MaxFPS());
+	myIniFile.WriteInt("poll", "PointerPriority", m_server->PointerPriority());
+	myIniFile.WriteInt("poll", "ClientMaxFPS", m_server->ClientMaxFPS());
+	myIniFile.WriteInt("poll", "MinFrameInterval", m_server->MinFrameInterval());
+	myIniFile.WriteInt("poll", "CoalesceMs", m_server->CoalesceMs());
+	myIniFile.WriteInt("poll", "AsyncSendKB", m_server->AsyncSendKB());
+	myIniFile.WriteInt("poll", "TelemetrySec", m_server->TelemetrySec());
+	myIniFile.WriteInt("poll", "ClientRateKB", m_server->ClientRateKB());
+	myIniFile.WriteInt("poll", "ServerRateKB", m_server->ServerRateKB());
+	myIniFile.WriteInt("poll", "LockProfileSec", m_server->LockProfileSec());
+	myIniFile.WriteInt("poll", "TraceSec", m_server->TraceSec());
+	myIniFile.WriteInt("poll", "DamageLog", m_server->DamageLog());
+	myIniFile.WriteInt("poll", "UpdatePool", m_server->UpdatePool());
+	myIniFile.WriteInt("poll", "BroadcastMs", m_server->BroadcastMs());
+	myIniFile.WriteInt("poll", "EncodeAhead", m_server->EncodeAhead());
+	myIniFile.WriteInt("poll", "RecordMs", m_server->RecordMs());
+	myIniFile.WriteInt("poll", "RecordKeyframeSec", m_server->RecordKeyframeSec());
 
 	myIniFile.WriteInt("poll", "EnableDriver", m_server->Driver());
 	myIniFile.WriteInt("poll", "EnableHook", m_server->Hook());
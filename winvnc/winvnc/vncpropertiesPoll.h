@@ -105,6 +105,22 @@ protected:
 	BOOL m_pref_PollOnEventOnly;
 	LONG m_pref_MaxCpu;
 	LONG m_pref_MaxFPS;
+	BOOL m_pref_PointerPriority;
+	LONG m_pref_ClientMaxFPS;
+	LONG m_pref_MinFrameInterval;
+	LONG m_pref_CoalesceMs;
+	LONG m_pref_AsyncSendKB;
+	LONG m_pref_TelemetrySec;
+	LONG m_pref_ClientRateKB;
+	LONG m_pref_ServerRateKB;
+	LONG m_pref_LockProfileSec;
+	LONG m_pref_TraceSec;
+	BOOL m_pref_DamageLog;
+	BOOL m_pref_UpdatePool;
+	LONG m_pref_BroadcastMs;
+	BOOL m_pref_EncodeAhead;
+	LONG m_pref_RecordMs;
+	LONG m_pref_RecordKeyframeSec;
 
 	BOOL m_pref_Driver;
 	BOOL m_pref_Hook;
@@ -0,0 +1,332 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncRecorder - damage-only server side session recording
+
+#include "vncrecorder.h"
+#include "vncbuffer.h"
+#include <time.h>
+
+// Rows per encoded rect, bounds the update buffer
+const int RECORD_STRIP_ROWS = 64;
+const char RECORD_EXTENSION[] = "_vnc.uvr";
+
+// Recorder thread, see vncRecorder::Start
+class vncRecorderThread : public omni_thread
+{
+public:
+	vncRecorderThread(vncRecorder *recorder) : m_recorder(recorder) {};
+	void Start() { start_undetached(); };
+protected:
+	virtual void *run_undetached(void *arg) { m_recorder->RecorderLoop(); return NULL; };
+	vncRecorder *m_recorder;
+};
+
+// What recordings are in, whatever the screen is: the headless player's
+// format, so it decodes without translating
+static rfbPixelFormat
+RecordFormat()
+{
+	rfbPixelFormat pf;
+	memset(&pf, 0, sizeof(pf));
+	pf.bitsPerPixel = 32;
+	pf.depth = 24;
+	pf.bigEndian = 0;
+	pf.trueColour = 1;
+	pf.redMax = 255;
+	pf.greenMax = 255;
+	pf.blueMax = 255;
+	pf.redShift = 16;
+	pf.greenShift = 8;
+	pf.blueShift = 0;
+	return pf;
+}
+
+vncRecorder::vncRecorder()
+{
+	m_thread = NULL;
+	m_hWork = NULL;
+	m_stop = false;
+	m_busy = 0;
+	memset(&m_scrinfo, 0, sizeof(m_scrinfo));
+	m_keyframe = FALSE;
+	m_resized = FALSE;
+	m_captureMs = 0;
+	m_intervalMs = 200;
+	m_waitMs = 200;
+	m_lastCapture = 0;
+	m_started = FALSE;
+	m_name[0] = 0;
+	m_updateSize = 0;
+	m_updateRects = 0;
+}
+
+vncRecorder::~vncRecorder()
+{
+	Stop();
+}
+
+BOOL
+vncRecorder::Start(const char *dir, DWORD intervalMs, DWORD keyframeMs)
+{
+	if (m_thread != NULL)
+		return TRUE;
+
+	SYSTEMTIME lt;
+	GetLocalTime(&lt);
+	char path[MAX_PATH + 32];
+	_snprintf_s(path, sizeof path, _TRUNCATE, "%s\\%02d_%02d_%02d_%02d_%02d%s", dir,
+		lt.wMonth, lt.wDay, lt.wHour, lt.wMinute, lt.wSecond, RECORD_EXTENSION);
+
+	RecordingHeader header;
+	header.source = recordingSourceServer;
+	header.keyframeMs = keyframeMs;
+	header.startTime = (long long)time(NULL);
+	if (!m_writer.Open(path, header)) {
+		vnclog.Print(LL_INTERR, VNCLOG("recorder: can't create %s, %s\n"), path, m_writer.Error().c_str());
+		return FALSE;
+	}
+	m_hWork = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (m_hWork == NULL) {
+		m_writer.Close();
+		return FALSE;
+	}
+
+	DWORD size = sizeof(m_name);
+	if (!GetComputerName(m_name, &size))
+		m_name[0] = 0;
+	{
+		omni_mutex_lock l(m_lock,359);
+		m_damage.clear();
+	}
+	memset(&m_scrinfo, 0, sizeof(m_scrinfo));
+	m_intervalMs = intervalMs;
+	m_waitMs = intervalMs;
+	m_lastCapture = GetTickCount() - intervalMs;
+	m_started = FALSE;
+	m_stop = false;
+	m_busy = 0;
+
+	vncRecorderThread *thread = new vncRecorderThread(this);
+	m_thread = thread;
+	thread->Start();
+	vnclog.Print(LL_INTINFO, VNCLOG("recorder: recording to %s, every %u ms, keyframes every %u ms\n"),
+		path, intervalMs, keyframeMs);
+	return TRUE;
+}
+
+void
+vncRecorder::Stop()
+{
+	if (m_thread == NULL)
+		return;
+	m_stop = true;
+	SetEvent(m_hWork);
+	m_thread->join(NULL);
+	m_thread = NULL;
+	CloseHandle(m_hWork);
+	m_hWork = NULL;
+	vnclog.Print(LL_INTINFO, VNCLOG("recorder: stopped, %I64d bytes\n"), m_writer.Bytes());
+	m_writer.Close();
+	std::vector<BYTE>().swap(m_shadow);
+	std::vector<BYTE>().swap(m_update);
+}
+
+// Cached and copied rects are just changed pixels to a recording
+
+void
+vncRecorder::add_changed(const rfb::Region2D &region)
+{
+	if (m_thread == NULL)
+		return;
+	omni_mutex_lock l(m_lock,360);
+	m_damage.assign_union(region);
+}
+
+void
+vncRecorder::add_cached(const rfb::Region2D &region)
+{
+	add_changed(region);
+}
+
+void
+vncRecorder::add_copied(const rfb::Region2D &dest, const rfb::Point &delta)
+{
+	add_changed(dest);
+}
+
+void
+vncRecorder::Capture(vncBuffer &buffer)
+{
+	if (m_thread == NULL || m_busy || buffer.m_backbuff == NULL)
+		return;
+	DWORD now = GetTickCount();
+	if (now - m_lastCapture < (DWORD)m_waitMs)
+		return;
+
+	const rfbServerInitMsg &si = buffer.m_scrinfo;
+	m_resized = si.framebufferWidth != m_scrinfo.framebufferWidth ||
+		si.framebufferHeight != m_scrinfo.framebufferHeight ||
+		memcmp(&si.format, &m_scrinfo.format, sizeof(si.format)) != 0;
+	rdr::U32 ms = m_writer.Now();
+	m_keyframe = m_resized || m_writer.KeyframeDue(ms);
+
+	rfb::Region2D damage;
+	{
+		omni_mutex_lock l(m_lock,361);
+		damage = m_damage;
+		m_damage.clear();
+	}
+	if (damage.is_empty() && !m_keyframe)
+		return;
+	m_lastCapture = now;
+
+	const rfb::Rect frame(0, 0, si.framebufferWidth, si.framebufferHeight);
+	const int bytesPerPixel = si.format.bitsPerPixel / 8;
+	const int bytesPerRow = si.framebufferWidth * bytesPerPixel;
+	m_rects.clear();
+	if (m_resized) {
+		m_scrinfo = si;
+		m_shadow.resize((size_t)bytesPerRow * si.framebufferHeight);
+	}
+	if (m_keyframe)
+		m_rects.push_back(frame);
+	else
+		damage.intersect(frame).get_rects(m_rects);
+	if (m_rects.empty() || m_shadow.empty())
+		return;
+
+	for (rfb::RectVector::const_iterator i = m_rects.begin(); i != m_rects.end(); i++) {
+		const int offset = i->tl.y * bytesPerRow + i->tl.x * bytesPerPixel;
+		const int width = (i->br.x - i->tl.x) * bytesPerPixel;
+		for (int y = i->tl.y; y < i->br.y; y++)
+			memcpy(&m_shadow[offset + (y - i->tl.y) * bytesPerRow],
+				buffer.m_backbuff + offset + (y - i->tl.y) * bytesPerRow, width);
+	}
+
+	m_captureMs = ms;
+	InterlockedExchange(&m_busy, 1);
+	SetEvent(m_hWork);
+}
+
+void
+vncRecorder::RecorderLoop()
+{
+	while (!m_stop) {
+		WaitForSingleObject(m_hWork, INFINITE);
+		if (m_stop || !m_busy)
+			continue;
+		DWORD start = GetTickCount();
+		Encode();
+		if (!m_writer.IsOpen()) {
+			// m_busy stays set, so nothing more is queued
+			vnclog.Print(LL_INTERR, VNCLOG("recorder: write failed, %s\n"), m_writer.Error().c_str());
+			break;
+		}
+		// At most a quarter of one core
+		DWORD took = GetTickCount() - start;
+		InterlockedExchange(&m_waitMs, (LONG)(took * 4 > m_intervalMs ? took * 4 : m_intervalMs));
+		InterlockedExchange(&m_busy, 0);
+	}
+}
+
+void
+vncRecorder::WriteServerInit(BOOL keyframe)
+{
+	rfbServerInitMsg si;
+	si.framebufferWidth = Swap16IfLE(m_scrinfo.framebufferWidth);
+	si.framebufferHeight = Swap16IfLE(m_scrinfo.framebufferHeight);
+	si.format = RecordFormat();
+	si.format.redMax = Swap16IfLE(si.format.redMax);
+	si.format.greenMax = Swap16IfLE(si.format.greenMax);
+	si.format.blueMax = Swap16IfLE(si.format.blueMax);
+	const size_t nameLength = strlen(m_name);
+	si.nameLength = Swap32IfLE((CARD32)nameLength);
+
+	std::vector<BYTE> msg(sz_rfbServerInitMsg + nameLength);
+	memcpy(&msg[0], &si, sz_rfbServerInitMsg);
+	memcpy(&msg[sz_rfbServerInitMsg], m_name, nameLength);
+	if (keyframe)
+		m_writer.Keyframe(&msg[0], msg.size(), m_captureMs);
+	else
+		m_writer.Message(&msg[0], msg.size(), m_captureMs);
+}
+
+void
+vncRecorder::FlushUpdate()
+{
+	if (m_updateRects == 0)
+		return;
+	rfbFramebufferUpdateMsg *fu = (rfbFramebufferUpdateMsg *)&m_update[0];
+	fu->type = rfbFramebufferUpdate;
+	fu->pad = 0;
+	fu->nRects = Swap16IfLE((CARD16)m_updateRects);
+	m_writer.Message(&m_update[0], m_updateSize, m_captureMs);
+	m_updateSize = sz_rfbFramebufferUpdateMsg;
+	m_updateRects = 0;
+}
+
+void
+vncRecorder::Encode()
+{
+	const int width = m_scrinfo.framebufferWidth;
+	const int height = m_scrinfo.framebufferHeight;
+	if (m_resized) {
+		rfbPixelFormat remote = RecordFormat();
+		m_encoder.SetLocalFormat(m_scrinfo.format, width, height);
+		m_encoder.SetRemoteFormat(remote);
+		m_update.resize(sz_rfbFramebufferUpdateMsg + m_encoder.RequiredBuffSize(width, RECORD_STRIP_ROWS));
+	}
+	if (m_keyframe)
+		WriteServerInit(m_started);
+
+	m_updateSize = sz_rfbFramebufferUpdateMsg;
+	m_updateRects = 0;
+	if (m_resized && m_started) {
+		// Players going through the keyframe resize here, a NewFBSize
+		// rect ends its update
+		rfbFramebufferUpdateRectHeader *surh = (rfbFramebufferUpdateRectHeader *)&m_update[m_updateSize];
+		surh->r.x = 0;
+		surh->r.y = 0;
+		surh->r.w = Swap16IfLE((CARD16)width);
+		surh->r.h = Swap16IfLE((CARD16)height);
+		surh->encoding = Swap32IfLE(rfbEncodingNewFBSize);
+		m_updateSize += sz_rfbFramebufferUpdateRectHeader;
+		m_updateRects++;
+		FlushUpdate();
+	}
+
+	for (rfb::RectVector::const_iterator i = m_rects.begin(); i != m_rects.end(); i++) {
+		for (int y = i->tl.y; y < i->br.y; y += RECORD_STRIP_ROWS) {
+			rfb::Rect strip(i->tl.x, y, i->br.x, y + RECORD_STRIP_ROWS < i->br.y ? y + RECORD_STRIP_ROWS : i->br.y);
+			UINT size = m_encoder.RequiredBuffSize(strip.br.x - strip.tl.x, strip.br.y - strip.tl.y);
+			if (m_updateSize + size > m_update.size() || m_updateRects == 0xffff)
+				FlushUpdate();
+			m_updateSize += m_encoder.EncodeRect(&m_shadow[0], &m_update[m_updateSize], strip);
+			m_updateRects++;
+		}
+	}
+	FlushUpdate();
+	m_started = TRUE;
+}
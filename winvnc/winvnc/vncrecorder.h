@@ -0,0 +1,114 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncRecorder
+
+// Server-side session recording. The recorder sits on the server's update
+// tracker next to the clients and only ever sees damage: what changed,
+// was cached or copied since the last capture. Every RecordMs the desktop
+// thread copies those rects out of the back buffer into a shadow frame,
+// and the recorder thread encodes them with Hextile into the same
+// container the viewers record to (common/SessionRecording). Hextile is
+// lossless and keeps no state between rects, so any keyframe is a point a
+// player can start from: a keyframe holds the ServerInit, and a full frame
+// update follows it. The container's zstd does the entropy coding.
+//
+// Memory is the shadow frame and one strip of encoded rects. A capture is
+// skipped while the thread still encodes the last one, the damage just
+// piles up until the next, and the interval stretches so that encoding
+// takes at most a quarter of one core.
+
+#if !defined(_WINVNC_VNCRECORDER)
+#define _WINVNC_VNCRECORDER
+#pragma once
+
+#include "stdhdrs.h"
+#include <omnithread.h>
+#include <vector>
+#include "rfb.h"
+#include "rfbRegion.h"
+#include "rfbUpdateTracker.h"
+#include "vncencodehext.h"
+#include "../../common/SessionRecording.h"
+
+class vncBuffer;
+
+class vncRecorder : public rfb::UpdateTracker
+{
+public:
+	vncRecorder();
+	~vncRecorder();
+
+	// Start a recording in dir, named after the time like the log video
+	BOOL Start(const char *dir, DWORD intervalMs, DWORD keyframeMs);
+	void Stop();
+	BOOL IsRecording() { return m_thread != NULL; };
+
+	// Damage, from the server's update tracker
+	virtual void add_changed(const rfb::Region2D &region);
+	virtual void add_cached(const rfb::Region2D &region);
+	virtual void add_copied(const rfb::Region2D &dest, const rfb::Point &delta);
+
+	// Desktop thread, with the update lock held
+	void Capture(vncBuffer &buffer);
+
+	void RecorderLoop();
+
+protected:
+	void Encode();
+	void WriteServerInit(BOOL keyframe);
+	void FlushUpdate();
+
+	omni_thread		*m_thread;
+	HANDLE			m_hWork;
+	volatile bool	m_stop;
+	volatile LONG	m_busy;
+
+	// Damage since the last capture
+	omni_mutex		m_lock;
+	rfb::Region2D	m_damage;
+
+	// Handed to the thread with m_busy
+	rfbServerInitMsg	m_scrinfo;
+	std::vector<BYTE>	m_shadow;
+	rfb::RectVector		m_rects;
+	BOOL				m_keyframe;
+	BOOL				m_resized;
+	rdr::U32			m_captureMs;
+
+	DWORD			m_intervalMs;
+	volatile LONG	m_waitMs;
+	DWORD			m_lastCapture;
+	BOOL			m_started;
+	char			m_name[256];
+
+	// Recorder thread only
+	RecordingWriter		m_writer;
+	vncEncodeHexT		m_encoder;
+	std::vector<BYTE>	m_update;
+	UINT				m_updateSize;
+	UINT				m_updateRects;
+};
+
+#endif // _WINVNC_VNCRECORDER
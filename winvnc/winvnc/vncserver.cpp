@@ -40,6 +40,7 @@
 #include "vncserver.h"
 #include "vncsockconnect.h"
 #include "vncclient.h"
+#include "vncstagetrace.h"
 #include "vncservice.h"
 #include "vnctimedmsgbox.h"
 #include "mmsystem.h" // sf@2002
@@ -62,6 +63,13 @@ extern BOOL SPECIAL_SC_PROMPT;
 void
 vncServer::ServerUpdateTracker::add_changed(const rfb::Region2D &rgn) {
 	vncClientList::iterator i;
+
+	m_server->m_recorder.add_changed(rgn);
+	if (m_server->UseDamageLog()) {
+		m_server->m_damageLog.Append(DAMAGE_CHANGED, rgn);
+		KickClients();
+		return;
+	}
 	
 	omni_mutex_lock l(m_server->m_clientsLock,5);
 
@@ -81,6 +89,13 @@ vncServer::ServerUpdateTracker::add_changed(const rfb::Region2D &rgn) {
 void
 vncServer::ServerUpdateTracker::add_cached(const rfb::Region2D &rgn) {
 	vncClientList::iterator i;
+
+	m_server->m_recorder.add_cached(rgn);
+	if (m_server->UseDamageLog()) {
+		m_server->m_damageLog.Append(DAMAGE_CACHED, rgn);
+		KickClients();
+		return;
+	}
 	
 	omni_mutex_lock l(m_server->m_clientsLock,7);
 
@@ -103,6 +118,13 @@ vncServer::ServerUpdateTracker::add_cached(const rfb::Region2D &rgn) {
 void
 vncServer::ServerUpdateTracker::add_copied(const rfb::Region2D &dest, const rfb::Point &delta) {
 	vncClientList::iterator i;
+
+	m_server->m_recorder.add_copied(dest, delta);
+	if (m_server->UseDamageLog()) {
+		m_server->m_damageLog.Append(DAMAGE_COPIED, dest, delta);
+		KickClients();
+		return;
+	}
 	
 	omni_mutex_lock l(m_server->m_clientsLock,9);
 
@@ -119,6 +141,17 @@ vncServer::ServerUpdateTracker::add_copied(const rfb::Region2D &dest, const rfb:
 	}
 }
 
+// Damage log mode: the region is already in the log, the clients only
+// need waking. No client update lock is taken here.
+void
+vncServer::ServerUpdateTracker::KickClients() {
+	vncClientList::iterator i;
+
+	omni_mutex_lock l(m_server->m_clientsLock,358);
+	for (i = m_server->m_authClients.begin(); i != m_server->m_authClients.end(); i++)
+		m_server->GetClient(*i)->KickUpdateThread();
+}
+
 
 
 // Constructor/destructor
@@ -165,6 +198,22 @@ vncServer::vncServer()
 	m_poll_oneventonly = FALSE;
 	m_MaxCpu=100;
 	m_MaxFPS = 25;
+	m_PointerPriority = FALSE;
+	m_ClientMaxFPS = 0;
+	m_MinFrameInterval = 0;
+	m_CoalesceMs = 0;
+	m_AsyncSendKB = 0;
+	m_TelemetrySec = 0;
+	m_ClientRateKB = 0;
+	m_ServerRateKB = 0;
+	m_LockProfileSec = 0;
+	m_TraceSec = 0;
+	m_DamageLog = FALSE;
+	m_UpdatePool = FALSE;
+	m_BroadcastMs = 0;
+	m_EncodeAhead = FALSE;
+	m_RecordMs = 200;
+	m_RecordKeyframeSec = 30;
 	m_poll_consoleonly = TRUE;
 
 	m_driver = FALSE;
@@ -305,6 +354,14 @@ vncServer::~vncServer()
 	// Wait for all the clients to die
 	WaitUntilAuthEmpty();
 	WaitUntilUnauthEmpty();
+	m_updateScheduler.Stop();
+
+	// Final numbers of the lock profiler, the periodic dump may be minutes old
+	if (m_LockProfileSec > 0) {
+		omni_lock_profiler::dump();
+		omni_lock_profiler::disable();
+	}
+	vncStageTrace::Disable();
 
 	// Don't free the desktop until no KillClient is likely to free it
 	{	omni_mutex_lock l(m_desktopLock,11);
@@ -320,6 +377,8 @@ vncServer::~vncServer()
 		Sleep(100);
 		vnclog.Print(LL_STATE, VNCLOG("Waiting for desktop to shutdown\n"));
 	}
+	// Nothing captures for the recording any more
+	m_recorder.Stop();
 
 	// Don't free the authhosts string until no more connections are possible
 	if (m_auth_hosts != 0)
@@ -368,6 +427,34 @@ vncServer::~vncServer()
 		delete virtualDisplay;
 }
 
+// Lock contention profiler
+static void
+LockProfileLog(const char *line)
+{
+	vnclog.Print(LL_STATE, "%s", line);
+}
+
+void
+vncServer::LockProfileSec(LONG value)
+{
+	m_LockProfileSec = value;
+	if (value > 0)
+		omni_lock_profiler::enable((unsigned long)value * 1000, LockProfileLog);
+	else
+		omni_lock_profiler::disable();
+}
+
+// Pipeline stage timing
+void
+vncServer::TraceSec(LONG value)
+{
+	m_TraceSec = value;
+	if (value > 0)
+		vncStageTrace::Enable((DWORD)value * 1000);
+	else
+		vncStageTrace::Disable();
+}
+
 void
 vncServer::ShutdownServer()
 {
@@ -426,6 +513,8 @@ vncServer::ShutdownServer()
 		Sleep(100);
 		vnclog.Print(LL_STATE, VNCLOG("Waiting for desktop to shutdown\n"));
 	}
+	// Nothing captures for the recording any more
+	m_recorder.Stop();
 
 	// Don't free the authhosts string until no more connections are possible
 	if (m_auth_hosts != 0)
@@ -49,6 +49,11 @@ class VirtualDisplay;
 #include "vncclient.h"
 #include "rfbRegion.h"
 #include "vncpasswd.h"
+#include "vnccpugovernor.h"
+#include "vncdamagelog.h"
+#include "vncupdatescheduler.h"
+#include "vncbroadcast.h"
+#include "vncrecorder.h"
 
 // Includes
 #include "stdhdrs.h"
@@ -208,10 +213,62 @@ public:
 	virtual BOOL PollConsoleOnly() {return m_poll_consoleonly;};
 	virtual void PollOnEventOnly(BOOL enable) {m_poll_oneventonly = enable;};
 	virtual BOOL PollOnEventOnly() {return m_poll_oneventonly;};
-	virtual void MaxCpu(LONG maxcpu) {m_MaxCpu = maxcpu;};
+	virtual void MaxCpu(LONG maxcpu) {m_MaxCpu = maxcpu; m_cpuGovernor.SetTarget(maxcpu);};
 	virtual LONG MaxCpu() {return m_MaxCpu;};
 	virtual void MaxFPS(LONG maxFPS) { m_MaxFPS = maxFPS; };
 	virtual LONG MaxFPS() { return m_MaxFPS; };
+	// Send changed rects near the pointer/focused window first
+	virtual void PointerPriority(BOOL value) { m_PointerPriority = value; };
+	virtual BOOL PointerPriority() { return m_PointerPriority; };
+	// Per-client frame pacing: max update rate (0 = no cap), min ms between frames, ms to let damage coalesce
+	virtual void ClientMaxFPS(LONG value) { m_ClientMaxFPS = value; };
+	virtual LONG ClientMaxFPS() { return m_ClientMaxFPS; };
+	virtual void MinFrameInterval(LONG value) { m_MinFrameInterval = value; };
+	virtual LONG MinFrameInterval() { return m_MinFrameInterval; };
+	virtual void CoalesceMs(LONG value) { m_CoalesceMs = value; };
+	virtual LONG CoalesceMs() { return m_CoalesceMs; };
+	// Per-client writer thread with a ring of this many KB, 0 = blocking sends
+	virtual void AsyncSendKB(LONG value) { m_AsyncSendKB = value; };
+	virtual LONG AsyncSendKB() { return m_AsyncSendKB; };
+	// Telemetry: seconds between stats file samples, 0 = off
+	virtual void TelemetrySec(LONG value) { m_TelemetrySec = value; };
+	virtual LONG TelemetrySec() { return m_TelemetrySec; };
+	// Bandwidth shaping, KB/s per viewer and for all viewers together, 0 = unlimited
+	virtual void ClientRateKB(LONG value) { m_ClientRateKB = value; };
+	virtual LONG ClientRateKB() { return m_ClientRateKB; };
+	virtual void ServerRateKB(LONG value) { m_ServerRateKB = value; };
+	virtual LONG ServerRateKB() { return m_ServerRateKB; };
+	// Lock contention profiler: seconds between dumps to the log, 0 = off
+	virtual void LockProfileSec(LONG value);
+	virtual LONG LockProfileSec() { return m_LockProfileSec; };
+	// Pipeline stage timing: seconds between summaries and trace exports, 0 = off
+	virtual void TraceSec(LONG value);
+	virtual LONG TraceSec() { return m_TraceSec; };
+	// Closed-loop MaxCpu control, shared by the desktop thread and the clients
+	vncCpuGovernor &CpuGovernor() { return m_cpuGovernor; };
+	vncDamageLog &GetDamageLog() { return m_damageLog; };
+	// Shared damage log instead of locking every client per region
+	virtual void DamageLog(BOOL value) { m_DamageLog = value; };
+	virtual BOOL DamageLog() { return m_DamageLog; };
+	// Broadcast mode needs the log as well
+	BOOL UseDamageLog() { return m_DamageLog || m_BroadcastMs > 0; };
+	vncUpdateScheduler &UpdateScheduler() { return m_updateScheduler; };
+	vncBroadcast &Broadcast() { return m_broadcast; };
+	// Client update jobs run on a shared worker pool
+	virtual void UpdatePool(BOOL value) { m_UpdatePool = value; };
+	virtual BOOL UpdatePool() { return m_UpdatePool; };
+	// Broadcast mode: one frame every n ms shared by all viewers, 0 = off
+	virtual void BroadcastMs(LONG value) { m_BroadcastMs = value; };
+	virtual LONG BroadcastMs() { return m_BroadcastMs; };
+	// Encode damage before the viewer asks for it (stateless encodings)
+	virtual void EncodeAhead(BOOL value) { m_EncodeAhead = value; };
+	virtual BOOL EncodeAhead() { return m_EncodeAhead; };
+	// Session recording (log video): capture interval, keyframe interval
+	virtual void RecordMs(LONG value) { m_RecordMs = value; };
+	virtual LONG RecordMs() { return m_RecordMs; };
+	virtual void RecordKeyframeSec(LONG value) { m_RecordKeyframeSec = value; };
+	virtual LONG RecordKeyframeSec() { return m_RecordKeyframeSec; };
+	vncRecorder &Recorder() { return m_recorder; };
 
 	// Client manipulation of the clipboard
 	virtual void UpdateLocalClipText(LPSTR text);
@@ -537,12 +594,17 @@ protected:
 		virtual void add_cached(const rfb::Region2D &region);
 		virtual void add_copied(const rfb::Region2D &dest, const rfb::Point &delta);
 	protected:
+		void KickClients();
 		vncServer *m_server;
 	};
 
 	friend class ServerUpdateTracker;
 
 	ServerUpdateTracker	m_update_tracker;
+	vncDamageLog		m_damageLog;
+	vncUpdateScheduler	m_updateScheduler;
+	vncBroadcast		m_broadcast;
+	vncRecorder			m_recorder;
 
 	// Internal stuffs
 protected:
@@ -600,7 +662,24 @@ protected:
 
 	BOOL				m_poll_oneventonly;
 	LONG				m_MaxCpu;
+	vncCpuGovernor		m_cpuGovernor;
 	LONG				m_MaxFPS;
+	BOOL				m_PointerPriority;
+	LONG				m_ClientMaxFPS;
+	LONG				m_MinFrameInterval;
+	LONG				m_CoalesceMs;
+	LONG				m_AsyncSendKB;
+	LONG				m_TelemetrySec;
+	LONG				m_ClientRateKB;
+	LONG				m_ServerRateKB;
+	LONG				m_LockProfileSec;
+	LONG				m_TraceSec;
+	BOOL				m_DamageLog;
+	BOOL				m_UpdatePool;
+	LONG				m_BroadcastMs;
+	BOOL				m_EncodeAhead;
+	LONG				m_RecordMs;
+	LONG				m_RecordKeyframeSec;
 	BOOL				m_poll_consoleonly;
 
 	BOOL				m_driver;
@@ -0,0 +1,228 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncStageTrace - pipeline stage timing
+
+#include "vncstagetrace.h"
+#include <omnithread.h>
+#include <process.h>
+#include <vector>
+#include <algorithm>
+
+// Power of two, ~2MB of events; at a few hundred events per frame that's
+// well over the default 10 s interval at 30 fps
+const LONG TRACE_EVENTS = 65536;
+
+struct vncTraceEvent
+{
+	__int64	start;		// QPC
+	__int64	duration;	// QPC ticks
+	DWORD	tid;
+	DWORD	arg;
+	LONG	frame;		// capture pass, see NextFrame
+	LONG	stage;		// written last, -1 while the slot is being filled
+};
+
+static const char *stageNames[STAGE_COUNT] =
+{
+	"capture", "check", "translate", "encode", "transform", "send", "update"
+};
+
+volatile bool vncStageTrace::enabled = false;
+static vncTraceEvent * volatile traceRing = NULL;
+static volatile LONG traceNext = 0;
+static volatile LONG traceWriters = 0;	// Records in progress
+static volatile LONG traceFrame = 0;
+static __int64 traceFreq = 0;
+static DWORD traceInterval = 0;
+static __int64 traceWindowStart = 0;
+static HANDLE traceWorker = NULL;
+static HANDLE traceWorkerStop = NULL;
+static omni_mutex traceMutex;
+
+static unsigned __stdcall
+TraceWorker(void *)
+{
+	while (WaitForSingleObject(traceWorkerStop, traceInterval) == WAIT_TIMEOUT) {
+		vncStageTrace::LogSummary();
+		char filename[MAX_PATH];
+		_snprintf_s(filename, sizeof(filename), _TRUNCATE, "%s\\winvnc_trace.json", vnclog.GetPath());
+		vncStageTrace::ExportChromeTrace(filename);
+	}
+	return 0;
+}
+
+static void
+StopTraceWorker()
+{
+	if (traceWorker == NULL)
+		return;
+	SetEvent(traceWorkerStop);
+	WaitForSingleObject(traceWorker, INFINITE);
+	CloseHandle(traceWorker);
+	CloseHandle(traceWorkerStop);
+	traceWorker = NULL;
+	traceWorkerStop = NULL;
+}
+
+__int64
+vncStageTrace::Now()
+{
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return t.QuadPart;
+}
+
+void
+vncStageTrace::Enable(DWORD intervalms)
+{
+	// Serializes Enable and Disable, the worker is joined without it
+	omni_mutex_lock l(traceMutex, 355);
+	if (enabled && intervalms == traceInterval)
+		return;
+	StopTraceWorker();
+	traceInterval = intervalms;
+	if (traceRing == NULL) {
+		vncTraceEvent *ring = new vncTraceEvent[TRACE_EVENTS];
+		for (LONG i = 0; i < TRACE_EVENTS; i++)
+			ring[i].stage = -1;
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		traceFreq = f.QuadPart;
+		traceNext = 0;
+		traceRing = ring;
+	}
+	traceWindowStart = Now();
+	enabled = true;
+	if (intervalms != 0) {
+		traceWorkerStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+		traceWorker = (HANDLE)_beginthreadex(NULL, 0, TraceWorker, NULL, 0, NULL);
+		if (traceWorker == NULL) {
+			CloseHandle(traceWorkerStop);
+			traceWorkerStop = NULL;
+		}
+	}
+	vnclog.Print(LL_INTINFO, VNCLOG("stage trace enabled, summary every %u ms\n"), intervalms);
+}
+
+void
+vncStageTrace::Disable()
+{
+	omni_mutex_lock l(traceMutex, 355);
+	enabled = false;
+	StopTraceWorker();
+	// A Record that already picked up the ring finishes before it's freed
+	vncTraceEvent *ring = (vncTraceEvent *)InterlockedExchangePointer((PVOID volatile *)&traceRing, NULL);
+	while (traceWriters != 0)
+		Sleep(1);
+	delete[] ring;
+}
+
+void
+vncStageTrace::Record(vncStage stage, __int64 start, DWORD arg)
+{
+	InterlockedIncrement(&traceWriters);
+	vncTraceEvent *ring = traceRing;
+	if (ring != NULL) {
+		__int64 end = Now();
+		vncTraceEvent &e = ring[(InterlockedIncrement(&traceNext) - 1) & (TRACE_EVENTS - 1)];
+		e.stage = -1;
+		e.start = start;
+		e.duration = end - start;
+		e.tid = GetCurrentThreadId();
+		e.arg = arg;
+		e.frame = traceFrame;
+		e.stage = stage;
+	}
+	InterlockedDecrement(&traceWriters);
+}
+
+void
+vncStageTrace::NextFrame()
+{
+	if (enabled)
+		InterlockedIncrement(&traceFrame);
+}
+
+// Percentiles over the events recorded since the previous summary
+void
+vncStageTrace::LogSummary()
+{
+	if (traceRing == NULL)
+		return;
+	__int64 windowStart = traceWindowStart;
+	traceWindowStart = Now();
+
+	std::vector<__int64> durations[STAGE_COUNT];
+	for (LONG i = 0; i < TRACE_EVENTS; i++) {
+		const vncTraceEvent &e = traceRing[i];
+		LONG stage = e.stage;
+		if (stage < 0 || stage >= STAGE_COUNT || e.start < windowStart)
+			continue;
+		durations[stage].push_back(e.duration);
+	}
+
+	vnclog.Print(LL_INTWARN, VNCLOG("stage timing (us)    count     p50     p90     p99     max\n"));
+	for (int s = 0; s < STAGE_COUNT; s++) {
+		std::vector<__int64> &d = durations[s];
+		if (d.empty())
+			continue;
+		std::sort(d.begin(), d.end());
+		size_t n = d.size();
+		vnclog.Print(LL_INTWARN, VNCLOG("  %-12s %8u %7I64d %7I64d %7I64d %7I64d\n"), stageNames[s], (unsigned)n,
+			d[n * 50 / 100] * 1000000 / traceFreq,
+			d[n * 90 / 100] * 1000000 / traceFreq,
+			d[n * 99 / 100] * 1000000 / traceFreq,
+			d[n - 1] * 1000000 / traceFreq);
+	}
+}
+
+bool
+vncStageTrace::ExportChromeTrace(const char *filename)
+{
+	if (traceRing == NULL)
+		return false;
+	FILE *f = NULL;
+	if (fopen_s(&f, filename, "w") != 0 || f == NULL)
+		return false;
+
+	// Oldest event first, the viewer doesn't care but diffs of two dumps do
+	LONG next = traceNext;
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+	bool first = true;
+	for (LONG i = 0; i < TRACE_EVENTS; i++) {
+		const vncTraceEvent &e = traceRing[(next + i) & (TRACE_EVENTS - 1)];
+		LONG stage = e.stage;
+		if (stage < 0 || stage >= STAGE_COUNT)
+			continue;
+		fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"winvnc\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,"
+			"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"arg\":%u,\"frame\":%ld}}",
+			first ? "" : ",\n", stageNames[stage], GetCurrentProcessId(), e.tid,
+			(double)e.start * 1000000.0 / traceFreq, (double)e.duration * 1000000.0 / traceFreq, e.arg, e.frame);
+		first = false;
+	}
+	fputs("\n]}\n", f);
+	fclose(f);
+	return true;
+}
@@ -0,0 +1,93 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncStageTrace
+
+// Pipeline stage timing. Each instrumented stage (capture, change
+// detection, translation, encoding, DSM transform, socket send and the
+// whole update) records a QPC start and duration into one process-wide
+// ring, stamped with the frame id of the desktop thread's capture pass it
+// belongs to. A worker thread started by Enable logs p50/p90/p99/max per
+// stage for the last interval and rewrites winvnc_trace.json in the log
+// directory in Chrome trace-event format (load it in chrome://tracing or
+// Perfetto). Nested stages on one thread show up nested in the viewer.
+// Disable stops the worker and frees the ring.
+// Disabled, a stage costs one test of 'enabled'.
+
+#if !defined(_WINVNC_VNCSTAGETRACE)
+#define _WINVNC_VNCSTAGETRACE
+#pragma once
+
+#include "stdhdrs.h"
+
+enum vncStage
+{
+	STAGE_CAPTURE,		// GrabRegion
+	STAGE_CHECK,		// CheckRegion
+	STAGE_TRANSLATE,	// pixel format translation of one rect
+	STAGE_ENCODE,		// vncEncodeMgr::EncodeRect, arg = encoding
+	STAGE_TRANSFORM,	// DSM plugin TransformBuffer, arg = bytes
+	STAGE_SEND,			// bytes to the socket or the send ring, arg = bytes
+	STAGE_UPDATE,		// one SendUpdate, arg = client id
+	STAGE_COUNT
+};
+
+class vncStageTrace
+{
+public:
+	static void Enable(DWORD intervalms);
+	static void Disable();
+	static volatile bool enabled;
+
+	static __int64 Now();
+	static void Record(vncStage stage, __int64 start, DWORD arg);
+	// The desktop thread starts a capture pass
+	static void NextFrame();
+
+	// Run by the worker once per interval, see above
+	static void LogSummary();
+	static bool ExportChromeTrace(const char *filename);
+};
+
+// Times the enclosing scope
+class vncStageTimer
+{
+public:
+	vncStageTimer(vncStage stage, DWORD arg = 0) : m_stage(stage), m_arg(arg)
+	{
+		m_start = vncStageTrace::enabled ? vncStageTrace::Now() : 0;
+	}
+	~vncStageTimer()
+	{
+		if (m_start != 0)
+			vncStageTrace::Record(m_stage, m_start, m_arg);
+	}
+	void SetArg(DWORD arg) { m_arg = arg; }
+private:
+	vncStage m_stage;
+	DWORD m_arg;
+	__int64 m_start;
+};
+
+#endif // _WINVNC_VNCSTAGETRACE
@@ -0,0 +1,197 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncTelemetry - per-client transport and encoder statistics
+
+#include "vnctelemetry.h"
+#include "vnccpugovernor.h"
+#include <time.h>
+
+// The stats file is shared by all clients and moved to .bak at this size
+const LONGLONG TELEMETRY_MAX_FILE = 4 * 1024 * 1024;
+
+static omni_mutex TelemetryFileMutex;
+
+vncTelemetry::vncTelemetry()
+{
+	m_clientid = 0;
+	m_socket = NULL;
+	memset(&m_last, 0, sizeof(m_last));
+	memset(&m_pending, 0, sizeof(m_pending));
+	m_due = false;
+	m_start = GetTickCount();
+	m_startBytes = 0;
+	m_startRetrans = 0;
+	m_rawBytes = 0;
+	m_cachedBytes = 0;
+	m_wireBytes = 0;
+	m_updates = 0;
+	m_encoding = 0;
+	m_shapedMs = 0;
+	m_updateBytes = 0;
+}
+
+void
+vncTelemetry::Init(int clientid, VSocket *socket)
+{
+	m_clientid = clientid;
+	m_socket = socket;
+	m_start = GetTickCount();
+	VSocketTcpStats stats;
+	m_socket->GetTcpStats(stats);
+	m_startBytes = stats.bytesSent;
+	m_startRetrans = stats.pktsRetrans;
+}
+
+// Bytes are counted when they are handed to the socket, which for an
+// update is at the latest the ClearQueue at the end of SendUpdate.
+void
+vncTelemetry::UpdateStart()
+{
+	m_updateBytes = m_socket->GetBytesAccepted();
+}
+
+void
+vncTelemetry::UpdateDone(UINT rawbytes, UINT cachedbytes, CARD32 encoding)
+{
+	m_wireBytes += m_socket->GetBytesAccepted() - m_updateBytes;
+	m_rawBytes += rawbytes;
+	m_cachedBytes += cachedbytes;
+	m_updates++;
+	m_encoding = encoding;
+}
+
+BOOL
+vncTelemetry::Poll(DWORD intervalms, int fps, int cpuLevel)
+{
+	DWORD now = GetTickCount();
+	DWORD elapsed = now - m_start;
+	if (m_socket == NULL || m_due || elapsed < intervalms || elapsed == 0)
+		return FALSE;
+
+	Sample &sample = m_pending;
+	memset(&sample, 0, sizeof(sample));
+	sample.time = now;
+	sample.interval = elapsed;
+	sample.fps = fps;
+	sample.updates = m_updates;
+	sample.encoding = m_encoding;
+	if (m_wireBytes > 0)
+		sample.ratio = (int)(m_rawBytes * 100 / m_wireBytes);
+	sample.cachedKB = (ULONG)(m_cachedBytes / 1024);
+	sample.limitKbps = (ULONG)((ULONGLONG)m_socket->GetRateLimit() * 8 / 1000);
+	sample.shapedMs = m_shapedMs;
+	sample.cpuLevel = cpuLevel;
+	m_due = true;
+
+	m_start = now;
+	m_rawBytes = 0;
+	m_cachedBytes = 0;
+	m_wireBytes = 0;
+	m_updates = 0;
+	m_shapedMs = 0;
+	return TRUE;
+}
+
+// The EStats query and the file append stay out of the update lock
+void
+vncTelemetry::Flush()
+{
+	if (!m_due)
+		return;
+	m_due = false;
+
+	VSocketTcpStats stats;
+	m_socket->GetTcpStats(stats);
+
+	Sample sample = m_pending;
+	sample.estats = stats.estats;
+	sample.rtt = stats.smoothedRtt;
+	sample.minRtt = stats.minRtt;
+	sample.retrans = stats.pktsRetrans - m_startRetrans;
+	sample.cwnd = stats.curCwnd;
+	sample.kbps = (ULONG)((stats.bytesSent - m_startBytes) * 8 / sample.interval);
+	sample.queueDepth = stats.queueDepth;
+	m_startBytes = stats.bytesSent;
+	m_startRetrans = stats.pktsRetrans;
+
+	{
+		omni_mutex_lock l(m_lastLock, 353);
+		m_last = sample;
+	}
+	Write(sample);
+}
+
+vncTelemetry::Sample
+vncTelemetry::GetLast()
+{
+	omni_mutex_lock l(m_lastLock, 353);
+	return m_last;
+}
+
+void
+vncTelemetry::Write(const Sample &sample)
+{
+	char line[512];
+	int len = _snprintf_s(line, sizeof(line), _TRUNCATE,
+		"{\"time\":%lld,\"client\":%d,\"interval_ms\":%u,"
+		"\"rtt_ms\":%ld,\"min_rtt_ms\":%ld,\"retrans\":%ld,\"cwnd\":%ld,"
+		"\"kbps\":%u,\"queue_bytes\":%u,\"fps\":%d,\"updates\":%d,"
+		"\"encoding\":%u,\"ratio\":%d.%02d,\"cached_kb\":%u,\"limit_kbps\":%u,\"shaped_ms\":%u,"
+		"\"cpu_level\":%d,\"cpu_knob\":\"%s\"}\r\n",
+		(long long)time(NULL), m_clientid, sample.interval,
+		sample.estats ? (long)sample.rtt : -1L,
+		sample.estats ? (long)sample.minRtt : -1L,
+		sample.estats ? (long)sample.retrans : -1L,
+		sample.estats ? (long)sample.cwnd : -1L,
+		sample.kbps, sample.queueDepth, sample.fps, sample.updates,
+		sample.encoding, sample.ratio / 100, sample.ratio % 100, sample.cachedKB,
+		sample.limitKbps, sample.shapedMs,
+		sample.cpuLevel, vncCpuGovernor::KnobName(sample.cpuLevel));
+	if (len <= 0)
+		return;
+
+	char filename[MAX_PATH];
+	char backup[MAX_PATH];
+	_snprintf_s(filename, sizeof(filename), _TRUNCATE, "%s\\winvnc_stats.json", vnclog.GetPath());
+	_snprintf_s(backup, sizeof(backup), _TRUNCATE, "%s.bak", filename);
+
+	omni_mutex_lock l(TelemetryFileMutex, 352);
+	HANDLE hFile = CreateFile(filename, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return;
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(hFile, &size) && size.QuadPart > TELEMETRY_MAX_FILE) {
+		CloseHandle(hFile);
+		MoveFileEx(filename, backup, MOVEFILE_REPLACE_EXISTING);
+		hFile = CreateFile(filename, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
+			return;
+	}
+	DWORD written = 0;
+	WriteFile(hFile, line, (DWORD)len, &written, NULL);
+	CloseHandle(hFile);
+}
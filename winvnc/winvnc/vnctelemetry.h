@@ -0,0 +1,111 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncTelemetry
+
+// Per-client transport and encoder statistics.
+// The update thread brackets every update it sends with UpdateStart and
+// UpdateDone, then calls Poll while it still holds the update lock. Once
+// per interval Poll moves the counters into a pending Sample. Flush, called
+// after the update lock is released, adds the socket statistics, keeps the
+// Sample for in-process consumers (GetLast) and appends it to
+// winvnc_stats.json in the log directory, one JSON object per line.
+
+#if !defined(_WINVNC_VNCTELEMETRY)
+#define _WINVNC_VNCTELEMETRY
+#pragma once
+
+#include "stdhdrs.h"
+#include <omnithread.h>
+#include "rfb.h"
+#include "vsocket.h"
+
+class vncTelemetry
+{
+public:
+	struct Sample
+	{
+		DWORD	time;			// GetTickCount() when taken
+		DWORD	interval;		// ms covered by the rates below
+		bool	estats;			// rtt, minRtt, retrans and cwnd are valid
+		ULONG	rtt;			// smoothed RTT, ms
+		ULONG	minRtt;			// ms
+		ULONG	retrans;		// packets retransmitted during the interval
+		ULONG	cwnd;			// congestion window, bytes
+		ULONG	kbps;			// send throughput, kbit/s
+		VCard	queueDepth;		// bytes in the send ring
+		int		fps;			// achieved update rate
+		int		updates;		// updates sent during the interval
+		CARD32	encoding;		// encoding of the last update
+		int		ratio;			// raw / wire bytes * 100, 0 if nothing was sent
+		ULONG	cachedKB;		// raw size of the rects the viewer took from its cache
+		ULONG	limitKbps;		// shaping rate for this viewer, 0 = unlimited
+		DWORD	shapedMs;		// time the update thread waited for tokens
+		int		cpuLevel;		// CPU governor throttle level, 0 = none
+	};
+
+	vncTelemetry();
+
+	void Init(int clientid, VSocket *socket);
+
+	// Called by the update thread around each update it sends
+	void UpdateStart();
+	void UpdateDone(UINT rawbytes, UINT cachedbytes, CARD32 encoding);
+	// Time spent waiting for the bandwidth shaper
+	void Shaped(DWORD ms) { m_shapedMs += ms; };
+
+	// Under the update lock: take the interval counters if intervalms has
+	// passed since the last sample
+	BOOL Poll(DWORD intervalms, int fps, int cpuLevel);
+	// Without it: finish and write the sample Poll took, if any
+	void Flush();
+
+	Sample GetLast();
+
+protected:
+	void Write(const Sample &sample);
+
+	int				m_clientid;
+	VSocket			*m_socket;
+	omni_mutex		m_lastLock;
+	Sample			m_last;
+	Sample			m_pending;
+	bool			m_due;
+
+	// Interval counters
+	DWORD			m_start;
+	ULONGLONG		m_startBytes;
+	ULONG			m_startRetrans;
+	ULONGLONG		m_rawBytes;
+	ULONGLONG		m_cachedBytes;
+	ULONGLONG		m_wireBytes;
+	int				m_updates;
+	CARD32			m_encoding;
+	DWORD			m_shapedMs;
+
+	// Current update
+	ULONGLONG		m_updateBytes;
+};
+
+#endif // _WINVNC_VNCTELEMETRY
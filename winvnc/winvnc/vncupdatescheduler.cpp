@@ -0,0 +1,305 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncUpdateScheduler - pooled client update jobs
+
+#include "vncupdatescheduler.h"
+#include "vncclient.h"
+#include <algorithm>
+
+// Worker index of the calling thread, -1 outside the pool
+static __declspec(thread) int currentWorker = -1;
+
+class vncUpdateWorker : public omni_thread
+{
+public:
+	vncUpdateWorker(vncUpdateScheduler *scheduler, int index)
+		: m_scheduler(scheduler), m_index(index) {};
+	void Start() { start_undetached(); };
+protected:
+	virtual void *run_undetached(void *arg) {
+		m_scheduler->WorkerLoop(m_index);
+		return NULL;
+	};
+	vncUpdateScheduler *m_scheduler;
+	int m_index;
+};
+
+class vncUpdateTimer : public omni_thread
+{
+public:
+	vncUpdateTimer(vncUpdateScheduler *scheduler) : m_scheduler(scheduler) {};
+	void Start() { start_undetached(); };
+protected:
+	virtual void *run_undetached(void *arg) {
+		m_scheduler->TimerLoop();
+		return NULL;
+	};
+	vncUpdateScheduler *m_scheduler;
+};
+
+vncUpdateScheduler::vncUpdateScheduler()
+	: m_idleSignal(&m_idleLock), m_delaySignal(&m_delayLock)
+{
+	m_running = false;
+	m_nworkers = 0;
+	m_queues = NULL;
+	m_next = 0;
+	m_queued = 0;
+	m_timer = NULL;
+}
+
+vncUpdateScheduler::~vncUpdateScheduler()
+{
+	Stop();
+}
+
+void
+vncUpdateScheduler::Start()
+{
+	omni_mutex_lock l(m_startLock, 359);
+	if (m_running)
+		return;
+
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	m_nworkers = si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+	m_queues = new Queue[m_nworkers];
+	m_queued = 0;
+	m_running = true;
+	for (int i = 0; i < m_nworkers; i++) {
+		vncUpdateWorker *worker = new vncUpdateWorker(this, i);
+		m_workers.push_back(worker);
+		worker->Start();
+	}
+	m_timer = new vncUpdateTimer(this);
+	m_timer->Start();
+	vnclog.Print(LL_INTINFO, VNCLOG("update scheduler started, %d workers\n"), m_nworkers);
+}
+
+void
+vncUpdateScheduler::Stop()
+{
+	omni_mutex_lock l(m_startLock, 359);
+	if (!m_running)
+		return;
+
+	m_running = false;
+	{
+		omni_mutex_lock l2(m_idleLock, 360);
+		m_idleSignal.broadcast();
+	}
+	{
+		omni_mutex_lock l3(m_delayLock, 361);
+		m_delaySignal.broadcast();
+	}
+	// join() deletes the thread objects
+	for (size_t i = 0; i < m_workers.size(); i++)
+		m_workers[i]->join(NULL);
+	m_workers.clear();
+	m_timer->join(NULL);
+	m_timer = NULL;
+	m_delayed.clear();
+	delete [] m_queues;
+	m_queues = NULL;
+	vnclog.Print(LL_INTINFO, VNCLOG("update scheduler stopped\n"));
+}
+
+void
+vncUpdateScheduler::Submit(vncClientUpdateThread *job, bool wake)
+{
+	if (!m_running || !job->m_active)
+		return;
+
+	for (;;) {
+		LONG state = job->m_jobState;
+		switch (state) {
+		case JOB_DELAYED:
+			// Held back until its frame time, the timer brings it back
+			if (job->m_jobHold && !wake)
+				return;
+			// Fall through, pull it forward
+		case JOB_IDLE:
+			if (InterlockedCompareExchange(&job->m_jobState, JOB_QUEUED, state) == state) {
+				Push(job, currentWorker);
+				return;
+			}
+			break;
+		case JOB_RUNNING:
+			// The worker queues it again once it's done
+			if (InterlockedCompareExchange(&job->m_jobState, JOB_RERUN, JOB_RUNNING) == JOB_RUNNING)
+				return;
+			break;
+		default:
+			// Queued, rerun or dead
+			return;
+		}
+	}
+}
+
+void
+vncUpdateScheduler::Cancel(vncClientUpdateThread *job)
+{
+	for (;;) {
+		if (!m_running) {
+			// Once Stop has joined the workers nothing runs or queues the job
+			omni_mutex_lock l(m_startLock, 359);
+			if (!m_running) {
+				InterlockedExchange(&job->m_jobState, JOB_DEAD);
+				return;
+			}
+		}
+		{
+			omni_mutex_lock l(m_delayLock, 361);
+			LONG state = job->m_jobState;
+			if (state == JOB_DEAD)
+				return;
+			if ((state == JOB_IDLE || state == JOB_DELAYED) &&
+				InterlockedCompareExchange(&job->m_jobState, JOB_DEAD, state) == state) {
+				m_delayed.erase(std::remove(m_delayed.begin(), m_delayed.end(), job), m_delayed.end());
+				return;
+			}
+		}
+		// Queued or running, the job sees m_active is off and goes idle
+		Sleep(1);
+	}
+}
+
+void
+vncUpdateScheduler::Push(vncClientUpdateThread *job, int worker)
+{
+	if (worker < 0 || worker >= m_nworkers)
+		worker = (int)((ULONG)InterlockedIncrement(&m_next) % (ULONG)m_nworkers);
+	{
+		omni_mutex_lock l(m_queues[worker].lock, 362);
+		m_queues[worker].jobs.push_back(job);
+	}
+	InterlockedIncrement(&m_queued);
+	omni_mutex_lock l(m_idleLock, 360);
+	m_idleSignal.signal();
+}
+
+vncClientUpdateThread *
+vncUpdateScheduler::Pop(int worker)
+{
+	vncClientUpdateThread *job = NULL;
+	// Own queue first, newest job, its client data is still in cache
+	{
+		Queue &q = m_queues[worker];
+		omni_mutex_lock l(q.lock, 362);
+		if (!q.jobs.empty()) {
+			job = q.jobs.back();
+			q.jobs.pop_back();
+		}
+	}
+	// Otherwise steal the oldest job of another worker
+	for (int i = 1; job == NULL && i < m_nworkers; i++) {
+		Queue &q = m_queues[(worker + i) % m_nworkers];
+		omni_mutex_lock l(q.lock, 362);
+		if (!q.jobs.empty()) {
+			job = q.jobs.front();
+			q.jobs.pop_front();
+		}
+	}
+	if (job)
+		InterlockedDecrement(&m_queued);
+	return job;
+}
+
+void
+vncUpdateScheduler::WorkerLoop(int worker)
+{
+	currentWorker = worker;
+	while (m_running) {
+		vncClientUpdateThread *job = Pop(worker);
+		if (job == NULL) {
+			omni_mutex_lock l(m_idleLock, 360);
+			while (m_running && m_queued == 0)
+				m_idleSignal.wait();
+			continue;
+		}
+
+		if (InterlockedCompareExchange(&job->m_jobState, JOB_RUNNING, JOB_QUEUED) != JOB_QUEUED)
+			continue;
+		job->m_jobHold = false;
+		DWORD delay = job->RunPooled();
+
+		if (delay > 0) {
+			Delay(job, delay);
+			continue;
+		}
+		if (InterlockedCompareExchange(&job->m_jobState, JOB_IDLE, JOB_RUNNING) != JOB_RUNNING) {
+			// Triggered while it ran
+			InterlockedExchange(&job->m_jobState, JOB_QUEUED);
+			Push(job, worker);
+		}
+	}
+	currentWorker = -1;
+}
+
+void
+vncUpdateScheduler::Delay(vncClientUpdateThread *job, DWORD ms)
+{
+	// Under the lock, so the timer never sees the entry before the state
+	omni_mutex_lock l(m_delayLock, 361);
+	job->m_jobDue = GetTickCount() + ms;
+	if (InterlockedCompareExchange(&job->m_jobState, JOB_DELAYED, JOB_RUNNING) != JOB_RUNNING) {
+		// Triggered while it ran, run it again now
+		InterlockedExchange(&job->m_jobState, JOB_QUEUED);
+		Push(job, currentWorker);
+		return;
+	}
+	if (std::find(m_delayed.begin(), m_delayed.end(), job) == m_delayed.end())
+		m_delayed.push_back(job);
+	m_delaySignal.signal();
+}
+
+void
+vncUpdateScheduler::TimerLoop()
+{
+	omni_mutex_lock l(m_delayLock, 361);
+	while (m_running) {
+		DWORD now = GetTickCount();
+		DWORD wait = 1000;
+		for (size_t i = 0; i < m_delayed.size(); ) {
+			vncClientUpdateThread *job = m_delayed[i];
+			if (job->m_jobState != JOB_DELAYED) {
+				// Pulled forward by Submit, or cancelled
+				m_delayed.erase(m_delayed.begin() + i);
+				continue;
+			}
+			LONG left = (LONG)(job->m_jobDue - now);
+			if (left <= 0) {
+				m_delayed.erase(m_delayed.begin() + i);
+				if (InterlockedCompareExchange(&job->m_jobState, JOB_QUEUED, JOB_DELAYED) == JOB_DELAYED)
+					Push(job, -1);
+				continue;
+			}
+			if ((DWORD)left < wait)
+				wait = (DWORD)left;
+			i++;
+		}
+		m_delaySignal.wait(wait);
+	}
+}
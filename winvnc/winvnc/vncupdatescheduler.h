@@ -0,0 +1,116 @@
+/////////////////////////////////////////////////////////////////////////////
+//  Copyright (C) 2002-2024 UltraVNC Team Members. All Rights Reserved.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+//  USA.
+//
+// If the source code for the program is not available from the place from
+// which you received this file, check
+// http://www.uvnc.com/
+//
+////////////////////////////////////////////////////////////////////////////
+
+// vncUpdateScheduler
+
+// Optional replacement for one update thread per client. A fixed pool of
+// workers, one per core, runs "frame due" jobs: one job per client, which
+// sends the client's pending update if it has one and its pacing allows.
+// A job whose frame is not due yet is parked with the timer thread until
+// it is, instead of holding a worker.
+// Each worker has its own deque; it takes its newest job first and, when
+// it runs dry, steals the oldest job of another worker.
+// A job is in exactly one place at a time, tracked by its state:
+//   idle -> queued -> running -> idle | delayed | queued (rerun)
+//   delayed -> queued (due, or triggered while not held for pacing)
+// Sends block a worker while they run, so the pool works best with
+// AsyncSendKB set.
+
+#if !defined(_WINVNC_VNCUPDATESCHEDULER)
+#define _WINVNC_VNCUPDATESCHEDULER
+#pragma once
+
+#include "stdhdrs.h"
+#include <omnithread.h>
+#include <deque>
+#include <vector>
+
+class vncClientUpdateThread;
+class vncUpdateWorker;
+class vncUpdateTimer;
+
+enum vncJobState
+{
+	JOB_IDLE,
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_RERUN,		// running, and triggered again meanwhile
+	JOB_DELAYED,	// waiting for the timer thread
+	JOB_DEAD		// cancelled, never runs again
+};
+
+class vncUpdateScheduler
+{
+public:
+	vncUpdateScheduler();
+	~vncUpdateScheduler();
+
+	// Start the pool on first use, one worker per core
+	void Start();
+	void Stop();
+
+	// Queue the client's job unless it is already queued or running.
+	// A job held back for pacing stays with the timer unless wake is set.
+	void Submit(vncClientUpdateThread *job, bool wake = false);
+	// Remove the job for good, waits while a worker is running it or,
+	// once the pool is shutting down, until it has stopped
+	void Cancel(vncClientUpdateThread *job);
+	bool IsRunning() { return m_running; };
+
+protected:
+	friend class vncUpdateWorker;
+	friend class vncUpdateTimer;
+
+	struct Queue
+	{
+		omni_mutex lock;
+		std::deque<vncClientUpdateThread *> jobs;
+	};
+
+	void Push(vncClientUpdateThread *job, int worker);
+	vncClientUpdateThread *Pop(int worker);
+	void WorkerLoop(int worker);
+	void TimerLoop();
+	void Delay(vncClientUpdateThread *job, DWORD ms);
+
+	omni_mutex			m_startLock;
+	volatile bool		m_running;
+	int					m_nworkers;
+	Queue				*m_queues;
+	std::vector<vncUpdateWorker *> m_workers;
+	volatile LONG		m_next;
+
+	// Idle workers sleep here while m_queued is 0
+	omni_mutex			m_idleLock;
+	omni_condition		m_idleSignal;
+	volatile LONG		m_queued;
+
+	// Jobs waiting for their frame time
+	vncUpdateTimer		*m_timer;
+	omni_mutex			m_delayLock;
+	omni_condition		m_delaySignal;
+	std::vector<vncClientUpdateThread *> m_delayed;
+};
+
+#endif // _WINVNC_VNCUPDATESCHEDULER
@@ -77,6 +77,8 @@ extern unsigned int G_SENDBUFFER_EX;
 // Socket implementation
 
 #include "vsocket.h"
+#include "rfb.h"
+#include "vncstagetrace.h"
 
 // The socket timeout value (currently 5 seconds, for no reason...)
 // *** THIS IS NOT CURRENTLY USED ANYWHERE
@@ -86,6 +88,21 @@ const VInt rfbMaxClientWait = 5000;
 // Socket implementation initialisation
 static WORD winsockVersion = 0;
 bool sendall(SOCKET RemoteSocket,char *buff,unsigned int bufflen,int dummy);
+bool sendallv(SOCKET RemoteSocket,WSABUF *bufs,DWORD count);
+
+// Longest wait for the writer to send what is queued when the socket goes
+const DWORD WRITER_DRAIN_WAIT = 5000;
+
+// Writer thread for asynchronous sends, see VSocket::EnableAsyncSend
+class VSocketWriter : public omni_thread
+{
+public:
+	VSocketWriter(VSocket *socket) : m_socket(socket) {};
+	void Start() { start_undetached(); };
+protected:
+	virtual void *run_undetached(void *arg) { m_socket->WriterLoop(); return NULL; };
+	VSocket *m_socket;
+};
 
 VSocketSystem::VSocketSystem()
 {
@@ -161,14 +178,48 @@ VSocket::VSocket()
 	m_fPluginStreamingIn = false;
 	m_fPluginStreamingOut = false;	
 	G_SENDBUFFER=G_SENDBUFFER_EX;
+
+	m_pBatchBuf = NULL;
+	m_nBatchBufSize = 0;
+	m_nBatchLen = 0;
+	m_fShapedSend = false;
+
+	m_pWriter = NULL;
+	m_WriterSock = INVALID_SOCKET;
+	m_pRing = NULL;
+	m_nRingSize = 0;
+	m_nRingHead = 0;
+	m_nRingTail = 0;
+	m_hRingData = NULL;
+	m_hRingSpace = NULL;
+	m_fWriterStop = false;
+	m_fWriterError = false;
+	m_nRunHead = 0;
+	m_nRunTail = 0;
+	m_nSendMark = 0;
+	m_nSendMarkTick = 0;
+
+	m_nBytesAccepted = 0;
+	m_fEStatsEnabled = false;
 }
 
 ////////////////////////////
 
 VSocket::~VSocket()
 {
+  // The writer still needs the socket for what is queued
+  if (m_pWriter != NULL)
+	StopWriter();
   // Close the socket
   Close();
+  if (m_hRingData != NULL)
+	CloseHandle(m_hRingData);
+  if (m_hRingSpace != NULL)
+	CloseHandle(m_hRingSpace);
+  if (m_pRing != NULL)
+	delete [] m_pRing;
+  if (m_pBatchBuf != NULL)
+	delete [] m_pBatchBuf;
   if (m_pNetRectBuf != NULL)
  	delete [] m_pNetRectBuf;
 }
@@ -1361,35 +1412,20 @@ VSocket::SendSock(const char *buff, const VCard bufflen, SOCKET allsock)
 	//adzm 2010-08-01
 	m_LastSentTick = GetTickCount();
 
-	unsigned int newsize=queuebuffersize+bufflen;
-	char *buff2;
-	buff2=(char*)buff;
-	unsigned int bufflen2=bufflen;
-
-	// adzm 2010-09 - flush as soon as we have a full buffer, not if we have exceeded it.
-	if (newsize >= G_SENDBUFFER)
-	{
-		memcpy(queuebuffer+queuebuffersize,buff2,G_SENDBUFFER-queuebuffersize);
-		if (!sendall(allsock,queuebuffer,G_SENDBUFFER,0)) return FALSE;
-		//			vnclog.Print(LL_SOCKERR, VNCLOG("SEND  %i\n") ,G_SENDBUFFER);
-		buff2+=(G_SENDBUFFER-queuebuffersize);
-		bufflen2-=(G_SENDBUFFER-queuebuffersize);
-		queuebuffersize=0;
-		// adzm 2010-09 - flush as soon as we have a full buffer, not if we have exceeded it.
-		while (bufflen2 >= G_SENDBUFFER)
-		{
-			if (!sendall(allsock,buff2,G_SENDBUFFER,0)) return false;
-			//				vnclog.Print(LL_SOCKERR, VNCLOG("SEND 1 %i\n") ,G_SENDBUFFER);
-			buff2+=G_SENDBUFFER;
-			bufflen2-=G_SENDBUFFER;
-		}
-	}
-	memcpy(queuebuffer+queuebuffersize,buff2,bufflen2);
-	queuebuffersize+=bufflen2;
+	// Scatter-gather: the queued bytes and the new buffer go out with one
+	// WSASend, without copying the buffer into queuebuffer first
+	WSABUF bufs[2];
+	DWORD count = 0;
 	if (queuebuffersize > 0) {
-		if (!sendall(allsock,queuebuffer,queuebuffersize,0)) 
-			return false;
+		bufs[count].buf = queuebuffer;
+		bufs[count++].len = queuebuffersize;
+	}
+	if (bufflen > 0) {
+		bufs[count].buf = (char*)buff;
+		bufs[count++].len = bufflen;
 	}
+	if (count > 0 && !Transmit(allsock, bufs, count, m_fShapedSend))
+		return false;
 	//	vnclog.Print(LL_SOCKERR, VNCLOG("SEND 2 %i\n") ,queuebuffersize);
 	queuebuffersize=0;
 	return bufflen;
@@ -1401,35 +1437,20 @@ VSocket::Send(const char *buff, const VCard bufflen)
 	//adzm 2010-08-01
 	m_LastSentTick = GetTickCount();
 
-	unsigned int newsize=queuebuffersize+bufflen;
-	char *buff2;
-	buff2=(char*)buff;
-	unsigned int bufflen2=bufflen;
-
-	// adzm 2010-09 - flush as soon as we have a full buffer, not if we have exceeded it.
-	if (newsize >= G_SENDBUFFER)
-	{
-		    memcpy(queuebuffer+queuebuffersize,buff2,G_SENDBUFFER-queuebuffersize);
-			if (!sendall(sock,queuebuffer,G_SENDBUFFER,0)) return FALSE;
-//			vnclog.Print(LL_SOCKERR, VNCLOG("SEND  %i\n") ,G_SENDBUFFER);
-			buff2+=(G_SENDBUFFER-queuebuffersize);
-			bufflen2-=(G_SENDBUFFER-queuebuffersize);
-			queuebuffersize=0;
-			// adzm 2010-09 - flush as soon as we have a full buffer, not if we have exceeded it.
-			while (bufflen2 >= G_SENDBUFFER)
-			{
-				if (!sendall(sock,buff2,G_SENDBUFFER,0)) return false;
-//				vnclog.Print(LL_SOCKERR, VNCLOG("SEND 1 %i\n") ,G_SENDBUFFER);
-				buff2+=G_SENDBUFFER;
-				bufflen2-=G_SENDBUFFER;
-			}
-	}
-	memcpy(queuebuffer+queuebuffersize,buff2,bufflen2);
-	queuebuffersize+=bufflen2;
+	// Scatter-gather: the queued bytes and the new buffer go out with one
+	// WSASend, without copying the buffer into queuebuffer first
+	WSABUF bufs[2];
+	DWORD count = 0;
 	if (queuebuffersize > 0) {
-		if (!sendall(sock,queuebuffer,queuebuffersize,0)) 
-			return false;
+		bufs[count].buf = queuebuffer;
+		bufs[count++].len = queuebuffersize;
+	}
+	if (bufflen > 0) {
+		bufs[count].buf = (char*)buff;
+		bufs[count++].len = bufflen;
 	}
+	if (count > 0 && !Transmit(sock, bufs, count, m_fShapedSend))
+		return false;
 //	vnclog.Print(LL_SOCKERR, VNCLOG("SEND 2 %i\n") ,queuebuffersize);
 	queuebuffersize=0;
 	return bufflen;
@@ -1459,23 +1480,25 @@ VSocket::SendQueuedSock(const char *buff, const VCard bufflen, SOCKET allsock)
 		//adzm 2010-08-01
 		m_LastSentTick = GetTickCount();
 
-		memcpy(queuebuffer+queuebuffersize,buff2,G_SENDBUFFER-queuebuffersize);
-		if (!sendall(allsock,queuebuffer,G_SENDBUFFER,0)) return FALSE;
-		//	vnclog.Print(LL_SOCKERR, VNCLOG("SEND Q  %i\n") ,G_SENDBUFFER);
-		buff2+=(G_SENDBUFFER-queuebuffersize);
-		bufflen2-=(G_SENDBUFFER-queuebuffersize);
-		queuebuffersize=0;			
-
-		// adzm 2010-09 - flush as soon as we have a full buffer, not if we have exceeded it.
-		while (bufflen2 >= G_SENDBUFFER)
-		{
-			if (!sendall(allsock,buff2,G_SENDBUFFER,0)) return false;				
-			//adzm 2010-08-01
-			m_LastSentTick = GetTickCount();
-			//	vnclog.Print(LL_SOCKERR, VNCLOG("SEND Q  %i\n") ,G_SENDBUFFER);
-			buff2+=G_SENDBUFFER;
-			bufflen2-=G_SENDBUFFER;
+		// Scatter-gather: queued bytes and the bulk of the new buffer go out
+		// with one WSASend, only the tail that doesn't fill a whole
+		// G_SENDBUFFER is copied into the queue.
+		unsigned int tail = newsize % G_SENDBUFFER;
+		WSABUF bufs[2];
+		DWORD count = 0;
+		if (queuebuffersize > 0) {
+			bufs[count].buf = queuebuffer;
+			bufs[count++].len = queuebuffersize;
 		}
+		if (bufflen2 > tail) {
+			bufs[count].buf = buff2;
+			bufs[count++].len = bufflen2 - tail;
+		}
+		if (!Transmit(allsock, bufs, count, m_fShapedSend)) return false;
+		//	vnclog.Print(LL_SOCKERR, VNCLOG("SEND Q  %i\n") ,newsize-tail);
+		buff2+=(bufflen2-tail);
+		bufflen2=tail;
+		queuebuffersize=0;
 	}
 	memcpy(queuebuffer+queuebuffersize,buff2,bufflen2);
 	queuebuffersize+=bufflen2;
@@ -1496,23 +1519,25 @@ VSocket::SendQueued(const char *buff, const VCard bufflen)
 			//adzm 2010-08-01
 			m_LastSentTick = GetTickCount();
 
-		    memcpy(queuebuffer+queuebuffersize,buff2,G_SENDBUFFER-queuebuffersize);
-			if (!sendall(sock,queuebuffer,G_SENDBUFFER,0)) return FALSE;
-		//	vnclog.Print(LL_SOCKERR, VNCLOG("SEND Q  %i\n") ,G_SENDBUFFER);
-			buff2+=(G_SENDBUFFER-queuebuffersize);
-			bufflen2-=(G_SENDBUFFER-queuebuffersize);
-			queuebuffersize=0;			
-
-			// adzm 2010-09 - flush as soon as we have a full buffer, not if we have exceeded it.
-			while (bufflen2 >= G_SENDBUFFER)
-			{
-				if (!sendall(sock,buff2,G_SENDBUFFER,0)) return false;				
-				//adzm 2010-08-01
-				m_LastSentTick = GetTickCount();
-			//	vnclog.Print(LL_SOCKERR, VNCLOG("SEND Q  %i\n") ,G_SENDBUFFER);
-				buff2+=G_SENDBUFFER;
-				bufflen2-=G_SENDBUFFER;
+			// Scatter-gather: queued bytes and the bulk of the new buffer go out
+			// with one WSASend, only the tail that doesn't fill a whole
+			// G_SENDBUFFER is copied into the queue.
+			unsigned int tail = newsize % G_SENDBUFFER;
+			WSABUF bufs[2];
+			DWORD count = 0;
+			if (queuebuffersize > 0) {
+				bufs[count].buf = queuebuffer;
+				bufs[count++].len = queuebuffersize;
+			}
+			if (bufflen2 > tail) {
+				bufs[count].buf = buff2;
+				bufs[count++].len = bufflen2 - tail;
 			}
+			if (!Transmit(sock, bufs, count, m_fShapedSend)) return false;
+		//	vnclog.Print(LL_SOCKERR, VNCLOG("SEND Q  %i\n") ,newsize-tail);
+			buff2+=(bufflen2-tail);
+			bufflen2=tail;
+			queuebuffersize=0;
 	}
 	memcpy(queuebuffer+queuebuffersize,buff2,bufflen2);
 	queuebuffersize+=bufflen2;
@@ -1535,6 +1560,7 @@ VSocket::SendExactSock(const char *buff, const VCard bufflen, unsigned char msgT
 {
 	if (allsock == -1) return VFalse;
 	//vnclog.Print(LL_SOCKERR, VNCLOG("SendExactMsg %i\n") ,bufflen);
+	SetSendClass(msgType);
 	// adzm 2010-09
 	if (!IsPluginStreamingOut() && m_fUsePlugin && m_pDSMPlugin->IsEnabled())
 	{
@@ -1555,6 +1581,7 @@ VSocket::SendExact(const char *buff, const VCard bufflen, unsigned char msgType)
 {
 	if (sock==-1) return VFalse;
 	//vnclog.Print(LL_SOCKERR, VNCLOG("SendExactMsg %i\n") ,bufflen);
+	SetSendClass(msgType);
 	// adzm 2010-09
 	if (!IsPluginStreamingOut() && m_fUsePlugin && m_pDSMPlugin->IsEnabled())
 	{
@@ -1584,6 +1611,7 @@ VSocket::SendExactQueueSock(const char *buff, const VCard bufflen, unsigned char
 {
 	if (allsock == -1) return VFalse;
 	//vnclog.Print(LL_SOCKERR, VNCLOG("SendExactMsg %i\n") ,bufflen);
+	SetSendClass(msgType);
 	// adzm 2010-09
 	if (!IsPluginStreamingOut() && m_fUsePlugin && m_pDSMPlugin->IsEnabled())
 	{
@@ -1605,6 +1633,7 @@ VSocket::SendExactQueue(const char *buff, const VCard bufflen, unsigned char msg
 {
 	if (sock==-1) return VFalse;
 	//vnclog.Print(LL_SOCKERR, VNCLOG("SendExactMsg %i\n") ,bufflen);
+	SetSendClass(msgType);
 	// adzm 2010-09
 	if (!IsPluginStreamingOut() && m_fUsePlugin && m_pDSMPlugin->IsEnabled())
 	{
@@ -1653,6 +1682,12 @@ VSocket::SendExactSock(const char *buff, const VCard bufflen, SOCKET allsock)
 			m_nNetRectBufOffset += bufflen;
 			return VTrue;
 		}
+		// Streaming plugins transform a byte stream, so messages are
+		// collected and transformed in one call when the queue is flushed
+		else if (m_fPluginStreamingOut)
+		{
+			return BatchTransform(buff, bufflen, true);
+		}
 		else // Tell the plugin to transform data
 		{
 			int nTransDataLen = 0;
@@ -1696,6 +1731,12 @@ VSocket::SendExact(const char *buff, const VCard bufflen)
 			m_nNetRectBufOffset += bufflen;
 			return VTrue;
 		}
+		// Streaming plugins transform a byte stream, so messages are
+		// collected and transformed in one call when the queue is flushed
+		else if (m_fPluginStreamingOut)
+		{
+			return BatchTransform(buff, bufflen, true);
+		}
 		else // Tell the plugin to transform data
 		{
 			int nTransDataLen = 0;
@@ -1749,6 +1790,12 @@ VSocket::SendExactQueueSock(const char *buff, const VCard bufflen, SOCKET allsoc
 			m_nNetRectBufOffset += bufflen;
 			return VTrue;
 		}
+		// Streaming plugins transform a byte stream, so messages are
+		// collected and transformed in one call when the queue is flushed
+		else if (m_fPluginStreamingOut)
+		{
+			return BatchTransform(buff, bufflen, false);
+		}
 		else // Tell the plugin to transform data
 		{
 			int nTransDataLen = 0;
@@ -1793,6 +1840,12 @@ VSocket::SendExactQueue(const char *buff, const VCard bufflen)
 			m_nNetRectBufOffset += bufflen;
 			return VTrue;
 		}
+		// Streaming plugins transform a byte stream, so messages are
+		// collected and transformed in one call when the queue is flushed
+		else if (m_fPluginStreamingOut)
+		{
+			return BatchTransform(buff, bufflen, false);
+		}
 		else // Tell the plugin to transform data
 		{
 			int nTransDataLen = 0;
@@ -1818,9 +1871,13 @@ VSocket::SendExactQueue(const char *buff, const VCard bufflen)
 VBool
 VSocket::ClearQueue()
 {
-	if (sock4 != INVALID_SOCKET) return ClearQueueSock(sock4);
-	if (sock6 != INVALID_SOCKET) return ClearQueueSock(sock6);
-	return false;
+	VBool result = VFalse;
+	if (m_nBatchLen == 0 || FlushBatch(false)) {
+		if (sock4 != INVALID_SOCKET) result = ClearQueueSock(sock4);
+		else if (sock6 != INVALID_SOCKET) result = ClearQueueSock(sock6);
+	}
+	m_fShapedSend = false;
+	return result;
 }
 
 VBool
@@ -1832,7 +1889,10 @@ VSocket::ClearQueueSock(SOCKET allsock)
 		//adzm 2010-08-01
 		m_LastSentTick = GetTickCount();
 		//adzm 2010-09 - return a bool in ClearQueue
-		if (!sendall(allsock,queuebuffer,queuebuffersize,0)) 
+		WSABUF buf;
+		buf.buf = queuebuffer;
+		buf.len = queuebuffersize;
+		if (!Transmit(allsock, &buf, 1, m_fShapedSend)) 
 			return VFalse;
 		queuebuffersize=0;
 	}
@@ -1844,19 +1904,43 @@ VBool
 VSocket::ClearQueue()
 {
 	if (sock==-1) return VFalse;
+	if (m_nBatchLen > 0 && !FlushBatch(false)) {
+		m_fShapedSend = false;
+		return VFalse;
+	}
 	if (queuebuffersize!=0)
   {
 	//adzm 2010-08-01
 	m_LastSentTick = GetTickCount();
 	//adzm 2010-09 - return a bool in ClearQueue
-	if (!sendall(sock,queuebuffer,queuebuffersize,0)) 
+	WSABUF buf;
+	buf.buf = queuebuffer;
+	buf.len = queuebuffersize;
+	bool sent = Transmit(sock, &buf, 1, m_fShapedSend);
+	m_fShapedSend = false;
+	if (!sent)
 		return VFalse;
 	queuebuffersize=0;
   }
+  m_fShapedSend = false;
   GetOptimalSndBuf();
   return VTrue;
 }
 #endif
+
+// Bytes already buffered belong to the previous message and go out in its
+// class
+void
+VSocket::SetSendClass(unsigned char msgType)
+{
+	bool shaped = msgType == rfbFramebufferUpdate || msgType == rfbFileTransfer ||
+		msgType == rfbServerCutText;
+	if (shaped == m_fShapedSend)
+		return;
+	if (m_nBatchLen > 0 || queuebuffersize > 0)
+		ClearQueue();
+	m_fShapedSend = shaped;
+}
 ////////////////////////////
 #ifdef IPV6V4
 VInt
@@ -2143,6 +2227,7 @@ void VSocket::SetDSMPluginConfig(char* szDSMPluginConfig)
 //adzm 2009-06-20
 BYTE* VSocket::TransformBuffer(BYTE* pDataBuffer, int nDataLen, int* pnTransformedDataLen)
 {
+	vncStageTimer timer(STAGE_TRANSFORM, nDataLen);
 	if (m_pPluginInterface) {
 		return m_pPluginInterface->TransformBuffer(pDataBuffer, nDataLen, pnTransformedDataLen);
 	} else {
@@ -2174,6 +2259,73 @@ BYTE* VSocket::RestoreBufferStep2(BYTE* pRestoredDataBuffer, int nDataLen, int*
 	}
 }
 
+//
+// Plugin streaming batches
+// A streaming plugin transforms a byte stream: transforming two buffers
+// one after the other gives the same bytes as transforming them joined,
+// and the viewer restores whatever chunks it reads. So instead of calling
+// TransformBuffer for every header and rect, plain bytes are collected
+// here and transformed in one call when the queue is flushed or the batch
+// gets big. Payloads bigger than the batch are transformed directly rather
+// than copied.
+//
+const VCard PLUGIN_BATCH_MAX = 256 * 1024;
+
+VBool
+VSocket::BatchTransform(const char *buff, const VCard bufflen, bool flush)
+{
+	if (m_nBatchLen + bufflen > PLUGIN_BATCH_MAX)
+	{
+		if (!FlushBatch(false))
+			return VFalse;
+		if (bufflen >= PLUGIN_BATCH_MAX)
+		{
+			int nTransDataLen = 0;
+			char* pBuffer = (char*)(TransformBuffer((BYTE*)buff, bufflen, &nTransDataLen));
+			if (pBuffer == NULL || nTransDataLen == 0)
+				return VFalse;
+			VInt result = flush ? Send(pBuffer, nTransDataLen) : SendQueued(pBuffer, nTransDataLen);
+			return result == (VInt)nTransDataLen;
+		}
+	}
+
+	if (m_nBatchLen + bufflen > m_nBatchBufSize)
+	{
+		VCard newsize = m_nBatchBufSize ? m_nBatchBufSize : 16384;
+		while (newsize < m_nBatchLen + bufflen)
+			newsize *= 2;
+		BYTE *newbuf = new BYTE[newsize];
+		if (m_pBatchBuf != NULL)
+		{
+			memcpy(newbuf, m_pBatchBuf, m_nBatchLen);
+			delete [] m_pBatchBuf;
+		}
+		m_pBatchBuf = newbuf;
+		m_nBatchBufSize = newsize;
+	}
+	memcpy(m_pBatchBuf + m_nBatchLen, buff, bufflen);
+	m_nBatchLen += bufflen;
+
+	if (flush)
+		return FlushBatch(true);
+	return VTrue;
+}
+
+// Transform the batch and hand it to the send queue, flush sends it too
+VBool
+VSocket::FlushBatch(bool flush)
+{
+	if (m_nBatchLen == 0)
+		return VTrue;
+	int nTransDataLen = 0;
+	char* pBuffer = (char*)(TransformBuffer(m_pBatchBuf, m_nBatchLen, &nTransDataLen));
+	m_nBatchLen = 0;
+	if (pBuffer == NULL || nTransDataLen == 0)
+		return VFalse;
+	VInt result = flush ? Send(pBuffer, nTransDataLen) : SendQueued(pBuffer, nTransDataLen);
+	return result == (VInt)nTransDataLen;
+}
+
 //
 // Ensures that the temporary "alignement" buffer in large enough 
 //
@@ -2317,6 +2469,500 @@ int val =0;
 	return 1;
 }
 
+// Scatter-gather counterpart of sendall: pushes all buffers with WSASend,
+// picking up where a partial send left off
+bool
+sendallv(SOCKET RemoteSocket,WSABUF *bufs,DWORD count)
+{
+	while (count > 0)
+	  {
+		struct fd_set write_fds;
+		struct timeval tm;
+		tm.tv_sec = 1;
+		tm.tv_usec = 0;
+
+		int selcount;
+		int aa=0;
+		do {
+			FD_ZERO(&write_fds);
+			FD_SET(RemoteSocket, &write_fds);			
+			selcount = select((int)(RemoteSocket+ 1), NULL, &write_fds, NULL, &tm);
+			aa++;
+		} while (selcount == 0&& !fShutdownOrdered && aa<600);
+		if (aa>=600) return false;
+		if (fShutdownOrdered) return false;
+		if (selcount < 0 || selcount > 1) return false;
+		DWORD sent = 0;
+		if (FD_ISSET(RemoteSocket, &write_fds)) 
+		{
+			if (WSASend(RemoteSocket, bufs, count, &sent, 0, NULL, NULL) == SOCKET_ERROR)
+				return false;
+		}
+		if (sent == 0)
+			return false;
+		while (count > 0 && sent >= bufs->len) {
+			sent -= bufs->len;
+			bufs++;
+			count--;
+		}
+		if (count > 0) {
+			bufs->buf += sent;
+			bufs->len -= sent;
+		}
+	  }
+	return true;
+}
+
+////////////////////////////
+// Asynchronous send
+
+VBool
+VSocket::EnableAsyncSend(VCard ringsize)
+{
+	if (m_pWriter != NULL)
+		return VTrue;
+#ifdef IPV6V4
+	m_WriterSock = (sock4 != INVALID_SOCKET) ? sock4 : sock6;
+#else
+	m_WriterSock = sock;
+#endif
+	if (m_WriterSock == INVALID_SOCKET || ringsize == 0 || ringsize > 0x40000000)
+		return VFalse;
+	// Head and tail are free running counters, a power of two keeps
+	// their position in the ring consistent when they wrap
+	VCard size = 4096;
+	while (size < ringsize)
+		size <<= 1;
+	ringsize = size;
+	m_pRing = new char[ringsize];
+	m_nRingSize = ringsize;
+	m_nRingHead = 0;
+	m_nRingTail = 0;
+	m_nRunHead = 0;
+	m_nRunTail = 0;
+	m_hRingData = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_hRingSpace = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (m_hRingData == NULL || m_hRingSpace == NULL)
+		return VFalse;
+	VSocketWriter *writer = new VSocketWriter(this);
+	m_pWriter = writer;
+	writer->Start();
+	vnclog.Print(LL_SOCKINFO, VNCLOG("asynchronous send enabled, %u byte ring\n"), ringsize);
+	return VTrue;
+}
+
+VCard
+VSocket::GetSendQueueDepth()
+{
+	if (m_pWriter == NULL)
+		return 0;
+	return (VCard)(ULONG)(m_nRingHead - m_nRingTail);
+}
+
+bool
+VSocket::IsSendBacklogged()
+{
+	return m_pWriter != NULL && GetSendQueueDepth() > m_nRingSize / 2;
+}
+
+// The mark goes in before the tick is cleared, so the writer either sees
+// the new mark with the tick cleared or has already moved the tail for
+// the check below
+void
+VSocket::SetSendMark()
+{
+	if (m_pWriter == NULL)
+		return;
+	omni_mutex_lock l(m_RingMutex, 350);
+	InterlockedExchange(&m_nSendMark, m_nRingHead);
+	m_nSendMarkTick = 0;
+	MemoryBarrier();
+	if (m_nRingTail == m_nSendMark)
+		m_nSendMarkTick = GetTickCount();
+}
+
+// A peer that stopped reading keeps the writer in its send for good: after
+// WRITER_DRAIN_WAIT the socket is closed under it and the rest is dropped
+void
+VSocket::StopWriter()
+{
+	DWORD start = GetTickCount();
+	while (m_nRingHead != m_nRingTail && !m_fWriterError && GetTickCount() - start < WRITER_DRAIN_WAIT)
+		WaitForSingleObject(m_hRingSpace, 100);
+	m_fWriterStop = true;
+	SetEvent(m_hRingData);
+	if (m_nRingHead != m_nRingTail && !m_fWriterError) {
+		vnclog.Print(LL_SOCKERR, VNCLOG("socket writer not drained, %u bytes dropped\n"), GetSendQueueDepth());
+		Close();
+	}
+	m_pWriter->join(NULL);
+	m_pWriter = NULL;
+}
+
+// Don't split a shaped send into pieces smaller than this
+const VCard SHAPE_MIN_CHUNK = 4096;
+// Longest single wait for tokens, so the writer still notices a stop
+const DWORD SHAPE_MAX_WAIT = 50;
+
+// Everything headed for the wire goes through here. Without a writer thread
+// it's a blocking sendallv, otherwise the buffers are copied into the ring.
+// Producers are serialized by m_RingMutex and wait for the writer when the
+// ring is full; the writer is the only consumer, so head and tail need no
+// lock of their own.
+// With bandwidth shaping on, shaped bytes go out in pieces no larger than
+// the buckets hold, paced by the writer thread when there is one and by the
+// calling thread otherwise. Unshaped bytes (input acks, keepalives, server
+// state) go out at once and only add to the debt the next frame waits for.
+bool
+VSocket::Transmit(SOCKET s, WSABUF *bufs, DWORD count, bool shaped)
+{
+	LONGLONG total = 0;
+	for (DWORD i = 0; i < count; i++)
+		total += bufs[i].len;
+	// With a writer thread this times the copy into the ring, the writer
+	// records the actual send on its own thread
+	vncStageTimer timer(STAGE_SEND, (DWORD)total);
+	if (m_pWriter == NULL) {
+		if (!shaped || !IsShaped()) {
+			if (!sendallv(s, bufs, count))
+				return false;
+			InterlockedExchangeAdd64(&m_nBytesAccepted, total);
+			m_bucket.Charge((VCard)total);
+			m_serverBucket.Charge((VCard)total);
+			return true;
+		}
+		for (DWORD i = 0; i < count; i++) {
+			char *src = bufs[i].buf;
+			ULONG remaining = bufs[i].len;
+			while (remaining > 0) {
+				WSABUF chunk;
+				chunk.buf = src;
+				chunk.len = ShapedChunk(remaining);
+				if (chunk.len == 0)
+					continue;
+				if (!sendallv(s, &chunk, 1))
+					return false;
+				InterlockedExchangeAdd64(&m_nBytesAccepted, chunk.len);
+				m_bucket.Charge(chunk.len);
+				m_serverBucket.Charge(chunk.len);
+				src += chunk.len;
+				remaining -= chunk.len;
+			}
+		}
+		return true;
+	}
+
+	omni_mutex_lock l(m_RingMutex, 350);
+	// The writer sends to one socket: move it over to s once what is queued
+	// for the old one is out, so the bytes still reach the wire in order
+	if (s != m_WriterSock) {
+		while (m_nRingHead != m_nRingTail && !m_fWriterError && !m_fWriterStop)
+			WaitForSingleObject(m_hRingSpace, 100);
+		if (m_fWriterError || m_fWriterStop)
+			return false;
+		m_WriterSock = s;
+	}
+	// The run is recorded before its bytes go in, so the writer never finds
+	// bytes past the last run
+	LONG end = m_nRingHead + (LONG)total;
+	ULONG last = (ULONG)(m_nRunHead - 1) % RING_RUNS;
+	if (m_nRunHead != m_nRunTail && m_fRunShaped[last] == shaped)
+		InterlockedExchange(&m_nRunEnd[last], end);
+	else {
+		while (m_nRunHead - m_nRunTail >= RING_RUNS && !m_fWriterError && !m_fWriterStop)
+			WaitForSingleObject(m_hRingSpace, 100);
+		if (m_fWriterError || m_fWriterStop)
+			return false;
+		ULONG run = (ULONG)m_nRunHead % RING_RUNS;
+		m_nRunEnd[run] = end;
+		m_fRunShaped[run] = shaped;
+		InterlockedIncrement(&m_nRunHead);
+	}
+	for (DWORD i = 0; i < count; i++) {
+		char *src = bufs[i].buf;
+		ULONG remaining = bufs[i].len;
+		while (remaining > 0) {
+			if (m_fWriterError || m_fWriterStop)
+				return false;
+			ULONG used = (ULONG)(m_nRingHead - m_nRingTail);
+			ULONG room = m_nRingSize - used;
+			if (room == 0) {
+				WaitForSingleObject(m_hRingSpace, 100);
+				continue;
+			}
+			ULONG pos = (ULONG)m_nRingHead % m_nRingSize;
+			ULONG n = remaining;
+			if (n > room) n = room;
+			if (n > m_nRingSize - pos) n = m_nRingSize - pos;
+			memcpy(m_pRing + pos, src, n);
+			InterlockedExchangeAdd(&m_nRingHead, (LONG)n);
+			SetEvent(m_hRingData);
+			src += n;
+			remaining -= n;
+		}
+	}
+	InterlockedExchangeAdd64(&m_nBytesAccepted, total);
+	return true;
+}
+
+void
+VSocket::WriterLoop()
+{
+	vnclog.Print(LL_SOCKINFO, VNCLOG("socket writer thread started\n"));
+	while (!m_fWriterStop) {
+		ULONG used = (ULONG)(m_nRingHead - m_nRingTail);
+		if (used == 0) {
+			WaitForSingleObject(m_hRingData, 1000);
+			continue;
+		}
+		// Runs the tail has passed, all but the last
+		while (m_nRunTail + 1 != m_nRunHead &&
+				(LONG)(m_nRingTail - m_nRunEnd[(ULONG)m_nRunTail % RING_RUNS]) >= 0)
+			InterlockedIncrement(&m_nRunTail);
+		ULONG run = (ULONG)m_nRunTail % RING_RUNS;
+		ULONG left = (ULONG)(m_nRunEnd[run] - m_nRingTail);
+		if (used > left)
+			used = left;
+		if (m_fRunShaped[run] && IsShaped()) {
+			used = ShapedChunk(used);
+			if (used == 0)
+				continue;
+		}
+		// The pending bytes may wrap around the end of the ring
+		ULONG pos = (ULONG)m_nRingTail % m_nRingSize;
+		WSABUF bufs[2];
+		DWORD count = 1;
+		bufs[0].buf = m_pRing + pos;
+		bufs[0].len = (used < m_nRingSize - pos) ? used : m_nRingSize - pos;
+		if (bufs[0].len < used) {
+			bufs[1].buf = m_pRing;
+			bufs[1].len = used - bufs[0].len;
+			count = 2;
+		}
+		__int64 traceStart = vncStageTrace::enabled ? vncStageTrace::Now() : 0;
+		bool sent = sendallv(m_WriterSock, bufs, count);
+		if (traceStart != 0)
+			vncStageTrace::Record(STAGE_SEND, traceStart, used);
+		if (!sent) {
+			vnclog.Print(LL_SOCKERR, VNCLOG("socket writer failed, %u bytes dropped\n"), used);
+			m_fWriterError = true;
+			SetEvent(m_hRingSpace);
+			break;
+		}
+		m_LastSentTick = GetTickCount();
+		m_bucket.Charge(used);
+		m_serverBucket.Charge(used);
+		InterlockedExchangeAdd(&m_nRingTail, (LONG)used);
+		if (m_nSendMarkTick == 0 && (LONG)(m_nRingTail - m_nSendMark) >= 0)
+			m_nSendMarkTick = m_LastSentTick;
+		SetEvent(m_hRingSpace);
+	}
+	vnclog.Print(LL_SOCKINFO, VNCLOG("socket writer thread stopped\n"));
+}
+
+////////////////////////////
+// Transport statistics
+
+static omni_mutex EStatsMutex;
+static bool EStatsLoaded = false;
+static t_GetPerTcpConnectionEStats pGetPerTcpConnectionEStats = NULL;
+static t_SetPerTcpConnectionEStats pSetPerTcpConnectionEStats = NULL;
+static t_GetPerTcp6ConnectionEStats pGetPerTcp6ConnectionEStats = NULL;
+static t_SetPerTcp6ConnectionEStats pSetPerTcp6ConnectionEStats = NULL;
+
+static void LoadEStats()
+{
+	omni_mutex_lock l(EStatsMutex, 351);
+	if (EStatsLoaded)
+		return;
+	EStatsLoaded = true;
+	HMODULE hIphlpapi = LoadLibrary("Iphlpapi.dll");
+	if (hIphlpapi == NULL)
+		return;
+	pGetPerTcpConnectionEStats = (t_GetPerTcpConnectionEStats)GetProcAddress(hIphlpapi, "GetPerTcpConnectionEStats");
+	pSetPerTcpConnectionEStats = (t_SetPerTcpConnectionEStats)GetProcAddress(hIphlpapi, "SetPerTcpConnectionEStats");
+	pGetPerTcp6ConnectionEStats = (t_GetPerTcp6ConnectionEStats)GetProcAddress(hIphlpapi, "GetPerTcp6ConnectionEStats");
+	pSetPerTcp6ConnectionEStats = (t_SetPerTcp6ConnectionEStats)GetProcAddress(hIphlpapi, "SetPerTcp6ConnectionEStats");
+}
+
+// Same calls for the IPv4 and IPv6 row types
+template <class ROW, class GETFN, class SETFN>
+static bool ReadEStats(ROW *row, GETFN pGet, SETFN pSet, bool enable, VSocketTcpStats &stats)
+{
+	if (pGet == NULL || pSet == NULL)
+		return false;
+	if (enable) {
+		// Collection is off by default, it stays on for the connection's lifetime
+		TCP_ESTATS_PATH_RW_v0 pathrw = { TRUE };
+		TCP_ESTATS_SND_CONG_RW_v0 congrw = { TRUE };
+		if (pSet(row, TcpConnectionEstatsPath, (PUCHAR)&pathrw, 0, sizeof(pathrw), 0) != NO_ERROR)
+			return false;
+		pSet(row, TcpConnectionEstatsSndCong, (PUCHAR)&congrw, 0, sizeof(congrw), 0);
+	}
+	TCP_ESTATS_PATH_ROD_v0 path;
+	memset(&path, 0, sizeof(path));
+	if (pGet(row, TcpConnectionEstatsPath, NULL, 0, 0, NULL, 0, 0, (PUCHAR)&path, 0, sizeof(path)) != NO_ERROR)
+		return false;
+	stats.smoothedRtt = path.SmoothedRtt;
+	stats.minRtt = path.MinRtt;
+	stats.pktsRetrans = path.PktsRetrans;
+	TCP_ESTATS_SND_CONG_ROD_v0 cong;
+	memset(&cong, 0, sizeof(cong));
+	if (pGet(row, TcpConnectionEstatsSndCong, NULL, 0, 0, NULL, 0, 0, (PUCHAR)&cong, 0, sizeof(cong)) == NO_ERROR)
+		stats.curCwnd = (ULONG)cong.CurCwnd;
+	return true;
+}
+
+VBool
+VSocket::GetTcpStats(VSocketTcpStats &stats)
+{
+	memset(&stats, 0, sizeof(stats));
+	stats.queueDepth = GetSendQueueDepth();
+	stats.bytesSent = GetBytesAccepted() - stats.queueDepth;
+
+#ifdef IPV6V4
+	SOCKET s = (sock4 != INVALID_SOCKET) ? sock4 : sock6;
+#else
+	SOCKET s = sock;
+#endif
+	if (s == INVALID_SOCKET)
+		return VFalse;
+	LoadEStats();
+
+	struct sockaddr_storage local, peer;
+	int locallen = sizeof(local);
+	int peerlen = sizeof(peer);
+	if (getsockname(s, (struct sockaddr *)&local, &locallen) != 0 ||
+		getpeername(s, (struct sockaddr *)&peer, &peerlen) != 0)
+		return VFalse;
+
+	bool enable = !m_fEStatsEnabled;
+	if (local.ss_family == AF_INET) {
+		MIB_TCPROW row;
+		row.dwState = MIB_TCP_STATE_ESTAB;
+		row.dwLocalAddr = ((struct sockaddr_in *)&local)->sin_addr.s_addr;
+		row.dwLocalPort = ((struct sockaddr_in *)&local)->sin_port;
+		row.dwRemoteAddr = ((struct sockaddr_in *)&peer)->sin_addr.s_addr;
+		row.dwRemotePort = ((struct sockaddr_in *)&peer)->sin_port;
+		stats.estats = ReadEStats(&row, pGetPerTcpConnectionEStats, pSetPerTcpConnectionEStats, enable, stats);
+	}
+	else if (local.ss_family == AF_INET6) {
+		MIB_TCP6ROW row;
+		row.State = MIB_TCP_STATE_ESTAB;
+		row.LocalAddr = ((struct sockaddr_in6 *)&local)->sin6_addr;
+		row.dwLocalScopeId = ((struct sockaddr_in6 *)&local)->sin6_scope_id;
+		row.dwLocalPort = ((struct sockaddr_in6 *)&local)->sin6_port;
+		row.RemoteAddr = ((struct sockaddr_in6 *)&peer)->sin6_addr;
+		row.dwRemoteScopeId = ((struct sockaddr_in6 *)&peer)->sin6_scope_id;
+		row.dwRemotePort = ((struct sockaddr_in6 *)&peer)->sin6_port;
+		stats.estats = ReadEStats(&row, pGetPerTcp6ConnectionEStats, pSetPerTcp6ConnectionEStats, enable, stats);
+	}
+	// Don't retry enabling every sample when we lack the rights
+	m_fEStatsEnabled = true;
+	return stats.estats ? VTrue : VFalse;
+}
+
+////////////////////////////
+// Bandwidth shaping
+
+VTokenBucket VSocket::m_serverBucket;
+
+VTokenBucket::VTokenBucket()
+{
+	m_rate = 0;
+	m_burst = 0;
+	m_tokens = 0;
+	m_last = GetTickCount();
+}
+
+void
+VTokenBucket::SetRate(VCard bytesPerSec)
+{
+	omni_mutex_lock l(m_lock, 354);
+	if (bytesPerSec == m_rate)
+		return;
+	m_rate = bytesPerSec;
+	// A quarter second worth of burst, enough for a few full packets
+	m_burst = bytesPerSec / 4;
+	if (m_burst < 16384)
+		m_burst = 16384;
+	m_tokens = m_burst;
+	m_last = GetTickCount();
+}
+
+void
+VTokenBucket::Refill()
+{
+	DWORD now = GetTickCount();
+	DWORD elapsed = now - m_last;
+	if (elapsed == 0)
+		return;
+	m_last = now;
+	m_tokens += (LONGLONG)elapsed * m_rate / 1000;
+	if (m_tokens > m_burst)
+		m_tokens = m_burst;
+}
+
+void
+VTokenBucket::Charge(VCard bytes)
+{
+	if (m_rate == 0)
+		return;
+	omni_mutex_lock l(m_lock, 354);
+	Refill();
+	m_tokens -= bytes;
+}
+
+VCard
+VTokenBucket::Available()
+{
+	if (m_rate == 0)
+		return 0xFFFFFFFF;
+	omni_mutex_lock l(m_lock, 354);
+	Refill();
+	return (m_tokens > 0) ? (VCard)m_tokens : 0;
+}
+
+DWORD
+VTokenBucket::TimeFor(VCard bytes)
+{
+	if (m_rate == 0)
+		return 0;
+	omni_mutex_lock l(m_lock, 354);
+	Refill();
+	LONGLONG missing = (LONGLONG)bytes - m_tokens;
+	if (missing <= 0)
+		return 0;
+	return (DWORD)((missing * 1000 + m_rate - 1) / m_rate);
+}
+
+VCard
+VSocket::ShapedChunk(VCard pending)
+{
+	VCard own = m_bucket.Available();
+	VCard shared = m_serverBucket.Available();
+	VCard allowed = (own < shared) ? own : shared;
+	VCard want = (pending < SHAPE_MIN_CHUNK) ? pending : SHAPE_MIN_CHUNK;
+	if (allowed >= want)
+		return (pending < allowed) ? pending : allowed;
+
+	own = m_bucket.TimeFor(want);
+	shared = m_serverBucket.TimeFor(want);
+	DWORD wait = (own > shared) ? own : shared;
+	if (wait > SHAPE_MAX_WAIT)
+		wait = SHAPE_MAX_WAIT;
+	Sleep(wait > 0 ? wait : 1);
+	return 0;
+}
+
+DWORD
+VSocket::GetShapingDelay()
+{
+	DWORD own = m_bucket.Delay();
+	DWORD shared = m_serverBucket.Delay();
+	return (own > shared) ? own : shared;
+}
+
 //method to get congestion window
 bool VSocket::GetOptimalSndBuf()
 {
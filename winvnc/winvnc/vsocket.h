@@ -51,8 +51,57 @@ extern "C" {
                 PMIB_TCPROW Row, TCP_ESTATS_TYPE EstatsType,
                 PUCHAR Rw, ULONG RwVersion, ULONG RwSize,
 				ULONG Offset);
+        typedef ULONG (WINAPI *t_GetPerTcp6ConnectionEStats)(
+                PMIB_TCP6ROW Row, TCP_ESTATS_TYPE EstatsType,
+                PUCHAR Rw, ULONG RwVersion, ULONG RwSize,
+                PUCHAR Ros, ULONG RosVersion, ULONG RosSize,
+                PUCHAR Rod, ULONG RodVersion, ULONG RodSize);
+       typedef ULONG (WINAPI *t_SetPerTcp6ConnectionEStats)(
+                PMIB_TCP6ROW Row, TCP_ESTATS_TYPE EstatsType,
+                PUCHAR Rw, ULONG RwVersion, ULONG RwSize,
+				ULONG Offset);
 }
 
+// Transport statistics, see VSocket::GetTcpStats
+struct VSocketTcpStats
+{
+	ULONGLONG bytesSent;	// bytes that left this process
+	VCard queueDepth;		// bytes still waiting in the send ring
+	bool estats;			// the fields below are valid
+	ULONG smoothedRtt;		// ms
+	ULONG minRtt;			// ms
+	ULONG pktsRetrans;		// since the connection started
+	ULONG curCwnd;			// bytes
+};
+
+// Token bucket for bandwidth shaping, see VSocket::SetRateLimit
+// Tokens are bytes. The sender takes at most what the bucket holds per
+// send and waits for it to refill in between; small control messages go
+// out regardless and put the bucket into debt. The update thread waits for
+// the debt to clear before it builds the next frame.
+class VTokenBucket
+{
+public:
+  VTokenBucket();
+  // 0 = unlimited
+  void SetRate(VCard bytesPerSec);
+  VCard GetRate() { return m_rate; };
+  void Charge(VCard bytes);
+  // Tokens available now, 0xFFFFFFFF when unlimited
+  VCard Available();
+  // ms until the bucket holds at least bytes
+  DWORD TimeFor(VCard bytes);
+  // ms until the bucket is out of debt
+  DWORD Delay() { return TimeFor(0); };
+protected:
+  void Refill();
+  omni_mutex m_lock;
+  VCard m_rate;
+  LONGLONG m_burst;
+  LONGLONG m_tokens;
+  DWORD m_last;
+};
+
 // Socket implementation
 
 // Create one or more VSocketSystem objects per application
@@ -289,6 +338,38 @@ public:
 
   //adzm 2010-08-01
   DWORD GetLastSentTick() { return m_LastSentTick; };
+
+  // Asynchronous send
+  // Once enabled, everything that would hit the wire goes into a bounded
+  // ring drained by a per-connection writer thread, so the caller can
+  // encode the next frame while this one is being sent.
+  VBool EnableAsyncSend(VCard ringsize);
+  bool IsAsyncSend() { return m_pWriter != NULL; };
+  // Bytes handed to the writer thread and not sent yet
+  VCard GetSendQueueDepth();
+  // More than half the ring waiting: callers should hold back new frames
+  bool IsSendBacklogged();
+  // Marks everything handed over so far. GetSendMarkTick is the tick count
+  // when the writer sent the last of it, 0 until then.
+  void SetSendMark();
+  DWORD GetSendMarkTick() { return m_nSendMarkTick; };
+
+  // Transport statistics
+  // RTT, retransmits and congestion window come from the TCP extended
+  // statistics, which need admin rights; without them only the byte
+  // counters are filled in and GetTcpStats returns VFalse.
+  VBool GetTcpStats(VSocketTcpStats &stats);
+  // Bytes handed to the socket or the send ring, cheap enough for every update
+  ULONGLONG GetBytesAccepted() { return (ULONGLONG)InterlockedCompareExchange64(&m_nBytesAccepted, 0, 0); };
+
+  // Bandwidth shaping, bytes per second, 0 = unlimited
+  // Every send is charged to this socket's bucket and to the one shared by
+  // all sockets; GetShapingDelay tells how long the next frame should wait.
+  void SetRateLimit(VCard bytesPerSec) { m_bucket.SetRate(bytesPerSec); };
+  VCard GetRateLimit() { return m_bucket.GetRate(); };
+  static void SetServerRateLimit(VCard bytesPerSec) { m_serverBucket.SetRate(bytesPerSec); };
+  DWORD GetShapingDelay();
+  bool IsShaped() { return m_bucket.GetRate() != 0 || m_serverBucket.GetRate() != 0; };
   IIntegratedPlugin* m_pIntegratedPluginInterface;
   ////////////////////////////
   // Internal structures
@@ -320,6 +401,13 @@ protected:
   BYTE* RestoreBufferStep1(BYTE* pDataBuffer, int nDataLen, int* nRestoredDataLen);
   BYTE* RestoreBufferStep2(BYTE* pDataBuffer, int nDataLen, int* nRestoredDataLen);
 
+  // Plugin streaming: plain bytes waiting for one TransformBuffer call
+  VBool BatchTransform(const char *buff, const VCard bufflen, bool flush);
+  VBool FlushBatch(bool flush);
+  BYTE* m_pBatchBuf;
+  VCard m_nBatchBufSize;
+  VCard m_nBatchLen;
+
   // All this should be private with accessors -> later
   BYTE* m_pNetRectBuf;
   bool m_fWriteToNetRectBuf;
@@ -329,6 +417,50 @@ protected:
   char queuebuffer[9000];
   DWORD queuebuffersize;
 
+  // Bandwidth shaping by message: framebuffer updates, file transfer and
+  // clipboard data are shaped, everything else goes out at once. A typed
+  // send sets the class for the untyped sends that follow, ClearQueue
+  // ends it.
+  void SetSendClass(unsigned char msgType);
+  bool m_fShapedSend;
+
+  // Asynchronous send
+  friend class VSocketWriter;
+  bool Transmit(SOCKET s, WSABUF *bufs, DWORD count, bool shaped);
+  void WriterLoop();
+  // Lets the writer send what is queued, then stops it
+  void StopWriter();
+  omni_thread *m_pWriter;
+  SOCKET m_WriterSock;		// set by producers only while the ring is empty
+  char *m_pRing;
+  VCard m_nRingSize;
+  volatile LONG m_nRingHead;	// bytes ever written into the ring
+  volatile LONG m_nRingTail;	// bytes ever sent from the ring
+  HANDLE m_hRingData;
+  HANDLE m_hRingSpace;
+  volatile bool m_fWriterStop;
+  volatile bool m_fWriterError;
+  // Runs of shaped and unshaped bytes in the ring. The writer keeps the
+  // last run, producers extend it while the class stays the same.
+  enum { RING_RUNS = 64 };
+  volatile LONG m_nRunEnd[RING_RUNS];	// ring head at the end of the run
+  bool m_fRunShaped[RING_RUNS];
+  volatile LONG m_nRunHead;
+  volatile LONG m_nRunTail;
+  volatile LONG m_nSendMark;		// ring head at SetSendMark
+  volatile DWORD m_nSendMarkTick;
+  omni_mutex m_RingMutex;
+
+  // Transport statistics
+  volatile LONGLONG m_nBytesAccepted;	// bytes handed to Transmit
+  bool m_fEStatsEnabled;
+
+  // Bandwidth shaping
+  // How much of pending may be sent now, 0 after waiting for tokens
+  VCard ShapedChunk(VCard pending);
+  VTokenBucket m_bucket;
+  static VTokenBucket m_serverBucket;
+
   // adzm 2010-08
   static int m_defaultSocketKeepAliveTimeout;
 
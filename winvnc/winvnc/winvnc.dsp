@@ -155,6 +155,10 @@ SOURCE=.\rfbRegion.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\rfbRegion_band.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\rfbRegion_X11.cxx
 # End Source File
 # Begin Source File
@@ -448,6 +452,10 @@ SOURCE=.\rfbRegion.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\rfbRegion_band.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\rfbRegion_win32.h
 # End Source File
 # Begin Source File